@@ -0,0 +1,228 @@
+// Compares boxing TraceResults for Lua and collecting them, with results allocated from TraceResult's pool and from the heap
+// The Lua state is a mock that only holds userdata, so the time is what AccelStruct::BoxResult and TraceResult_gc add to a trace
+// Each frame boxes every result before collecting any, like a frame of traces whose results are left for the GC
+//
+// Usage: vistrace_bench_pool [results per frame = 262144] [frames = 20]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "GarrysMod/Lua/Interface.h"
+
+#include "glm/glm.hpp"
+
+#include "TraceResult.h"
+
+using namespace glm;
+using namespace GarrysMod::Lua;
+using Clock = std::chrono::steady_clock;
+
+// Stack of userdata, which is all pushing and collecting a TraceResult touches
+// Userdata is allocated like Lua's default allocator does, and freed when popped
+class MockLua : public ILuaBase
+{
+private:
+	std::vector<void*> mStack;
+
+	void* At(int iStackPos) const
+	{
+		const int i = iStackPos < 0 ? static_cast<int>(mStack.size()) + iStackPos : iStackPos - 1;
+		return i >= 0 && i < static_cast<int>(mStack.size()) ? mStack[i] : nullptr;
+	}
+
+	[[noreturn]] static void Unsupported(const char* name)
+	{
+		fprintf(stderr, "MockLua doesn't support %s\n", name);
+		std::abort();
+	}
+
+public:
+	~MockLua() { Pop(Top()); }
+
+	int Top(void) override { return static_cast<int>(mStack.size()); }
+	void Push(int iStackPos) override { Unsupported("Push"); }
+	void Pop(int iAmt = 1) override
+	{
+		for (int i = 0; i < iAmt && !mStack.empty(); i++) {
+			free(mStack.back());
+			mStack.pop_back();
+		}
+	}
+
+	void GetTable(int iStackPos) override { Unsupported("GetTable"); }
+	void GetField(int iStackPos, const char* strName) override { Unsupported("GetField"); }
+	void SetField(int iStackPos, const char* strName) override { Unsupported("SetField"); }
+	void CreateTable() override { Unsupported("CreateTable"); }
+	void SetTable(int iStackPos) override { Unsupported("SetTable"); }
+	void SetMetaTable(int iStackPos) override {}
+	bool GetMetaTable(int i) override { return false; }
+	void Call(int iArgs, int iResults) override { Unsupported("Call"); }
+	int PCall(int iArgs, int iResults, int iErrorFunc) override { Unsupported("PCall"); }
+	int Equal(int iA, int iB) override { return At(iA) == At(iB); }
+	int RawEqual(int iA, int iB) override { return At(iA) == At(iB); }
+	void Insert(int iStackPos) override { Unsupported("Insert"); }
+	void Remove(int iStackPos) override { Unsupported("Remove"); }
+	int Next(int iStackPos) override { Unsupported("Next"); }
+
+	void* NewUserdata(unsigned int iSize) override
+	{
+		mStack.push_back(malloc(iSize));
+		return mStack.back();
+	}
+
+	[[noreturn]] void ThrowError(const char* strError) override
+	{
+		fprintf(stderr, "%s\n", strError);
+		std::abort();
+	}
+	void CheckType(int iStackPos, int iType) override
+	{
+		if (At(iStackPos) == nullptr) ThrowError("Expected userdata");
+	}
+	[[noreturn]] void ArgError(int iArgNum, const char* strMessage) override { ThrowError(strMessage); }
+
+	void RawGet(int iStackPos) override { Unsupported("RawGet"); }
+	void RawSet(int iStackPos) override { Unsupported("RawSet"); }
+
+	const char* GetString(int iStackPos = -1, unsigned int* iOutLen = nullptr) override { return nullptr; }
+	double GetNumber(int iStackPos = -1) override { return 0.0; }
+	bool GetBool(int iStackPos = -1) override { return false; }
+	CFunc GetCFunction(int iStackPos = -1) override { return nullptr; }
+	void* GetUserdata(int iStackPos = -1) override { return At(iStackPos); }
+
+	void PushNil() override { Unsupported("PushNil"); }
+	void PushString(const char* val, unsigned int iLen = 0) override { Unsupported("PushString"); }
+	void PushNumber(double val) override { Unsupported("PushNumber"); }
+	void PushBool(bool val) override { Unsupported("PushBool"); }
+	void PushCFunction(CFunc val) override { Unsupported("PushCFunction"); }
+	void PushCClosure(CFunc val, int iVars) override { Unsupported("PushCClosure"); }
+	void PushUserdata(void*) override { Unsupported("PushUserdata"); }
+
+	int ReferenceCreate() override { Unsupported("ReferenceCreate"); }
+	void ReferenceFree(int i) override { Unsupported("ReferenceFree"); }
+	void ReferencePush(int i) override { Unsupported("ReferencePush"); }
+	void PushSpecial(int iType) override { Unsupported("PushSpecial"); }
+
+	bool IsType(int iStackPos, int iType) override { return At(iStackPos) != nullptr; }
+	int GetType(int iStackPos) override { return At(iStackPos) != nullptr ? Type::UserData : Type::None; }
+	const char* GetTypeName(int iType) override { return "userdata"; }
+	void CreateMetaTableType(const char* strName, int iType) override {}
+
+	const char* CheckString(int iStackPos = -1) override { Unsupported("CheckString"); }
+	double CheckNumber(int iStackPos = -1) override { Unsupported("CheckNumber"); }
+	int ObjLen(int iStackPos = -1) override { return 0; }
+
+	const QAngle& GetAngle(int iStackPos = -1) override { Unsupported("GetAngle"); }
+	const Vector& GetVector(int iStackPos = -1) override { Unsupported("GetVector"); }
+	void PushAngle(const QAngle& val) override { Unsupported("PushAngle"); }
+	void PushVector(const Vector& val) override { Unsupported("PushVector"); }
+
+	void SetState(lua_State* L) override {}
+	int CreateMetaTable(const char* strName) override { return 1; }
+	bool PushMetaTable(int iType) override { return false; }
+	void PushUserType(void* data, int iType) override { Unsupported("PushUserType"); }
+	void SetUserType(int iStackPos, void* data) override
+	{
+		// Same layout as the module base's UserData, whose data pointer comes first
+		*static_cast<void**>(At(iStackPos)) = data;
+	}
+};
+
+// Same as AccelStruct::BoxResult, with the pool bypassed through the global operators when not pooled
+template <bool Pooled>
+static void BoxResult(ILuaBase* LUA, const TraceResult& result, const std::shared_ptr<const std::vector<Material>>& pMaterials)
+{
+	TraceResult* pRes = Pooled ? new TraceResult(result) : ::new TraceResult(result);
+	pRes->RetainMaterials(pMaterials);
+	LUA->PushUserType_Value(pRes, TraceResult::id);
+}
+
+// Same as TraceResult_gc, for the userdata at iStackPos
+template <bool Pooled>
+static void CollectResult(ILuaBase* LUA, int iStackPos)
+{
+	LUA->CheckType(iStackPos, TraceResult::id);
+	TraceResult* pRes = *LUA->GetUserType<TraceResult*>(iStackPos, TraceResult::id);
+
+	LUA->SetUserType(iStackPos, NULL);
+	if (Pooled) delete pRes;
+	else ::delete pRes;
+}
+
+template <bool Pooled>
+static void RunFrame(
+	MockLua& lua, size_t numResults,
+	const TraceResult& result, const std::shared_ptr<const std::vector<Material>>& pMaterials
+)
+{
+	for (size_t i = 0; i < numResults; i++) BoxResult<Pooled>(&lua, result, pMaterials);
+	for (int i = 1; i <= lua.Top(); i++) CollectResult<Pooled>(&lua, i);
+	lua.Pop(lua.Top());
+}
+
+template <typename Func>
+static double MedianMs(int repetitions, Func&& func)
+{
+	std::vector<double> times(repetitions);
+	for (int i = 0; i < repetitions; i++) {
+		auto start = Clock::now();
+		func();
+		times[i] = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+	std::sort(times.begin(), times.end());
+	return times[repetitions / 2];
+}
+
+int main(int argc, char** argv)
+{
+	const size_t numResults = argc > 1 ? std::max(1, std::atoi(argv[1])) : 1 << 18;
+	const int frames = argc > 2 ? std::max(1, std::atoi(argv[2])) : 20;
+
+	// Normally assigned when the module registers its metatables
+	TraceResult::id = 1;
+
+	auto pMaterials = std::make_shared<std::vector<Material>>(1);
+
+	const vec2 uvs[3] = { vec2(0.f, 0.f), vec2(1.f, 0.f), vec2(0.f, 1.f) };
+	Triangle tri(
+		bvh::Vector3<float>(0.f, 0.f, 0.f),
+		bvh::Vector3<float>(1.f, 0.f, 0.f),
+		bvh::Vector3<float>(0.f, 1.f, 0.f),
+		0, uvs
+	);
+	for (int c = 0; c < 3; c++) {
+		tri.normals[c] = vec3(0.f, 0.f, 1.f);
+		tri.tangents[c] = vec3(1.f, 0.f, 0.f);
+		tri.alphas[c] = 0.f;
+	}
+
+	const Entity ent{ nullptr, 0, {}, vec4(1.f) };
+	const TraceResult result(vec3(0.f, 0.f, -1.f), 1.f, -1.f, -1.f, tri, vec2(0.25f), ent, (*pMaterials)[0]);
+
+	MockLua lua;
+
+	// Grow the pool to a frame's worth of results before timing, as it would be after the first frame in game
+	RunFrame<true>(lua, numResults, result, pMaterials);
+
+	const double heapTime = MedianMs(frames, [&]() { RunFrame<false>(lua, numResults, result, pMaterials); });
+	const double pooledTime = MedianMs(frames, [&]() { RunFrame<true>(lua, numResults, result, pMaterials); });
+
+	size_t numAllocated, capacity;
+	TraceResult::GetPoolStats(numAllocated, capacity);
+
+	printf(
+		"%zu results per frame (%zu bytes each), median of %d\n"
+		"  heap:   %8.3fms (%6.1fns per result)\n"
+		"  pooled: %8.3fms (%6.1fns per result, %.2fx)\n"
+		"  pool holds %zu slots, %zu still allocated\n",
+		numResults, sizeof(TraceResult), frames,
+		heapTime, heapTime * 1e6 / numResults,
+		pooledTime, pooledTime * 1e6 / numResults, heapTime / pooledTime,
+		capacity, numAllocated
+	);
+	return 0;
+}
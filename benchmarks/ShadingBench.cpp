@@ -0,0 +1,219 @@
+// Times CalcTBN and CalcShadingData (through TraceResult's getters) for materials with different sets of textures
+// - each material on its own, as a run of hits on one surface dispatches to the same specialised path every time
+// - every material interleaved, as secondary bounces land on whatever surface they hit
+//
+// Textures are procedural so no game files are needed, and cheap so the time left is shading rather than decoding
+//
+// Usage: vistrace_bench_shading [hits = 262144] [repetitions = 20]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "TraceResult.h"
+
+using namespace glm;
+using namespace VisTrace;
+using Clock = std::chrono::steady_clock;
+
+// Smooth pattern whose frequency differs per texture, so samples can't be hoisted out of the loop
+class PatternTexture : public IVTFTexture
+{
+private:
+	float mFrequency;
+
+public:
+	explicit PatternTexture(float frequency) : mFrequency(frequency) {}
+
+	bool IsValid() const override { return true; }
+	VTFTextureFormatInfo GetFormat() const override { return { "RGBA8888", 32, 4, 8, 8, 8, 8, false, true }; }
+	uint32_t GetVersionMajor() const override { return 7; }
+	uint32_t GetVersionMinor() const override { return 2; }
+
+	uint16_t GetWidth(uint8_t mipLevel = 0) const override { return std::max(1, 512 >> mipLevel); }
+	uint16_t GetHeight(uint8_t mipLevel = 0) const override { return std::max(1, 512 >> mipLevel); }
+	uint16_t GetDepth(uint8_t mipLevel = 0) const override { return 1; }
+	uint8_t GetFaces() const override { return 1; }
+	uint16_t GetMIPLevels() const override { return 10; }
+	uint16_t GetFrames() const override { return 1; }
+	uint16_t GetFirstFrame() const override { return 0; }
+
+	Pixel GetPixel(uint16_t x, uint16_t y, uint16_t z, uint8_t mipLevel, uint16_t frame, uint8_t face) const override
+	{
+		return Sample(
+			(x + 0.5f) / GetWidth(mipLevel), (y + 0.5f) / GetHeight(mipLevel),
+			z, mipLevel, frame, face
+		);
+	}
+
+	Pixel Sample(float u, float v, uint16_t z, float mipLevel, uint16_t frame, uint8_t face) const override
+	{
+		const float s = 0.5f + 0.5f * std::sin(u * mFrequency + mipLevel);
+		const float t = 0.5f + 0.5f * std::cos(v * mFrequency);
+		return Pixel{ s, t, s * t, 1.f - 0.5f * s };
+	}
+};
+
+struct Hit
+{
+	Triangle tri;
+	vec2 uv;
+	vec3 direction;
+	float distance;
+	size_t material;
+};
+
+struct NamedMaterial
+{
+	const char* name;
+	Material material;
+};
+
+static std::vector<NamedMaterial> MakeMaterials()
+{
+	auto base = std::make_shared<PatternTexture>(13.f);
+	auto base2 = std::make_shared<PatternTexture>(17.f);
+	auto normal = std::make_shared<PatternTexture>(19.f);
+	auto normal2 = std::make_shared<PatternTexture>(23.f);
+	auto mrao = std::make_shared<PatternTexture>(29.f);
+	auto mrao2 = std::make_shared<PatternTexture>(31.f);
+	auto blend = std::make_shared<PatternTexture>(37.f);
+	auto detail = std::make_shared<PatternTexture>(41.f);
+
+	std::vector<NamedMaterial> materials(5);
+
+	materials[0].name = "base";
+	materials[0].material.baseTexture = base;
+
+	materials[1].name = "base, normal";
+	materials[1].material.baseTexture = base;
+	materials[1].material.normalMap = normal;
+
+	materials[2].name = "base, normal, MRAO";
+	materials[2].material.baseTexture = base;
+	materials[2].material.normalMap = normal;
+	materials[2].material.mrao = mrao;
+
+	materials[3].name = "base, normal, detail";
+	materials[3].material.baseTexture = base;
+	materials[3].material.normalMap = normal;
+	materials[3].material.detail = detail;
+
+	materials[4].name = "blended, both layers";
+	materials[4].material.baseTexture = base;
+	materials[4].material.normalMap = normal;
+	materials[4].material.mrao = mrao;
+	materials[4].material.baseTexture2 = base2;
+	materials[4].material.normalMap2 = normal2;
+	materials[4].material.mrao2 = mrao2;
+	materials[4].material.blendTexture = blend;
+
+	for (NamedMaterial& named : materials) named.material.UpdateFeatures();
+	return materials;
+}
+
+static vec3 RandomUnit(std::mt19937& rng)
+{
+	std::normal_distribution<float> normal(0.f, 1.f);
+	vec3 v;
+	do {
+		v = vec3(normal(rng), normal(rng), normal(rng));
+	} while (dot(v, v) < 1e-6f);
+	return normalize(v);
+}
+
+static std::vector<Hit> MakeHits(size_t n, size_t numMaterials, std::mt19937& rng)
+{
+	std::uniform_real_distribution<float> unit(0.f, 1.f);
+
+	std::vector<Hit> hits(n);
+	for (size_t i = 0; i < n; i++) {
+		const vec3 p0 = RandomUnit(rng) * 100.f;
+		const vec3 p1 = p0 + RandomUnit(rng) * 8.f, p2 = p0 + RandomUnit(rng) * 8.f;
+		const vec2 uvs[3] = { vec2(unit(rng), unit(rng)), vec2(unit(rng), unit(rng)), vec2(unit(rng), unit(rng)) };
+
+		Hit& hit = hits[i];
+		hit.tri = Triangle(
+			bvh::Vector3<float>(p0.x, p0.y, p0.z),
+			bvh::Vector3<float>(p1.x, p1.y, p1.z),
+			bvh::Vector3<float>(p2.x, p2.y, p2.z),
+			0, uvs
+		);
+
+		const vec3 faceNormal(hit.tri.nNorm[0], hit.tri.nNorm[1], hit.tri.nNorm[2]);
+		const vec3 faceTangent = normalize(p1 - p0);
+		for (int c = 0; c < 3; c++) {
+			hit.tri.normals[c] = normalize(faceNormal + RandomUnit(rng) * 0.1f);
+			hit.tri.tangents[c] = faceTangent;
+			hit.tri.alphas[c] = unit(rng);
+		}
+
+		const float u = unit(rng), v = unit(rng) * (1.f - u);
+		hit.uv = vec2(u, v);
+		hit.direction = -normalize(faceNormal + RandomUnit(rng) * 0.5f);
+		hit.distance = 10.f + unit(rng) * 1000.f;
+		hit.material = i % numMaterials;
+	}
+
+	return hits;
+}
+
+// Everything a renderer reads from a hit before evaluating the BSDF
+static float Shade(const std::vector<Hit>& hits, const std::vector<const Material*>& materials)
+{
+	const Entity ent{ nullptr, 0, {}, vec4(1.f) };
+
+	float sink = 0.f;
+	for (const Hit& hit : hits) {
+		TraceResult result(hit.direction, hit.distance, 0.01f, 0.001f, hit.tri, hit.uv, ent, *materials[hit.material]);
+		sink += result.GetNormal().x + result.GetAlbedo().y + result.GetAlpha() + result.GetRoughness();
+	}
+	return sink;
+}
+
+template <typename Func>
+static double MedianMs(int repetitions, Func&& func)
+{
+	std::vector<double> times(repetitions);
+	for (int i = 0; i < repetitions; i++) {
+		auto start = Clock::now();
+		func();
+		times[i] = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+	std::sort(times.begin(), times.end());
+	return times[repetitions / 2];
+}
+
+int main(int argc, char** argv)
+{
+	const size_t numHits = argc > 1 ? std::max(1, std::atoi(argv[1])) : 1 << 18;
+	const int repetitions = argc > 2 ? std::max(1, std::atoi(argv[2])) : 20;
+
+	const std::vector<NamedMaterial> materials = MakeMaterials();
+
+	std::mt19937 rng(1234);
+	const std::vector<Hit> hits = MakeHits(numHits, materials.size(), rng);
+
+	printf("%zu hits, median of %d\n", numHits, repetitions);
+
+	volatile float sink = 0.f;
+	for (const NamedMaterial& named : materials) {
+		const std::vector<const Material*> only(materials.size(), &named.material);
+		const double time = MedianMs(repetitions, [&]() { sink = sink + Shade(hits, only); });
+		printf("  %-22s %8.3fms (%6.1fns per hit)\n", named.name, time, time * 1e6 / numHits);
+	}
+
+	std::vector<const Material*> mixed;
+	for (const NamedMaterial& named : materials) mixed.push_back(&named.material);
+	const double time = MedianMs(repetitions, [&]() { sink = sink + Shade(hits, mixed); });
+	printf("  %-22s %8.3fms (%6.1fns per hit)\n", "interleaved", time, time * 1e6 / numHits);
+
+	return 0;
+}
@@ -0,0 +1,178 @@
+// Compares the two ways PopulateAccel has skinned meshes:
+// - per triangle corner, multiplying bone by bind for every weight of every attribute (before the palette)
+// - premultiplying a palette once, then skinning each unique vertex with SkinVertices
+//
+// Usage: vistrace_bench_skinning [grid size = 256] [bones = 64] [repetitions = 20]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "Skinning.h"
+
+using namespace glm;
+using Clock = std::chrono::steady_clock;
+
+// Grid of quads, so interior vertices are shared by 6 triangles like most model meshes
+static void MakeMesh(
+	size_t gridSize, size_t numBones,
+	std::vector<SkinVertex>& vertices, std::vector<uint32_t>& indices
+)
+{
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> unit(0.f, 1.f);
+	std::uniform_int_distribution<int> bone(0, static_cast<int>(numBones) - 1);
+
+	vertices.resize(gridSize * gridSize);
+	for (size_t y = 0; y < gridSize; y++) {
+		for (size_t x = 0; x < gridSize; x++) {
+			SkinVertex& v = vertices[y * gridSize + x];
+			v.pos = vec3(x, y, unit(rng));
+			v.normal = normalize(vec3(unit(rng) - 0.5f, unit(rng) - 0.5f, 1.f));
+			v.tangent = normalize(cross(v.normal, vec3(0.f, 1.f, 0.f)));
+			v.uv = vec2(x, y) / static_cast<float>(gridSize);
+
+			// Most vertices of a character are weighted to 2 or 3 bones
+			v.numBones = static_cast<uint8_t>(1 + (x + y) % 3);
+			float total = 0.f;
+			for (uint8_t w = 0; w < 3; w++) {
+				v.boneIds[w] = static_cast<int8_t>(bone(rng));
+				v.weights[w] = w < v.numBones ? unit(rng) + 0.1f : 0.f;
+				total += v.weights[w];
+			}
+			for (uint8_t w = 0; w < 3; w++) v.weights[w] /= total;
+		}
+	}
+
+	indices.clear();
+	indices.reserve((gridSize - 1) * (gridSize - 1) * 6);
+	for (size_t y = 0; y + 1 < gridSize; y++) {
+		for (size_t x = 0; x + 1 < gridSize; x++) {
+			const uint32_t i = static_cast<uint32_t>(y * gridSize + x);
+			const uint32_t right = i + 1, down = i + static_cast<uint32_t>(gridSize), diag = down + 1;
+			indices.insert(indices.end(), { i, right, diag, i, diag, down });
+		}
+	}
+}
+
+static mat4 RandomTransform(std::mt19937& rng)
+{
+	std::uniform_real_distribution<float> dist(-1.f, 1.f);
+	mat4 m(1.f);
+	for (int col = 0; col < 3; col++) {
+		for (int row = 0; row < 3; row++) m[col][row] += 0.25f * dist(rng);
+	}
+	m[3] = vec4(dist(rng) * 50.f, dist(rng) * 50.f, dist(rng) * 50.f, 1.f);
+	return m;
+}
+
+// The skinning rebuilds did before the palette, kept here as the baseline
+static vec3 TransformToBone(
+	const vec3& vec,
+	const std::vector<mat4>& bones, const std::vector<mat4>& binds,
+	const SkinVertex& vertex,
+	const bool angleOnly
+)
+{
+	vec4 final(0.f);
+	vec4 v(vec, angleOnly ? 0.f : 1.f);
+	for (uint8_t i = 0; i < vertex.numBones; i++) {
+		final += bones[vertex.boneIds[i]] * binds[vertex.boneIds[i]] * v * vertex.weights[i];
+	}
+	return vec3(final);
+}
+
+static void SkinCorners(
+	const std::vector<SkinVertex>& vertices, const std::vector<uint32_t>& indices,
+	const std::vector<mat4>& bones, const std::vector<mat4>& binds,
+	std::vector<SkinnedVertex>& corners
+)
+{
+	for (size_t i = 0; i < indices.size(); i++) {
+		const SkinVertex& vertex = vertices[indices[i]];
+		corners[i].pos = TransformToBone(vertex.pos, bones, binds, vertex, false);
+		corners[i].normal = TransformToBone(vertex.normal, bones, binds, vertex, true);
+		corners[i].tangent = TransformToBone(vertex.tangent, bones, binds, vertex, true);
+	}
+}
+
+static void SkinUnique(
+	const std::vector<SkinVertex>& vertices, const std::vector<uint32_t>& indices,
+	const std::vector<mat4>& bones, const std::vector<mat4>& binds,
+	std::vector<mat4>& palette, std::vector<SkinnedVertex>& skinned, std::vector<SkinnedVertex>& corners
+)
+{
+	// Same as BuildSkinningPalette, which reads the binds from a Model
+	palette.resize(bones.size());
+	for (size_t i = 0; i < bones.size(); i++) palette[i] = bones[i] * binds[i];
+
+	SkinVertices(vertices.data(), vertices.size(), palette.data(), palette.size(), skinned.data());
+
+	// Stands in for AssembleSkinnedTriangles gathering each triangle's corners
+	for (size_t i = 0; i < indices.size(); i++) corners[i] = skinned[indices[i]];
+}
+
+template <typename Func>
+static double MedianMs(int repetitions, Func&& func)
+{
+	std::vector<double> times(repetitions);
+	for (int i = 0; i < repetitions; i++) {
+		auto start = Clock::now();
+		func();
+		times[i] = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+	std::sort(times.begin(), times.end());
+	return times[repetitions / 2];
+}
+
+int main(int argc, char** argv)
+{
+	const size_t gridSize = argc > 1 ? std::max(2, std::atoi(argv[1])) : 256;
+	const size_t numBones = argc > 2 ? std::min(std::max(1, std::atoi(argv[2])), 127) : 64;
+	const int repetitions = argc > 3 ? std::max(1, std::atoi(argv[3])) : 20;
+
+	std::vector<SkinVertex> vertices;
+	std::vector<uint32_t> indices;
+	MakeMesh(gridSize, numBones, vertices, indices);
+
+	std::mt19937 rng(5678);
+	std::vector<mat4> bones(numBones), binds(numBones);
+	for (size_t i = 0; i < numBones; i++) {
+		bones[i] = RandomTransform(rng);
+		binds[i] = RandomTransform(rng);
+	}
+
+	std::vector<SkinnedVertex> cornersBefore(indices.size()), cornersAfter(indices.size());
+	std::vector<SkinnedVertex> skinned(vertices.size());
+	std::vector<mat4> palette;
+
+	const double before = MedianMs(repetitions, [&]() {
+		SkinCorners(vertices, indices, bones, binds, cornersBefore);
+	});
+	const double after = MedianMs(repetitions, [&]() {
+		SkinUnique(vertices, indices, bones, binds, palette, skinned, cornersAfter);
+	});
+
+	// The two only differ by float rounding, as the palette changes the order of the multiplies
+	float maxError = 0.f;
+	for (size_t i = 0; i < indices.size(); i++) {
+		const vec3 diff = abs(cornersBefore[i].pos - cornersAfter[i].pos);
+		maxError = std::max(maxError, std::max(diff.x, std::max(diff.y, diff.z)));
+	}
+
+	printf(
+		"%zu vertices, %zu triangles, %zu bones, median of %d\n"
+		"  per corner: %8.3fms\n"
+		"  palette:    %8.3fms (%.2fx)\n"
+		"  max position difference %g\n",
+		vertices.size(), indices.size() / 3, numBones, repetitions,
+		before, after, before / after, maxError
+	);
+	return 0;
+}
@@ -0,0 +1,153 @@
+// Compares sampling a texture through the VTF parser against sampling its decoded tiles
+//
+// Usage: vistrace_bench_texture <path to .vtf> [samples = 1048576] [repetitions = 10]
+// DXT compressed textures (most of a map's base textures and normal maps) show the largest difference
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <vector>
+
+#include "VTFTexture.h"
+#include "ResourceCache.h"
+
+using namespace VisTrace;
+using Clock = std::chrono::steady_clock;
+
+struct Samples
+{
+	std::vector<float> u, v, lod;
+
+	explicit Samples(size_t n) : u(n), v(n), lod(n) {}
+};
+
+// Rays from a camera hit neighbouring texels one after the other, so this sweeps rows of the texture at a fixed LoD
+static Samples MakeCoherent(size_t n, float lod)
+{
+	Samples samples(n);
+	const size_t width = static_cast<size_t>(std::sqrt(static_cast<double>(n))) + 1;
+	for (size_t i = 0; i < n; i++) {
+		samples.u[i] = (i % width + 0.5f) / width;
+		samples.v[i] = (i / width + 0.5f) / width;
+		samples.lod[i] = lod;
+	}
+	return samples;
+}
+
+// Secondary bounces land anywhere, at any LoD
+static Samples MakeIncoherent(size_t n, float maxLod)
+{
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> unit(0.f, 1.f);
+
+	Samples samples(n);
+	for (size_t i = 0; i < n; i++) {
+		samples.u[i] = unit(rng);
+		samples.v[i] = unit(rng);
+		samples.lod[i] = unit(rng) * maxLod;
+	}
+	return samples;
+}
+
+template <typename Func>
+static double MedianMs(int repetitions, Func&& func)
+{
+	std::vector<double> times(repetitions);
+	for (int i = 0; i < repetitions; i++) {
+		auto start = Clock::now();
+		func();
+		times[i] = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+	std::sort(times.begin(), times.end());
+	return times[repetitions / 2];
+}
+
+static void SampleEach(const VTFTextureWrapper& tex, const Samples& samples, std::vector<Pixel>& out)
+{
+	for (size_t i = 0; i < out.size(); i++) {
+		out[i] = tex.Sample(samples.u[i], samples.v[i], 0, samples.lod[i], 0, 0);
+	}
+}
+
+static void Run(
+	const char* name, int repetitions,
+	const VTFTextureWrapper& raw, const VTFTextureWrapper& decoded, const Samples& samples
+)
+{
+	const size_t n = samples.u.size();
+	std::vector<Pixel> rawOut(n), decodedOut(n), batchOut(n);
+
+	// Decode every MIP the samples touch before timing
+	SampleEach(decoded, samples, decodedOut);
+
+	const double rawTime = MedianMs(repetitions, [&]() { SampleEach(raw, samples, rawOut); });
+	const double decodedTime = MedianMs(repetitions, [&]() { SampleEach(decoded, samples, decodedOut); });
+	const double batchTime = MedianMs(repetitions, [&]() {
+		decoded.SampleBatch(samples.u.data(), samples.v.data(), samples.lod.data(), batchOut.data(), n);
+	});
+
+	// Decoded LDR texels are stored as 8 bits per channel, so some difference is expected
+	double totalError = 0.0;
+	for (size_t i = 0; i < n; i++) {
+		totalError += std::fabs(rawOut[i].r - decodedOut[i].r) + std::fabs(rawOut[i].g - decodedOut[i].g);
+		totalError += std::fabs(rawOut[i].b - decodedOut[i].b) + std::fabs(rawOut[i].a - decodedOut[i].a);
+	}
+
+	printf(
+		"%s (%zu samples, median of %d)\n"
+		"  parser:         %8.3fms\n"
+		"  decoded:        %8.3fms (%.2fx)\n"
+		"  decoded batch:  %8.3fms (%.2fx)\n"
+		"  mean channel difference %g\n",
+		name, n, repetitions,
+		rawTime,
+		decodedTime, rawTime / decodedTime,
+		batchTime, rawTime / batchTime,
+		totalError / (4.0 * n)
+	);
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2) {
+		printf("Usage: %s <path to .vtf> [samples] [repetitions]\n", argv[0]);
+		return 1;
+	}
+
+	const size_t numSamples = argc > 2 ? std::max(1, std::atoi(argv[2])) : 1 << 20;
+	const int repetitions = argc > 3 ? std::max(1, std::atoi(argv[3])) : 10;
+
+	std::ifstream file(argv[1], std::ios::binary);
+	std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	if (data.empty()) {
+		printf("Failed to read %s\n", argv[1]);
+		return 1;
+	}
+
+	VTFTextureWrapper raw(data.data(), static_cast<uint32_t>(data.size()));
+	VTFTextureWrapper decoded(data.data(), static_cast<uint32_t>(data.size()));
+	if (!raw.IsValid()) {
+		printf("%s isn't a valid VTF\n", argv[1]);
+		return 1;
+	}
+
+	ResourceCache::SetDecodeBudget(size_t(1) << 30);
+	ResourceCache::SetMIPTimeout(0);
+	if (!decoded.EnableDecoding()) {
+		printf("%s can't be decoded (volumetric, cubemap, or animated)\n", argv[1]);
+		return 1;
+	}
+
+	printf("%ux%u, %u MIPs\n", raw.GetWidth(), raw.GetHeight(), raw.GetMIPLevels());
+
+	const float maxLod = static_cast<float>(raw.GetMIPLevels() - 1);
+	Run("Coherent, MIP 0", repetitions, raw, decoded, MakeCoherent(numSamples, 0.f));
+	Run("Coherent, MIP 1.5", repetitions, raw, decoded, MakeCoherent(numSamples, std::min(1.5f, maxLod)));
+	Run("Incoherent, any MIP", repetitions, raw, decoded, MakeIncoherent(numSamples, maxLod));
+	return 0;
+}
@@ -4,6 +4,8 @@
 
 #include "vistrace/IRenderTarget.h"
 #include "vistrace/ISampler.h"
+#include "vistrace/IHitBuffer.h"
+#include "vistrace/IBSDFMaterial.h"
 
 namespace VisTrace
 {
@@ -14,6 +16,8 @@ namespace VisTrace
 		extern int VTFTexture;
 		extern int RenderTarget;
 		extern int Sampler;
+		extern int HitBuffer;
+		extern int BSDFMaterial;
 	};
 }
 
@@ -21,6 +25,8 @@ namespace VisTrace
 int VisTrace::VType::VTFTexture = -1;                                                   \
 int VisTrace::VType::RenderTarget = -1;                                                 \
 int VisTrace::VType::Sampler = -1;                                                      \
+int VisTrace::VType::HitBuffer = -1;                                                    \
+int VisTrace::VType::BSDFMaterial = -1;                                                 \
 void vt_extension_open__Imp(GarrysMod::Lua::ILuaBase* LUA);                             \
 int vt_extension_open(lua_State* L)                                                     \
 {                                                                                       \
@@ -43,6 +49,16 @@ int vt_extension_open(lua_State* L)
 		VisTrace::VType::Sampler = LUA->GetNumber();                                    \
 	LUA->Pop();                                                                         \
                                                                                         \
+	LUA->GetField(-1, "VisTraceHitBuffer_id");                                          \
+	if (LUA->IsType(-1, GarrysMod::Lua::Type::Number))                                  \
+		VisTrace::VType::HitBuffer = LUA->GetNumber();                                  \
+	LUA->Pop();                                                                         \
+                                                                                        \
+	LUA->GetField(-1, "BSDFMaterial_id");                                               \
+	if (LUA->IsType(-1, GarrysMod::Lua::Type::Number))                                  \
+		VisTrace::VType::BSDFMaterial = LUA->GetNumber();                               \
+	LUA->Pop();                                                                         \
+                                                                                        \
 	vt_extension_open__Imp(LUA);                                                        \
 	return 0;                                                                           \
 }                                                                                       \
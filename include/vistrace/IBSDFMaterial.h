@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+
+namespace VisTrace
+{
+	/// <summary>
+	/// Shading points to evaluate a material at, as an array per attribute with an element per point
+	/// Vectors are 3 consecutive floats per point, the same layout as IHitBuffer
+	/// </summary>
+	struct BSDFBatch
+	{
+		size_t size = 0;
+
+		const float* pNormals = nullptr;
+		const float* pTangents = nullptr;
+		const float* pBinormals = nullptr;
+		const float* pIncident = nullptr; // Pointing away from the surface
+		const float* pScattered = nullptr;
+
+		// Hit colour, metalness, and roughness of each point (either all set or all null)
+		// If null, every point is shaded with the material's current colours, metalness, and roughness
+		const float* pAlbedos = nullptr;
+		const float* pMetalness = nullptr;
+		const float* pRoughness = nullptr;
+	};
+
+	/// <summary>
+	/// Lua BSDFMaterial, boxed by pointer like the other objects: *LUA->GetUserType<IBSDFMaterial*>(index, VType::BSDFMaterial)
+	/// </summary>
+	class IBSDFMaterial
+	{
+	public:
+		IBSDFMaterial() {};
+		virtual ~IBSDFMaterial() {};
+
+		/// <summary>
+		/// Evaluates the BSDF at every point of a batch in parallel
+		/// </summary>
+		/// <param name="pOut">3 floats per point</param>
+		virtual void EvalBatch(const BSDFBatch& batch, float* pOut) const = 0;
+
+		/// <summary>
+		/// Evaluates the PDF of sampling each point's scattered direction in parallel
+		/// </summary>
+		/// <param name="pOut">1 float per point</param>
+		virtual void EvalPDFBatch(const BSDFBatch& batch, float* pOut) const = 0;
+	};
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace VisTrace
+{
+	// Triangle, instance, entity, and submaterial of rays that didn't hit anything, and the instance of triangles that aren't part of one
+	constexpr uint32_t INVALID_INDEX = UINT32_MAX;
+
+	enum class HitAttributes : uint8_t
+	{
+		None = 0,
+
+		Position = 0b001,
+		TBN      = 0b010, // Shading normal, tangent, and binormal
+		Shading  = 0b100, // Albedo, alpha, metalness, and roughness
+
+		All = 0b111
+	};
+
+	inline HitAttributes operator |(const HitAttributes& lhs, const HitAttributes& rhs)
+	{
+		return static_cast<HitAttributes>(static_cast<uint8_t>(lhs) | static_cast<uint8_t>(rhs));
+	}
+
+	inline HitAttributes operator &(const HitAttributes& lhs, const HitAttributes& rhs)
+	{
+		return static_cast<HitAttributes>(static_cast<uint8_t>(lhs) & static_cast<uint8_t>(rhs));
+	}
+
+	/// <summary>
+	/// Closest hits of a batch of rays, stored as an array per attribute with an element per ray
+	/// Vectors are 3 consecutive floats per ray, and barycentrics are the u and v of each ray
+	/// </summary>
+	class IHitBuffer
+	{
+	public:
+		IHitBuffer() {};
+		virtual ~IHitBuffer() {};
+
+		virtual size_t GetSize() const = 0;
+
+		virtual bool IsHit(size_t i) const = 0;
+		virtual bool HitSky(size_t i) const = 0;
+
+		virtual const float* GetDistances() const = 0; // 0 for misses
+		virtual const uint32_t* GetTriangles() const = 0;
+		virtual const uint32_t* GetInstances() const = 0; // Static prop instance the triangle belongs to
+		virtual const float* GetBarycentrics() const = 0;
+		virtual const uint32_t* GetEntities() const = 0;
+		virtual const uint32_t* GetSubMaterials() const = 0;
+
+		/// <summary>
+		/// Computes shading attributes for a range of rays in parallel, skipping misses and attributes already computed
+		/// Rays are grouped by material, and each of a material's textures is sampled for the whole group with IVTFTexture::SampleBatch
+		/// </summary>
+		/// <returns>False if the range is out of bounds, or the accel has been rebuilt since the rays were traced</returns>
+		virtual bool Shade(size_t start, size_t count, HitAttributes attributes = HitAttributes::All) = 0;
+
+		/// <summary>
+		/// Gets which attributes have been computed for a ray
+		/// </summary>
+		virtual HitAttributes GetShaded(size_t i) const = 0;
+
+		// Only valid for rays shaded with the corresponding attribute, null if no ray has been
+		virtual const float* GetPositions() const = 0;
+		virtual const float* GetNormals() const = 0;
+		virtual const float* GetTangents() const = 0;
+		virtual const float* GetBinormals() const = 0;
+		virtual const float* GetAlbedos() const = 0;
+		virtual const float* GetAlphas() const = 0;
+		virtual const float* GetMetalness() const = 0;
+		virtual const float* GetRoughness() const = 0;
+	};
+}
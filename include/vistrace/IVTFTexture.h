@@ -3,6 +3,7 @@
 #include "vistrace/Structs.h"
 
 #include <cstdint>
+#include <cstddef>
 
 namespace VisTrace
 {
@@ -140,5 +141,19 @@ namespace VisTrace
 		{
 			return Sample(u, v, mipLevel, 0);
 		}
+
+		/// <summary>
+		/// Samples the first frame of a 2D texture at many uvs in one call, with the same filtering as Sample
+		/// Implementations can share work between samples, so prefer this over calling Sample in a loop
+		/// </summary>
+		/// <param name="u">U coordinate of each sample</param>
+		/// <param name="v">V coordinate of each sample</param>
+		/// <param name="lod">MIP level of each sample</param>
+		/// <param name="out">Filtered pixel of each sample</param>
+		/// <param name="n">Number of samples</param>
+		virtual void SampleBatch(const float* u, const float* v, const float* lod, Pixel* out, size_t n) const
+		{
+			for (size_t i = 0; i < n; i++) out[i] = Sample(u[i], v[i], lod[i]);
+		}
 	};
 }
@@ -93,3 +93,33 @@ bool ValidVector(const glm::vec3& v)
 		!(std::isinf(v.x) || std::isinf(v.y) || std::isinf(v.z))
 	);
 }
+
+// Ray Tracing Gems
+glm::vec3 OffsetRayOrigin(const glm::vec3& pos, const glm::vec3& normal)
+{
+	using namespace glm;
+
+	const float origin = 1.f / 32.f;
+	const float fScale = 1.f / 65536.f;
+	const float iScale = 256.f;
+
+	// Per-component integer offset to bit representation of fp32 position.
+	ivec3 iOff = ivec3(normal * iScale);
+	vec3 iPos = intBitsToFloat(
+		floatBitsToInt(pos) +
+		ivec3(
+			pos.x < 0.f ? -iOff.x : iOff.x,
+			pos.y < 0.f ? -iOff.y : iOff.y,
+			pos.z < 0.f ? -iOff.z : iOff.z
+		)
+	);
+
+	// Select per-component between small fixed offset or above variable offset depending on distance to origin.
+	vec3 fOff = normal * fScale;
+
+	return vec3(
+		abs(pos.x) < origin ? pos.x + fOff.x : iPos.x,
+		abs(pos.y) < origin ? pos.y + fOff.y : iPos.y,
+		abs(pos.z) < origin ? pos.z + fOff.z : iPos.z
+	);
+}
@@ -71,8 +71,33 @@ inline glm::vec2 TransformTexcoord(const glm::vec2& texcoord, const glm::mat2x4&
 	return transformed * scale;
 }
 
+/// <summary>
+/// Offsets a ray origin along a normal to avoid self intersection
+/// </summary>
+/// <param name="pos">Hit position</param>
+/// <param name="normal">Normal to offset along (flip to the side the new ray will leave from)</param>
+/// <returns>Offset ray origin</returns>
+glm::vec3 OffsetRayOrigin(const glm::vec3& pos, const glm::vec3& normal);
+
 // Ray Tracing Gems
 inline float TriUVInfoToTexLOD(const VisTrace::IVTFTexture* pTex, glm::vec2 uvInfo)
 {
 	return uvInfo.x + 0.5f * log2(pTex->GetWidth() * pTex->GetHeight() * uvInfo.y);
 }
+
+/// <summary>
+/// Hashes raw bytes with 64 bit FNV-1a, chain calls by passing the previous hash
+/// </summary>
+/// <param name="pData">Data to hash</param>
+/// <param name="size">Size of the data in bytes</param>
+/// <param name="hash">Hash to continue from</param>
+/// <returns>Updated hash</returns>
+inline uint64_t HashBytes(const void* pData, size_t size, uint64_t hash = 14695981039346656037ULL)
+{
+	const uint8_t* pBytes = static_cast<const uint8_t*>(pData);
+	for (size_t i = 0; i < size; i++) {
+		hash ^= pBytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
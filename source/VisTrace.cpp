@@ -12,13 +12,18 @@
 
 #include "TraceResult.h"
 #include "AccelStruct.h"
+#include "RenderSession.h"
+#include "HitBuffer.h"
 
 #include "BSDF.h"
 #include "HDRI.h"
 #include "Tonemapper.h"
+#include "Camera.h"
 
 #include "ResourceCache.h"
 
+#include <cstdio>
+
 using namespace GarrysMod::Lua;
 using namespace VisTrace;
 
@@ -466,6 +471,24 @@ LUA_FUNCTION(TraceResult_gc)
 	return 0;
 }
 
+/*
+	returns table stats
+		uint32_t numAllocated (results alive, whether or not Lua has collected them yet)
+		uint32_t capacity (results the pool can hold before allocating another slab)
+*/
+LUA_FUNCTION(vistrace_GetTraceResultPoolStats)
+{
+	size_t numAllocated, capacity;
+	TraceResult::GetPoolStats(numAllocated, capacity);
+
+	LUA->CreateTable();
+	LUA->PushNumber(numAllocated);
+	LUA->SetField(-2, "numAllocated");
+	LUA->PushNumber(capacity);
+	LUA->SetField(-2, "capacity");
+	return 1;
+}
+
 LUA_FUNCTION(TraceResult_Pos)
 {
 	LUA->CheckType(1, TraceResult::id);
@@ -492,23 +515,31 @@ LUA_FUNCTION(TraceResult_Distance)
 	return 1;
 }
 
-LUA_FUNCTION(TraceResult_Entity)
+// Pushes the entity hit, or NULL if the index has since been reused by a different entity
+static void PushHitEntity(ILuaBase* LUA, uint32_t entIdx, const CBaseEntity* rawEnt)
 {
-	LUA->CheckType(1, TraceResult::id);
-	TraceResult* pResult = *LUA->GetUserType<TraceResult*>(1, TraceResult::id);
-
 	LUA->PushSpecial(SPECIAL_GLOB);
 	LUA->GetField(-1, "Entity");
-	LUA->PushNumber(pResult->entIdx);
+	LUA->PushNumber(entIdx);
 	LUA->Call(1, 1);
 
 	CBaseEntity* pEnt = LUA->GetUserType<CBaseEntity>(-1, Type::Entity);
-	if (pEnt == nullptr || pEnt != pResult->rawEnt) {
-		LUA->GetField(-2, "Entity");
+	if (pEnt == nullptr || pEnt != rawEnt) {
+		LUA->Pop();
+		LUA->GetField(-1, "Entity");
 		LUA->PushNumber(-1);
 		LUA->Call(1, 1);
 	}
 
+	LUA->Remove(-2);
+}
+
+LUA_FUNCTION(TraceResult_Entity)
+{
+	LUA->CheckType(1, TraceResult::id);
+	TraceResult* pResult = *LUA->GetUserType<TraceResult*>(1, TraceResult::id);
+
+	PushHitEntity(LUA, pResult->entIdx, pResult->rawEnt);
 	return 1;
 }
 
@@ -656,6 +687,130 @@ LUA_FUNCTION(TraceResult_BaseMIPLevel)
 	return 1;
 }
 
+// Writes a vector to a field of the table at the top of the stack, updating the vector already there in place if there is one
+static void SetVectorField(ILuaBase* LUA, const char* name, const glm::vec3& v)
+{
+	LUA->GetField(-1, name);
+	if (LUA->IsType(-1, Type::Vector)) {
+		Vector* pVec = LUA->GetUserType<Vector>(-1, Type::Vector);
+		pVec->x = v.x;
+		pVec->y = v.y;
+		pVec->z = v.z;
+		LUA->Pop();
+		return;
+	}
+	LUA->Pop();
+
+	LUA->PushVector(MakeVector(v.x, v.y, v.z));
+	LUA->SetField(-2, name);
+}
+
+/*
+	TraceResult result
+	table       tbl = {}
+	TraceField  fields = TraceField.All
+
+	Reads many attributes in one call, with the same values and keys as the accessors of the same names
+	Pass the same table every time to avoid allocating, vectors already in it are updated in place so don't keep references to them
+
+	returns tbl
+*/
+LUA_FUNCTION(TraceResult_Fill)
+{
+	LUA->CheckType(1, TraceResult::id);
+	TraceResult* pResult = *LUA->GetUserType<TraceResult*>(1, TraceResult::id);
+
+	TraceField fields = TraceField::All;
+	if (LUA->IsType(3, Type::Number)) fields = static_cast<TraceField>(LUA->GetNumber(3));
+
+	if (LUA->Top() < 2 || LUA->IsType(2, Type::Nil)) LUA->CreateTable();
+	else {
+		LUA->CheckType(2, Type::Table);
+		LUA->Push(2);
+	}
+
+	auto has = [fields](const TraceField field) { return (fields & field) != TraceField::None; };
+
+	if (has(TraceField::Pos)) SetVectorField(LUA, "Pos", pResult->GetPos());
+	if (has(TraceField::Incident)) SetVectorField(LUA, "Incident", pResult->wo);
+	if (has(TraceField::Distance)) {
+		LUA->PushNumber(pResult->distance);
+		LUA->SetField(-2, "Distance");
+	}
+	if (has(TraceField::Entity)) {
+		PushHitEntity(LUA, pResult->entIdx, pResult->rawEnt);
+		LUA->SetField(-2, "Entity");
+	}
+
+	if (has(TraceField::GeometricNormal)) SetVectorField(LUA, "GeometricNormal", pResult->geometricNormal);
+	if (has(TraceField::Normal)) SetVectorField(LUA, "Normal", pResult->GetNormal());
+	if (has(TraceField::Tangent)) SetVectorField(LUA, "Tangent", pResult->GetTangent());
+	if (has(TraceField::Binormal)) SetVectorField(LUA, "Binormal", pResult->GetBinormal());
+
+	if (has(TraceField::Barycentric)) SetVectorField(LUA, "Barycentric", pResult->uvw);
+	if (has(TraceField::TextureUV)) {
+		LUA->GetField(-1, "TextureUV");
+		if (!LUA->IsType(-1, Type::Table)) {
+			LUA->Pop();
+			LUA->CreateTable();
+			LUA->Push(-1);
+			LUA->SetField(-3, "TextureUV");
+		}
+		LUA->PushNumber(pResult->texUV.x);
+		LUA->SetField(-2, "u");
+		LUA->PushNumber(pResult->texUV.y);
+		LUA->SetField(-2, "v");
+		LUA->Pop();
+	}
+	if (has(TraceField::SubMaterialIndex)) {
+		LUA->PushNumber(pResult->submatIdx + 1);
+		LUA->SetField(-2, "SubMaterialIndex");
+	}
+
+	if (has(TraceField::Albedo)) SetVectorField(LUA, "Albedo", pResult->GetAlbedo());
+	if (has(TraceField::Alpha)) {
+		LUA->PushNumber(pResult->GetAlpha());
+		LUA->SetField(-2, "Alpha");
+	}
+	if (has(TraceField::Metalness)) {
+		LUA->PushNumber(pResult->GetMetalness());
+		LUA->SetField(-2, "Metalness");
+	}
+	if (has(TraceField::Roughness)) {
+		LUA->PushNumber(pResult->GetRoughness());
+		LUA->SetField(-2, "Roughness");
+	}
+
+	if (has(TraceField::MaterialFlags)) {
+		LUA->PushNumber(static_cast<double>(pResult->GetMaterialFlags()));
+		LUA->SetField(-2, "MaterialFlags");
+	}
+	if (has(TraceField::SurfaceFlags)) {
+		LUA->PushNumber(static_cast<double>(pResult->GetSurfFlags()));
+		LUA->SetField(-2, "SurfaceFlags");
+	}
+
+	if (has(TraceField::HitSky)) {
+		LUA->PushBool(pResult->hitSky);
+		LUA->SetField(-2, "HitSky");
+	}
+	if (has(TraceField::HitWater)) {
+		LUA->PushBool(pResult->HitWater());
+		LUA->SetField(-2, "HitWater");
+	}
+	if (has(TraceField::FrontFacing)) {
+		LUA->PushBool(pResult->frontFacing);
+		LUA->SetField(-2, "FrontFacing");
+	}
+
+	if (has(TraceField::BaseMIPLevel)) {
+		LUA->PushNumber(pResult->GetBaseMIPLevel());
+		LUA->SetField(-2, "BaseMIPLevel");
+	}
+
+	return 1;
+}
+
 LUA_FUNCTION(TraceResult_Material)
 {
 	LUA->CheckType(1, TraceResult::id);
@@ -697,163 +852,1311 @@ LUA_FUNCTION(TraceResult_BaseTexture2)
 	LUA->CheckType(1, TraceResult::id);
 	TraceResult* pResult = *LUA->GetUserType<TraceResult*>(1, TraceResult::id);
 
-	if (pResult->GetBaseTexture2().empty()) return 0;
-	LUA->PushString(pResult->GetBaseTexture2().c_str());
+	if (pResult->GetBaseTexture2().empty()) return 0;
+	LUA->PushString(pResult->GetBaseTexture2().c_str());
+	return 1;
+}
+LUA_FUNCTION(TraceResult_NormalMap2)
+{
+	LUA->CheckType(1, TraceResult::id);
+	TraceResult* pResult = *LUA->GetUserType<TraceResult*>(1, TraceResult::id);
+
+	if (pResult->GetNormalMap2().empty()) return 0;
+	LUA->PushString(pResult->GetNormalMap2().c_str());
+	return 1;
+}
+LUA_FUNCTION(TraceResult_MRAO2)
+{
+	LUA->CheckType(1, TraceResult::id);
+	TraceResult* pResult = *LUA->GetUserType<TraceResult*>(1, TraceResult::id);
+
+	if (pResult->GetMRAO2().empty()) return 0;
+	LUA->PushString(pResult->GetMRAO2().c_str());
+	return 1;
+}
+
+LUA_FUNCTION(TraceResult_BlendTexture)
+{
+	LUA->CheckType(1, TraceResult::id);
+	TraceResult* pResult = *LUA->GetUserType<TraceResult*>(1, TraceResult::id);
+
+	if (pResult->GetBlendTexture().empty()) return 0;
+	LUA->PushString(pResult->GetBlendTexture().c_str());
+	return 1;
+}
+LUA_FUNCTION(TraceResult_DetailTexture)
+{
+	LUA->CheckType(1, TraceResult::id);
+	TraceResult* pResult = *LUA->GetUserType<TraceResult*>(1, TraceResult::id);
+
+	if (pResult->GetDetailTexture().empty()) return 0;
+	LUA->PushString(pResult->GetDetailTexture().c_str());
+	return 1;
+}
+
+LUA_FUNCTION(TraceResult_tostring)
+{
+	LUA->PushString("VisTraceResult");
+	return 1;
+}
+#pragma endregion
+
+#pragma region Tracing API
+static int AccelStruct_id;
+static World* g_pWorld = nullptr;
+
+/// <summary>
+/// Finishes loading the world if its background load is done, announcing it the first time it becomes ready
+/// </summary>
+/// <param name="timeout">Milliseconds to wait for the background load, negative to wait indefinitely</param>
+/// <returns>Whether the world is ready to be used</returns>
+static bool PollWorld(ILuaBase* LUA, double timeout = 0.0)
+{
+	if (g_pWorld == nullptr) return false;
+	if (g_pWorld->IsReady()) return true;
+	if (!g_pWorld->Finalise(LUA, timeout)) return false;
+
+	const WorldLoadStats& stats = g_pWorld->loadStats;
+	char statsMsg[512];
+	snprintf(
+		statsMsg, sizeof(statsMsg),
+		"VisTrace: Loaded %zu triangles and %zu static props (%zu unique models) in %.1fms, skipping %.1fMB of unused lumps\n"
+		"  read %.1fms, world materials %.1fms, %zu textures %.1fms, triangles %.1fms, prop models %.1fms, prop materials %.1fms, instances %.1fms",
+		stats.numTriangles, stats.numStaticProps, stats.numUniqueProps, stats.totalTime, stats.bytesSkipped / (1024.0 * 1024.0),
+		stats.readTime, stats.materialTime, stats.numTextures, stats.textureTime, stats.triangleTime, stats.propModelTime, stats.propMaterialTime, stats.instanceTime
+	);
+	printLua(LUA, "VisTrace: Map loaded successfully!");
+	printLua(LUA, statsMsg);
+
+	LUA->PushSpecial(SPECIAL_GLOB);
+	LUA->GetField(-1, "hook");
+
+	LUA->GetField(-1, "Remove");
+	LUA->PushString("Think");
+	LUA->PushString("VisTrace.LoadWorld");
+	LUA->Call(2, 0);
+
+	LUA->GetField(-1, "Run");
+	LUA->PushString("VisTraceWorldReady");
+	LUA->Call(1, 0);
+	LUA->Pop(2); // hook and _G
+
+	return true;
+}
+
+// Gets the world if it's ready, otherwise accels are built from entities alone
+static const World* GetReadyWorld(ILuaBase* LUA)
+{
+	return PollWorld(LUA) ? g_pWorld : nullptr;
+}
+
+LUA_FUNCTION(World_Think)
+{
+	PollWorld(LUA);
+	return 0;
+}
+
+/*
+	returns bool ready
+*/
+LUA_FUNCTION(vistrace_IsWorldReady)
+{
+	LUA->PushBool(PollWorld(LUA));
+	return 1;
+}
+
+/*
+	float timeout = nil (seconds, waits indefinitely if nil)
+
+	returns bool ready
+*/
+LUA_FUNCTION(vistrace_WaitForWorld)
+{
+	double timeout = -1.0;
+	if (LUA->IsType(1, Type::Number)) timeout = LUA->GetNumber(1) * 1000.0;
+
+	LUA->PushBool(PollWorld(LUA, timeout));
+	return 1;
+}
+
+/*
+	float megabytes = 0 (textures and models nothing references are evicted least recently used first past this, 0 for unlimited)
+*/
+LUA_FUNCTION(vistrace_SetCacheBudget)
+{
+	double megabytes = LUA->IsType(1, Type::Number) ? LUA->GetNumber(1) : 0.0;
+	if (megabytes < 0.0) LUA->ArgError(1, "Budget cannot be negative");
+
+	ResourceCache::SetMemoryBudget(static_cast<size_t>(megabytes * 1024.0 * 1024.0));
+	return 0;
+}
+
+/*
+	returns table stats
+		uint32_t hits
+		uint32_t misses
+		uint32_t evictions
+		uint32_t numTextures
+		uint32_t numModels
+		float    textureMemory (MB)
+		float    modelMemory (MB)
+		float    budget (MB, 0 if unlimited)
+		uint32_t numDecodedMIPs
+		uint32_t mipEvictions
+		float    decodedMemory (MB, not included in textureMemory)
+		float    decodeBudget (MB)
+		uint32_t numMissing (paths known not to exist)
+		uint32_t probesSaved (file system lookups skipped for known missing paths)
+*/
+LUA_FUNCTION(vistrace_GetCacheStats)
+{
+	const ResourceCache::Stats stats = ResourceCache::GetStats();
+	const double megabyte = 1024.0 * 1024.0;
+
+	LUA->CreateTable();
+	LUA->PushNumber(stats.hits);
+	LUA->SetField(-2, "hits");
+	LUA->PushNumber(stats.misses);
+	LUA->SetField(-2, "misses");
+	LUA->PushNumber(stats.evictions);
+	LUA->SetField(-2, "evictions");
+	LUA->PushNumber(stats.numTextures);
+	LUA->SetField(-2, "numTextures");
+	LUA->PushNumber(stats.numModels);
+	LUA->SetField(-2, "numModels");
+
+	LUA->PushNumber(stats.textureBytes / megabyte);
+	LUA->SetField(-2, "textureMemory");
+	LUA->PushNumber(stats.modelBytes / megabyte);
+	LUA->SetField(-2, "modelMemory");
+	LUA->PushNumber(stats.budget / megabyte);
+	LUA->SetField(-2, "budget");
+
+	LUA->PushNumber(stats.numDecodedMIPs);
+	LUA->SetField(-2, "numDecodedMIPs");
+	LUA->PushNumber(stats.mipEvictions);
+	LUA->SetField(-2, "mipEvictions");
+	LUA->PushNumber(stats.decodedBytes / megabyte);
+	LUA->SetField(-2, "decodedMemory");
+	LUA->PushNumber(stats.decodeBudget / megabyte);
+	LUA->SetField(-2, "decodeBudget");
+
+	LUA->PushNumber(stats.numMissing);
+	LUA->SetField(-2, "numMissing");
+	LUA->PushNumber(stats.probesSaved);
+	LUA->SetField(-2, "probesSaved");
+	return 1;
+}
+
+/*
+	float megabytes = 0 (MIPs of textures loaded from now on are decoded as they're sampled while they fit in this, 0 to stop decoding)
+*/
+LUA_FUNCTION(vistrace_SetTextureDecodeBudget)
+{
+	double megabytes = LUA->IsType(1, Type::Number) ? LUA->GetNumber(1) : 0.0;
+	if (megabytes < 0.0) LUA->ArgError(1, "Budget cannot be negative");
+
+	ResourceCache::SetDecodeBudget(static_cast<size_t>(megabytes * 1024.0 * 1024.0));
+	return 0;
+}
+
+/*
+	int frames = 300 (decoded MIPs larger than 64x64 are evicted after going this many frames without being sampled, 0 to never evict)
+*/
+LUA_FUNCTION(vistrace_SetTextureMIPTimeout)
+{
+	double frames = LUA->IsType(1, Type::Number) ? LUA->GetNumber(1) : 300.0;
+	if (frames < 0.0) LUA->ArgError(1, "Timeout cannot be negative");
+
+	ResourceCache::SetMIPTimeout(static_cast<uint32_t>(frames));
+	return 0;
+}
+
+LUA_FUNCTION(ResourceCache_Think)
+{
+	ResourceCache::AdvanceFrame();
+	return 0;
+}
+
+LUA_FUNCTION(vistrace_ClearMissingCache)
+{
+	ResourceCache::ClearMissing();
+	return 0;
+}
+
+LUA_FUNCTION(AccelStruct_gc)
+{
+	LUA->CheckType(1, AccelStruct_id);
+	AccelStruct* pAccelStruct = *LUA->GetUserType<AccelStruct*>(1, AccelStruct_id);
+
+	LUA->SetUserType(1, NULL);
+	delete pAccelStruct;
+
+	return 0;
+}
+
+/*
+	table[Entity] entities = {}
+	boolean       traceWorld = true (the world is left out until it's ready, see vistrace.WaitForWorld)
+	table         boneMatrices = nil (table[Entity] = packed state, see below)
+
+	Each entity's packed state is either its bone matrices alone, as a table or string of 12 floats per bone (rows of a 3x4 matrix),
+	or a table of any of the following, where anything left out is queried from the entity:
+		table or string bones        (bone matrices as above)
+		string          material     (same as Entity:GetMaterial)
+		table[string]   subMaterials (one per model material in order, "" for the model's own, same as Entity:GetSubMaterial)
+		table[int]      bodygroups   (one per model bodygroup in order, same as Entity:GetBodygroup)
+
+	returns AccelStruct
+*/
+LUA_FUNCTION(vistrace_CreateAccel)
+{
+	bool traceWorld = true;
+	if (LUA->IsType(2, Type::Bool)) traceWorld = LUA->GetBool(2);
+
+	int boneMatricesIdx = 0;
+	if (LUA->IsType(3, Type::Table)) boneMatricesIdx = 3;
+	else if (!LUA->IsType(3, Type::Nil) && LUA->Top() >= 3) LUA->CheckType(3, Type::Table);
+	if (!LUA->IsType(1, Type::Nil) && LUA->Top() >= 1) LUA->CheckType(1, Type::Table);
+
+	const World* pWorld = traceWorld ? GetReadyWorld(LUA) : nullptr;
+
+	// Boxed before populating, so the accel is collected rather than leaked if populating throws
+	AccelStruct* pAccelStruct = new AccelStruct();
+	LUA->PushUserType_Value(pAccelStruct, AccelStruct_id);
+
+	// Push the entities to the top of the stack, leaving the packed state where it is
+	if (LUA->IsType(1, Type::Table)) LUA->Push(1);
+	else LUA->CreateTable();
+
+	// Pops the entities, leaving the accel on top
+	pAccelStruct->PopulateAccel(LUA, pWorld, boneMatricesIdx);
+	return 1;
+}
+
+/*
+	AccelStruct   accel
+	table[Entity] entities = {}
+	boolean       traceWorld = true (the world is left out until it's ready, see vistrace.WaitForWorld)
+	table         boneMatrices = nil (table[Entity] = packed state, see vistrace.CreateAccel)
+*/
+LUA_FUNCTION(AccelStruct_Rebuild)
+{
+	LUA->CheckType(1, AccelStruct_id);
+
+	bool traceWorld = true;
+	if (LUA->IsType(3, Type::Bool)) traceWorld = LUA->GetBool(3);
+
+	int boneMatricesIdx = 0;
+	if (LUA->IsType(4, Type::Table)) boneMatricesIdx = 4;
+	else if (!LUA->IsType(4, Type::Nil) && LUA->Top() >= 4) LUA->CheckType(4, Type::Table);
+
+	AccelStruct* pAccelStruct = *LUA->GetUserType<AccelStruct*>(1, AccelStruct_id);
+
+	// Push the entities to the top of the stack, leaving the packed state where it is
+	if (LUA->Top() == 1 || LUA->IsType(2, Type::Nil)) LUA->CreateTable();
+	else {
+		LUA->CheckType(2, Type::Table);
+		LUA->Push(2);
+	}
+	pAccelStruct->PopulateAccel(LUA, traceWorld ? GetReadyWorld(LUA) : nullptr, boneMatricesIdx);
+
+	return 0;
+}
+
+/*
+	AccelStruct accel
+	Vector      origin
+	Vector      direction
+	float       tMin = 0
+	float       tMax = FLT_MAX
+	float       coneWidth = -1
+	float       coneAngle = -1
+
+	returns TraceResult
+*/
+LUA_FUNCTION(AccelStruct_Traverse)
+{
+	LUA->CheckType(1, AccelStruct_id);
+	AccelStruct* pAccelStruct = *LUA->GetUserType<AccelStruct*>(1, AccelStruct_id);
+	return pAccelStruct->Traverse(LUA);
+}
+
+/*
+	AccelStruct accel
+
+	returns table stats
+		uint32_t numEntities
+		uint32_t numTriangles
+		uint32_t numInstances
+		uint32_t numSkinnedVertices
+		uint32_t numReusedEntities
+		uint32_t numLuaCalls
+		float    skinningTime (ms)
+		float    bvhTime (ms)
+		float    totalTime (ms)
+*/
+LUA_FUNCTION(AccelStruct_GetBuildStats)
+{
+	LUA->CheckType(1, AccelStruct_id);
+	AccelStruct* pAccelStruct = *LUA->GetUserType<AccelStruct*>(1, AccelStruct_id);
+	const AccelBuildStats& stats = pAccelStruct->GetBuildStats();
+
+	LUA->CreateTable();
+	LUA->PushNumber(stats.numEntities);
+	LUA->SetField(-2, "numEntities");
+	LUA->PushNumber(stats.numTriangles);
+	LUA->SetField(-2, "numTriangles");
+	LUA->PushNumber(stats.numInstances);
+	LUA->SetField(-2, "numInstances");
+	LUA->PushNumber(stats.numSkinnedVertices);
+	LUA->SetField(-2, "numSkinnedVertices");
+	LUA->PushNumber(stats.numReusedEntities);
+	LUA->SetField(-2, "numReusedEntities");
+	LUA->PushNumber(stats.numLuaCalls);
+	LUA->SetField(-2, "numLuaCalls");
+
+	LUA->PushNumber(stats.skinningTime);
+	LUA->SetField(-2, "skinningTime");
+	LUA->PushNumber(stats.bvhTime);
+	LUA->SetField(-2, "bvhTime");
+	LUA->PushNumber(stats.totalTime);
+	LUA->SetField(-2, "totalTime");
+	return 1;
+}
+
+/*
+	AccelStruct accel
+	Vector      reference = nil (entities use LoD 0 plus the bias if nil)
+	int         bias = 0
+	float       scale = 0.1 (distance multiplier before comparing against the model's LoD switch points)
+*/
+LUA_FUNCTION(AccelStruct_SetLoDSettings)
+{
+	LUA->CheckType(1, AccelStruct_id);
+	AccelStruct* pAccelStruct = *LUA->GetUserType<AccelStruct*>(1, AccelStruct_id);
+
+	AccelLoDSettings settings{};
+	if (LUA->IsType(2, Type::Vector)) {
+		Vector reference = LUA->GetVector(2);
+		settings.hasReference = true;
+		settings.reference = glm::vec3(reference.x, reference.y, reference.z);
+	} else if (!LUA->IsType(2, Type::Nil)) LUA->CheckType(2, Type::Vector);
+
+	if (LUA->IsType(3, Type::Number)) settings.bias = LUA->GetNumber(3);
+	if (LUA->IsType(4, Type::Number)) {
+		settings.scale = LUA->GetNumber(4);
+		if (settings.scale < 0.f) LUA->ArgError(4, "LoD scale must not be negative");
+	}
+
+	pAccelStruct->SetLoDSettings(settings);
+	return 0;
+}
+
+static IRenderTarget* GetGBufferTarget(ILuaBase* LUA, const char* channel, RTFormat format)
+{
+	LUA->GetField(3, channel);
+	if (!LUA->IsType(-1, RenderTarget::id)) {
+		LUA->Pop();
+		return nullptr;
+	}
+
+	IRenderTarget* pRt = *LUA->GetUserType<IRenderTarget*>(-1, RenderTarget::id);
+	LUA->Pop();
+
+	if (!pRt->IsValid()) LUA->ThrowError((std::string("Invalid render target for channel ") + channel).c_str());
+	if (pRt->GetFormat() != format) LUA->ThrowError((std::string("Incorrect render target format for channel ") + channel).c_str());
+	return pRt;
+}
+
+/*
+	AccelStruct accel
+	table       camera
+		Vector     pos
+		Angle      ang
+		float      fov           = 90 (horizontal, degrees, ignored by equirectangular cameras)
+		CameraType type          = CameraType.Pinhole
+		float      aperture      = 0 (lens radius, thin lens only)
+		float      focusDistance = 100 (thin lens only)
+		uint32_t   seed          = 0
+	table       targets (all the same size, only the channels present are evaluated)
+		VisTraceRT depth           (RF)
+		VisTraceRT position        (RGBFFF)
+		VisTraceRT normal          (RGBFFF)
+		VisTraceRT geometricNormal (RGBFFF)
+		VisTraceRT albedo          (RGBFFF)
+		VisTraceRT roughness       (RF)
+		VisTraceRT metalness       (RF)
+		VisTraceRT entity          (RF)
+		VisTraceRT material        (RF, submaterial index)
+*/
+LUA_FUNCTION(AccelStruct_RenderGBuffer)
+{
+	LUA->CheckType(1, AccelStruct_id);
+	LUA->CheckType(2, Type::Table);
+	LUA->CheckType(3, Type::Table);
+	AccelStruct* pAccelStruct = *LUA->GetUserType<AccelStruct*>(1, AccelStruct_id);
+	if (!pAccelStruct->IsBuilt()) LUA->ThrowError("Unable to render G-buffer, acceleration structure invalid (use AccelStruct:Rebuild to rebuild it)");
+
+	GBufferTargets targets{};
+	targets.pDepth = GetGBufferTarget(LUA, "depth", RTFormat::RF);
+	targets.pPosition = GetGBufferTarget(LUA, "position", RTFormat::RGBFFF);
+	targets.pNormal = GetGBufferTarget(LUA, "normal", RTFormat::RGBFFF);
+	targets.pGeometricNormal = GetGBufferTarget(LUA, "geometricNormal", RTFormat::RGBFFF);
+	targets.pAlbedo = GetGBufferTarget(LUA, "albedo", RTFormat::RGBFFF);
+	targets.pRoughness = GetGBufferTarget(LUA, "roughness", RTFormat::RF);
+	targets.pMetalness = GetGBufferTarget(LUA, "metalness", RTFormat::RF);
+	targets.pEntity = GetGBufferTarget(LUA, "entity", RTFormat::RF);
+	targets.pMaterial = GetGBufferTarget(LUA, "material", RTFormat::RF);
+
+	IRenderTarget* pFirst = nullptr;
+	for (IRenderTarget* pRt : {
+		targets.pDepth, targets.pPosition, targets.pNormal, targets.pGeometricNormal, targets.pAlbedo,
+		targets.pRoughness, targets.pMetalness, targets.pEntity, targets.pMaterial
+	}) {
+		if (pRt == nullptr) continue;
+		if (pFirst == nullptr) pFirst = pRt;
+		else if (pRt->GetWidth() != pFirst->GetWidth() || pRt->GetHeight() != pFirst->GetHeight())
+			LUA->ThrowError("All G-buffer render targets must be the same size");
+	}
+	if (pFirst == nullptr) return 0;
+
+	LUA->GetField(2, "pos");
+	LUA->GetField(2, "ang");
+	if (!LUA->IsType(-2, Type::Vector)) LUA->ThrowError("Camera pos must be a Vector");
+	if (!LUA->IsType(-1, Type::Angle)) LUA->ThrowError("Camera ang must be an Angle");
+
+	glm::vec3 pos, ang;
+	{
+		Vector v = LUA->GetVector(-2);
+		QAngle a = LUA->GetAngle(-1);
+		pos = glm::vec3(v.x, v.y, v.z);
+		ang = glm::vec3(a.x, a.y, a.z);
+	}
+	LUA->Pop(2);
+
+	float fov = 90.f, aperture = 0.f, focusDistance = 100.f;
+	CameraType type = CameraType::Pinhole;
+	uint32_t seed = 0;
+
+	LUA->GetField(2, "fov");
+	if (LUA->IsType(-1, Type::Number)) fov = LUA->GetNumber();
+	LUA->GetField(2, "type");
+	if (LUA->IsType(-1, Type::Number)) type = static_cast<CameraType>(LUA->GetNumber());
+	LUA->GetField(2, "aperture");
+	if (LUA->IsType(-1, Type::Number)) aperture = LUA->GetNumber();
+	LUA->GetField(2, "focusDistance");
+	if (LUA->IsType(-1, Type::Number)) focusDistance = LUA->GetNumber();
+	LUA->GetField(2, "seed");
+	if (LUA->IsType(-1, Type::Number)) seed = LUA->GetNumber();
+	LUA->Pop(5);
+
+	switch (type) {
+	case CameraType::Pinhole:
+	case CameraType::ThinLens:
+	case CameraType::Equirectangular:
+		break;
+	default:
+		LUA->ThrowError("Invalid camera type");
+	}
+
+	Camera camera = MakeCamera(type, pos, ang, fov, pFirst->GetWidth(), pFirst->GetHeight(), aperture, focusDistance);
+	if (!pAccelStruct->RenderGBuffer(camera, seed, targets)) LUA->ThrowError("Failed to render G-buffer");
+	return 0;
+}
+
+LUA_FUNCTION(AccelStruct_tostring)
+{
+	LUA->PushString("AccelStruct");
+	return 1;
+}
+#pragma endregion
+
+// Materials are boxed by pointer so extensions can read them as an IBSDFMaterial*, like hit buffers and render targets
+static BSDFMaterial* CheckMaterial(ILuaBase* LUA, int iStackPos)
+{
+	LUA->CheckType(iStackPos, BSDFMaterial::id);
+	return &static_cast<BoxedBSDFMaterial*>(*LUA->GetUserType<IBSDFMaterial*>(iStackPos, BSDFMaterial::id))->material;
+}
+
+#pragma region Hit Buffers
+static HitBuffer* CheckHitBuffer(ILuaBase* LUA, int iStackPos)
+{
+	LUA->CheckType(iStackPos, HitBuffer::id);
+	return static_cast<HitBuffer*>(*LUA->GetUserType<IHitBuffer*>(iStackPos, HitBuffer::id));
+}
+
+// Converts a 1 based ray index to 0 based, erroring if it's out of range
+static size_t CheckRayIndex(ILuaBase* LUA, const HitBuffer* pHits, int iStackPos)
+{
+	double i = LUA->CheckNumber(iStackPos);
+	if (i < 1.0 || i > pHits->GetSize()) LUA->ArgError(iStackPos, "Ray index out of range");
+	return static_cast<size_t>(i) - 1;
+}
+
+// Shades a single ray if it hasn't been already
+// Returns false if the ray missed
+static bool ShadeRay(ILuaBase* LUA, HitBuffer* pHits, size_t i, HitAttributes attribute)
+{
+	if (!pHits->IsHit(i)) return false;
+
+	if ((pHits->GetShaded(i) & attribute) == HitAttributes::None && !pHits->Shade(i, 1, attribute)) {
+		LUA->ThrowError("Acceleration structure was rebuilt after the rays were traced");
+	}
+	return true;
+}
+
+LUA_FUNCTION(vistrace_CreateHitBuffer)
+{
+	IHitBuffer* pHits = new HitBuffer();
+	LUA->PushUserType_Value(pHits, HitBuffer::id);
+	return 1;
+}
+
+/*
+	AccelStruct accel
+	VisTraceRT  origins (RGBFFF, from vistrace.GenerateCameraRays or your own)
+	VisTraceRT  directions (RGBFFF, the same size as origins)
+	HitBuffer   hits = nil (reused if passed, otherwise a new buffer is created)
+	float       tMin = 0
+	float       tMax = huge
+	float       coneWidth = -1
+	float       coneAngle = -1
+
+	Traces a ray per pixel of the render targets in parallel, storing the closest hits instead of creating a TraceResult for each
+
+	returns HitBuffer
+*/
+LUA_FUNCTION(AccelStruct_TraverseBatch)
+{
+	LUA->CheckType(1, AccelStruct_id);
+	LUA->CheckType(2, RenderTarget::id);
+	LUA->CheckType(3, RenderTarget::id);
+	const AccelStruct* pAccelStruct = *LUA->GetUserType<AccelStruct*>(1, AccelStruct_id);
+	if (!pAccelStruct->IsBuilt()) LUA->ThrowError("Unable to perform traversal, acceleration structure invalid (use AccelStruct:Rebuild to rebuild it)");
+
+	IRenderTarget* pOrigins = *LUA->GetUserType<IRenderTarget*>(2, RenderTarget::id);
+	IRenderTarget* pDirections = *LUA->GetUserType<IRenderTarget*>(3, RenderTarget::id);
+	if (!pOrigins->IsValid() || pOrigins->GetFormat() != RTFormat::RGBFFF) LUA->ArgError(2, "Render target must be valid and RGBFFF");
+	if (!pDirections->IsValid() || pDirections->GetFormat() != RTFormat::RGBFFF) LUA->ArgError(3, "Render target must be valid and RGBFFF");
+	if (pOrigins->GetWidth() != pDirections->GetWidth() || pOrigins->GetHeight() != pDirections->GetHeight()) {
+		LUA->ArgError(3, "Render target must be the same size as origins");
+	}
+
+	int numArgs = LUA->Top();
+
+	float tMin = 0.f;
+	if (numArgs > 4 && !LUA->IsType(5, Type::Nil)) tMin = static_cast<float>(LUA->CheckNumber(5));
+
+	float tMax = FLT_MAX;
+	if (numArgs > 5 && !LUA->IsType(6, Type::Nil)) tMax = static_cast<float>(LUA->CheckNumber(6));
+
+	float coneWidth = -1;
+	if (numArgs > 6 && !LUA->IsType(7, Type::Nil)) coneWidth = static_cast<float>(LUA->CheckNumber(7));
+
+	float coneAngle = -1;
+	if (numArgs > 7 && !LUA->IsType(8, Type::Nil)) coneAngle = static_cast<float>(LUA->CheckNumber(8));
+
+	if (coneWidth >= 0 && coneAngle <= 0.f) LUA->ThrowError("Valid cone width but invalid cone angle passed");
+	if (coneWidth < 0 && coneAngle > 0.f) LUA->ThrowError("Valid cone angle but invalid cone width passed");
+
+	if (tMin < 0.f) LUA->ArgError(5, "tMin cannot be less than 0");
+	if (tMax <= tMin) LUA->ArgError(6, "tMax must be greater than tMin");
+
+	if (numArgs > 3 && !LUA->IsType(4, Type::Nil)) {
+		CheckHitBuffer(LUA, 4);
+		LUA->Push(4);
+	} else {
+		IHitBuffer* pHits = new HitBuffer();
+		LUA->PushUserType_Value(pHits, HitBuffer::id);
+	}
+	HitBuffer* pHits = CheckHitBuffer(LUA, -1);
+
+	const size_t numRays = static_cast<size_t>(pOrigins->GetWidth()) * pOrigins->GetHeight();
+	if (!pHits->Trace(
+		pAccelStruct,
+		reinterpret_cast<const glm::vec3*>(pOrigins->GetRawData()),
+		reinterpret_cast<const glm::vec3*>(pDirections->GetRawData()),
+		numRays,
+		tMin, tMax,
+		coneWidth, coneAngle
+	)) LUA->ThrowError("Failed to trace rays");
+
+	// Keep the accel alive for as long as the buffer refers to it
+	if (pHits->accelRef != -1) LUA->ReferenceFree(pHits->accelRef);
+	LUA->Push(1);
+	pHits->accelRef = LUA->ReferenceCreate();
+
+	return 1;
+}
+
+LUA_FUNCTION(HitBuffer_gc)
+{
+	HitBuffer* pHits = CheckHitBuffer(LUA, 1);
+
+	LUA->SetUserType(1, NULL);
+
+	int accelRef = pHits->accelRef;
+	delete pHits;
+	if (accelRef != -1) LUA->ReferenceFree(accelRef);
+
+	return 0;
+}
+
+LUA_FUNCTION(HitBuffer_GetSize)
+{
+	HitBuffer* pHits = CheckHitBuffer(LUA, 1);
+	LUA->PushNumber(pHits->GetSize());
+	return 1;
+}
+
+/*
+	HitBuffer      hits
+	uint32_t       start = 1
+	uint32_t       count = all remaining rays
+	HitAttributes  attributes = HitAttributes.All
+
+	Computes shading attributes for a range of rays in parallel, rays missing attributes are also shaded on demand by their accessors
+*/
+LUA_FUNCTION(HitBuffer_Shade)
+{
+	HitBuffer* pHits = CheckHitBuffer(LUA, 1);
+
+	size_t start = 0;
+	if (!LUA->IsType(2, Type::Nil) && LUA->Top() > 1) start = CheckRayIndex(LUA, pHits, 2);
+
+	size_t count = pHits->GetSize() - start;
+	if (!LUA->IsType(3, Type::Nil) && LUA->Top() > 2) {
+		double n = LUA->CheckNumber(3);
+		if (n < 0.0 || n > count) LUA->ArgError(3, "Count out of range");
+		count = n;
+	}
+
+	HitAttributes attributes = HitAttributes::All;
+	if (LUA->IsType(4, Type::Number)) attributes = static_cast<HitAttributes>(LUA->GetNumber(4));
+
+	if (!pHits->Shade(start, count, attributes)) LUA->ThrowError("Acceleration structure was rebuilt after the rays were traced");
+	return 0;
+}
+
+LUA_FUNCTION(HitBuffer_IsHit)
+{
+	HitBuffer* pHits = CheckHitBuffer(LUA, 1);
+	LUA->PushBool(pHits->IsHit(CheckRayIndex(LUA, pHits, 2)));
+	return 1;
+}
+
+LUA_FUNCTION(HitBuffer_HitSky)
+{
+	HitBuffer* pHits = CheckHitBuffer(LUA, 1);
+	LUA->PushBool(pHits->HitSky(CheckRayIndex(LUA, pHits, 2)));
+	return 1;
+}
+
+LUA_FUNCTION(HitBuffer_Distance)
+{
+	HitBuffer* pHits = CheckHitBuffer(LUA, 1);
+	size_t i = CheckRayIndex(LUA, pHits, 2);
+	if (!pHits->IsHit(i)) return 0;
+
+	LUA->PushNumber(pHits->GetDistances()[i]);
+	return 1;
+}
+
+LUA_FUNCTION(HitBuffer_Triangle)
+{
+	HitBuffer* pHits = CheckHitBuffer(LUA, 1);
+	size_t i = CheckRayIndex(LUA, pHits, 2);
+	if (!pHits->IsHit(i)) return 0;
+
+	LUA->PushNumber(pHits->GetTriangles()[i]);
+	return 1;
+}
+
+LUA_FUNCTION(HitBuffer_Barycentric)
+{
+	HitBuffer* pHits = CheckHitBuffer(LUA, 1);
+	size_t i = CheckRayIndex(LUA, pHits, 2);
+	if (!pHits->IsHit(i)) return 0;
+
+	const float* uv = pHits->GetBarycentrics() + i * 2;
+	LUA->PushVector(MakeVector(uv[0], uv[1], 1.f - uv[0] - uv[1]));
+	return 1;
+}
+
+LUA_FUNCTION(HitBuffer_Entity)
+{
+	HitBuffer* pHits = CheckHitBuffer(LUA, 1);
+	size_t i = CheckRayIndex(LUA, pHits, 2);
+	if (!pHits->IsHit(i)) return 0;
+
+	PushHitEntity(LUA, pHits->GetEntities()[i], pHits->GetRawEntity(i));
+	return 1;
+}
+
+LUA_FUNCTION(HitBuffer_SubMaterialIndex)
+{
+	HitBuffer* pHits = CheckHitBuffer(LUA, 1);
+	size_t i = CheckRayIndex(LUA, pHits, 2);
+	if (!pHits->IsHit(i)) return 0;
+
+	LUA->PushNumber(pHits->GetSubMaterials()[i] + 1);
+	return 1;
+}
+
+LUA_FUNCTION(HitBuffer_Pos)
+{
+	HitBuffer* pHits = CheckHitBuffer(LUA, 1);
+	size_t i = CheckRayIndex(LUA, pHits, 2);
+	if (!ShadeRay(LUA, pHits, i, HitAttributes::Position)) return 0;
+
+	const float* v = pHits->GetPositions() + i * 3;
+	LUA->PushVector(MakeVector(v[0], v[1], v[2]));
+	return 1;
+}
+
+LUA_FUNCTION(HitBuffer_Normal)
+{
+	HitBuffer* pHits = CheckHitBuffer(LUA, 1);
+	size_t i = CheckRayIndex(LUA, pHits, 2);
+	if (!ShadeRay(LUA, pHits, i, HitAttributes::TBN)) return 0;
+
+	const float* v = pHits->GetNormals() + i * 3;
+	LUA->PushVector(MakeVector(v[0], v[1], v[2]));
+	return 1;
+}
+LUA_FUNCTION(HitBuffer_Tangent)
+{
+	HitBuffer* pHits = CheckHitBuffer(LUA, 1);
+	size_t i = CheckRayIndex(LUA, pHits, 2);
+	if (!ShadeRay(LUA, pHits, i, HitAttributes::TBN)) return 0;
+
+	const float* v = pHits->GetTangents() + i * 3;
+	LUA->PushVector(MakeVector(v[0], v[1], v[2]));
+	return 1;
+}
+LUA_FUNCTION(HitBuffer_Binormal)
+{
+	HitBuffer* pHits = CheckHitBuffer(LUA, 1);
+	size_t i = CheckRayIndex(LUA, pHits, 2);
+	if (!ShadeRay(LUA, pHits, i, HitAttributes::TBN)) return 0;
+
+	const float* v = pHits->GetBinormals() + i * 3;
+	LUA->PushVector(MakeVector(v[0], v[1], v[2]));
+	return 1;
+}
+
+LUA_FUNCTION(HitBuffer_Albedo)
+{
+	HitBuffer* pHits = CheckHitBuffer(LUA, 1);
+	size_t i = CheckRayIndex(LUA, pHits, 2);
+	if (!ShadeRay(LUA, pHits, i, HitAttributes::Shading)) return 0;
+
+	const float* v = pHits->GetAlbedos() + i * 3;
+	LUA->PushVector(MakeVector(v[0], v[1], v[2]));
 	return 1;
 }
-LUA_FUNCTION(TraceResult_NormalMap2)
+LUA_FUNCTION(HitBuffer_Alpha)
 {
-	LUA->CheckType(1, TraceResult::id);
-	TraceResult* pResult = *LUA->GetUserType<TraceResult*>(1, TraceResult::id);
+	HitBuffer* pHits = CheckHitBuffer(LUA, 1);
+	size_t i = CheckRayIndex(LUA, pHits, 2);
+	if (!ShadeRay(LUA, pHits, i, HitAttributes::Shading)) return 0;
 
-	if (pResult->GetNormalMap2().empty()) return 0;
-	LUA->PushString(pResult->GetNormalMap2().c_str());
+	LUA->PushNumber(pHits->GetAlphas()[i]);
 	return 1;
 }
-LUA_FUNCTION(TraceResult_MRAO2)
+LUA_FUNCTION(HitBuffer_Metalness)
 {
-	LUA->CheckType(1, TraceResult::id);
-	TraceResult* pResult = *LUA->GetUserType<TraceResult*>(1, TraceResult::id);
+	HitBuffer* pHits = CheckHitBuffer(LUA, 1);
+	size_t i = CheckRayIndex(LUA, pHits, 2);
+	if (!ShadeRay(LUA, pHits, i, HitAttributes::Shading)) return 0;
 
-	if (pResult->GetMRAO2().empty()) return 0;
-	LUA->PushString(pResult->GetMRAO2().c_str());
+	LUA->PushNumber(pHits->GetMetalness()[i]);
 	return 1;
 }
-
-LUA_FUNCTION(TraceResult_BlendTexture)
+LUA_FUNCTION(HitBuffer_Roughness)
 {
-	LUA->CheckType(1, TraceResult::id);
-	TraceResult* pResult = *LUA->GetUserType<TraceResult*>(1, TraceResult::id);
+	HitBuffer* pHits = CheckHitBuffer(LUA, 1);
+	size_t i = CheckRayIndex(LUA, pHits, 2);
+	if (!ShadeRay(LUA, pHits, i, HitAttributes::Shading)) return 0;
 
-	if (pResult->GetBlendTexture().empty()) return 0;
-	LUA->PushString(pResult->GetBlendTexture().c_str());
+	LUA->PushNumber(pHits->GetRoughness()[i]);
 	return 1;
 }
-LUA_FUNCTION(TraceResult_DetailTexture)
+
+/*
+	HitBuffer hits
+	uint32_t  i
+
+	Builds a full TraceResult for a ray, for anything the buffer doesn't store (textures, BSDF sampling, etc.)
+
+	returns TraceResult or nil if the ray missed
+*/
+LUA_FUNCTION(HitBuffer_GetResult)
 {
-	LUA->CheckType(1, TraceResult::id);
-	TraceResult* pResult = *LUA->GetUserType<TraceResult*>(1, TraceResult::id);
+	HitBuffer* pHits = CheckHitBuffer(LUA, 1);
+	size_t i = CheckRayIndex(LUA, pHits, 2);
+	if (!pHits->IsHit(i)) return 0;
 
-	if (pResult->GetDetailTexture().empty()) return 0;
-	LUA->PushString(pResult->GetDetailTexture().c_str());
+	std::optional<TraceResult> result = pHits->GetResult(i);
+	if (!result) LUA->ThrowError("Acceleration structure was rebuilt after the rays were traced");
+
+	LUA->PushUserType_Value(pHits->GetAccel()->BoxResult(*result), TraceResult::id);
 	return 1;
 }
 
-LUA_FUNCTION(TraceResult_tostring)
+// Errors if a render target isn't valid, in the given format, and a pixel per ray
+static IRenderTarget* CheckBatchTarget(ILuaBase* LUA, const HitBuffer* pHits, int iStackPos, RTFormat format, const char* error)
 {
-	LUA->PushString("VisTraceResult");
-	return 1;
+	LUA->CheckType(iStackPos, RenderTarget::id);
+	IRenderTarget* pRt = *LUA->GetUserType<IRenderTarget*>(iStackPos, RenderTarget::id);
+	if (!pRt->IsValid() || pRt->GetFormat() != format) LUA->ArgError(iStackPos, error);
+	if (static_cast<size_t>(pRt->GetWidth()) * pRt->GetHeight() != pHits->GetSize()) {
+		LUA->ArgError(iStackPos, "Render target must have a pixel per ray");
+	}
+	return pRt;
 }
-#pragma endregion
 
-#pragma region Tracing API
-static int AccelStruct_id;
-static World* g_pWorld = nullptr;
+// Shades every ray's TBN and shading attributes if they haven't been already, and fills a batch with them
+// incident holds the direction each ray arrived from, and must outlive the batch
+static BSDFBatch MakeHitBatch(ILuaBase* LUA, HitBuffer* pHits, const float* pScattered, std::vector<glm::vec3>& incident)
+{
+	const size_t numRays = pHits->GetSize();
+	if (!pHits->Shade(0, numRays, HitAttributes::TBN | HitAttributes::Shading)) {
+		LUA->ThrowError("Acceleration structure was rebuilt after the rays were traced");
+	}
 
-LUA_FUNCTION(AccelStruct_gc)
+	// Directions may be the caller's own and not unit length, so they're normalised like TraceResult's incident direction
+	const glm::vec3* pDirections = reinterpret_cast<const glm::vec3*>(pHits->GetDirections());
+	incident.resize(numRays);
+	for (size_t i = 0; i < numRays; i++) incident[i] = -glm::normalize(pDirections[i]);
+
+	BSDFBatch batch;
+	batch.size = numRays;
+	batch.pNormals = pHits->GetNormals();
+	batch.pTangents = pHits->GetTangents();
+	batch.pBinormals = pHits->GetBinormals();
+	batch.pIncident = &incident[0].x;
+	batch.pScattered = pScattered;
+	batch.pAlbedos = pHits->GetAlbedos();
+	batch.pMetalness = pHits->GetMetalness();
+	batch.pRoughness = pHits->GetRoughness();
+	return batch;
+}
+
+/*
+	HitBuffer    self
+	BSDFMaterial material
+	VisTraceRT   scattered (RGBFFF, a pixel per ray)
+	VisTraceRT   out (RGBFFF, a pixel per ray)
+
+	Evaluates the BSDF at every hit in parallel, writing black for misses
+	Equivalent to TraceResult:EvalBSDF for each ray, but doesn't change the material's colours, metalness, or roughness
+*/
+LUA_FUNCTION(HitBuffer_EvalBSDF)
 {
-	LUA->CheckType(1, AccelStruct_id);
-	AccelStruct* pAccelStruct = *LUA->GetUserType<AccelStruct*>(1, AccelStruct_id);
+	HitBuffer* pHits = CheckHitBuffer(LUA, 1);
+	const BSDFMaterial* pMat = CheckMaterial(LUA, 2);
 
-	LUA->SetUserType(1, NULL);
-	delete pAccelStruct;
+	IRenderTarget* pScattered = CheckBatchTarget(LUA, pHits, 3, RTFormat::RGBFFF, "Render target must be valid and RGBFFF");
+	IRenderTarget* pOut = CheckBatchTarget(LUA, pHits, 4, RTFormat::RGBFFF, "Render target must be valid and RGBFFF");
+	if (pHits->GetSize() == 0) return 0;
+
+	std::vector<glm::vec3> incident;
+	const BSDFBatch batch = MakeHitBatch(LUA, pHits, reinterpret_cast<const float*>(pScattered->GetRawData()), incident);
+
+	float* pColours = reinterpret_cast<float*>(pOut->GetRawData());
+	EvalBSDFBatch(*pMat, batch, pColours);
+
+	for (size_t i = 0; i < batch.size; i++) {
+		if (pHits->IsHit(i)) continue;
+		pColours[i * 3] = pColours[i * 3 + 1] = pColours[i * 3 + 2] = 0.f;
+	}
 
 	return 0;
 }
 
 /*
-	table[Entity] entities = {}
-	boolean       traceWorld = true
+	HitBuffer    self
+	BSDFMaterial material
+	VisTraceRT   scattered (RGBFFF, a pixel per ray)
+	VisTraceRT   out (RF, a pixel per ray)
 
-	returns AccelStruct
+	Evaluates the PDF of each hit scattering in the given direction in parallel, writing 0 for misses
+	Equivalent to TraceResult:EvalPDF for each ray, but doesn't change the material's colours, metalness, or roughness
 */
-LUA_FUNCTION(vistrace_CreateAccel)
+LUA_FUNCTION(HitBuffer_EvalPDF)
 {
-	bool traceWorld = true;
-	if (LUA->IsType(2, Type::Bool)) traceWorld = LUA->GetBool(2);
+	HitBuffer* pHits = CheckHitBuffer(LUA, 1);
+	const BSDFMaterial* pMat = CheckMaterial(LUA, 2);
 
-	AccelStruct* pAccelStruct = new AccelStruct();
+	IRenderTarget* pScattered = CheckBatchTarget(LUA, pHits, 3, RTFormat::RGBFFF, "Render target must be valid and RGBFFF");
+	IRenderTarget* pOut = CheckBatchTarget(LUA, pHits, 4, RTFormat::RF, "Render target must be valid and RF");
+	if (pHits->GetSize() == 0) return 0;
 
-	if (LUA->Top() == 0) LUA->CreateTable();
-	else if (LUA->IsType(1, Type::Nil)) {
-		LUA->Pop(LUA->Top());
-		LUA->CreateTable();
-	} else {
-		if (!LUA->IsType(1, Type::Table)) {
-			delete pAccelStruct; // Throwing an error wont destruct
-			LUA->CheckType(1, Type::Table); // Still checktype so we get the formatted error for free
+	std::vector<glm::vec3> incident;
+	const BSDFBatch batch = MakeHitBatch(LUA, pHits, reinterpret_cast<const float*>(pScattered->GetRawData()), incident);
+
+	float* pPDFs = reinterpret_cast<float*>(pOut->GetRawData());
+	EvalPDFBatch(*pMat, batch, pPDFs);
+
+	for (size_t i = 0; i < batch.size; i++) {
+		if (!pHits->IsHit(i)) pPDFs[i] = 0.f;
+	}
+
+	return 0;
+}
+
+LUA_FUNCTION(HitBuffer_tostring)
+{
+	LUA->PushString("HitBuffer");
+	return 1;
+}
+#pragma endregion
+
+#pragma region Camera API
+/*
+	Vector     pos
+	Angle      ang
+	float      fov (horizontal, degrees, ignored by equirectangular cameras)
+	uint16_t   width
+	uint16_t   height
+	VisTraceRT origins (RGBFFF, resized to width x height if needed)
+	VisTraceRT directions (RGBFFF, resized to width x height if needed)
+	table      options = {}
+		CameraType type          = CameraType.Pinhole
+		float      aperture      = 0 (lens radius, thin lens only)
+		float      focusDistance = 100 (thin lens only)
+		uint32_t   seed          = 0 (lens sample seed, the same seed always generates the same rays)
+
+	returns float spread angle (pass as coneAngle to AccelStruct:Traverse with a coneWidth of 0)
+*/
+LUA_FUNCTION(vistrace_GenerateCameraRays)
+{
+	LUA->CheckType(1, Type::Vector);
+	LUA->CheckType(2, Type::Angle);
+	LUA->CheckType(6, RenderTarget::id);
+	LUA->CheckType(7, RenderTarget::id);
+
+	glm::vec3 pos, ang;
+	{
+		Vector v = LUA->GetVector(1);
+		QAngle a = LUA->GetAngle(2);
+		pos = glm::vec3(v.x, v.y, v.z);
+		ang = glm::vec3(a.x, a.y, a.z);
+	}
+	float fov = LUA->CheckNumber(3);
+
+	double width = LUA->CheckNumber(4), height = LUA->CheckNumber(5);
+	if (width < 1.0 || width > UINT16_MAX) LUA->ArgError(4, "Width out of range");
+	if (height < 1.0 || height > UINT16_MAX) LUA->ArgError(5, "Height out of range");
+
+	IRenderTarget* pOrigins = *LUA->GetUserType<IRenderTarget*>(6, RenderTarget::id);
+	IRenderTarget* pDirections = *LUA->GetUserType<IRenderTarget*>(7, RenderTarget::id);
+	if (pOrigins->GetFormat() != RTFormat::RGBFFF) LUA->ArgError(6, "Render target's format must be RGBFFF");
+	if (pDirections->GetFormat() != RTFormat::RGBFFF) LUA->ArgError(7, "Render target's format must be RGBFFF");
+
+	CameraType type = CameraType::Pinhole;
+	float aperture = 0.f, focusDistance = 100.f;
+	uint32_t seed = 0;
+	if (LUA->IsType(8, Type::Table)) {
+		LUA->GetField(8, "type");
+		if (LUA->IsType(-1, Type::Number)) type = static_cast<CameraType>(LUA->GetNumber());
+		LUA->GetField(8, "aperture");
+		if (LUA->IsType(-1, Type::Number)) aperture = LUA->GetNumber();
+		LUA->GetField(8, "focusDistance");
+		if (LUA->IsType(-1, Type::Number)) focusDistance = LUA->GetNumber();
+		LUA->GetField(8, "seed");
+		if (LUA->IsType(-1, Type::Number)) seed = LUA->GetNumber();
+		LUA->Pop(4);
+
+		switch (type) {
+		case CameraType::Pinhole:
+		case CameraType::ThinLens:
+		case CameraType::Equirectangular:
+			break;
+		default:
+			LUA->ThrowError("Invalid camera type");
 		}
-		LUA->Pop(LUA->Top() - 1); // Pop all but the table
 	}
-	pAccelStruct->PopulateAccel(LUA, traceWorld ? g_pWorld : nullptr);
 
-	LUA->PushUserType_Value(pAccelStruct, AccelStruct_id);
+	// Only reallocate if the size changed, so the same targets can be reused every frame
+	if (pOrigins->GetWidth() != width || pOrigins->GetHeight() != height || !pOrigins->IsValid()) {
+		if (!pOrigins->Resize(width, height)) LUA->ThrowError("Failed to resize origins render target");
+	}
+	if (pDirections->GetWidth() != width || pDirections->GetHeight() != height || !pDirections->IsValid()) {
+		if (!pDirections->Resize(width, height)) LUA->ThrowError("Failed to resize directions render target");
+	}
+
+	Camera camera = MakeCamera(type, pos, ang, fov, width, height, aperture, focusDistance);
+	if (!GenerateCameraRays(camera, seed, pOrigins, pDirections)) LUA->ThrowError("Failed to generate camera rays");
+
+	LUA->PushNumber(camera.spreadAngle);
 	return 1;
 }
+#pragma endregion
 
+#pragma region Render Sessions
 /*
-	AccelStruct   accel
-	table[Entity] entities = {}
+	AccelStruct accel
+	Vector      pos
+	Angle       ang
+	float       fov
+	uint16_t    width
+	uint16_t    height
+	table       options = {}
+		uint32_t samples   = 0 (render until cancelled)
+		uint32_t bounces   = 4
+		uint32_t threads   = 0 (all but one hardware thread)
+		uint32_t seed      = time
+		float    budget    = 0 (milliseconds of CPU time per frame over all workers, 0 is unlimited)
+		HDRI     hdri      = nil
+		Vector   skyColour = Vector(1, 1, 1)
+
+		CameraType cameraType    = CameraType.Pinhole
+		float      aperture      = 0 (lens radius, thin lens only)
+		float      focusDistance = 100 (thin lens only)
+
+	returns RenderSession
 */
-LUA_FUNCTION(AccelStruct_Rebuild)
+LUA_FUNCTION(vistrace_CreateRenderSession)
 {
 	LUA->CheckType(1, AccelStruct_id);
+	LUA->CheckType(2, Type::Vector);
+	LUA->CheckType(3, Type::Angle);
 
-	bool traceWorld = true;
-	if (LUA->IsType(3, Type::Bool)) traceWorld = LUA->GetBool(3);
+	const AccelStruct* pAccel = *LUA->GetUserType<AccelStruct*>(1, AccelStruct_id);
 
-	AccelStruct* pAccelStruct = *LUA->GetUserType<AccelStruct*>(1, AccelStruct_id);
+	RenderSessionSettings settings{};
+	{
+		Vector pos = LUA->GetVector(2);
+		QAngle ang = LUA->GetAngle(3);
+		settings.pos = glm::vec3(pos.x, pos.y, pos.z);
+		settings.ang = glm::vec3(ang.x, ang.y, ang.z);
+	}
+	settings.fov = LUA->CheckNumber(4);
+
+	double width = LUA->CheckNumber(5), height = LUA->CheckNumber(6);
+	if (width < 1.0 || width > UINT16_MAX) LUA->ArgError(5, "Width out of range");
+	if (height < 1.0 || height > UINT16_MAX) LUA->ArgError(6, "Height out of range");
+	settings.width = width;
+	settings.height = height;
+
+	settings.seed = time(NULL);
+
+	int hdriRef = -1;
+	if (LUA->IsType(7, Type::Table)) {
+		LUA->GetField(7, "samples");
+		if (LUA->IsType(-1, Type::Number)) settings.samples = std::max(LUA->GetNumber(), 0.0);
+		LUA->GetField(7, "bounces");
+		if (LUA->IsType(-1, Type::Number)) settings.bounces = std::max(LUA->GetNumber(), 0.0);
+		LUA->GetField(7, "threads");
+		if (LUA->IsType(-1, Type::Number)) settings.threads = std::max(LUA->GetNumber(), 0.0);
+		LUA->GetField(7, "seed");
+		if (LUA->IsType(-1, Type::Number)) settings.seed = LUA->GetNumber();
+		LUA->GetField(7, "budget");
+		if (LUA->IsType(-1, Type::Number)) settings.budget = std::max(LUA->GetNumber(), 0.0);
+		LUA->GetField(7, "skyColour");
+		if (LUA->IsType(-1, Type::Vector)) {
+			Vector v = LUA->GetVector();
+			settings.skyColour = glm::vec3(v.x, v.y, v.z);
+		}
+		LUA->GetField(7, "cameraType");
+		if (LUA->IsType(-1, Type::Number)) settings.cameraType = static_cast<CameraType>(LUA->GetNumber());
+		LUA->GetField(7, "aperture");
+		if (LUA->IsType(-1, Type::Number)) settings.aperture = LUA->GetNumber();
+		LUA->GetField(7, "focusDistance");
+		if (LUA->IsType(-1, Type::Number)) settings.focusDistance = LUA->GetNumber();
+		LUA->Pop(9);
+
+		switch (settings.cameraType) {
+		case CameraType::Pinhole:
+		case CameraType::ThinLens:
+		case CameraType::Equirectangular:
+			break;
+		default:
+			LUA->ThrowError("Invalid camera type");
+		}
 
-	if (LUA->Top() == 1) LUA->CreateTable();
-	else if (LUA->IsType(2, Type::Nil)) {
-		LUA->Pop(LUA->Top());
-		LUA->CreateTable();
-	} else {
-		LUA->CheckType(2, Type::Table);
-		LUA->Pop(LUA->Top() - 2); // Pop all but the table (and self)
+		LUA->GetField(7, "hdri");
+		if (LUA->IsType(-1, HDRI::id)) {
+			settings.pHDRI = *LUA->GetUserType<HDRI*>(-1, HDRI::id);
+			hdriRef = LUA->ReferenceCreate(); // Pops the HDRI
+		} else {
+			LUA->Pop();
+		}
 	}
-	pAccelStruct->PopulateAccel(LUA, traceWorld ? g_pWorld : nullptr);
 
+	RenderSession* pSession = new RenderSession(pAccel, settings);
+	if (!pSession->IsValid()) {
+		delete pSession;
+		if (hdriRef != -1) LUA->ReferenceFree(hdriRef);
+		LUA->ThrowError("Failed to create render session");
+	}
+
+	LUA->Push(1);
+	pSession->accelRef = LUA->ReferenceCreate();
+	pSession->hdriRef = hdriRef;
+
+	LUA->PushUserType_Value(pSession, RenderSession::id);
+	return 1;
+}
+
+LUA_FUNCTION(RenderSession_gc)
+{
+	LUA->CheckType(1, RenderSession::id);
+	RenderSession* pSession = *LUA->GetUserType<RenderSession*>(1, RenderSession::id);
+
+	LUA->SetUserType(1, NULL);
+
+	// Stop the workers before releasing the objects they're using
+	int accelRef = pSession->accelRef, hdriRef = pSession->hdriRef;
+	delete pSession;
+
+	if (accelRef != -1) LUA->ReferenceFree(accelRef);
+	if (hdriRef != -1) LUA->ReferenceFree(hdriRef);
+
+	return 0;
+}
+
+LUA_FUNCTION(RenderSession_Start)
+{
+	LUA->CheckType(1, RenderSession::id);
+	RenderSession* pSession = *LUA->GetUserType<RenderSession*>(1, RenderSession::id);
+	pSession->Start();
+	return 0;
+}
+
+LUA_FUNCTION(RenderSession_Pause)
+{
+	LUA->CheckType(1, RenderSession::id);
+	RenderSession* pSession = *LUA->GetUserType<RenderSession*>(1, RenderSession::id);
+	pSession->Pause();
+	return 0;
+}
+
+LUA_FUNCTION(RenderSession_Resume)
+{
+	LUA->CheckType(1, RenderSession::id);
+	RenderSession* pSession = *LUA->GetUserType<RenderSession*>(1, RenderSession::id);
+	pSession->Resume();
+	return 0;
+}
+
+LUA_FUNCTION(RenderSession_Cancel)
+{
+	LUA->CheckType(1, RenderSession::id);
+	RenderSession* pSession = *LUA->GetUserType<RenderSession*>(1, RenderSession::id);
+	pSession->Cancel();
 	return 0;
 }
 
+LUA_FUNCTION(RenderSession_IsRunning)
+{
+	LUA->CheckType(1, RenderSession::id);
+	RenderSession* pSession = *LUA->GetUserType<RenderSession*>(1, RenderSession::id);
+	LUA->PushBool(pSession->IsRunning());
+	return 1;
+}
+
+LUA_FUNCTION(RenderSession_IsPaused)
+{
+	LUA->CheckType(1, RenderSession::id);
+	RenderSession* pSession = *LUA->GetUserType<RenderSession*>(1, RenderSession::id);
+	LUA->PushBool(pSession->IsPaused());
+	return 1;
+}
+
+LUA_FUNCTION(RenderSession_IsCancelled)
+{
+	LUA->CheckType(1, RenderSession::id);
+	RenderSession* pSession = *LUA->GetUserType<RenderSession*>(1, RenderSession::id);
+	LUA->PushBool(pSession->IsCancelled());
+	return 1;
+}
+
 /*
-	AccelStruct accel
-	Vector      origin
-	Vector      direction
-	float       tMin = 0
-	float       tMax = FLT_MAX
-	float       coneWidth = -1
-	float       coneAngle = -1
+	returns:
+	float    progress (0-1, always 0 if there's no sample target)
+	uint32_t samples
+*/
+LUA_FUNCTION(RenderSession_GetProgress)
+{
+	LUA->CheckType(1, RenderSession::id);
+	RenderSession* pSession = *LUA->GetUserType<RenderSession*>(1, RenderSession::id);
+	LUA->PushNumber(pSession->GetProgress());
+	LUA->PushNumber(pSession->GetSamples());
+	return 2;
+}
 
-	returns TraceResult
+/*
+	float budget (milliseconds of CPU time per frame summed over all workers, 0 is unlimited)
 */
-LUA_FUNCTION(AccelStruct_Traverse)
+LUA_FUNCTION(RenderSession_SetBudget)
 {
-	LUA->CheckType(1, AccelStruct_id);
-	AccelStruct* pAccelStruct = *LUA->GetUserType<AccelStruct*>(1, AccelStruct_id);
-	return pAccelStruct->Traverse(LUA);
+	LUA->CheckType(1, RenderSession::id);
+	RenderSession* pSession = *LUA->GetUserType<RenderSession*>(1, RenderSession::id);
+	pSession->SetBudget(LUA->CheckNumber(2));
+	return 0;
 }
 
-LUA_FUNCTION(AccelStruct_tostring)
+LUA_FUNCTION(RenderSession_GetBudget)
 {
-	LUA->PushString("AccelStruct");
+	LUA->CheckType(1, RenderSession::id);
+	RenderSession* pSession = *LUA->GetUserType<RenderSession*>(1, RenderSession::id);
+	LUA->PushNumber(pSession->GetBudget());
+	return 1;
+}
+
+/*
+	VisTraceRT rt (must be the same size as the session)
+*/
+LUA_FUNCTION(RenderSession_GetImage)
+{
+	LUA->CheckType(1, RenderSession::id);
+	LUA->CheckType(2, RenderTarget::id);
+	RenderSession* pSession = *LUA->GetUserType<RenderSession*>(1, RenderSession::id);
+	IRenderTarget* pRt = *LUA->GetUserType<IRenderTarget*>(2, RenderTarget::id);
+	if (!pRt->IsValid()) LUA->ThrowError("Invalid render target");
+
+	if (!pSession->GetImage(pRt)) LUA->ThrowError("Render target size does not match the session");
+	return 0;
+}
+
+LUA_FUNCTION(RenderSession_tostring)
+{
+	LUA->PushString("RenderSession");
 	return 1;
 }
+
+LUA_FUNCTION(RenderSession_Think)
+{
+	RenderSession::TickAll();
+	return 0;
+}
 #pragma endregion
 
 #pragma region BSDFMaterial
 LUA_FUNCTION(vistrace_CreateMaterial)
 {
-	LUA->PushUserType_Value(BSDFMaterial{}, BSDFMaterial::id);
+	LUA->PushUserType_Value(new BoxedBSDFMaterial(), BSDFMaterial::id);
 	return 1;
 }
 
-LUA_FUNCTION(Material_Colour)
+LUA_FUNCTION(Material_gc)
 {
 	LUA->CheckType(1, BSDFMaterial::id);
+	IBSDFMaterial* pMat = *LUA->GetUserType<IBSDFMaterial*>(1, BSDFMaterial::id);
+
+	LUA->SetUserType(1, NULL);
+	delete pMat;
 
-	BSDFMaterial* pMat = LUA->GetUserType<BSDFMaterial>(1, BSDFMaterial::id);
+	return 0;
+}
+
+LUA_FUNCTION(Material_Colour)
+{
+	BSDFMaterial* pMat = CheckMaterial(LUA, 1);
 	if (LUA->Top() == 1) {
 		LUA->PushVector(MakeVector(pMat->dielectricInput.x, pMat->dielectricInput.y, pMat->dielectricInput.z));
 		LUA->PushVector(MakeVector(pMat->conductorInput.x, pMat->conductorInput.y, pMat->conductorInput.z));
@@ -870,8 +2173,7 @@ LUA_FUNCTION(Material_Colour)
 
 LUA_FUNCTION(Material_DielectricColour)
 {
-	LUA->CheckType(1, BSDFMaterial::id);
-	BSDFMaterial* pMat = LUA->GetUserType<BSDFMaterial>(1, BSDFMaterial::id);
+	BSDFMaterial* pMat = CheckMaterial(LUA, 1);
 	if (LUA->Top() == 1) {
 		LUA->PushVector(MakeVector(pMat->dielectricInput.x, pMat->dielectricInput.y, pMat->dielectricInput.z));
 		return 1;
@@ -885,8 +2187,7 @@ LUA_FUNCTION(Material_DielectricColour)
 
 LUA_FUNCTION(Material_ConductorColour)
 {
-	LUA->CheckType(1, BSDFMaterial::id);
-	BSDFMaterial* pMat = LUA->GetUserType<BSDFMaterial>(1, BSDFMaterial::id);
+	BSDFMaterial* pMat = CheckMaterial(LUA, 1);
 	if (LUA->Top() == 1) {
 		LUA->PushVector(MakeVector(pMat->conductorInput.x, pMat->conductorInput.y, pMat->conductorInput.z));
 		return 1;
@@ -900,8 +2201,7 @@ LUA_FUNCTION(Material_ConductorColour)
 
 LUA_FUNCTION(Material_EdgeTint)
 {
-	LUA->CheckType(1, BSDFMaterial::id);
-	BSDFMaterial* pMat = LUA->GetUserType<BSDFMaterial>(1, BSDFMaterial::id);
+	BSDFMaterial* pMat = CheckMaterial(LUA, 1);
 	if (LUA->Top() == 1) {
 		LUA->PushVector(MakeVector(pMat->edgetint.x, pMat->edgetint.y, pMat->edgetint.z));
 		return 1;
@@ -915,8 +2215,7 @@ LUA_FUNCTION(Material_EdgeTint)
 
 LUA_FUNCTION(Material_EdgeTintFalloff)
 {
-	LUA->CheckType(1, BSDFMaterial::id);
-	BSDFMaterial* pMat = LUA->GetUserType<BSDFMaterial>(1, BSDFMaterial::id);
+	BSDFMaterial* pMat = CheckMaterial(LUA, 1);
 	if (LUA->Top() == 1) {
 		LUA->PushNumber(pMat->falloff);
 		return 1;
@@ -929,8 +2228,7 @@ LUA_FUNCTION(Material_EdgeTintFalloff)
 
 LUA_FUNCTION(Material_Metalness)
 {
-	LUA->CheckType(1, BSDFMaterial::id);
-	BSDFMaterial* pMat = LUA->GetUserType<BSDFMaterial>(1, BSDFMaterial::id);
+	BSDFMaterial* pMat = CheckMaterial(LUA, 1);
 	if (LUA->Top() == 1) {
 		LUA->PushNumber(pMat->metallic);
 		return 1;
@@ -943,8 +2241,7 @@ LUA_FUNCTION(Material_Metalness)
 }
 LUA_FUNCTION(Material_Roughness)
 {
-	LUA->CheckType(1, BSDFMaterial::id);
-	BSDFMaterial* pMat = LUA->GetUserType<BSDFMaterial>(1, BSDFMaterial::id);
+	BSDFMaterial* pMat = CheckMaterial(LUA, 1);
 	if (LUA->Top() == 1) {
 		LUA->PushNumber(pMat->linearRoughness);
 		return 1;
@@ -959,8 +2256,7 @@ LUA_FUNCTION(Material_Roughness)
 
 LUA_FUNCTION(Material_Anisotropy)
 {
-	LUA->CheckType(1, BSDFMaterial::id);
-	BSDFMaterial* pMat = LUA->GetUserType<BSDFMaterial>(1, BSDFMaterial::id);
+	BSDFMaterial* pMat = CheckMaterial(LUA, 1);
 	if (LUA->Top() == 1) {
 		LUA->PushNumber(pMat->anisotropy);
 		return 1;
@@ -976,8 +2272,7 @@ LUA_FUNCTION(Material_Anisotropy)
 }
 LUA_FUNCTION(Material_AnisotropicRotation)
 {
-	LUA->CheckType(1, BSDFMaterial::id);
-	BSDFMaterial* pMat = LUA->GetUserType<BSDFMaterial>(1, BSDFMaterial::id);
+	BSDFMaterial* pMat = CheckMaterial(LUA, 1);
 	if (LUA->Top() == 1) {
 		LUA->PushNumber(pMat->anisotropicRotation);
 		return 1;
@@ -991,8 +2286,7 @@ LUA_FUNCTION(Material_AnisotropicRotation)
 
 LUA_FUNCTION(Material_IoR)
 {
-	LUA->CheckType(1, BSDFMaterial::id);
-	BSDFMaterial* pMat = LUA->GetUserType<BSDFMaterial>(1, BSDFMaterial::id);
+	BSDFMaterial* pMat = CheckMaterial(LUA, 1);
 	if (LUA->Top() == 1) {
 		LUA->PushNumber(pMat->ior);
 		return 1;
@@ -1005,8 +2299,7 @@ LUA_FUNCTION(Material_IoR)
 
 LUA_FUNCTION(Material_OutsideIoR)
 {
-	LUA->CheckType(1, BSDFMaterial::id);
-	BSDFMaterial* pMat = LUA->GetUserType<BSDFMaterial>(1, BSDFMaterial::id);
+	BSDFMaterial* pMat = CheckMaterial(LUA, 1);
 	if (LUA->Top() == 1) {
 		LUA->PushNumber(pMat->outsideIoR);
 		return 1;
@@ -1019,8 +2312,7 @@ LUA_FUNCTION(Material_OutsideIoR)
 
 LUA_FUNCTION(Material_DiffuseTransmission)
 {
-	LUA->CheckType(1, BSDFMaterial::id);
-	BSDFMaterial* pMat = LUA->GetUserType<BSDFMaterial>(1, BSDFMaterial::id);
+	BSDFMaterial* pMat = CheckMaterial(LUA, 1);
 	if (LUA->Top() == 1) {
 		LUA->PushNumber(pMat->diffuseTransmission);
 		return 1;
@@ -1032,8 +2324,7 @@ LUA_FUNCTION(Material_DiffuseTransmission)
 }
 LUA_FUNCTION(Material_SpecularTransmission)
 {
-	LUA->CheckType(1, BSDFMaterial::id);
-	BSDFMaterial* pMat = LUA->GetUserType<BSDFMaterial>(1, BSDFMaterial::id);
+	BSDFMaterial* pMat = CheckMaterial(LUA, 1);
 	if (LUA->Top() == 1) {
 		LUA->PushNumber(pMat->specularTransmission);
 		return 1;
@@ -1046,8 +2337,7 @@ LUA_FUNCTION(Material_SpecularTransmission)
 
 LUA_FUNCTION(Material_Thin)
 {
-	LUA->CheckType(1, BSDFMaterial::id);
-	BSDFMaterial* pMat = LUA->GetUserType<BSDFMaterial>(1, BSDFMaterial::id);
+	BSDFMaterial* pMat = CheckMaterial(LUA, 1);
 	if (LUA->Top() == 1) {
 		LUA->PushBool(pMat->thin);
 		return 1;
@@ -1060,8 +2350,7 @@ LUA_FUNCTION(Material_Thin)
 
 LUA_FUNCTION(Material_ActiveLobes)
 {
-	LUA->CheckType(1, BSDFMaterial::id);
-	BSDFMaterial* pMat = LUA->GetUserType<BSDFMaterial>(1, BSDFMaterial::id);
+	BSDFMaterial* pMat = CheckMaterial(LUA, 1);
 	if (LUA->Top() == 1) {
 		LUA->PushNumber(static_cast<double>(pMat->activeLobes));
 		return 1;
@@ -1098,7 +2387,7 @@ LUA_FUNCTION(TraceResult_SampleBSDF)
 	TraceResult* pResult = *LUA->GetUserType<TraceResult*>(1, TraceResult::id);
 	ISampler* pSampler = *LUA->GetUserType<ISampler*>(2, Sampler::id);
 
-	BSDFMaterial* pMat = LUA->GetUserType<BSDFMaterial>(3, BSDFMaterial::id);
+	BSDFMaterial* pMat = CheckMaterial(LUA, 3);
 	pMat->PrepShadingData(
 		pResult->GetAlbedo(),
 		pResult->GetMetalness(), pResult->GetRoughness()
@@ -1153,7 +2442,7 @@ LUA_FUNCTION(TraceResult_EvalBSDF)
 		scattered = glm::vec3(v.x, v.y, v.z);
 	}
 
-	BSDFMaterial* pMat = LUA->GetUserType<BSDFMaterial>(2, BSDFMaterial::id);
+	BSDFMaterial* pMat = CheckMaterial(LUA, 2);
 	pMat->PrepShadingData(
 		pResult->GetAlbedo(),
 		pResult->GetMetalness(), pResult->GetRoughness()
@@ -1193,7 +2482,7 @@ LUA_FUNCTION(TraceResult_EvalPDF)
 		scattered = glm::vec3(v.x, v.y, v.z);
 	}
 
-	BSDFMaterial* pMat = LUA->GetUserType<BSDFMaterial>(2, BSDFMaterial::id);
+	BSDFMaterial* pMat = CheckMaterial(LUA, 2);
 	pMat->PrepShadingData(
 		pResult->GetAlbedo(),
 		pResult->GetMetalness(), pResult->GetRoughness()
@@ -1233,7 +2522,7 @@ LUA_FUNCTION(vistrace_SampleBSDF)
 
 	ISampler* pSampler = *LUA->GetUserType<ISampler*>(1, Sampler::id);
 
-	BSDFMaterial* pMat = LUA->GetUserType<BSDFMaterial>(2, BSDFMaterial::id);
+	BSDFMaterial* pMat = CheckMaterial(LUA, 2);
 
 	Vector v = LUA->GetVector(3);
 	glm::vec3 normal(v.x, v.y, v.z);
@@ -1291,7 +2580,7 @@ LUA_FUNCTION(vistrace_EvalBSDF)
 	LUA->CheckType(5, Type::Vector);
 	LUA->CheckType(6, Type::Vector);
 
-	BSDFMaterial* pMat = LUA->GetUserType<BSDFMaterial>(1, BSDFMaterial::id);
+	BSDFMaterial* pMat = CheckMaterial(LUA, 1);
 
 	Vector v = LUA->GetVector(2);
 	glm::vec3 normal(v.x, v.y, v.z);
@@ -1331,7 +2620,7 @@ LUA_FUNCTION(vistrace_EvalPDF)
 	LUA->CheckType(5, Type::Vector);
 	LUA->CheckType(6, Type::Vector);
 
-	BSDFMaterial* pMat = LUA->GetUserType<BSDFMaterial>(1, BSDFMaterial::id);
+	BSDFMaterial* pMat = CheckMaterial(LUA, 1);
 
 	Vector v = LUA->GetVector(2);
 	glm::vec3 normal(v.x, v.y, v.z);
@@ -1477,44 +2766,20 @@ LUA_FUNCTION(HDRI_gc)
 #pragma region Helpers
 LUA_FUNCTION(vistrace_CalcRayOrigin)
 {
-	assert(sizeof(int) == sizeof(float));
-	using namespace glm;
-
 	LUA->CheckType(1, Type::Vector);
 	LUA->CheckType(2, Type::Vector);
 
-	vec3 pos, normal;
+	glm::vec3 pos, normal;
 	{
 		Vector v = LUA->GetVector(1);
-		pos = vec3(v.x, v.y, v.z);
+		pos = glm::vec3(v.x, v.y, v.z);
 
 		v = LUA->GetVector(2);
-		normal = vec3(v.x, v.y, v.z);
-	}
-
-	const float origin = 1.f / 32.f;
-	const float fScale = 1.f / 65536.f;
-	const float iScale = 256.f;
-
-	// Per-component integer offset to bit representation of fp32 position.
-	ivec3 iOff = ivec3(normal * iScale);
-	vec3 iPos = intBitsToFloat(
-		floatBitsToInt(pos) +
-		ivec3(
-			pos.x < 0.f ? -iOff.x : iOff.x,
-			pos.y < 0.f ? -iOff.y : iOff.y,
-			pos.z < 0.f ? -iOff.z : iOff.z
-		)
-	);
-
-	// Select per-component between small fixed offset or above variable offset depending on distance to origin.
-	vec3 fOff = normal * fScale;
+		normal = glm::vec3(v.x, v.y, v.z);
+	}
 
-	LUA->PushVector(MakeVector(
-		abs(pos.x) < origin ? pos.x + fOff.x : iPos.x,
-		abs(pos.y) < origin ? pos.y + fOff.y : iPos.y,
-		abs(pos.z) < origin ? pos.z + fOff.z : iPos.z
-	));
+	glm::vec3 origin = OffsetRayOrigin(pos, normal);
+	LUA->PushVector(MakeVector(origin.x, origin.y, origin.z));
 	return 1;
 }
 #pragma endregion
@@ -1565,13 +2830,25 @@ LUA_FUNCTION(GM_Initialize)
 	const char* mapName = LUA->GetString();
 	LUA->Pop(3); // _G, game, and string
 
+	// Each map can mount its own content, so paths missing on the last one may exist now
+	ResourceCache::ClearMissing();
+
 	g_pWorld = new World(LUA, mapName);
 	if (!g_pWorld->IsValid()) {
 		delete g_pWorld;
 		g_pWorld = nullptr;
 		printLua(LUA, "VisTrace: Failed to load map, acceleration structures will only trace props");
 	} else {
-		printLua(LUA, "VisTrace: Map loaded successfully!");
+		printLua(LUA, "VisTrace: Map read, loading the rest in the background...");
+
+		LUA->PushSpecial(SPECIAL_GLOB);
+		LUA->GetField(-1, "hook");
+		LUA->GetField(-1, "Add");
+		LUA->PushString("Think");
+		LUA->PushString("VisTrace.LoadWorld");
+		LUA->PushCFunction(World_Think);
+		LUA->Call(3, 0);
+		LUA->Pop(2); // hook and _G
 	}
 
 	LUA->PushSpecial(SPECIAL_REG); // REG
@@ -1721,6 +2998,8 @@ GMOD_MODULE_OPEN()
 
 		PUSH_C_FUNC(TraceResult, BaseMIPLevel);
 
+		PUSH_C_FUNC(TraceResult, Fill);
+
 		PUSH_C_FUNC(TraceResult, Material);
 
 		PUSH_C_FUNC(TraceResult, BaseTexture);
@@ -1748,7 +3027,75 @@ GMOD_MODULE_OPEN()
 		LUA->SetField(-2, "__gc");
 
 		PUSH_C_FUNC(AccelStruct, Traverse);
+		PUSH_C_FUNC(AccelStruct, TraverseBatch);
 		PUSH_C_FUNC(AccelStruct, Rebuild);
+		PUSH_C_FUNC(AccelStruct, RenderGBuffer);
+		PUSH_C_FUNC(AccelStruct, GetBuildStats);
+		PUSH_C_FUNC(AccelStruct, SetLoDSettings);
+	LUA->Pop();
+
+	HitBuffer::id = LUA->CreateMetaTable("VisTraceHitBuffer");
+	LUA->PushSpecial(SPECIAL_REG);
+	LUA->PushNumber(HitBuffer::id);
+	LUA->SetField(-2, "VisTraceHitBuffer_id");
+	LUA->Pop(); // Pop the registry
+		LUA->Push(-1);
+		LUA->SetField(-2, "__index");
+		LUA->PushCFunction(HitBuffer_tostring);
+		LUA->SetField(-2, "__tostring");
+		LUA->PushCFunction(HitBuffer_gc);
+		LUA->SetField(-2, "__gc");
+
+		PUSH_C_FUNC(HitBuffer, GetSize);
+		PUSH_C_FUNC(HitBuffer, Shade);
+
+		PUSH_C_FUNC(HitBuffer, IsHit);
+		PUSH_C_FUNC(HitBuffer, HitSky);
+
+		PUSH_C_FUNC(HitBuffer, Distance);
+		PUSH_C_FUNC(HitBuffer, Triangle);
+		PUSH_C_FUNC(HitBuffer, Barycentric);
+		PUSH_C_FUNC(HitBuffer, Entity);
+		PUSH_C_FUNC(HitBuffer, SubMaterialIndex);
+
+		PUSH_C_FUNC(HitBuffer, Pos);
+		PUSH_C_FUNC(HitBuffer, Normal);
+		PUSH_C_FUNC(HitBuffer, Tangent);
+		PUSH_C_FUNC(HitBuffer, Binormal);
+
+		PUSH_C_FUNC(HitBuffer, Albedo);
+		PUSH_C_FUNC(HitBuffer, Alpha);
+		PUSH_C_FUNC(HitBuffer, Metalness);
+		PUSH_C_FUNC(HitBuffer, Roughness);
+
+		PUSH_C_FUNC(HitBuffer, GetResult);
+
+		PUSH_C_FUNC(HitBuffer, EvalBSDF);
+		PUSH_C_FUNC(HitBuffer, EvalPDF);
+	LUA->Pop();
+
+	RenderSession::id = LUA->CreateMetaTable("RenderSession");
+		LUA->Push(-1);
+		LUA->SetField(-2, "__index");
+		LUA->PushCFunction(RenderSession_tostring);
+		LUA->SetField(-2, "__tostring");
+		LUA->PushCFunction(RenderSession_gc);
+		LUA->SetField(-2, "__gc");
+
+		PUSH_C_FUNC(RenderSession, Start);
+		PUSH_C_FUNC(RenderSession, Pause);
+		PUSH_C_FUNC(RenderSession, Resume);
+		PUSH_C_FUNC(RenderSession, Cancel);
+
+		PUSH_C_FUNC(RenderSession, IsRunning);
+		PUSH_C_FUNC(RenderSession, IsPaused);
+		PUSH_C_FUNC(RenderSession, IsCancelled);
+		PUSH_C_FUNC(RenderSession, GetProgress);
+
+		PUSH_C_FUNC(RenderSession, SetBudget);
+		PUSH_C_FUNC(RenderSession, GetBudget);
+
+		PUSH_C_FUNC(RenderSession, GetImage);
 	LUA->Pop();
 
 	Sampler::id = LUA->CreateMetaTable("Sampler");
@@ -1786,10 +3133,16 @@ GMOD_MODULE_OPEN()
 	LUA->Pop();
 
 	BSDFMaterial::id = LUA->CreateMetaTable("BSDFMaterial");
+	LUA->PushSpecial(SPECIAL_REG);
+	LUA->PushNumber(BSDFMaterial::id);
+	LUA->SetField(-2, "BSDFMaterial_id");
+	LUA->Pop(); // Pop the registry
 		LUA->Push(-1);
 		LUA->SetField(-2, "__index");
 		LUA->PushCFunction(Material_tostring);
 		LUA->SetField(-2, "__tostring");
+		LUA->PushCFunction(Material_gc);
+		LUA->SetField(-2, "__gc");
 
 		PUSH_C_FUNC(Material, Colour);
 		PUSH_C_FUNC(Material, DielectricColour);
@@ -1818,6 +3171,16 @@ GMOD_MODULE_OPEN()
 		LUA->CreateTable();
 			PUSH_C_FUNC(vistrace, CreateRenderTarget);
 			PUSH_C_FUNC(vistrace, CreateAccel);
+			PUSH_C_FUNC(vistrace, CreateHitBuffer);
+			PUSH_C_FUNC(vistrace, IsWorldReady);
+			PUSH_C_FUNC(vistrace, WaitForWorld);
+			PUSH_C_FUNC(vistrace, SetCacheBudget);
+			PUSH_C_FUNC(vistrace, GetCacheStats);
+			PUSH_C_FUNC(vistrace, GetTraceResultPoolStats);
+			PUSH_C_FUNC(vistrace, SetTextureDecodeBudget);
+			PUSH_C_FUNC(vistrace, SetTextureMIPTimeout);
+			PUSH_C_FUNC(vistrace, ClearMissingCache);
+			PUSH_C_FUNC(vistrace, CreateRenderSession);
 			PUSH_C_FUNC(vistrace, CreateSampler);
 			PUSH_C_FUNC(vistrace, CreateMaterial);
 
@@ -1825,6 +3188,7 @@ GMOD_MODULE_OPEN()
 			PUSH_C_FUNC(vistrace, LoadTexture);
 
 			PUSH_C_FUNC(vistrace, CalcRayOrigin);
+			PUSH_C_FUNC(vistrace, GenerateCameraRays);
 
 			PUSH_C_FUNC(vistrace, SampleBSDF);
 			PUSH_C_FUNC(vistrace, EvalBSDF);
@@ -1872,8 +3236,73 @@ GMOD_MODULE_OPEN()
 
 			PUSH_ENUM(LobeType, All);
 		LUA->SetField(-2, "LobeType");
+
+		LUA->CreateTable();
+			PUSH_ENUM(CameraType, Pinhole);
+			PUSH_ENUM(CameraType, ThinLens);
+			PUSH_ENUM(CameraType, Equirectangular);
+		LUA->SetField(-2, "CameraType");
+
+		LUA->CreateTable();
+			PUSH_ENUM(TraceField, None);
+
+			PUSH_ENUM(TraceField, Pos);
+			PUSH_ENUM(TraceField, Incident);
+			PUSH_ENUM(TraceField, Distance);
+			PUSH_ENUM(TraceField, Entity);
+			PUSH_ENUM(TraceField, GeometricNormal);
+			PUSH_ENUM(TraceField, Normal);
+			PUSH_ENUM(TraceField, Tangent);
+			PUSH_ENUM(TraceField, Binormal);
+			PUSH_ENUM(TraceField, Barycentric);
+			PUSH_ENUM(TraceField, TextureUV);
+			PUSH_ENUM(TraceField, SubMaterialIndex);
+			PUSH_ENUM(TraceField, Albedo);
+			PUSH_ENUM(TraceField, Alpha);
+			PUSH_ENUM(TraceField, Metalness);
+			PUSH_ENUM(TraceField, Roughness);
+			PUSH_ENUM(TraceField, MaterialFlags);
+			PUSH_ENUM(TraceField, SurfaceFlags);
+			PUSH_ENUM(TraceField, HitSky);
+			PUSH_ENUM(TraceField, HitWater);
+			PUSH_ENUM(TraceField, FrontFacing);
+			PUSH_ENUM(TraceField, BaseMIPLevel);
+
+			PUSH_ENUM(TraceField, TBN);
+			PUSH_ENUM(TraceField, Shading);
+
+			PUSH_ENUM(TraceField, All);
+		LUA->SetField(-2, "TraceField");
+
+		LUA->CreateTable();
+			PUSH_ENUM(HitAttributes, None);
+			PUSH_ENUM(HitAttributes, Position);
+			PUSH_ENUM(HitAttributes, TBN);
+			PUSH_ENUM(HitAttributes, Shading);
+			PUSH_ENUM(HitAttributes, All);
+		LUA->SetField(-2, "HitAttributes");
 	LUA->Pop();
 
+	// Grant render sessions their budget once per frame
+	LUA->PushSpecial(SPECIAL_GLOB);
+	LUA->GetField(-1, "hook");
+	LUA->GetField(-1, "Add");
+	LUA->PushString("Think");
+	LUA->PushString("VisTrace.RenderSessions");
+	LUA->PushCFunction(RenderSession_Think);
+	LUA->Call(3, 0);
+	LUA->Pop(2); // hook and _G
+
+	// Time out decoded texture MIPs that haven't been sampled recently
+	LUA->PushSpecial(SPECIAL_GLOB);
+	LUA->GetField(-1, "hook");
+	LUA->GetField(-1, "Add");
+	LUA->PushString("Think");
+	LUA->PushString("VisTrace.TextureResidency");
+	LUA->PushCFunction(ResourceCache_Think);
+	LUA->Call(3, 0);
+	LUA->Pop(2); // hook and _G
+
 	LUA->PushSpecial(SPECIAL_GLOB);
 	LUA->GetField(-1, "game");
 	LUA->GetField(-1, "GetMap");
@@ -1907,6 +3336,7 @@ GMOD_MODULE_OPEN()
 
 GMOD_MODULE_CLOSE()
 {
+	RenderSession::CancelAll();
 	if (g_pWorld != nullptr) delete g_pWorld;
 	ResourceCache::Clear();
 	return 0;
@@ -3,6 +3,17 @@
 #include "glm/ext/scalar_constants.hpp"
 #include "glm/gtx/rotate_vector.hpp"
 
+#include <algorithm>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define BSDF_SSE
+#include <xmmintrin.h>
+#endif
+
 using namespace glm;
 using namespace VisTrace;
 
@@ -883,3 +894,560 @@ float EvalPDF(
 
 	return pdf;
 }
+
+#pragma region Batches
+// Points per work item, a group is either evaluated with SSE or point by point
+#define BSDF_BATCH_LANES 4
+
+// Below this many points the cost of spinning up threads outweighs the work
+#define PARALLEL_BSDF_THRESHOLD 1024
+
+static inline vec3 LoadBatchVec3(const float* p, size_t i)
+{
+	return vec3(p[i * 3], p[i * 3 + 1], p[i * 3 + 2]);
+}
+
+static inline void StoreBatchVec3(const vec3& v, float* p, size_t i)
+{
+	p[i * 3] = v.x;
+	p[i * 3 + 1] = v.y;
+	p[i * 3 + 2] = v.z;
+}
+
+static vec3 EvalBatchPoint(const BSDFMaterial& data, const BSDFBatch& batch, size_t i)
+{
+	const vec3 normal = LoadBatchVec3(batch.pNormals, i);
+	const vec3 tangent = LoadBatchVec3(batch.pTangents, i);
+	const vec3 binormal = LoadBatchVec3(batch.pBinormals, i);
+	const vec3 incident = LoadBatchVec3(batch.pIncident, i);
+	const vec3 scattered = LoadBatchVec3(batch.pScattered, i);
+
+	if (batch.pAlbedos == nullptr) return EvalBSDF(data, normal, tangent, binormal, incident, scattered);
+
+	BSDFMaterial point = data;
+	point.PrepShadingData(LoadBatchVec3(batch.pAlbedos, i), batch.pMetalness[i], batch.pRoughness[i]);
+	return EvalBSDF(point, normal, tangent, binormal, incident, scattered);
+}
+
+static float EvalPDFBatchPoint(const BSDFMaterial& data, const BSDFBatch& batch, size_t i)
+{
+	const vec3 normal = LoadBatchVec3(batch.pNormals, i);
+	const vec3 tangent = LoadBatchVec3(batch.pTangents, i);
+	const vec3 binormal = LoadBatchVec3(batch.pBinormals, i);
+	const vec3 incident = LoadBatchVec3(batch.pIncident, i);
+	const vec3 scattered = LoadBatchVec3(batch.pScattered, i);
+
+	if (batch.pAlbedos == nullptr) return EvalPDF(data, normal, tangent, binormal, incident, scattered);
+
+	BSDFMaterial point = data;
+	point.PrepShadingData(LoadBatchVec3(batch.pAlbedos, i), batch.pMetalness[i], batch.pRoughness[i]);
+	return EvalPDF(point, normal, tangent, binormal, incident, scattered);
+}
+
+// The SSE path only covers the diffuse, specular reflection, and conductor lobes in an unrotated frame
+static bool CanBatchSSE(const BSDFMaterial& data)
+{
+	return data.specularTransmission == 0.f && data.anisotropicRotation == 0.f;
+}
+
+#ifdef BSDF_SSE
+// Each function below mirrors its scalar counterpart operation for operation (other than powf with integer exponents), so lanes match EvalBSDF and EvalPDF to within rounding
+struct Vec3x4
+{
+	__m128 x, y, z;
+};
+
+struct BSDFLanes
+{
+	Vec3x4 incident;
+	Vec3x4 scattered;
+
+	__m128 metallic;
+	__m128 linearRoughness;
+	__m128 roughness;
+
+	Vec3x4 dielectric;
+	Vec3x4 conductor;
+};
+
+// Terms shared by the specular and conductor lobes
+struct MicrofacetLanes
+{
+	Vec3x4 halfway;
+	__m128 iDotH, sDotH;
+	__m128 D, G1incident, G1scattered;
+	__m128 Ess, Eavg;
+};
+
+static inline Vec3x4 LoadVec3x4(const float* p, size_t i)
+{
+	p += i * 3;
+	return Vec3x4{
+		_mm_setr_ps(p[0], p[3], p[6], p[9]),
+		_mm_setr_ps(p[1], p[4], p[7], p[10]),
+		_mm_setr_ps(p[2], p[5], p[8], p[11])
+	};
+}
+
+static inline void StoreVec3x4(const Vec3x4& v, float* p, size_t i)
+{
+	alignas(16) float x[4], y[4], z[4];
+	_mm_store_ps(x, v.x);
+	_mm_store_ps(y, v.y);
+	_mm_store_ps(z, v.z);
+
+	p += i * 3;
+	for (int lane = 0; lane < 4; lane++) {
+		p[lane * 3] = x[lane];
+		p[lane * 3 + 1] = y[lane];
+		p[lane * 3 + 2] = z[lane];
+	}
+}
+
+static inline Vec3x4 Set1Vec3x4(const vec3& v)
+{
+	return Vec3x4{ _mm_set1_ps(v.x), _mm_set1_ps(v.y), _mm_set1_ps(v.z) };
+}
+
+static inline __m128 Dot4(const Vec3x4& a, const Vec3x4& b)
+{
+	return _mm_add_ps(_mm_add_ps(_mm_mul_ps(a.x, b.x), _mm_mul_ps(a.y, b.y)), _mm_mul_ps(a.z, b.z));
+}
+
+static inline __m128 Select4(const __m128 mask, const __m128 a, const __m128 b)
+{
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+static inline Vec3x4 Select4(const __m128 mask, const Vec3x4& a, const Vec3x4& b)
+{
+	return Vec3x4{ Select4(mask, a.x, b.x), Select4(mask, a.y, b.y), Select4(mask, a.z, b.z) };
+}
+
+static inline __m128 Clamp01x4(const __m128 v)
+{
+	return _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), _mm_set1_ps(1.f));
+}
+
+static inline __m128 Mix4(const float x, const float y, const __m128 a)
+{
+	return _mm_add_ps(
+		_mm_mul_ps(_mm_set1_ps(x), _mm_sub_ps(_mm_set1_ps(1.f), a)),
+		_mm_mul_ps(_mm_set1_ps(y), a)
+	);
+}
+
+static inline __m128 Pow5x4(const __m128 v)
+{
+	const __m128 v2 = _mm_mul_ps(v, v);
+	return _mm_mul_ps(_mm_mul_ps(v2, v2), v);
+}
+
+static inline __m128 IsFinite4(const __m128 v)
+{
+	const __m128 absolute = _mm_andnot_ps(_mm_set1_ps(-0.f), v);
+	return _mm_cmplt_ps(absolute, _mm_set1_ps(INFINITY));
+}
+
+static inline __m128 Normalise4(const Vec3x4& v, Vec3x4& out)
+{
+	const __m128 invLength = _mm_div_ps(_mm_set1_ps(1.f), _mm_sqrt_ps(Dot4(v, v)));
+	out = Vec3x4{ _mm_mul_ps(v.x, invLength), _mm_mul_ps(v.y, invLength), _mm_mul_ps(v.z, invLength) };
+	return invLength;
+}
+
+// Loads a group of points into the shading frame, returning false if any of them need the scalar path
+static bool LoadLanes(const BSDFMaterial& data, const BSDFBatch& batch, size_t i, BSDFLanes& lanes)
+{
+	if (batch.pAlbedos == nullptr) {
+		lanes.metallic = _mm_set1_ps(data.metallic);
+		lanes.linearRoughness = _mm_set1_ps(data.linearRoughness);
+		lanes.roughness = _mm_set1_ps(data.roughness);
+		lanes.dielectric = Set1Vec3x4(data.dielectric);
+		lanes.conductor = Set1Vec3x4(data.conductor);
+	} else {
+		lanes.metallic = data.metallicOverridden ? _mm_set1_ps(data.metallic) : Clamp01x4(_mm_loadu_ps(batch.pMetalness + i));
+		if (data.roughnessOverridden) {
+			lanes.linearRoughness = _mm_set1_ps(data.linearRoughness);
+			lanes.roughness = _mm_set1_ps(data.roughness);
+		} else {
+			lanes.linearRoughness = Clamp01x4(_mm_loadu_ps(batch.pRoughness + i));
+			lanes.roughness = _mm_mul_ps(lanes.linearRoughness, lanes.linearRoughness);
+		}
+
+		const Vec3x4 albedo = LoadVec3x4(batch.pAlbedos, i);
+		lanes.dielectric = Vec3x4{
+			Clamp01x4(_mm_mul_ps(_mm_set1_ps(data.dielectricInput.x), albedo.x)),
+			Clamp01x4(_mm_mul_ps(_mm_set1_ps(data.dielectricInput.y), albedo.y)),
+			Clamp01x4(_mm_mul_ps(_mm_set1_ps(data.dielectricInput.z), albedo.z))
+		};
+		lanes.conductor = Vec3x4{
+			Clamp01x4(_mm_mul_ps(_mm_set1_ps(data.conductorInput.x), albedo.x)),
+			Clamp01x4(_mm_mul_ps(_mm_set1_ps(data.conductorInput.y), albedo.y)),
+			Clamp01x4(_mm_mul_ps(_mm_set1_ps(data.conductorInput.z), albedo.z))
+		};
+	}
+
+	if (_mm_movemask_ps(_mm_cmplt_ps(lanes.roughness, _mm_set1_ps(kMinGGXAlpha))) != 0) return false;
+
+	const Vec3x4 normal = LoadVec3x4(batch.pNormals, i);
+	const Vec3x4 tangent = LoadVec3x4(batch.pTangents, i);
+	const Vec3x4 binormal = LoadVec3x4(batch.pBinormals, i);
+	const Vec3x4 incident = LoadVec3x4(batch.pIncident, i);
+	const Vec3x4 scattered = LoadVec3x4(batch.pScattered, i);
+
+	// Points hit from behind flip the normal but not the tangent or binormal, like to_local
+	const __m128 iDotN = Dot4(incident, normal);
+	const __m128 side = Select4(_mm_cmpge_ps(iDotN, _mm_setzero_ps()), _mm_set1_ps(1.f), _mm_set1_ps(-1.f));
+
+	lanes.incident = Vec3x4{ Dot4(incident, tangent), Dot4(incident, binormal), _mm_mul_ps(iDotN, side) };
+	lanes.scattered = Vec3x4{ Dot4(scattered, tangent), Dot4(scattered, binormal), _mm_mul_ps(Dot4(scattered, normal), side) };
+	return true;
+}
+
+static inline void CalculateLobePDFs4(
+	const BSDFMaterial& data, const BSDFLanes& lanes,
+	__m128& pDiffuse, __m128& pSpecularReflection, __m128& pConductor
+)
+{
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 dielectric = _mm_sub_ps(_mm_set1_ps(1.f), lanes.metallic);
+
+	pDiffuse            = (data.activeLobes & LobeType::DiffuseReflection)    != LobeType::None ? dielectric     : zero;
+	pSpecularReflection = (data.activeLobes & LobeType::SpecularReflection)   != LobeType::None ? dielectric     : zero;
+	pConductor          = (data.activeLobes & LobeType::ConductiveReflection) != LobeType::None ? lanes.metallic : zero;
+
+	const __m128 normFactor = _mm_add_ps(_mm_add_ps(pDiffuse, pSpecularReflection), pConductor);
+	const __m128 normalise = _mm_cmpgt_ps(normFactor, zero);
+	const __m128 invNormFactor = _mm_div_ps(_mm_set1_ps(1.f), normFactor);
+
+	pDiffuse            = Select4(normalise, _mm_mul_ps(pDiffuse, invNormFactor), pDiffuse);
+	pSpecularReflection = Select4(normalise, _mm_mul_ps(pSpecularReflection, invNormFactor), pSpecularReflection);
+	pConductor          = Select4(normalise, _mm_mul_ps(pConductor, invNormFactor), pConductor);
+}
+
+static inline __m128 MicrofacetD4(const __m128 ax, const __m128 ay, const Vec3x4& n)
+{
+	const __m128 c1 = _mm_add_ps(
+		_mm_add_ps(
+			_mm_div_ps(_mm_mul_ps(n.x, n.x), _mm_mul_ps(ax, ax)),
+			_mm_div_ps(_mm_mul_ps(n.y, n.y), _mm_mul_ps(ay, ay))
+		),
+		_mm_mul_ps(n.z, n.z)
+	);
+	const __m128 denom = _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(_mm_mul_ps(_mm_set1_ps(pi<float>()), ax), ay), c1), c1);
+	return _mm_div_ps(_mm_set1_ps(1.f), denom);
+}
+
+static inline __m128 MicrofacetG1x4(const __m128 ax, const __m128 ay, const Vec3x4& v)
+{
+	const __m128 one = _mm_set1_ps(1.f);
+
+	// Same terms as microfacet_g1
+	const __m128 num = _mm_add_ps(
+		_mm_add_ps(_mm_mul_ps(_mm_mul_ps(_mm_mul_ps(ax, ax), v.x), v.x), _mm_mul_ps(ay, ay)),
+		_mm_mul_ps(v.y, v.y)
+	);
+	const __m128 root = _mm_sqrt_ps(_mm_add_ps(one, _mm_div_ps(num, _mm_mul_ps(v.z, v.z))));
+	const __m128 lambda = _mm_div_ps(_mm_sub_ps(root, one), _mm_set1_ps(2.f));
+	return _mm_div_ps(one, _mm_add_ps(one, lambda));
+}
+
+static inline __m128 MicrofacetEnergyFit4(const __m128 cosTheta, const __m128 roughness)
+{
+	const float S[5] = { -0.170718f, 4.07985f, -11.5295f, 18.4961f, -9.23618f };
+	const float T[5] = { 0.0632331f, 3.1434f, -7.47567f, 13.0482f, -7.0401f };
+
+	const __m128 r2 = _mm_mul_ps(roughness, roughness);
+	const __m128 r3 = _mm_mul_ps(r2, roughness);
+	const __m128 r4 = _mm_mul_ps(r3, roughness);
+
+	const __m128 sqrtCos = _mm_sqrt_ps(cosTheta);
+
+	__m128 s = _mm_mul_ps(_mm_set1_ps(S[0]), sqrtCos);
+	s = _mm_add_ps(s, _mm_mul_ps(_mm_set1_ps(S[1]), roughness));
+	s = _mm_add_ps(s, _mm_mul_ps(_mm_set1_ps(S[2]), r2));
+	s = _mm_add_ps(s, _mm_mul_ps(_mm_set1_ps(S[3]), r3));
+	s = _mm_add_ps(s, _mm_mul_ps(_mm_set1_ps(S[4]), r4));
+
+	__m128 t = _mm_mul_ps(_mm_set1_ps(T[0]), cosTheta);
+	t = _mm_add_ps(t, _mm_mul_ps(_mm_set1_ps(T[1]), roughness));
+	t = _mm_add_ps(t, _mm_mul_ps(_mm_set1_ps(T[2]), r2));
+	t = _mm_add_ps(t, _mm_mul_ps(_mm_set1_ps(T[3]), r3));
+	t = _mm_add_ps(t, _mm_mul_ps(_mm_set1_ps(T[4]), r4));
+
+	// x^6 = (x^2)^3 and x^0.75 = sqrt(x) * sqrt(sqrt(x)), cosTheta is never negative in the shading frame
+	const __m128 s2 = _mm_mul_ps(s, s);
+	const __m128 t2 = _mm_mul_ps(t, t);
+	const __m128 s6 = _mm_mul_ps(_mm_mul_ps(s2, s2), s2);
+	const __m128 t6 = _mm_mul_ps(_mm_mul_ps(t2, t2), t2);
+	const __m128 cos075 = _mm_mul_ps(sqrtCos, _mm_sqrt_ps(sqrtCos));
+
+	return _mm_sub_ps(
+		_mm_set1_ps(1.f),
+		_mm_div_ps(_mm_mul_ps(s6, cos075), _mm_add_ps(t6, _mm_mul_ps(cosTheta, cosTheta)))
+	);
+}
+
+static inline __m128 MicrofacetEnergyAvgFit4(const __m128 roughness)
+{
+	const float A[3] = { 0.592665f, -1.47034f, 1.47196f };
+
+	const __m128 r2 = _mm_mul_ps(roughness, roughness);
+	const __m128 r3 = _mm_mul_ps(r2, roughness);
+
+	const __m128 denom = _mm_add_ps(
+		_mm_add_ps(_mm_set1_ps(1.f), _mm_mul_ps(_mm_set1_ps(A[1]), roughness)),
+		_mm_mul_ps(_mm_set1_ps(A[2]), r2)
+	);
+	return _mm_div_ps(_mm_mul_ps(_mm_set1_ps(A[0]), r3), denom);
+}
+
+static inline __m128 MicrofacetCompensation4(const __m128 Ess, const __m128 Eavg, const __m128 Fss)
+{
+	const __m128 one = _mm_set1_ps(1.f);
+	const __m128 Fms = _mm_div_ps(Eavg, _mm_sub_ps(one, _mm_mul_ps(Fss, _mm_sub_ps(one, Eavg))));
+	return _mm_add_ps(one, _mm_div_ps(_mm_mul_ps(Fms, _mm_sub_ps(one, Ess)), Ess));
+}
+
+static inline __m128 FresnelDielectric4(const float eta, const __m128 cosTheta)
+{
+	const __m128 one = _mm_set1_ps(1.f);
+
+	const __m128 k = _mm_sub_ps(_mm_add_ps(_mm_set1_ps(eta * eta), _mm_mul_ps(cosTheta, cosTheta)), one);
+	const __m128 totalInternal = _mm_cmplt_ps(k, _mm_setzero_ps());
+
+	const __m128 g = _mm_sqrt_ps(_mm_max_ps(k, _mm_setzero_ps()));
+	const __m128 c1 = _mm_add_ps(g, cosTheta);
+	const __m128 c2 = _mm_sub_ps(g, cosTheta);
+	const __m128 c3 = _mm_div_ps(c2, c1);
+	const __m128 c4 = _mm_div_ps(
+		_mm_sub_ps(_mm_mul_ps(cosTheta, c1), one),
+		_mm_add_ps(_mm_mul_ps(cosTheta, c2), one)
+	);
+
+	const __m128 F = _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), c3), c3), _mm_add_ps(one, _mm_mul_ps(c4, c4)));
+	return Select4(totalInternal, one, F);
+}
+
+static inline MicrofacetLanes CalcMicrofacetLanes(const BSDFMaterial& data, const BSDFLanes& lanes)
+{
+	MicrofacetLanes m;
+
+	const Vec3x4& i = lanes.incident;
+	const Vec3x4& s = lanes.scattered;
+	Normalise4(Vec3x4{ _mm_add_ps(i.x, s.x), _mm_add_ps(i.y, s.y), _mm_add_ps(i.z, s.z) }, m.halfway);
+
+	m.iDotH = Dot4(i, m.halfway);
+	m.sDotH = Dot4(s, m.halfway);
+
+	const __m128 ax = _mm_mul_ps(lanes.roughness, _mm_set1_ps(1 + data.anisotropy));
+	const __m128 ay = _mm_mul_ps(lanes.roughness, _mm_set1_ps(1 - data.anisotropy));
+
+	m.D = MicrofacetD4(ax, ay, m.halfway);
+	m.G1incident = MicrofacetG1x4(ax, ay, i);
+	m.G1scattered = MicrofacetG1x4(ax, ay, s);
+
+	m.Ess = MicrofacetEnergyFit4(i.z, lanes.linearRoughness);
+	m.Eavg = MicrofacetEnergyAvgFit4(lanes.linearRoughness);
+	return m;
+}
+
+static inline Vec3x4 EvalDiffuse4(const BSDFLanes& lanes, const MicrofacetLanes& m)
+{
+	const __m128 one = _mm_set1_ps(1.f);
+	const __m128 iDotN = lanes.incident.z;
+	const __m128 sDotN = lanes.scattered.z;
+
+	const __m128 energyBias = Mix4(0.f, 0.5f, lanes.linearRoughness);
+	const __m128 energyFactor = Mix4(1.f, 1.f / 1.51f, lanes.linearRoughness);
+	const __m128 fd90 = _mm_add_ps(energyBias, _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(_mm_set1_ps(2.f), m.sDotH), m.sDotH), lanes.linearRoughness));
+	const __m128 lightScatter = _mm_add_ps(one, _mm_mul_ps(_mm_sub_ps(fd90, one), Pow5x4(_mm_sub_ps(one, sDotN))));
+	const __m128 viewScatter = _mm_add_ps(one, _mm_mul_ps(_mm_sub_ps(fd90, one), Pow5x4(_mm_sub_ps(one, iDotN))));
+
+	const __m128 valid = _mm_cmpgt_ps(sDotN, _mm_setzero_ps());
+	const __m128 piLanes = _mm_set1_ps(pi<float>());
+	auto channel = [&](const __m128 dielectric) {
+		__m128 c = _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(dielectric, lightScatter), viewScatter), energyFactor);
+		c = _mm_mul_ps(_mm_div_ps(c, piLanes), sDotN);
+		return _mm_and_ps(valid, c);
+	};
+
+	return Vec3x4{ channel(lanes.dielectric.x), channel(lanes.dielectric.y), channel(lanes.dielectric.z) };
+}
+
+static inline __m128 EvalSpecularReflection4(const BSDFMaterial& data, const BSDFLanes& lanes, const MicrofacetLanes& m)
+{
+	const float eta = data.ior / data.outsideIoR;
+	const __m128 iDotN = lanes.incident.z;
+	const __m128 sDotN = lanes.scattered.z;
+
+	const __m128 F = FresnelDielectric4(eta, m.iDotH);
+
+	__m128 specular = _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(F, m.G1incident), m.G1scattered), m.D);
+	specular = _mm_mul_ps(_mm_div_ps(specular, _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(4.f), iDotN), sDotN)), sDotN);
+	specular = _mm_mul_ps(specular, MicrofacetCompensation4(m.Ess, m.Eavg, _mm_set1_ps(fresnel_dielectric_avg(eta))));
+
+	return _mm_and_ps(_mm_cmpge_ps(sDotN, _mm_setzero_ps()), specular);
+}
+
+static inline Vec3x4 EvalConductor4(const BSDFMaterial& data, const BSDFLanes& lanes, const MicrofacetLanes& m)
+{
+	const __m128 iDotN = lanes.incident.z;
+	const __m128 sDotN = lanes.scattered.z;
+
+	// The edge tint falloff is an arbitrary exponent, so this stays a powf per lane
+	alignas(16) float edge[4];
+	_mm_store_ps(edge, _mm_sub_ps(_mm_set1_ps(1.f), m.iDotH));
+	for (int lane = 0; lane < 4; lane++) edge[lane] = powf(edge[lane], 1.f / data.falloff);
+	const __m128 edgeFactor = _mm_load_ps(edge);
+
+	const float pSqr2 = 2.f * data.falloff * data.falloff;
+	const float p3 = 3.f * data.falloff;
+	const __m128 avgDenom = _mm_set1_ps(1 + p3 + pSqr2);
+
+	const __m128 denom = _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(4.f), iDotN), sDotN);
+	const __m128 valid = _mm_cmpge_ps(sDotN, _mm_setzero_ps());
+
+	auto channel = [&](const __m128 reflectance, const float edgetint) {
+		const __m128 F = _mm_add_ps(reflectance, _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(edgetint), reflectance), edgeFactor));
+		const __m128 Favg = _mm_div_ps(
+			_mm_add_ps(_mm_add_ps(_mm_set1_ps(edgetint * pSqr2), reflectance), _mm_mul_ps(reflectance, _mm_set1_ps(p3))),
+			avgDenom
+		);
+
+		__m128 c = _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(F, m.G1incident), m.G1scattered), m.D);
+		c = _mm_mul_ps(_mm_div_ps(c, denom), sDotN);
+		c = _mm_mul_ps(c, MicrofacetCompensation4(m.Ess, m.Eavg, Favg));
+		return _mm_and_ps(valid, c);
+	};
+
+	return Vec3x4{
+		channel(lanes.conductor.x, data.edgetint.x),
+		channel(lanes.conductor.y, data.edgetint.y),
+		channel(lanes.conductor.z, data.edgetint.z)
+	};
+}
+
+// Shared by the specular reflection and conductor PDFs, which only differ in the conductor rejecting scattered directions below the surface
+static inline __m128 EvalMicrofacetPDF4(const BSDFLanes& lanes, const MicrofacetLanes& m)
+{
+	const __m128 zero = _mm_setzero_ps();
+
+	const __m128 pdf = _mm_div_ps(
+		_mm_mul_ps(_mm_mul_ps(m.D, m.G1incident), m.iDotH),
+		_mm_mul_ps(_mm_mul_ps(_mm_set1_ps(4.f), lanes.incident.z), m.sDotH)
+	);
+
+	__m128 valid = _mm_and_ps(_mm_cmpge_ps(m.halfway.z, zero), _mm_cmpge_ps(m.iDotH, zero));
+	valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpge_ps(pdf, zero), IsFinite4(pdf)));
+	return _mm_and_ps(valid, pdf);
+}
+
+static Vec3x4 EvalBSDF4(const BSDFMaterial& data, const BSDFLanes& lanes)
+{
+	__m128 pDiffuse, pSpecularReflection, pConductor;
+	CalculateLobePDFs4(data, lanes, pDiffuse, pSpecularReflection, pConductor);
+
+	const __m128 zero = _mm_setzero_ps();
+	const MicrofacetLanes m = CalcMicrofacetLanes(data, lanes);
+
+	const __m128 dielectricWeight = _mm_sub_ps(_mm_set1_ps(1.f), lanes.metallic);
+
+	Vec3x4 result{ zero, zero, zero };
+	auto accumulate = [&](const __m128 lobePDF, const __m128 weight, const Vec3x4& lobe) {
+		const __m128 active = _mm_cmpgt_ps(lobePDF, zero);
+		result.x = _mm_add_ps(result.x, _mm_and_ps(active, _mm_mul_ps(weight, lobe.x)));
+		result.y = _mm_add_ps(result.y, _mm_and_ps(active, _mm_mul_ps(weight, lobe.y)));
+		result.z = _mm_add_ps(result.z, _mm_and_ps(active, _mm_mul_ps(weight, lobe.z)));
+	};
+
+	accumulate(pDiffuse, dielectricWeight, EvalDiffuse4(lanes, m));
+
+	const __m128 specular = EvalSpecularReflection4(data, lanes, m);
+	accumulate(pSpecularReflection, dielectricWeight, Vec3x4{ specular, specular, specular });
+
+	accumulate(pConductor, lanes.metallic, EvalConductor4(data, lanes, m));
+
+	return result;
+}
+
+static __m128 EvalPDF4(const BSDFMaterial& data, const BSDFLanes& lanes)
+{
+	__m128 pDiffuse, pSpecularReflection, pConductor;
+	CalculateLobePDFs4(data, lanes, pDiffuse, pSpecularReflection, pConductor);
+
+	const __m128 zero = _mm_setzero_ps();
+	const MicrofacetLanes m = CalcMicrofacetLanes(data, lanes);
+
+	const __m128 sDotN = lanes.scattered.z;
+	const __m128 diffusePDF = _mm_and_ps(_mm_cmpgt_ps(sDotN, zero), _mm_div_ps(sDotN, _mm_set1_ps(pi<float>())));
+	const __m128 specularPDF = EvalMicrofacetPDF4(lanes, m);
+	const __m128 conductorPDF = _mm_and_ps(_mm_cmpge_ps(sDotN, zero), specularPDF);
+
+	__m128 pdf = zero;
+	pdf = _mm_add_ps(pdf, _mm_and_ps(_mm_cmpgt_ps(pDiffuse, zero), _mm_mul_ps(pDiffuse, diffusePDF)));
+	pdf = _mm_add_ps(pdf, _mm_and_ps(_mm_cmpgt_ps(pSpecularReflection, zero), _mm_mul_ps(pSpecularReflection, specularPDF)));
+	pdf = _mm_add_ps(pdf, _mm_and_ps(_mm_cmpgt_ps(pConductor, zero), _mm_mul_ps(pConductor, conductorPDF)));
+	return pdf;
+}
+#endif
+
+void EvalBSDFBatch(const BSDFMaterial& data, const BSDFBatch& batch, float* pOut)
+{
+	const int32_t numGroups = static_cast<int32_t>((batch.size + BSDF_BATCH_LANES - 1) / BSDF_BATCH_LANES);
+	[[maybe_unused]] const bool simd = CanBatchSSE(data);
+
+	#pragma omp parallel for schedule(static) if(batch.size > PARALLEL_BSDF_THRESHOLD)
+	for (int32_t group = 0; group < numGroups; group++) {
+		const size_t start = static_cast<size_t>(group) * BSDF_BATCH_LANES;
+		const size_t end = std::min(start + BSDF_BATCH_LANES, batch.size);
+
+#ifdef BSDF_SSE
+		BSDFLanes lanes;
+		if (simd && end - start == BSDF_BATCH_LANES && LoadLanes(data, batch, start, lanes)) {
+			StoreVec3x4(EvalBSDF4(data, lanes), pOut, start);
+			continue;
+		}
+#endif
+
+		for (size_t i = start; i < end; i++) {
+			StoreBatchVec3(EvalBatchPoint(data, batch, i), pOut, i);
+		}
+	}
+}
+
+void EvalPDFBatch(const BSDFMaterial& data, const BSDFBatch& batch, float* pOut)
+{
+	const int32_t numGroups = static_cast<int32_t>((batch.size + BSDF_BATCH_LANES - 1) / BSDF_BATCH_LANES);
+	[[maybe_unused]] const bool simd = CanBatchSSE(data);
+
+	#pragma omp parallel for schedule(static) if(batch.size > PARALLEL_BSDF_THRESHOLD)
+	for (int32_t group = 0; group < numGroups; group++) {
+		const size_t start = static_cast<size_t>(group) * BSDF_BATCH_LANES;
+		const size_t end = std::min(start + BSDF_BATCH_LANES, batch.size);
+
+#ifdef BSDF_SSE
+		BSDFLanes lanes;
+		if (simd && end - start == BSDF_BATCH_LANES && LoadLanes(data, batch, start, lanes)) {
+			_mm_storeu_ps(pOut + start, EvalPDF4(data, lanes));
+			continue;
+		}
+#endif
+
+		for (size_t i = start; i < end; i++) {
+			pOut[i] = EvalPDFBatchPoint(data, batch, i);
+		}
+	}
+}
+
+void BoxedBSDFMaterial::EvalBatch(const BSDFBatch& batch, float* pOut) const
+{
+	EvalBSDFBatch(material, batch, pOut);
+}
+
+void BoxedBSDFMaterial::EvalPDFBatch(const BSDFBatch& batch, float* pOut) const
+{
+	::EvalPDFBatch(material, batch, pOut);
+}
+#pragma endregion
@@ -3,6 +3,7 @@
 #include "glm/glm.hpp"
 
 #include "vistrace/ISampler.h"
+#include "vistrace/IBSDFMaterial.h"
 
 constexpr float kMinGGXAlpha = 0.0064f;
 
@@ -94,6 +95,18 @@ struct BSDFMaterial
 	void PrepShadingData(const glm::vec3& hitColour, float hitMetalness, float hitRoughness);
 };
 
+/// <summary>
+/// A BSDFMaterial as boxed for Lua, by pointer like the other objects so extensions can read it as an IBSDFMaterial*
+/// </summary>
+class BoxedBSDFMaterial : public VisTrace::IBSDFMaterial
+{
+public:
+	BSDFMaterial material{};
+
+	void EvalBatch(const VisTrace::BSDFBatch& batch, float* pOut) const override;
+	void EvalPDFBatch(const VisTrace::BSDFBatch& batch, float* pOut) const override;
+};
+
 struct BSDFSample
 {
 	glm::vec3 scattered = glm::vec3(0.f);
@@ -120,3 +133,16 @@ float EvalPDF(
 	const glm::vec3& normal, const glm::vec3& tangent, const glm::vec3& binormal,
 	const glm::vec3& incidentWorld, const glm::vec3& scatteredWorld
 );
+
+/// <summary>
+/// Evaluates EvalBSDF at every point of a batch in parallel, 4 points at a time with SSE where the material allows
+/// Points with delta lobes, and materials with specular transmission or anisotropic rotation, fall back to EvalBSDF
+/// </summary>
+/// <param name="pOut">3 floats per point</param>
+void EvalBSDFBatch(const BSDFMaterial& data, const VisTrace::BSDFBatch& batch, float* pOut);
+
+/// <summary>
+/// Evaluates EvalPDF at every point of a batch in parallel, with the same fast path as EvalBSDFBatch
+/// </summary>
+/// <param name="pOut">1 float per point</param>
+void EvalPDFBatch(const BSDFMaterial& data, const VisTrace::BSDFBatch& batch, float* pOut);
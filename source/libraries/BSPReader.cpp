@@ -0,0 +1,163 @@
+#include "BSPReader.h"
+
+#include "GMFS.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+	constexpr int32_t BSP_IDENT = ('P' << 24) + ('S' << 16) + ('B' << 8) + 'V';
+	constexpr int NUM_LUMPS = 64;
+
+	struct Lump
+	{
+		int32_t offset;
+		int32_t length;
+		int32_t version;
+		char fourCC[4];
+	};
+
+	struct Header
+	{
+		int32_t ident;
+		int32_t version;
+		Lump lumps[NUM_LUMPS];
+		int32_t mapRevision;
+	};
+
+	struct GameLump
+	{
+		int32_t id;
+		uint16_t flags;
+		uint16_t version;
+		int32_t offset;
+		int32_t length;
+	};
+
+	enum : int
+	{
+		LUMP_VISIBILITY = 4,
+		LUMP_LIGHTING = 8,
+		LUMP_PHYSDISP = 28,
+		LUMP_PHYSCOLLIDE = 29,
+		LUMP_DISP_LIGHTMAP_ALPHAS = 32,
+		LUMP_DISP_LIGHTMAP_SAMPLE_POSITIONS = 34,
+		LUMP_GAME_LUMP = 35,
+		LUMP_PAKFILE = 40,
+		LUMP_LIGHTING_HDR = 53
+	};
+
+	bool IsLumpUsed(int lump)
+	{
+		switch (lump) {
+		case LUMP_VISIBILITY:
+		case LUMP_LIGHTING:
+		case LUMP_PHYSDISP:
+		case LUMP_PHYSCOLLIDE:
+		case LUMP_DISP_LIGHTMAP_ALPHAS:
+		case LUMP_DISP_LIGHTMAP_SAMPLE_POSITIONS:
+		case LUMP_PAKFILE:
+		case LUMP_LIGHTING_HDR:
+			return false;
+		default:
+			return true;
+		}
+	}
+
+	// Lumps are 4 byte aligned in files written by vbsp
+	size_t Align4(size_t v) { return (v + 3) & ~static_cast<size_t>(3); }
+}
+
+bool ReadBSPLumps(const std::string& path, std::vector<uint8_t>& data, size_t& bytesSkipped)
+{
+	bytesSkipped = 0;
+	if (!FileSystem::Exists(path.c_str(), "GAME")) return false;
+
+	FileHandle_t file = FileSystem::Open(path.c_str(), "rb", "GAME");
+	if (file == nullptr) return false;
+
+	const uint32_t filesize = FileSystem::Size(file);
+
+	if (filesize < sizeof(Header)) {
+		FileSystem::Close(file);
+		return false;
+	}
+
+	Header header;
+	FileSystem::Read(&header, sizeof(Header), file);
+	if (header.ident != BSP_IDENT) {
+		FileSystem::Close(file);
+		return false;
+	}
+
+	// Lay the used lumps out back to back after the header, in the order they appear in the file so reads only ever seek forwards
+	int order[NUM_LUMPS];
+	for (int i = 0; i < NUM_LUMPS; i++) order[i] = i;
+	std::sort(order, order + NUM_LUMPS, [&header](int a, int b) { return header.lumps[a].offset < header.lumps[b].offset; });
+
+	Header compacted = header;
+	size_t size = sizeof(Header);
+	for (int i = 0; i < NUM_LUMPS; i++) {
+		const int lumpIdx = order[i];
+		const Lump& lump = header.lumps[lumpIdx];
+		Lump& out = compacted.lumps[lumpIdx];
+
+		if (
+			lump.offset < 0 || lump.length < 0 ||
+			static_cast<uint64_t>(lump.offset) + static_cast<uint64_t>(lump.length) > filesize
+		) {
+			FileSystem::Close(file);
+			return false;
+		}
+
+		if (lump.length == 0 || !IsLumpUsed(lumpIdx)) {
+			bytesSkipped += lump.length;
+			out.offset = 0;
+			out.length = 0;
+			continue;
+		}
+
+		size = Align4(size);
+		out.offset = static_cast<int32_t>(size);
+		size += lump.length;
+	}
+
+	data.assign(size, 0);
+	memcpy(data.data(), &compacted, sizeof(Header));
+
+	for (int i = 0; i < NUM_LUMPS; i++) {
+		const int lumpIdx = order[i];
+		const Lump& lump = compacted.lumps[lumpIdx];
+		if (lump.length == 0) continue;
+
+		FileSystem::Seek(file, header.lumps[lumpIdx].offset, FILESYSTEM_SEEK_HEAD);
+		FileSystem::Read(data.data() + lump.offset, lump.length, file);
+	}
+
+	FileSystem::Close(file);
+
+	// Game lump entries (static props among them) store absolute file offsets, so move them with the lump
+	const Lump& gameLump = compacted.lumps[LUMP_GAME_LUMP];
+	if (gameLump.length >= static_cast<int32_t>(sizeof(int32_t))) {
+		const int32_t delta = gameLump.offset - header.lumps[LUMP_GAME_LUMP].offset;
+
+		int32_t numGameLumps;
+		memcpy(&numGameLumps, data.data() + gameLump.offset, sizeof(int32_t));
+		if (numGameLumps < 0 || sizeof(int32_t) + numGameLumps * sizeof(GameLump) > static_cast<size_t>(gameLump.length)) {
+			data.clear();
+			return false;
+		}
+
+		for (int32_t i = 0; i < numGameLumps; i++) {
+			uint8_t* pEntry = data.data() + gameLump.offset + sizeof(int32_t) + i * sizeof(GameLump);
+
+			GameLump entry;
+			memcpy(&entry, pEntry, sizeof(GameLump));
+			entry.offset += delta;
+			memcpy(pEntry, &entry, sizeof(GameLump));
+		}
+	}
+
+	return true;
+}
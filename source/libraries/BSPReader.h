@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// <summary>
+/// Reads a BSP from the game filesystem lump by lump, skipping lumps VisTrace never uses (pakfile, lighting, visibility and physics)
+/// The result is a compacted BSP with the skipped lumps left empty, ready to hand to BSPMap
+/// </summary>
+/// <param name="path">Path of the BSP relative to the GAME search path</param>
+/// <param name="data">Output BSP data</param>
+/// <param name="bytesSkipped">Set to the number of bytes of lump data that weren't read</param>
+/// <returns>Whether the BSP was read successfully</returns>
+bool ReadBSPLumps(const std::string& path, std::vector<uint8_t>& data, size_t& bytesSkipped);
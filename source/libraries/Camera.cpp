@@ -0,0 +1,153 @@
+#include "Camera.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "glm/gtc/constants.hpp"
+using namespace glm;
+
+using namespace VisTrace;
+
+void AngleVectors(const vec3& ang, vec3& forward, vec3& right, vec3& up)
+{
+	const float sp = sinf(radians(ang.x)), cp = cosf(radians(ang.x));
+	const float sy = sinf(radians(ang.y)), cy = cosf(radians(ang.y));
+	const float sr = sinf(radians(ang.z)), cr = cosf(radians(ang.z));
+
+	forward = vec3(cp * cy, cp * sy, -sp);
+	right = vec3(-sr * sp * cy + cr * sy, -sr * sp * sy - cr * cy, -sr * cp);
+	up = vec3(cr * sp * cy + sr * sy, cr * sp * sy - sr * cy, cr * cp);
+}
+
+Camera MakeCamera(
+	CameraType type,
+	const vec3& pos, const vec3& ang, float fov,
+	uint16_t width, uint16_t height,
+	float aperture, float focusDistance
+)
+{
+	Camera camera{};
+	camera.type = type;
+	camera.pos = pos;
+	AngleVectors(ang, camera.forward, camera.right, camera.up);
+
+	camera.width = width;
+	camera.height = height;
+	camera.tanHalfFov = tanf(radians(fov) * 0.5f);
+	camera.aspect = width > 0 ? static_cast<float>(height) / width : 1.f;
+
+	camera.aperture = max(aperture, 0.f);
+	camera.focusDistance = max(focusDistance, 0.001f);
+
+	// Angle subtended by a single pixel, see Ray Tracing Gems chapter 20
+	if (width == 0) camera.spreadAngle = 0.f;
+	else if (type == CameraType::Equirectangular) camera.spreadAngle = two_pi<float>() / width;
+	else camera.spreadAngle = atanf(2.f * camera.tanHalfFov / width);
+
+	return camera;
+}
+
+// Maps a unit square sample to a unit disk, preserving stratification
+static vec2 ConcentricSampleDisk(const vec2& sample)
+{
+	vec2 offset = 2.f * sample - 1.f;
+	if (offset.x == 0.f && offset.y == 0.f) return vec2(0.f);
+
+	float r, theta;
+	if (abs(offset.x) > abs(offset.y)) {
+		r = offset.x;
+		theta = quarter_pi<float>() * (offset.y / offset.x);
+	} else {
+		r = offset.y;
+		theta = half_pi<float>() - quarter_pi<float>() * (offset.x / offset.y);
+	}
+	return r * vec2(cosf(theta), sinf(theta));
+}
+
+void GenerateCameraRay(
+	const Camera& camera,
+	float x, float y, const vec2& lensSample,
+	vec3& origin, vec3& direction
+)
+{
+	const float u = x / camera.width, v = y / camera.height;
+
+	if (camera.type == CameraType::Equirectangular) {
+		const float azimuth = (u - 0.5f) * two_pi<float>();
+		const float elevation = (0.5f - v) * pi<float>();
+
+		origin = camera.pos;
+		direction = normalize(
+			cosf(elevation) * (cosf(azimuth) * camera.forward + sinf(azimuth) * camera.right) +
+			sinf(elevation) * camera.up
+		);
+		return;
+	}
+
+	const float px = (2.f * u - 1.f) * camera.tanHalfFov;
+	const float py = (1.f - 2.f * v) * camera.tanHalfFov * camera.aspect;
+	direction = normalize(camera.forward + px * camera.right + py * camera.up);
+	origin = camera.pos;
+
+	if (camera.type == CameraType::ThinLens && camera.aperture > 0.f) {
+		// Every ray through the pixel converges on the plane of focus
+		const vec3 focus = camera.pos + direction * (camera.focusDistance / dot(direction, camera.forward));
+		const vec2 lens = camera.aperture * ConcentricSampleDisk(lensSample);
+
+		origin = camera.pos + lens.x * camera.right + lens.y * camera.up;
+		direction = normalize(focus - origin);
+	}
+}
+
+// PCG hash, used to give each pixel an independent but repeatable lens sample
+static uint32_t PCGHash(uint32_t v)
+{
+	uint32_t state = v * 747796405U + 2891336453U;
+	uint32_t word = ((state >> ((state >> 28U) + 4U)) ^ state) * 277803737U;
+	return (word >> 22U) ^ word;
+}
+
+void GeneratePixelRay(
+	const Camera& camera, uint32_t seed,
+	uint16_t x, uint16_t y,
+	vec3& origin, vec3& direction
+)
+{
+	vec2 lensSample(0.5f);
+	if (camera.type == CameraType::ThinLens) {
+		const uint32_t idx = static_cast<uint32_t>(y) * camera.width + x;
+		const uint32_t hash = PCGHash(idx ^ PCGHash(seed));
+		lensSample = vec2(hash & 0xFFFF, hash >> 16) / 65536.f;
+	}
+
+	GenerateCameraRay(camera, x + 0.5f, y + 0.5f, lensSample, origin, direction);
+}
+
+bool GenerateCameraRays(
+	const Camera& camera, uint32_t seed,
+	IRenderTarget* pOrigins, IRenderTarget* pDirections
+)
+{
+	if (
+		!pOrigins->IsValid() || pOrigins->GetFormat() != RTFormat::RGBFFF ||
+		pOrigins->GetWidth() != camera.width || pOrigins->GetHeight() != camera.height
+	) return false;
+	if (
+		!pDirections->IsValid() || pDirections->GetFormat() != RTFormat::RGBFFF ||
+		pDirections->GetWidth() != camera.width || pDirections->GetHeight() != camera.height
+	) return false;
+
+	vec3* pOriginData = reinterpret_cast<vec3*>(pOrigins->GetRawData());
+	vec3* pDirectionData = reinterpret_cast<vec3*>(pDirections->GetRawData());
+
+	#pragma omp parallel for collapse(2)
+	for (int32_t y = 0; y < camera.height; y++) {
+		for (int32_t x = 0; x < camera.width; x++) {
+			const size_t idx = static_cast<size_t>(y) * camera.width + x;
+			GeneratePixelRay(camera, seed, x, y, pOriginData[idx], pDirectionData[idx]);
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdint>
+#include "glm/glm.hpp"
+
+#include "vistrace/IRenderTarget.h"
+
+enum class CameraType : uint8_t
+{
+	Pinhole,
+	ThinLens,
+	Equirectangular
+};
+
+struct Camera
+{
+	CameraType type = CameraType::Pinhole;
+
+	glm::vec3 pos = glm::vec3(0.f);
+	glm::vec3 forward = glm::vec3(1.f, 0.f, 0.f);
+	glm::vec3 right = glm::vec3(0.f, -1.f, 0.f);
+	glm::vec3 up = glm::vec3(0.f, 0.f, 1.f);
+
+	uint16_t width = 0;
+	uint16_t height = 0;
+
+	float tanHalfFov = 1.f; // Horizontal
+	float aspect = 1.f;     // Height over width
+
+	float aperture = 0.f;        // Lens radius, thin lens only
+	float focusDistance = 100.f; // Thin lens only
+
+	float spreadAngle = 0.f; // Ray cone spread angle per pixel
+};
+
+/// <summary>
+/// Converts Source engine angles (pitch, yaw, roll in degrees) to forward, right, and up vectors
+/// </summary>
+void AngleVectors(const glm::vec3& ang, glm::vec3& forward, glm::vec3& right, glm::vec3& up);
+
+/// <summary>
+/// Creates a camera and precomputes its basis and ray cone spread angle
+/// </summary>
+/// <param name="fov">Horizontal field of view in degrees, ignored by equirectangular cameras</param>
+Camera MakeCamera(
+	CameraType type,
+	const glm::vec3& pos, const glm::vec3& ang, float fov,
+	uint16_t width, uint16_t height,
+	float aperture = 0.f, float focusDistance = 100.f
+);
+
+/// <summary>
+/// Generates a single camera ray
+/// </summary>
+/// <param name="x">Horizontal position in pixels (0.5 is the centre of the first pixel)</param>
+/// <param name="y">Vertical position in pixels</param>
+/// <param name="lensSample">Uniform random numbers used to sample the lens of thin lens cameras</param>
+void GenerateCameraRay(
+	const Camera& camera,
+	float x, float y, const glm::vec2& lensSample,
+	glm::vec3& origin, glm::vec3& direction
+);
+
+/// <summary>
+/// Generates the ray through the centre of a pixel, identical to the one GenerateCameraRays writes for it
+/// </summary>
+/// <param name="seed">Seed for the per pixel lens samples</param>
+void GeneratePixelRay(
+	const Camera& camera, uint32_t seed,
+	uint16_t x, uint16_t y,
+	glm::vec3& origin, glm::vec3& direction
+);
+
+/// <summary>
+/// Fills RGBFFF origin and direction render targets with a ray through the centre of each pixel
+/// </summary>
+/// <param name="seed">Seed for the per pixel lens samples, the same seed always generates the same rays</param>
+/// <returns>False if the render targets aren't RGBFFF and the size of the camera</returns>
+bool GenerateCameraRays(
+	const Camera& camera, uint32_t seed,
+	VisTrace::IRenderTarget* pOrigins, VisTrace::IRenderTarget* pDirections
+);
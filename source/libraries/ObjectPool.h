@@ -0,0 +1,152 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <new>
+
+/// <summary>
+/// Fixed size allocator for objects that are created and destroyed in large numbers, like TraceResults handed to Lua
+/// Objects are carved out of slabs and recycled through free lists, so steady state allocation never touches the heap
+/// Each thread keeps its own free list and only locks the pool to move a batch of slots to or from it
+/// Slabs are only freed with the pool, so pools are meant to live for the lifetime of the module (one per type)
+/// </summary>
+template <typename T, size_t SlabSize = 1024>
+class ObjectPool
+{
+private:
+	union Slot
+	{
+		Slot* pNext;
+		alignas(T) unsigned char storage[sizeof(T)];
+	};
+
+	// Number of slots moved between a thread's free list and the pool at a time
+	static constexpr size_t BATCH_SIZE = 64;
+
+	struct LocalList
+	{
+		const ObjectPool* pPool = nullptr; // Pool the list belongs to, threads only cache slots from the first pool they use
+		Slot* pFree = nullptr;
+		size_t count = 0;
+	};
+
+	// Slots left in the list of a thread that exits aren't returned, which is at most a couple of batches
+	static LocalList& GetLocalList()
+	{
+		static thread_local LocalList list;
+		return list;
+	}
+
+	std::mutex mMutex;
+	std::vector<std::unique_ptr<Slot[]>> mSlabs;
+	Slot* mpFreeList = nullptr;
+
+	std::atomic<size_t> mNumAllocated{ 0 };
+
+	// Must be called with the mutex held
+	Slot* PopShared()
+	{
+		if (mpFreeList == nullptr) {
+			std::unique_ptr<Slot[]> pSlab(new Slot[SlabSize]);
+			for (size_t i = 0; i < SlabSize; i++) {
+				pSlab[i].pNext = i + 1 < SlabSize ? &pSlab[i + 1] : nullptr;
+			}
+			mpFreeList = &pSlab[0];
+			mSlabs.push_back(std::move(pSlab));
+		}
+
+		Slot* pSlot = mpFreeList;
+		mpFreeList = pSlot->pNext;
+		return pSlot;
+	}
+
+	LocalList* GetOwnLocalList()
+	{
+		LocalList& list = GetLocalList();
+		if (list.pPool == nullptr) list.pPool = this;
+		return list.pPool == this ? &list : nullptr;
+	}
+
+public:
+	ObjectPool() = default;
+	ObjectPool(const ObjectPool&) = delete;
+	ObjectPool& operator=(const ObjectPool&) = delete;
+
+	/// <summary>
+	/// Gets uninitialised storage for one T
+	/// </summary>
+	void* Allocate()
+	{
+		mNumAllocated.fetch_add(1, std::memory_order_relaxed);
+
+		LocalList* pList = GetOwnLocalList();
+		if (pList == nullptr) {
+			std::lock_guard<std::mutex> lock(mMutex);
+			return PopShared()->storage;
+		}
+
+		if (pList->pFree == nullptr) {
+			std::lock_guard<std::mutex> lock(mMutex);
+			for (size_t i = 0; i < BATCH_SIZE; i++) {
+				Slot* pSlot = PopShared();
+				pSlot->pNext = pList->pFree;
+				pList->pFree = pSlot;
+			}
+			pList->count = BATCH_SIZE;
+		}
+
+		Slot* pSlot = pList->pFree;
+		pList->pFree = pSlot->pNext;
+		pList->count--;
+		return pSlot->storage;
+	}
+
+	/// <summary>
+	/// Returns storage from Allocate to the pool, the object must already have been destroyed
+	/// Storage may be freed on a different thread to the one that allocated it
+	/// </summary>
+	void Free(void* p)
+	{
+		if (p == nullptr) return;
+		mNumAllocated.fetch_sub(1, std::memory_order_relaxed);
+
+		Slot* pSlot = reinterpret_cast<Slot*>(p);
+		LocalList* pList = GetOwnLocalList();
+		if (pList == nullptr) {
+			std::lock_guard<std::mutex> lock(mMutex);
+			pSlot->pNext = mpFreeList;
+			mpFreeList = pSlot;
+			return;
+		}
+
+		pSlot->pNext = pList->pFree;
+		pList->pFree = pSlot;
+		pList->count++;
+
+		// Hand a batch back once the list holds two, so a thread that only frees doesn't hoard slots
+		if (pList->count >= BATCH_SIZE * 2) {
+			std::lock_guard<std::mutex> lock(mMutex);
+			for (size_t i = 0; i < BATCH_SIZE; i++) {
+				Slot* pReturned = pList->pFree;
+				pList->pFree = pReturned->pNext;
+				pReturned->pNext = mpFreeList;
+				mpFreeList = pReturned;
+			}
+			pList->count -= BATCH_SIZE;
+		}
+	}
+
+	size_t GetNumAllocated() const
+	{
+		return mNumAllocated.load(std::memory_order_relaxed);
+	}
+
+	size_t GetCapacity()
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		return mSlabs.size() * SlabSize;
+	}
+};
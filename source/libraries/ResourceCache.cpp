@@ -1,51 +1,468 @@
 #include "ResourceCache.h"
 
 #include "VTFTexture.h"
+#include "GMFS.h"
 
 #include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <atomic>
 #include <new>
+#include <mutex>
+#include <shared_mutex>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 using namespace VisTrace;
+using namespace ResourceCache;
+
+namespace
+{
+	std::atomic<size_t> memoryBudget{ 0 };
+
+	// MIPs are only decoded while the bytes of every decoded MIP fit in this
+	std::atomic<size_t> decodeBudget{ 0 };
+	std::atomic<size_t> decodedBytes{ 0 };
+	std::atomic<size_t> numDecodedMIPs{ 0 };
+	std::atomic<size_t> numMIPEvictions{ 0 };
+
+	// Advanced once per game frame, decoded MIPs not sampled for mipTimeout frames are evicted
+	std::atomic<uint32_t> frameCounter{ 1 };
+	std::atomic<uint32_t> mipTimeout{ 300 };
+	std::atomic<uint64_t> useClock{ 0 };
+
+	std::atomic<size_t> numHits{ 0 };
+	std::atomic<size_t> numMisses{ 0 };
+	std::atomic<size_t> numEvictions{ 0 };
+	std::atomic<size_t> numProbesSaved{ 0 };
+
+	// Only one thread trims at a time, others just skip it
+	std::mutex trimMutex;
+
+	/// <summary>
+	/// Map of paths to resources split into shards, each with its own lock
+	/// Hits only take a shared lock on one shard, and each resource is constructed exactly once even if several threads miss on it at the same time
+	/// </summary>
+	template <typename T>
+	class ConcurrentCache
+	{
+	public:
+		struct Entry
+		{
+			std::once_flag constructed;
+			std::shared_ptr<const T> pResource;
+			size_t bytes = 0;
+			std::atomic<uint64_t> lastUse{ 0 };
+		};
+
+		// A resource nothing outside the cache references, which can be evicted
+		struct Candidate
+		{
+			std::string path;
+			uint64_t lastUse;
+		};
+
+	private:
+		struct Shard
+		{
+			std::shared_mutex mutex;
+			std::unordered_map<std::string, std::shared_ptr<Entry>> entries;
+		};
+
+		static constexpr size_t NUM_SHARDS = 16;
+		Shard mShards[NUM_SHARDS];
+
+		std::atomic<size_t> mBytes{ 0 };
+		std::atomic<size_t> mCount{ 0 };
+
+		Shard& GetShard(const std::string& path)
+		{
+			return mShards[std::hash<std::string>{}(path) % NUM_SHARDS];
+		}
+
+	public:
+		/// <summary>
+		/// Gets a resource, constructing it with the factory on the first request
+		/// Failed constructions (nullptr) aren't kept, so the next request tries again
+		/// </summary>
+		/// <param name="factory">Returns the resource and sets its size in bytes</param>
+		template <typename Factory>
+		std::shared_ptr<const T> GetOrCreate(const std::string& path, Factory&& factory)
+		{
+			Shard& shard = GetShard(path);
 
-static auto textureCache = std::unordered_map<std::string, const IVTFTexture*>();
-static auto modelCache = std::unordered_map<std::string, const Model*>();
+			std::shared_ptr<Entry> pEntry;
+			{
+				std::shared_lock<std::shared_mutex> lock(shard.mutex);
+				auto it = shard.entries.find(path);
+				if (it != shard.entries.end()) pEntry = it->second;
+			}
 
-const IVTFTexture* ResourceCache::GetTexture(const std::string& path, const std::string& fallback)
+			if (pEntry == nullptr) {
+				std::unique_lock<std::shared_mutex> lock(shard.mutex);
+				pEntry = shard.entries.try_emplace(path, std::make_shared<Entry>()).first->second;
+			}
+
+			// Constructed outside of the shard lock, so a slow load only blocks threads waiting on the same path
+			// It's published under the lock though, as eviction and iteration read entries with only the shard locked
+			bool constructed = false;
+			std::call_once(pEntry->constructed, [&]() {
+				size_t bytes = 0;
+				std::shared_ptr<const T> pResource = factory(bytes);
+
+				std::unique_lock<std::shared_mutex> lock(shard.mutex);
+				pEntry->pResource = std::move(pResource);
+				pEntry->bytes = bytes;
+				constructed = true;
+			});
+
+			if (pEntry->pResource == nullptr) {
+				std::unique_lock<std::shared_mutex> lock(shard.mutex);
+				auto it = shard.entries.find(path);
+				if (it != shard.entries.end() && it->second == pEntry) shard.entries.erase(it);
+				return nullptr;
+			}
+
+			pEntry->lastUse.store(useClock.fetch_add(1, std::memory_order_relaxed), std::memory_order_relaxed);
+			if (constructed) {
+				numMisses++;
+				mBytes += pEntry->bytes;
+				mCount++;
+				Trim();
+			} else {
+				numHits++;
+			}
+
+			return pEntry->pResource;
+		}
+
+		void GetCandidates(std::vector<Candidate>& candidates)
+		{
+			for (Shard& shard : mShards) {
+				std::shared_lock<std::shared_mutex> lock(shard.mutex);
+				for (const auto& [path, pEntry] : shard.entries) {
+					// Only the entry itself holds the resource, and the map holds the only reference to the entry so nothing is mid lookup
+					if (pEntry.use_count() == 1 && pEntry->pResource != nullptr && pEntry->pResource.use_count() == 1) {
+						candidates.push_back(Candidate{ path, pEntry->lastUse.load(std::memory_order_relaxed) });
+					}
+				}
+			}
+		}
+
+		/// <summary>
+		/// Evicts a resource if it's still unreferenced
+		/// </summary>
+		/// <returns>Bytes freed</returns>
+		size_t Evict(const std::string& path)
+		{
+			Shard& shard = GetShard(path);
+			std::unique_lock<std::shared_mutex> lock(shard.mutex);
+
+			auto it = shard.entries.find(path);
+			if (it == shard.entries.end()) return 0;
+
+			const std::shared_ptr<Entry>& pEntry = it->second;
+			if (pEntry.use_count() != 1 || pEntry->pResource == nullptr || pEntry->pResource.use_count() != 1) return 0;
+
+			const size_t bytes = pEntry->bytes;
+			shard.entries.erase(it);
+
+			mBytes -= bytes;
+			mCount--;
+			numEvictions++;
+			return bytes;
+		}
+
+		/// <summary>
+		/// Calls a function on every constructed resource, with its shard locked for reading
+		/// </summary>
+		template <typename Func>
+		void ForEach(Func&& func)
+		{
+			for (Shard& shard : mShards) {
+				std::shared_lock<std::shared_mutex> lock(shard.mutex);
+				for (const auto& [path, pEntry] : shard.entries) {
+					if (pEntry->pResource != nullptr) func(*pEntry->pResource);
+				}
+			}
+		}
+
+		size_t GetBytes() const { return mBytes; }
+		size_t GetCount() const { return mCount; }
+
+		/// <summary>
+		/// Drops every resource, which are freed once nothing else references them
+		/// </summary>
+		void Clear()
+		{
+			for (Shard& shard : mShards) {
+				std::unique_lock<std::shared_mutex> lock(shard.mutex);
+				shard.entries.clear();
+			}
+			mBytes = 0;
+			mCount = 0;
+		}
+	};
+
+	/// <summary>
+	/// Paths known not to exist, so they're only ever probed on the file system once
+	/// </summary>
+	class MissingSet
+	{
+	private:
+		mutable std::shared_mutex mMutex;
+		std::unordered_set<std::string> mPaths;
+
+	public:
+		bool Contains(const std::string& path) const
+		{
+			std::shared_lock<std::shared_mutex> lock(mMutex);
+			return mPaths.find(path) != mPaths.end();
+		}
+
+		void Insert(const std::string& path)
+		{
+			std::unique_lock<std::shared_mutex> lock(mMutex);
+			mPaths.insert(path);
+		}
+
+		size_t Size() const
+		{
+			std::shared_lock<std::shared_mutex> lock(mMutex);
+			return mPaths.size();
+		}
+
+		void Clear()
+		{
+			std::unique_lock<std::shared_mutex> lock(mMutex);
+			mPaths.clear();
+		}
+	};
+
+	ConcurrentCache<IVTFTexture> textureCache;
+	ConcurrentCache<Model> modelCache;
+
+	MissingSet missingTextures;
+	MissingSet missingModels;
+	MissingSet missingFiles;
+}
+
+void ResourceCache::Trim()
+{
+	const size_t budget = memoryBudget;
+	if (budget == 0 || textureCache.GetBytes() + modelCache.GetBytes() <= budget) return;
+
+	std::unique_lock<std::mutex> lock(trimMutex, std::try_to_lock);
+	if (!lock.owns_lock()) return;
+
+	std::vector<ConcurrentCache<IVTFTexture>::Candidate> textures;
+	std::vector<ConcurrentCache<Model>::Candidate> models;
+	textureCache.GetCandidates(textures);
+	modelCache.GetCandidates(models);
+
+	// Merge both caches' candidates, oldest first
+	struct Candidate { bool isTexture; size_t idx; uint64_t lastUse; };
+	std::vector<Candidate> candidates;
+	candidates.reserve(textures.size() + models.size());
+	for (size_t i = 0; i < textures.size(); i++) candidates.push_back(Candidate{ true, i, textures[i].lastUse });
+	for (size_t i = 0; i < models.size(); i++) candidates.push_back(Candidate{ false, i, models[i].lastUse });
+	std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) { return a.lastUse < b.lastUse; });
+
+	for (const Candidate& candidate : candidates) {
+		if (textureCache.GetBytes() + modelCache.GetBytes() <= budget) break;
+
+		if (candidate.isTexture) textureCache.Evict(textures[candidate.idx].path);
+		else modelCache.Evict(models[candidate.idx].path);
+	}
+}
+
+bool ResourceCache::ReserveDecode(const size_t bytes)
 {
-	if (textureCache.find(path) != textureCache.end()) return textureCache[path];
+	const size_t budget = decodeBudget;
+	if (bytes == 0 || budget == 0) return false;
+
+	size_t current = decodedBytes.load();
+	do {
+		if (current + bytes > budget) return false;
+	} while (!decodedBytes.compare_exchange_weak(current, current + bytes));
 
+	numDecodedMIPs++;
+	return true;
+}
+
+void ResourceCache::ReleaseDecode(const size_t bytes)
+{
+	decodedBytes -= bytes;
+	numDecodedMIPs--;
+}
+
+uint32_t ResourceCache::GetFrame()
+{
+	return frameCounter.load(std::memory_order_relaxed);
+}
+
+void ResourceCache::AdvanceFrame()
+{
+	const uint32_t frame = ++frameCounter;
+	const uint32_t timeout = mipTimeout;
+	if (timeout == 0 || frame <= timeout || decodedBytes == 0) return;
+
+	// Every cached texture is a VTFTextureWrapper
+	size_t numEvicted = 0;
+	textureCache.ForEach([frame, timeout, &numEvicted](const IVTFTexture& texture) {
+		numEvicted += static_cast<const VTFTextureWrapper&>(texture).EvictMIPs(frame - timeout);
+	});
+	numMIPEvictions += numEvicted;
+}
+
+TextureRef ResourceCache::GetTexture(const std::string& path, const std::string& fallback)
+{
+	TextureRef pTexture = nullptr;
 	if (!path.empty()) {
-		const IVTFTexture* pTexture = new (std::nothrow) VTFTextureWrapper(path);
-		if (pTexture != nullptr && pTexture->IsValid()) {
-			textureCache.emplace(path, pTexture);
-			return pTexture;
+		if (missingTextures.Contains(path)) {
+			numProbesSaved++;
+		} else {
+			pTexture = textureCache.GetOrCreate(path, [&path](size_t& bytes) -> TextureRef {
+				VTFTextureWrapper* pTexture = new (std::nothrow) VTFTextureWrapper(path);
+				if (pTexture != nullptr && pTexture->IsValid()) {
+					// MIPs are decoded as they're sampled, for as long as they fit in the decode budget
+					if (decodeBudget > 0) pTexture->EnableDecoding();
+
+					bytes = pTexture->GetMemorySize();
+					return TextureRef(pTexture);
+				}
+
+				if (pTexture != nullptr) delete pTexture;
+				missingTextures.Insert(path);
+				return nullptr;
+			});
 		}
-		if (pTexture != nullptr) delete pTexture;
 	}
+	if (pTexture != nullptr) return pTexture;
 
-	return (fallback.empty() || textureCache.find(fallback) == textureCache.end()) ? nullptr : textureCache[fallback];
+	return fallback.empty() ? nullptr : GetTexture(fallback);
 }
 
-const Model* ResourceCache::GetModel(const std::string& path, const std::string& fallback)
+ModelRef ResourceCache::GetModel(const std::string& path, const std::string& fallback)
 {
-	if (modelCache.find(path) != modelCache.end()) return modelCache[path];
-
+	ModelRef pModel = nullptr;
 	if (!path.empty()) {
-		const Model* pModel = new (std::nothrow) Model(path.substr(0, path.length() - 4));
-		if (pModel != nullptr && pModel->IsValid()) {
-			modelCache.emplace(path, pModel);
-			return pModel;
+		if (missingModels.Contains(path)) {
+			numProbesSaved++;
+		} else {
+			pModel = modelCache.GetOrCreate(path, [&path](size_t& bytes) -> ModelRef {
+				Model* pModel = new (std::nothrow) Model(path.substr(0, path.length() - 4));
+				if (pModel != nullptr && pModel->IsValid()) {
+					bytes = pModel->GetMemorySize();
+					return ModelRef(pModel);
+				}
+
+				if (pModel != nullptr) delete pModel;
+				missingModels.Insert(path);
+				return nullptr;
+			});
 		}
-		if (pModel != nullptr) delete pModel;
 	}
+	if (pModel != nullptr) return pModel;
 
-	return (fallback.empty() || modelCache.find(fallback) == modelCache.end()) ? nullptr : modelCache[fallback];
+	return fallback.empty() ? nullptr : GetModel(fallback);
 }
 
-void ResourceCache::Clear()
+bool ResourceCache::FileExists(const std::string& path)
+{
+	if (missingFiles.Contains(path)) {
+		numProbesSaved++;
+		return false;
+	}
+
+	if (FileSystem::Exists(path.c_str(), "GAME")) return true;
+
+	missingFiles.Insert(path);
+	return false;
+}
+
+size_t ResourceCache::PreloadTextures(const std::vector<std::string>& paths)
+{
+	std::unordered_set<std::string> seen;
+	std::vector<std::string> toLoad;
+	for (const std::string& path : paths) {
+		if (!path.empty() && seen.insert(path).second) toLoad.push_back(path);
+	}
+
+	#pragma omp parallel for schedule(dynamic)
+	for (int32_t i = 0; i < static_cast<int32_t>(toLoad.size()); i++) {
+		GetTexture(toLoad[i]);
+	}
+
+	return toLoad.size();
+}
+
+void ResourceCache::PreloadModels(const std::vector<std::string>& paths)
 {
-	for (const auto& [k, pTex] : textureCache) {
-		delete pTex;
+	std::unordered_set<std::string> seen;
+	std::vector<std::string> toLoad;
+	for (const std::string& path : paths) {
+		if (!path.empty() && seen.insert(path).second) toLoad.push_back(path);
 	}
-	textureCache.clear();
+
+	#pragma omp parallel for schedule(dynamic)
+	for (int32_t i = 0; i < static_cast<int32_t>(toLoad.size()); i++) {
+		GetModel(toLoad[i]);
+	}
+}
+
+void ResourceCache::SetDecodeBudget(size_t bytes)
+{
+	decodeBudget = bytes;
+}
+
+void ResourceCache::SetMIPTimeout(uint32_t frames)
+{
+	mipTimeout = frames;
+}
+
+void ResourceCache::SetMemoryBudget(size_t bytes)
+{
+	memoryBudget = bytes;
+	Trim();
+}
+
+Stats ResourceCache::GetStats()
+{
+	Stats stats{};
+	stats.hits = numHits;
+	stats.misses = numMisses;
+	stats.evictions = numEvictions;
+
+	stats.numTextures = textureCache.GetCount();
+	stats.numModels = modelCache.GetCount();
+	stats.textureBytes = textureCache.GetBytes();
+	stats.modelBytes = modelCache.GetBytes();
+
+	stats.budget = memoryBudget;
+
+	stats.decodedBytes = decodedBytes;
+	stats.numDecodedMIPs = numDecodedMIPs;
+	stats.mipEvictions = numMIPEvictions;
+	stats.decodeBudget = decodeBudget;
+
+	stats.numMissing = missingTextures.Size() + missingModels.Size() + missingFiles.Size();
+	stats.probesSaved = numProbesSaved;
+	return stats;
+}
+
+void ResourceCache::ClearMissing()
+{
+	missingTextures.Clear();
+	missingModels.Clear();
+	missingFiles.Clear();
+}
+
+void ResourceCache::Clear()
+{
+	textureCache.Clear();
+	modelCache.Clear();
+	ClearMissing();
 }
@@ -4,11 +4,102 @@
 #include "Model.h"
 
 #include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
 
+// Safe to use from any thread, except Clear
 namespace ResourceCache
 {
-	const VisTrace::IVTFTexture* GetTexture(const std::string& path, const std::string& fallback = "");
-	const Model* GetModel(const std::string& path, const std::string& fallback = "");
+	// Resources stay alive for as long as any reference to them does, even if they're evicted from the cache
+	using TextureRef = std::shared_ptr<const VisTrace::IVTFTexture>;
+	using ModelRef = std::shared_ptr<const Model>;
+
+	struct Stats
+	{
+		size_t hits = 0;
+		size_t misses = 0;
+		size_t evictions = 0;
+
+		size_t numTextures = 0;
+		size_t numModels = 0;
+		size_t textureBytes = 0;
+		size_t modelBytes = 0;
+
+		size_t budget = 0; // 0 if unlimited
+
+		size_t decodedBytes = 0; // Not included in textureBytes
+		size_t numDecodedMIPs = 0;
+		size_t mipEvictions = 0;
+		size_t decodeBudget = 0;
+
+		size_t numMissing = 0; // Paths known not to exist
+		size_t probesSaved = 0; // File system lookups skipped because the path was known not to exist
+	};
+
+	TextureRef GetTexture(const std::string& path, const std::string& fallback = "");
+	ModelRef GetModel(const std::string& path, const std::string& fallback = "");
+
+	/// <summary>
+	/// Checks if a file exists in the GAME search path, remembering files that don't so they're only probed once
+	/// </summary>
+	bool FileExists(const std::string& path);
+
+	/// <summary>
+	/// Reads and decodes any textures that aren't already cached in parallel, so later calls to GetTexture are just lookups
+	/// </summary>
+	/// <returns>Number of unique paths requested</returns>
+	size_t PreloadTextures(const std::vector<std::string>& paths);
+
+	/// <summary>
+	/// Parses any models that aren't already cached in parallel, so later calls to GetModel are just lookups
+	/// </summary>
+	void PreloadModels(const std::vector<std::string>& paths);
+
+	/// <summary>
+	/// Sets the memory budget shared by textures and models, evicting least recently used resources nothing else references when it's exceeded
+	/// </summary>
+	/// <param name="bytes">Budget in bytes, 0 for unlimited</param>
+	void SetMemoryBudget(size_t bytes);
+
+	/// <summary>
+	/// Sets how many bytes texture MIPs can be decoded into as they're sampled, trading memory for sampling without decompressing texels on every tap
+	/// Only textures loaded while the budget is non-zero are decoded, and MIPs that don't fit (or textures that are volumetric, cubemaps, or animated) sample from their VTF data as before
+	/// </summary>
+	/// <param name="bytes">Budget in bytes, 0 to stop decoding</param>
+	void SetDecodeBudget(size_t bytes);
+
+	/// <summary>
+	/// Reserves space in the decode budget for a MIP
+	/// </summary>
+	/// <returns>False if it doesn't fit</returns>
+	bool ReserveDecode(size_t bytes);
+	void ReleaseDecode(size_t bytes);
+
+	/// <summary>
+	/// Sets how many frames a decoded MIP larger than 64x64 can go without being sampled before it's evicted
+	/// </summary>
+	/// <param name="frames">Frames, 0 to never evict</param>
+	void SetMIPTimeout(uint32_t frames);
+
+	uint32_t GetFrame();
+
+	/// <summary>
+	/// Advances the frame counter and evicts decoded MIPs that have timed out, call once per game frame
+	/// </summary>
+	void AdvanceFrame();
+
+	/// <summary>
+	/// Evicts unreferenced resources, least recently used first, until the cache fits in the budget
+	/// </summary>
+	void Trim();
+
+	Stats GetStats();
+
+	/// <summary>
+	/// Forgets which paths are missing, for when files may have been added (e.g. after mounting content)
+	/// </summary>
+	void ClearMissing();
 
 	void Clear();
 }
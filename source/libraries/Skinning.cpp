@@ -0,0 +1,138 @@
+#include "Skinning.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define SKINNING_SSE
+#include <xmmintrin.h>
+#endif
+
+#include "glm/gtx/compatibility.hpp"
+using namespace glm;
+
+// Below this many vertices the cost of spinning up threads outweighs the work
+#define PARALLEL_SKINNING_THRESHOLD 4096
+
+void BuildSkinningPalette(const std::vector<mat4>& bones, const Model* pModel, std::vector<mat4>& palette)
+{
+	palette.resize(bones.size());
+	for (size_t i = 0; i < bones.size(); i++) {
+		palette[i] = bones[i] * pModel->GetBindMatrix(i);
+	}
+}
+
+#ifdef SKINNING_SSE
+static inline __m128 TransformSSE(const __m128 cols[4], const vec3& v, const bool point)
+{
+	__m128 out = _mm_add_ps(
+		_mm_add_ps(
+			_mm_mul_ps(cols[0], _mm_set1_ps(v.x)),
+			_mm_mul_ps(cols[1], _mm_set1_ps(v.y))
+		),
+		_mm_mul_ps(cols[2], _mm_set1_ps(v.z))
+	);
+	return point ? _mm_add_ps(out, cols[3]) : out;
+}
+
+static inline vec3 StoreVec3(const __m128 v)
+{
+	alignas(16) float out[4];
+	_mm_store_ps(out, v);
+	return vec3(out[0], out[1], out[2]);
+}
+#endif
+
+void SkinVertices(
+	const SkinVertex* pVertices, size_t numVertices,
+	const mat4* pPalette, size_t numBones,
+	SkinnedVertex* pOut
+)
+{
+	#pragma omp parallel for schedule(static) if(numVertices > PARALLEL_SKINNING_THRESHOLD)
+	for (int32_t i = 0; i < static_cast<int32_t>(numVertices); i++) {
+		const SkinVertex& vertex = pVertices[i];
+		const uint8_t numWeights = vertex.numBones < 3 ? vertex.numBones : 3;
+
+#ifdef SKINNING_SSE
+		// Blend the palette matrices column by column, then transform with the blended matrix
+		__m128 cols[4] = { _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps() };
+		for (uint8_t w = 0; w < numWeights; w++) {
+			int8_t bone = vertex.boneIds[w];
+			if (bone < 0 || static_cast<size_t>(bone) >= numBones) bone = 0;
+
+			const float* m = &pPalette[bone][0][0];
+			const __m128 weight = _mm_set1_ps(vertex.weights[w]);
+			cols[0] = _mm_add_ps(cols[0], _mm_mul_ps(_mm_loadu_ps(m), weight));
+			cols[1] = _mm_add_ps(cols[1], _mm_mul_ps(_mm_loadu_ps(m + 4), weight));
+			cols[2] = _mm_add_ps(cols[2], _mm_mul_ps(_mm_loadu_ps(m + 8), weight));
+			cols[3] = _mm_add_ps(cols[3], _mm_mul_ps(_mm_loadu_ps(m + 12), weight));
+		}
+
+		pOut[i].pos = StoreVec3(TransformSSE(cols, vertex.pos, true));
+		pOut[i].normal = StoreVec3(TransformSSE(cols, vertex.normal, false));
+		pOut[i].tangent = StoreVec3(TransformSSE(cols, vertex.tangent, false));
+#else
+		mat4 blended(0.f);
+		for (uint8_t w = 0; w < numWeights; w++) {
+			int8_t bone = vertex.boneIds[w];
+			if (bone < 0 || static_cast<size_t>(bone) >= numBones) bone = 0;
+
+			blended += pPalette[bone] * vertex.weights[w];
+		}
+
+		pOut[i].pos = vec3(blended * vec4(vertex.pos, 1.f));
+		pOut[i].normal = vec3(blended * vec4(vertex.normal, 0.f));
+		pOut[i].tangent = vec3(blended * vec4(vertex.tangent, 0.f));
+#endif
+	}
+}
+
+void AssembleSkinnedTriangles(const Mesh* pMesh, const SkinnedVertex* pSkinned, Triangle* pTris)
+{
+	const SkinVertex* pVertices = pMesh->GetVertices();
+	const int32_t numTris = pMesh->GetNumTriangles();
+
+	#pragma omp parallel for schedule(static) if(numTris > PARALLEL_SKINNING_THRESHOLD)
+	for (int32_t triIdx = 0; triIdx < numTris; triIdx++) {
+		const uint32_t indices[3] = {
+			pMesh->GetIndex(triIdx * 3),
+			pMesh->GetIndex(triIdx * 3 + 1),
+			pMesh->GetIndex(triIdx * 3 + 2)
+		};
+
+		const glm::vec2 uvs[3] = {
+			pVertices[indices[0]].uv,
+			pVertices[indices[1]].uv,
+			pVertices[indices[2]].uv
+		};
+
+		const SkinnedVertex* verts[3] = { pSkinned + indices[0], pSkinned + indices[1], pSkinned + indices[2] };
+
+		Triangle tri(
+			Vector3(verts[0]->pos.x, verts[0]->pos.y, verts[0]->pos.z),
+			Vector3(verts[1]->pos.x, verts[1]->pos.y, verts[1]->pos.z),
+			Vector3(verts[2]->pos.x, verts[2]->pos.y, verts[2]->pos.z),
+			pMesh->GetTriangleMaterial(triIdx),
+			uvs,
+			false
+		);
+
+		tri.alphas[0] = tri.alphas[1] = tri.alphas[2] = 0.f;
+
+		for (int j = 0; j < 3; j++) {
+			tri.normals[j] = verts[j]->normal;
+			if (!all(isfinite(tri.normals[j]))) {
+				tri.normals[j] = vec3(tri.nNorm[0], tri.nNorm[1], tri.nNorm[2]);
+			}
+
+			tri.tangents[j] = verts[j]->tangent;
+			if (!all(isfinite(tri.tangents[j]))) {
+				tri.tangents[j] = normalize(vec3(tri.e1[0], tri.e1[1], tri.e1[2]));
+			}
+		}
+
+		pTris[triIdx] = tri;
+	}
+}
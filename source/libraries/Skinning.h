@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "Model.h"
+#include "Primitives.h"
+
+/// <summary>
+/// Vertex after skinning, in world space
+/// </summary>
+struct SkinnedVertex
+{
+	glm::vec3 pos;
+	glm::vec3 normal;
+	glm::vec3 tangent;
+};
+
+/// <summary>
+/// Premultiplies each bone's transform by its bind matrix, so skinning only needs one matrix per bone
+/// </summary>
+/// <param name="bones">Bone to world transforms</param>
+/// <param name="pModel">Model to read bind matrices from</param>
+/// <param name="palette">Output palette, resized to the number of bones</param>
+void BuildSkinningPalette(const std::vector<glm::mat4>& bones, const Model* pModel, std::vector<glm::mat4>& palette);
+
+/// <summary>
+/// Skins vertices by the blended palette matrices of their bones
+/// Bone ids outside of the palette are treated as bone 0
+/// </summary>
+/// <param name="pVertices">Bind pose vertices</param>
+/// <param name="numVertices">Number of vertices</param>
+/// <param name="pPalette">Skinning palette from BuildSkinningPalette</param>
+/// <param name="numBones">Number of matrices in the palette</param>
+/// <param name="pOut">Output vertices, must have space for numVertices</param>
+void SkinVertices(
+	const SkinVertex* pVertices, size_t numVertices,
+	const glm::mat4* pPalette, size_t numBones,
+	SkinnedVertex* pOut
+);
+
+/// <summary>
+/// Builds triangles from a mesh's index buffer and its skinned vertices
+/// Materials are the mesh's own submaterial indices, and entIdx is left at 0
+/// </summary>
+/// <param name="pMesh">Mesh the vertices were skinned from</param>
+/// <param name="pSkinned">Skinned vertices, one per mesh vertex</param>
+/// <param name="pTris">Triangles to write to, must have space for the mesh's triangles</param>
+void AssembleSkinnedTriangles(const Mesh* pMesh, const SkinnedVertex* pSkinned, Triangle* pTris);
@@ -1,4 +1,8 @@
 #include <stdexcept>
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+#include <iterator>
 
 #include "GMFS.h"
 
@@ -8,13 +12,16 @@
 #include "TraceResult.h"
 
 #include "ResourceCache.h"
+#include "BSPReader.h"
 #include "Model.h"
-
-#include "bvh/locally_ordered_clustering_builder.hpp"
-#include "bvh/leaf_collapser.hpp"
+#include "Skinning.h"
 
 #include "glm/gtx/euler_angles.hpp"
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 #define MISSING_TEXTURE "debug/debugempty"
 #define WATER_BASE_TEXTURE "models/debug/debugwhite"
 
@@ -31,82 +38,6 @@ void normalise(Vector3& v)
 	v[2] /= length;
 }
 
-glm::vec3 TransformToBone(
-	const glm::vec3& vec,
-	const std::vector<glm::mat4>& bones, const std::vector<glm::mat4>& binds,
-	uint8_t numBones, float weights[3], int8_t boneIds[3],
-	const bool angleOnly = false
-)
-{
-	glm::vec4 final(0.f);
-	glm::vec4 vertex = glm::vec4(vec, angleOnly ? 0.f : 1.f);
-	for (size_t i = 0U; i < numBones; i++) {
-		final += bones[boneIds[i]] * binds[boneIds[i]] * vertex * weights[i];
-	}
-	return glm::vec3(final);
-}
-
-Vector3 TransformToBone(
-	const Vector3& vec,
-	const std::vector<glm::mat4>& bones, const std::vector<glm::mat4>& binds,
-	uint8_t numBones, float weights[3], int8_t boneIds[3],
-	const bool angleOnly = false
-)
-{
-	glm::vec3 tmp = TransformToBone(
-		glm::vec3(vec[0], vec[1], vec[2]),
-		bones, binds,
-		numBones, weights, boneIds,
-		angleOnly
-	);
-
-	return Vector3(tmp.x, tmp.y, tmp.z);
-}
-
-void SkinTriangle(Triangle& tri, const std::vector<glm::mat4>& bones, const std::vector<glm::mat4>& binds)
-{
-	Vector3 vertexPositions[3] = {
-					tri.p0,
-					tri.p0 - tri.e1,
-					tri.p0 + tri.e2
-	};
-
-	for (int vertIdx = 0; vertIdx < 3; vertIdx++) {
-		vertexPositions[vertIdx] = TransformToBone(
-			vertexPositions[vertIdx],
-			bones, binds,
-			tri.numBones[vertIdx], tri.weights[vertIdx], tri.boneIds[vertIdx]
-		);
-
-		tri.normals[vertIdx] = TransformToBone(
-			tri.normals[vertIdx],
-			bones, binds,
-			tri.numBones[vertIdx], tri.weights[vertIdx], tri.boneIds[vertIdx],
-			true
-		);
-
-		tri.tangents[vertIdx] = TransformToBone(
-			tri.tangents[vertIdx],
-			bones, binds,
-			tri.numBones[vertIdx], tri.weights[vertIdx], tri.boneIds[vertIdx],
-			true
-		);
-	}
-
-	tri.p0 = vertexPositions[0];
-	tri.e1 = vertexPositions[0] - vertexPositions[1];
-	tri.e2 = vertexPositions[2] - vertexPositions[0];
-
-	tri.ComputeNormalAndLoD();
-}
-
-void SkinTriangle(Triangle& tri, const glm::mat4 bone, glm::mat4 bind)
-{
-	std::vector<glm::mat4> bones{ bone };
-	std::vector<glm::mat4> binds{ bind };
-	SkinTriangle(tri, bones, binds);
-}
-
 Material ReadEntityMaterial(IMaterial* sourceMaterial, const std::string& materialPath)
 {
 	Material mat{};
@@ -117,11 +48,6 @@ Material ReadEntityMaterial(IMaterial* sourceMaterial, const std::string& materi
 	mat.normalMapPath = GetMaterialString(sourceMaterial, "$bumpmap");
 	mat.detailPath = GetMaterialString(sourceMaterial, "$detail");
 
-	mat.baseTexture = ResourceCache::GetTexture(mat.baseTexPath, MISSING_TEXTURE);
-	mat.normalMap = ResourceCache::GetTexture(mat.normalMapPath);
-	mat.detail = ResourceCache::GetTexture(mat.detailPath);
-	if (!mat.baseTexPath.empty()) mat.mrao = ResourceCache::GetTexture("vistrace/pbr/" + mat.baseTexPath + "_mrao");
-
 	IMaterialVar* basetexturetransform = GetMaterialVar(sourceMaterial, "$basetexturetransform");
 	if (basetexturetransform) {
 		const VMatrix pMat = basetexturetransform->GetMatrixValue();
@@ -180,21 +106,197 @@ Material ReadEntityMaterial(IMaterial* sourceMaterial, const std::string& materi
 	return mat;
 }
 
-World::World(GarrysMod::Lua::ILuaBase* LUA, const std::string& mapName)
+static Material ReadWorldMaterial(IMaterial* sourceMaterial, const BSPTexture& tex)
 {
-	std::string path = "maps/" + mapName + ".bsp";
-	if (!FileSystem::Exists(path.c_str(), "GAME")) return;
-	FileHandle_t file = FileSystem::Open(path.c_str(), "rb", "GAME");
+	Material mat{};
+	mat.path = tex.path;
+	mat.maskedBlending = false;
+	
+	const char* shaderName = sourceMaterial->GetShaderName();
+
+	if (shaderName == nullptr || strncmp(shaderName, "Water", 5) != 0) {
+		IMaterialVar* maskedblending = GetMaterialVar(sourceMaterial, "$maskedblending");
+		if (maskedblending) {
+			mat.maskedBlending = maskedblending->GetIntValue() != 0;
+		}
 
-	uint32_t filesize = FileSystem::Size(file);
-	uint8_t* data = reinterpret_cast<uint8_t*>(malloc(filesize));
-	if (data == nullptr) return;
+		mat.baseTexPath = GetMaterialString(sourceMaterial, "$basetexture");
+		mat.normalMapPath = GetMaterialString(sourceMaterial, "$bumpmap");
 
-	FileSystem::Read(data, filesize, file);
-	FileSystem::Close(file);
+		mat.baseTexPath2 = GetMaterialString(sourceMaterial, "$basetexture2");
+		mat.normalMapPath2 = GetMaterialString(sourceMaterial, "$bumpmap2");
 
-	pMap = new BSPMap(data, filesize);
-	free(data);
+		mat.blendTexPath = GetMaterialString(sourceMaterial, "$blendmodulatetexture");
+
+		mat.detailPath = GetMaterialString(sourceMaterial, "$detail");
+
+		IMaterialVar* basetexturetransform = GetMaterialVar(sourceMaterial, "$basetexturetransform");
+		if (basetexturetransform) {
+			const VMatrix pMat = basetexturetransform->GetMatrixValue();
+			mat.baseTexMat = pMat.To2x4();
+		}
+
+		IMaterialVar* bumptransform = GetMaterialVar(sourceMaterial, "$bumptransform");
+		if (bumptransform) {
+			const VMatrix pMat = bumptransform->GetMatrixValue();
+			mat.normalMapMat = pMat.To2x4();
+		}
+
+		IMaterialVar* basetexturetransform2 = GetMaterialVar(sourceMaterial, "$basetexturetransform2");
+		if (basetexturetransform2) {
+			const VMatrix pMat = basetexturetransform2->GetMatrixValue();
+			mat.baseTexMat2 = pMat.To2x4();
+		}
+
+		IMaterialVar* bumptransform2 = GetMaterialVar(sourceMaterial, "$bumptransform2");
+		if (bumptransform2) {
+			const VMatrix pMat = bumptransform2->GetMatrixValue();
+			mat.normalMapMat2 = pMat.To2x4();
+		}
+
+		IMaterialVar* blendmasktransform = GetMaterialVar(sourceMaterial, "$blendmasktransform");
+		if (blendmasktransform) {
+			const VMatrix pMat = blendmasktransform->GetMatrixValue();
+			mat.blendTexMat = pMat.To2x4();
+		}
+
+		IMaterialVar* detailtexturetransform = GetMaterialVar(sourceMaterial, "$detailtexturetransform");
+		if (detailtexturetransform) {
+			const VMatrix pMat = detailtexturetransform->GetMatrixValue();
+			mat.detailMat = pMat.To2x4();
+		}
+
+		IMaterialVar* detailscale = GetMaterialVar(sourceMaterial, "$detailscale");
+		if (detailscale) {
+			mat.detailScale = detailscale->GetFloatValue();
+		}
+
+		IMaterialVar* detailblendfactor = GetMaterialVar(sourceMaterial, "$detailblendfactor");
+		if (detailblendfactor) {
+			mat.detailBlendFactor = detailblendfactor->GetFloatValue();
+		}
+
+		IMaterialVar* detailblendmode = GetMaterialVar(sourceMaterial, "$detailblendmode");
+		if (detailblendmode) {
+			mat.detailBlendMode = static_cast<DetailBlendMode>(detailblendmode->GetIntValue());
+		}
+
+		IMaterialVar* alphatestreference = GetMaterialVar(sourceMaterial, "$alphatestreference");
+		if (alphatestreference) {
+			mat.alphatestreference = alphatestreference->GetFloatValue();
+		}
+
+		IMaterialVar* detailtint = GetMaterialVar(sourceMaterial, "$detailtint");
+		if (detailtint) {
+			float values[3];
+			detailtint->GetVecValue(values, 3);
+			mat.detailTint = glm::vec3(values[0], values[1], values[2]);
+		}
+
+		IMaterialVar* detail_ambt = GetMaterialVar(sourceMaterial, "$detail_alpha_mask_base_texture");
+		if (detail_ambt) {
+			mat.detailAlphaMaskBaseTexture = detail_ambt->GetIntValue() != 0;
+		}
+	} else {
+		mat.water = true;
+		mat.normalMapPath = GetMaterialString(sourceMaterial, "$normalmap");
+
+		IMaterialVar* fogcolor = GetMaterialVar(sourceMaterial, "$fogcolor");
+		if (fogcolor) {
+			float values[3];
+			fogcolor->GetVecValue(values, 3);
+
+			mat.colour = glm::vec4(values[0], values[1], values[2], 1);
+		}
+
+		// Not sure if any gmod materials will even implement water base textures
+		// Or if it's even available in gmod's engine version, but here just in case
+		mat.baseTexPath = GetMaterialString(sourceMaterial, "$basetexture");
+	}
+
+	IMaterialVar* flags = GetMaterialVar(sourceMaterial, "$flags");
+	if (flags) {
+		mat.flags = static_cast<MaterialFlags>(flags->GetIntValue());
+	}
+
+	mat.surfFlags = tex.flags;
+
+	return mat;
+}
+
+// Every texture path LoadMaterialTextures may load for a material, so they can be prefetched together
+static void GetMaterialTexturePaths(const Material& mat, std::vector<std::string>& paths)
+{
+	const std::string* texPaths[] = {
+		&mat.baseTexPath, &mat.normalMapPath,
+		&mat.baseTexPath2, &mat.normalMapPath2,
+		&mat.blendTexPath, &mat.detailPath
+	};
+	for (const std::string* pPath : texPaths) {
+		if (!pPath->empty()) paths.push_back(*pPath);
+	}
+
+	if (!mat.water) {
+		if (!mat.baseTexPath.empty()) paths.push_back("vistrace/pbr/" + mat.baseTexPath + "_mrao");
+		if (!mat.baseTexPath2.empty()) paths.push_back("vistrace/pbr/" + mat.baseTexPath2 + "_mrao");
+	}
+}
+
+// Resolves a material's texture paths to textures, which is just cache lookups if they were prefetched
+static void LoadMaterialTextures(Material& mat)
+{
+	if (mat.water) {
+		mat.baseTexture = ResourceCache::GetTexture(mat.baseTexPath, WATER_BASE_TEXTURE);
+		if (mat.baseTexture == nullptr) mat.baseTexture = ResourceCache::GetTexture(MISSING_TEXTURE);
+		mat.normalMap = ResourceCache::GetTexture(mat.normalMapPath);
+		mat.UpdateFeatures();
+		return;
+	}
+
+	mat.baseTexture = ResourceCache::GetTexture(mat.baseTexPath, MISSING_TEXTURE);
+	mat.normalMap = ResourceCache::GetTexture(mat.normalMapPath);
+	if (!mat.baseTexPath.empty()) mat.mrao = ResourceCache::GetTexture("vistrace/pbr/" + mat.baseTexPath + "_mrao");
+
+	mat.baseTexture2 = ResourceCache::GetTexture(mat.baseTexPath2);
+	mat.normalMap2 = ResourceCache::GetTexture(mat.normalMapPath2);
+	if (!mat.baseTexPath2.empty()) mat.mrao2 = ResourceCache::GetTexture("vistrace/pbr/" + mat.baseTexPath2 + "_mrao");
+
+	mat.blendTexture = ResourceCache::GetTexture(mat.blendTexPath);
+	mat.detail = ResourceCache::GetTexture(mat.detailPath);
+	mat.UpdateFeatures();
+}
+
+// Loads the textures of a range of materials, reading and decoding every unique texture in parallel first
+static void PrefetchMaterialTextures(std::vector<Material>& materials, size_t first, size_t& numTextures)
+{
+	std::vector<std::string> paths;
+	for (size_t i = first; i < materials.size(); i++) {
+		GetMaterialTexturePaths(materials[i], paths);
+	}
+	numTextures += ResourceCache::PreloadTextures(paths);
+
+	for (size_t i = first; i < materials.size(); i++) {
+		LoadMaterialTextures(materials[i]);
+	}
+}
+
+using Clock = std::chrono::steady_clock;
+static double MsSince(const Clock::time_point& start)
+{
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+World::World(GarrysMod::Lua::ILuaBase* LUA, const std::string& mapName)
+{
+	mLoadStart = Clock::now();
+
+	// Only the lumps we use are read, so the pakfile and lighting never touch memory
+	{
+		std::vector<uint8_t> data;
+		if (!ReadBSPLumps("maps/" + mapName + ".bsp", data, loadStats.bytesSkipped)) return;
+
+		pMap = new BSPMap(data.data(), data.size());
+	}
 
 	if (!pMap->IsValid()) {
 		delete pMap;
@@ -216,14 +318,10 @@ World::World(GarrysMod::Lua::ILuaBase* LUA, const std::string& mapName)
 	}
 
 	ResourceCache::GetTexture(WATER_BASE_TEXTURE);
+	loadStats.readTime = MsSince(mLoadStart);
 
-	const glm::vec3* vertices = reinterpret_cast<const glm::vec3*>(pMap->GetVertices());
-	const glm::vec3* normals = reinterpret_cast<const glm::vec3*>(pMap->GetNormals());
-	const glm::vec3* tangents = reinterpret_cast<const glm::vec3*>(pMap->GetTangents());
-	const glm::vec3* binormals = reinterpret_cast<const glm::vec3*>(pMap->GetBinormals());
-	const glm::vec2* uvs = reinterpret_cast<const glm::vec2*>(pMap->GetUVs());
-	const float* alphas = pMap->GetAlphas();
 	const int16_t* textures = pMap->GetTriTextures();
+	const int32_t numTris = pMap->GetNumTris();
 
 	Entity world{};
 	world.rawEntity = nullptr; // replace with world ent ptr
@@ -232,12 +330,12 @@ World::World(GarrysMod::Lua::ILuaBase* LUA, const std::string& mapName)
 	world.materials = std::vector<size_t>();
 
 	LUA->PushSpecial(SPECIAL_GLOB); // _G
-	auto submatIds = std::unordered_map<std::string, size_t>();
 
-	triangles.reserve(pMap->GetNumTris());
-	for (size_t triIdx = 0; triIdx < pMap->GetNumTris(); triIdx++) {
-		size_t vi0 = triIdx * 3;
-		size_t vi1 = vi0 + 1, vi2 = vi0 + 2;
+	// Materials have to be read through Lua, so resolve each unique texture serially (in order of first use) before anything else
+	Clock::time_point phaseStart = Clock::now();
+	std::unordered_map<int16_t, size_t> textureMaterials;
+	for (int32_t triIdx = 0; triIdx < numTris; triIdx++) {
+		if (textureMaterials.find(textures[triIdx]) != textureMaterials.end()) continue;
 
 		// Load texture
 		BSPTexture tex;
@@ -260,149 +358,75 @@ World::World(GarrysMod::Lua::ILuaBase* LUA, const std::string& mapName)
 				LUA->ThrowError("Invalid material on world");
 			}
 
-			IMaterial* sourceMaterial = LUA->GetUserType<IMaterial>(-1, Type::Material);
-			Material mat{};
-			mat.path = tex.path;
-			mat.maskedBlending = false;
-			
-			const char* shaderName = sourceMaterial->GetShaderName();
-
-			if (shaderName == nullptr || strncmp(shaderName, "Water", 5) != 0) {
-				IMaterialVar* maskedblending = GetMaterialVar(sourceMaterial, "$maskedblending");
-				if (maskedblending) {
-					mat.maskedBlending = maskedblending->GetIntValue() != 0;
-				}
-
-				mat.baseTexPath = GetMaterialString(sourceMaterial, "$basetexture");
-				mat.normalMapPath = GetMaterialString(sourceMaterial, "$bumpmap");
-
-				mat.baseTexPath2 = GetMaterialString(sourceMaterial, "$basetexture2");
-				mat.normalMapPath2 = GetMaterialString(sourceMaterial, "$bumpmap2");
-
-				mat.blendTexPath = GetMaterialString(sourceMaterial, "$blendmodulatetexture");
-
-				mat.detailPath = GetMaterialString(sourceMaterial, "$detail");
-
-				mat.baseTexture = ResourceCache::GetTexture(mat.baseTexPath, MISSING_TEXTURE);
-				mat.normalMap = ResourceCache::GetTexture(mat.normalMapPath);
-				if (!mat.baseTexPath.empty()) mat.mrao = ResourceCache::GetTexture("vistrace/pbr/" + mat.baseTexPath + "_mrao");
-
-				mat.baseTexture2 = ResourceCache::GetTexture(mat.baseTexPath2);
-				mat.normalMap2 = ResourceCache::GetTexture(mat.normalMapPath2);
-				if (!mat.baseTexPath2.empty()) mat.mrao2 = ResourceCache::GetTexture("vistrace/pbr/" + mat.baseTexPath2 + "_mrao");
-
-				mat.blendTexture = ResourceCache::GetTexture(mat.blendTexPath);
-				mat.detail = ResourceCache::GetTexture(mat.detailPath);
-
-				IMaterialVar* basetexturetransform = GetMaterialVar(sourceMaterial, "$basetexturetransform");
-				if (basetexturetransform) {
-					const VMatrix pMat = basetexturetransform->GetMatrixValue();
-					mat.baseTexMat = pMat.To2x4();
-				}
-
-				IMaterialVar* bumptransform = GetMaterialVar(sourceMaterial, "$bumptransform");
-				if (bumptransform) {
-					const VMatrix pMat = bumptransform->GetMatrixValue();
-					mat.normalMapMat = pMat.To2x4();
-				}
-
-				IMaterialVar* basetexturetransform2 = GetMaterialVar(sourceMaterial, "$basetexturetransform2");
-				if (basetexturetransform2) {
-					const VMatrix pMat = basetexturetransform2->GetMatrixValue();
-					mat.baseTexMat2 = pMat.To2x4();
-				}
-
-				IMaterialVar* bumptransform2 = GetMaterialVar(sourceMaterial, "$bumptransform2");
-				if (bumptransform2) {
-					const VMatrix pMat = bumptransform2->GetMatrixValue();
-					mat.normalMapMat2 = pMat.To2x4();
-				}
-
-				IMaterialVar* blendmasktransform = GetMaterialVar(sourceMaterial, "$blendmasktransform");
-				if (blendmasktransform) {
-					const VMatrix pMat = blendmasktransform->GetMatrixValue();
-					mat.blendTexMat = pMat.To2x4();
-				}
-
-				IMaterialVar* detailtexturetransform = GetMaterialVar(sourceMaterial, "$detailtexturetransform");
-				if (detailtexturetransform) {
-					const VMatrix pMat = detailtexturetransform->GetMatrixValue();
-					mat.detailMat = pMat.To2x4();
-				}
-
-				IMaterialVar* detailscale = GetMaterialVar(sourceMaterial, "$detailscale");
-				if (detailscale) {
-					mat.detailScale = detailscale->GetFloatValue();
-				}
-
-				IMaterialVar* detailblendfactor = GetMaterialVar(sourceMaterial, "$detailblendfactor");
-				if (detailblendfactor) {
-					mat.detailBlendFactor = detailblendfactor->GetFloatValue();
-				}
-
-				IMaterialVar* detailblendmode = GetMaterialVar(sourceMaterial, "$detailblendmode");
-				if (detailblendmode) {
-					mat.detailBlendMode = static_cast<DetailBlendMode>(detailblendmode->GetIntValue());
-				}
-
-				IMaterialVar* alphatestreference = GetMaterialVar(sourceMaterial, "$alphatestreference");
-				if (alphatestreference) {
-					mat.alphatestreference = alphatestreference->GetFloatValue();
-				}
+			Material mat = ReadWorldMaterial(LUA->GetUserType<IMaterial>(-1, Type::Material), tex);
+			LUA->Pop(); // _G
 
-				IMaterialVar* detailtint = GetMaterialVar(sourceMaterial, "$detailtint");
-				if (detailtint) {
-					float values[3];
-					detailtint->GetVecValue(values, 3);
-					mat.detailTint = glm::vec3(values[0], values[1], values[2]);
-				}
+			world.materials.push_back(materials.size());
+			materialIds.emplace(strPath, materials.size());
+			materials.push_back(mat);
+		}
 
-				IMaterialVar* detail_ambt = GetMaterialVar(sourceMaterial, "$detail_alpha_mask_base_texture");
-				if (detail_ambt) {
-					mat.detailAlphaMaskBaseTexture = detail_ambt->GetIntValue() != 0;
-				}
-			} else {
-				mat.water = true;
-				mat.normalMapPath = GetMaterialString(sourceMaterial, "$normalmap");
+		textureMaterials.emplace(textures[triIdx], materialIds[strPath]);
+	}
+	loadStats.materialTime = MsSince(phaseStart);
 
-				IMaterialVar* fogcolor = GetMaterialVar(sourceMaterial, "$fogcolor");
-				if (fogcolor) {
-					float values[3];
-					fogcolor->GetVecValue(values, 3);
+	// Static props are gathered here so errors can still be thrown to Lua
+	const int32_t numProps = pMap->GetNumStaticProps();
+	mProps.resize(numProps);
+	for (int32_t i = 0; i < numProps; i++) {
+		try {
+			mProps[i] = pMap->GetStaticProp(i);
+		} catch (std::out_of_range e) {
+			delete pMap;
+			pMap = nullptr;
+			LUA->ThrowError(e.what());
+		} catch (std::runtime_error e) {
+			delete pMap;
+			pMap = nullptr;
+			LUA->ThrowError(e.what()); // This means we didn't check the map was valid first
+		}
+	}
 
-					mat.colour = glm::vec4(values[0], values[1], values[2], 1);
-				}
+	entities.push_back(world);
 
-				// Not sure if any gmod materials will even implement water base textures
-				// Or if it's even available in gmod's engine version, but here just in case
-				mat.baseTexPath = GetMaterialString(sourceMaterial, "$basetexture");
+	LUA->Pop(); // Pop _G
 
-				mat.baseTexture = ResourceCache::GetTexture(mat.baseTexPath, WATER_BASE_TEXTURE);
-				if (mat.baseTexture == nullptr) mat.baseTexture = ResourceCache::GetTexture(MISSING_TEXTURE);
-				mat.normalMap = ResourceCache::GetTexture(mat.normalMapPath);
-			}
+	// Everything else that doesn't need Lua happens off the main thread, and Finalise picks up from there
+	mBackgroundLoad = std::async(std::launch::async, [this, textureMaterials = std::move(textureMaterials)]() {
+		LoadBackground(textureMaterials);
+	});
+}
 
-			IMaterialVar* flags = GetMaterialVar(sourceMaterial, "$flags");
-			if (flags) {
-				mat.flags = static_cast<MaterialFlags>(flags->GetIntValue());
-			}
+void World::LoadBackground(const std::unordered_map<int16_t, size_t>& textureMaterials)
+{
+	const glm::vec3* vertices = reinterpret_cast<const glm::vec3*>(pMap->GetVertices());
+	const glm::vec3* normals = reinterpret_cast<const glm::vec3*>(pMap->GetNormals());
+	const glm::vec3* tangents = reinterpret_cast<const glm::vec3*>(pMap->GetTangents());
+	const glm::vec2* uvs = reinterpret_cast<const glm::vec2*>(pMap->GetUVs());
+	const float* alphas = pMap->GetAlphas();
+	const int16_t* textures = pMap->GetTriTextures();
+	const int32_t numTris = pMap->GetNumTris();
 
-			LUA->Pop(); // _G
+	// World materials were read on the main thread without their textures, which are loaded here all at once
+	Clock::time_point phaseStart = Clock::now();
+	PrefetchMaterialTextures(materials, 0, loadStats.numTextures);
+	loadStats.textureTime = MsSince(phaseStart);
 
-			mat.surfFlags = tex.flags;
+	// Each triangle is independent once its material is known
+	phaseStart = Clock::now();
+	triangles.resize(numTris);
 
-			submatIds.emplace(strPath, world.materials.size());
-			world.materials.push_back(materials.size());
-			materialIds.emplace(strPath, materials.size());
-			materials.push_back(mat);
-		}
+	#pragma omp parallel for schedule(static)
+	for (int32_t triIdx = 0; triIdx < numTris; triIdx++) {
+		size_t vi0 = triIdx * 3;
+		size_t vi1 = vi0 + 1, vi2 = vi0 + 2;
 
 		// Construct bvh tri
 		Triangle tri(
 			Vector3{ vertices[vi0].x, vertices[vi0].y, vertices[vi0].z },
 			Vector3{ vertices[vi1].x, vertices[vi1].y, vertices[vi1].z },
 			Vector3{ vertices[vi2].x, vertices[vi2].y, vertices[vi2].z },
-			world.materials[submatIds[strPath]],
+			textureMaterials.find(textures[triIdx])->second,
 			uvs + vi0,
 
 			// Backface cull on the world to prevent z fighting on 2 sided water surfaces
@@ -414,92 +438,189 @@ World::World(GarrysMod::Lua::ILuaBase* LUA, const std::string& mapName)
 		memcpy(tri.tangents, tangents + vi0, sizeof(glm::vec3) * 3);
 		memcpy(tri.alphas, alphas + vi0, sizeof(float) * 3);
 
-		triangles.push_back(tri);
+		triangles[triIdx] = tri;
 	}
+	loadStats.triangleTime = MsSince(phaseStart);
+
+	// Parse every unique static prop model and build its BLAS in parallel
+	phaseStart = Clock::now();
+	std::vector<std::string> propModelPaths;
+	propModelPaths.reserve(mProps.size());
+	for (const BSPStaticProp& prop : mProps) {
+		propModelPaths.push_back(prop.model);
+	}
+	ResourceCache::PreloadModels(propModelPaths);
 
-	entities.push_back(world);
+	mPropModels.resize(mProps.size());
+	std::vector<const Model*> uniqueModels;
+	for (size_t i = 0; i < mProps.size(); i++) {
+		mPropModels[i] = ResourceCache::GetModel(mProps[i].model, MISSING_MODEL);
+		if (modelBLAS.try_emplace(mPropModels[i].get(), nullptr).second) uniqueModels.push_back(mPropModels[i].get());
+	}
 
-	// Add static props
-	for (int i = 0; i < pMap->GetNumStaticProps(); i++) {
-		Entity entData{};
-		entData.id = world.id;
-		entData.rawEntity = world.rawEntity;
-		entData.colour = world.colour;
-		entData.materials = std::vector<size_t>();
+	std::vector<std::unique_ptr<BLAS>> uniqueBLAS(uniqueModels.size());
 
-		BSPStaticProp prop;
-		try {
-			prop = pMap->GetStaticProp(i);
-		} catch (std::out_of_range e) {
-			LUA->ThrowError(e.what());
-		} catch (std::runtime_error e) {
-			LUA->ThrowError(e.what()); // This means we didn't check the map was valid first
-		}
+	#pragma omp parallel for schedule(dynamic)
+	for (int32_t i = 0; i < static_cast<int32_t>(uniqueModels.size()); i++) {
+		uniqueBLAS[i] = std::make_unique<BLAS>(uniqueModels[i]);
+	}
 
-		glm::mat4 bone = glm::translate(glm::identity<glm::mat4>(), glm::vec3(prop.pos.x, prop.pos.y, prop.pos.z));
-		glm::mat4 angle = glm::eulerAngleZYX(glm::radians(prop.ang.y), glm::radians(prop.ang.x), glm::radians(prop.ang.z));
-		bone *= angle;
+	// Every prop using the same model shares its geometry and BVH
+	for (size_t i = 0; i < uniqueModels.size(); i++) {
+		modelBLAS[uniqueModels[i]] = std::move(uniqueBLAS[i]);
+	}
+	loadStats.propModelTime = MsSince(phaseStart);
+	loadStats.numUniqueProps = uniqueModels.size();
+}
 
-		// Cache model
-		const Model* pModel = ResourceCache::GetModel(prop.model, MISSING_MODEL);
+bool World::Finalise(GarrysMod::Lua::ILuaBase* LUA, double timeout)
+{
+	if (mReady) return true;
+	if (!IsValid() || !mBackgroundLoad.valid()) return false;
+
+	if (timeout < 0.0) mBackgroundLoad.wait();
+	else if (
+		mBackgroundLoad.wait_for(std::chrono::duration<double, std::milli>(timeout)) != std::future_status::ready
+	) return false;
+
+	// Exceptions from the background load can't unwind through Lua, so they're caught here and thrown as Lua errors
+	// A failed load releases the map, leaving the world invalid
+	char error[256] = "";
+	try {
+		mBackgroundLoad.get();
+	} catch (const std::exception& e) {
+		snprintf(error, sizeof(error), "Failed to load world: %s", e.what());
+	}
+	if (error[0] != '\0') {
+		delete pMap;
+		pMap = nullptr;
+		LUA->ThrowError(error);
+	}
 
-		// Cache bind pose
-		glm::mat4 bind = pModel->GetBindMatrix(0);
+	Clock::time_point phaseStart = Clock::now();
+	const size_t firstPropMaterial = materials.size();
+	{
+		// Static props are gathered separately and only added once every one of them has succeeded,
+		// so an error can't leave the world with some of them (these are freed before throwing)
+		std::vector<Instance> propInstances;
+		std::vector<Entity> propEntities;
+		std::unordered_map<std::string, size_t> propMaterialIds;
+		std::vector<Material> propMaterials;
+
+		LUA->PushSpecial(SPECIAL_GLOB); // _G
+		const Entity& world = entities[0];
+
+		// Add static props, reading any new materials through Lua
+		for (size_t i = 0; i < mProps.size() && error[0] == '\0'; i++) {
+			const BSPStaticProp& prop = mProps[i];
+			const Model* pModel = mPropModels[i].get();
+			const BLAS* pBLAS = modelBLAS[pModel].get();
+			if (!pBLAS->IsValid()) continue;
+
+			Entity entData{};
+			entData.id = world.id;
+			entData.rawEntity = world.rawEntity;
+			entData.colour = world.colour;
+			entData.materials = std::vector<size_t>();
+
+			glm::mat4 bone = glm::translate(glm::identity<glm::mat4>(), glm::vec3(prop.pos.x, prop.pos.y, prop.pos.z));
+			glm::mat4 angle = glm::eulerAngleZYX(glm::radians(prop.ang.y), glm::radians(prop.ang.x), glm::radians(prop.ang.z));
+			bone *= angle;
+
+			// Get materials
+			entData.materials.reserve(pModel->GetNumMaterials());
+			for (int materialId = 0; materialId < pModel->GetNumMaterials(); materialId++) {
+				std::string materialPath = pModel->GetMaterial(materialId);
+
+				auto worldMaterial = materialIds.find(materialPath);
+				if (worldMaterial != materialIds.end()) {
+					entData.materials.push_back(worldMaterial->second);
+					continue;
+				}
 
-		// Get materials
-		entData.materials.reserve(pModel->GetNumMaterials());
-		for (int materialId = 0; materialId < pModel->GetNumMaterials(); materialId++) {
-			std::string materialPath = pModel->GetMaterial(materialId);
+				if (propMaterialIds.find(materialPath) == propMaterialIds.end()) {
+					LUA->GetField(-1, "Material");
+					LUA->PushString(materialPath.c_str());
+					LUA->Call(1, 1);
+					if (!LUA->IsType(-1, Type::Material)) {
+						snprintf(error, sizeof(error), "Invalid material on entity");
+						LUA->Pop(); // _G
+						break;
+					}
 
-			if (materialIds.find(materialPath) == materialIds.end()) {
-				LUA->GetField(-1, "Material");
-				LUA->PushString(materialPath.c_str());
-				LUA->Call(1, 1);
-				if (!LUA->IsType(-1, Type::Material)) LUA->ThrowError("Invalid material on entity");
+					// Grab the source material
+					IMaterial* sourceMaterial = LUA->GetUserType<IMaterial>(-1, Type::Material);
 
-				// Grab the source material
-				IMaterial* sourceMaterial = LUA->GetUserType<IMaterial>(-1, Type::Material);
+					// Read props
+					Material mat = ReadEntityMaterial(sourceMaterial, materialPath);
 
-				// Read props
-				Material mat = ReadEntityMaterial(sourceMaterial, materialPath);
+					LUA->Pop(); // _G
 
-				LUA->Pop(); // _G
+					propMaterialIds.emplace(materialPath, materials.size() + propMaterials.size());
+					propMaterials.push_back(mat);
+				}
 
-				materialIds.emplace(materialPath, materials.size());
-				materials.push_back(mat);
+				entData.materials.push_back(propMaterialIds[materialPath]);
 			}
+			if (error[0] != '\0') break;
 
-			entData.materials.push_back(materialIds[materialPath]);
+			std::vector<size_t> instanceMaterials(pBLAS->GetNumSubmaterials());
+			for (size_t submatIdx = 0; submatIdx < instanceMaterials.size(); submatIdx++) {
+				instanceMaterials[submatIdx] = entData.materials[pModel->GetMaterialIdx(prop.skin, submatIdx)];
+			}
+
+			propInstances.emplace_back(pBLAS, bone, std::move(instanceMaterials), entities.size() + propEntities.size());
+			propEntities.push_back(entData);
 		}
 
-		for (size_t bodygroupIdx = 0; bodygroupIdx < pModel->GetNumBodyGroups(); bodygroupIdx++) {
-			const Mesh* pMesh = pModel->GetMesh(bodygroupIdx, 0);
+		LUA->Pop(); // Pop _G
 
-			size_t triStart = triangles.size();
-			triangles.insert(
-				triangles.end(),
-				pMesh->GetTriangles(),
-				pMesh->GetTriangles() + pMesh->GetNumTriangles()
+		if (error[0] == '\0') {
+			materialIds.insert(propMaterialIds.begin(), propMaterialIds.end());
+			materials.insert(materials.end(), propMaterials.begin(), propMaterials.end());
+			entities.insert(entities.end(), propEntities.begin(), propEntities.end());
+			instances.insert(
+				instances.end(),
+				std::make_move_iterator(propInstances.begin()), std::make_move_iterator(propInstances.end())
 			);
-
-			for (int triIdx = triStart; triIdx < pMesh->GetNumTriangles() + triStart; triIdx++) {
-				Triangle& tri = triangles[triIdx];
-
-				tri.entIdx = entities.size();
-				tri.material = entData.materials[pModel->GetMaterialIdx(prop.skin, tri.material)];
-
-				SkinTriangle(tri, bone, bind);
-			}
 		}
-
-		entities.push_back(entData);
 	}
+	if (error[0] != '\0') {
+		delete pMap;
+		pMap = nullptr;
+		LUA->ThrowError(error);
+	}
+	loadStats.propMaterialTime = MsSince(phaseStart);
+
+	phaseStart = Clock::now();
+	PrefetchMaterialTextures(materials, firstPropMaterial, loadStats.numTextures);
+	loadStats.textureTime += MsSince(phaseStart);
+
+	// Build the top level BVH over static props
+	phaseStart = Clock::now();
+	if (!instances.empty()) {
+		BuildBVH(instanceAccel, instances.data(), instances.size());
+		pInstanceIntersector = std::make_unique<InstanceIntersector>(instanceAccel, instances.data());
+		pInstanceTraverser = std::make_unique<Traverser>(instanceAccel);
+	}
+	loadStats.instanceTime = MsSince(phaseStart);
 
-	LUA->Pop(); // Pop _G
+	loadStats.numTriangles = triangles.size();
+	loadStats.numStaticProps = instances.size();
+	loadStats.totalTime = MsSince(mLoadStart);
+
+	// Only needed while loading
+	mProps = std::vector<BSPStaticProp>();
+	mPropModels = std::vector<ResourceCache::ModelRef>();
+
+	mReady = true;
+	return true;
 }
 
 World::~World()
 {
+	// The background load reads from the map, so it has to finish first
+	if (mBackgroundLoad.valid()) mBackgroundLoad.wait();
 	if (pMap != nullptr) delete pMap;
 }
 
@@ -508,6 +629,17 @@ bool World::IsValid() const
 	return pMap != nullptr;
 }
 
+bool World::IsReady() const
+{
+	return mReady;
+}
+
+std::optional<InstanceIntersector::Result> World::TraverseInstances(const Ray& ray) const
+{
+	if (pInstanceTraverser == nullptr) return std::nullopt;
+	return pInstanceTraverser->traverse(ray, *pInstanceIntersector);
+}
+
 AccelStruct::AccelStruct()
 {
 	mpIntersector = nullptr;
@@ -519,7 +651,7 @@ AccelStruct::AccelStruct()
 	mEntities = std::vector<Entity>();
 
 	mMaterialIds = std::unordered_map<std::string, size_t>();
-	mMaterials = std::vector<Material>();
+	mpMaterials = std::make_shared<std::vector<Material>>();
 }
 
 AccelStruct::~AccelStruct()
@@ -530,29 +662,107 @@ AccelStruct::~AccelStruct()
 	}
 }
 
-void AccelStruct::PopulateAccel(ILuaBase* LUA, const World* pWorld)
+// Reads one entity's bones from a flat table of numbers or a string of packed floats,
+// each bone being the 12 values of a row major 3x4 matrix like Source's matrix3x4_t
+static bool ReadPackedBones(ILuaBase* LUA, std::vector<glm::mat4>& bones)
 {
-	mpWorld = pWorld;
+	auto toMat4 = [](const float* rows) {
+		glm::mat4 transform = glm::identity<glm::mat4>();
+		for (int row = 0; row < 3; row++) {
+			for (int col = 0; col < 4; col++) {
+				transform[col][row] = rows[row * 4 + col];
+			}
+		}
+		return transform;
+	};
 
-	// Delete accel
-	if (mAccelBuilt) {
-		mAccelBuilt = false;
-		delete mpIntersector;
-		delete mpTraverser;
+	if (LUA->IsType(-1, Type::String)) {
+		unsigned int length = 0;
+		const char* pData = LUA->GetString(-1, &length);
+		if (length == 0 || length % (12 * sizeof(float)) != 0) return false;
+
+		bones.resize(length / (12 * sizeof(float)));
+		for (size_t boneIndex = 0; boneIndex < bones.size(); boneIndex++) {
+			float rows[12];
+			memcpy(rows, pData + boneIndex * sizeof(rows), sizeof(rows));
+			bones[boneIndex] = toMat4(rows);
+		}
+		return true;
 	}
 
-	// Redefine containers
-	mTriangles.clear();
+	if (!LUA->IsType(-1, Type::Table)) return false;
 
-	mEntities.clear();
+	size_t length = LUA->ObjLen();
+	if (length == 0 || length % 12 != 0) return false;
 
-	mMaterialIds.clear();
-	mMaterials.clear();
+	bones.resize(length / 12);
+	for (size_t boneIndex = 0; boneIndex < bones.size(); boneIndex++) {
+		float rows[12];
+		for (int i = 0; i < 12; i++) {
+			LUA->PushNumber(boneIndex * 12 + i + 1);
+			LUA->GetTable(-2);
+			rows[i] = LUA->GetNumber();
+			LUA->Pop();
+		}
+		bones[boneIndex] = toMat4(rows);
+	}
+	return true;
+}
 
-	if (mpWorld != nullptr) {
-		mTriangles = mpWorld->triangles;
-		mEntities = mpWorld->entities;
-		mMaterials = mpWorld->materials;
+// Reads one string per material from a list, empty strings keep the model's own material like GetSubMaterial
+static bool ReadPackedSubMaterials(ILuaBase* LUA, size_t numMaterials, std::vector<std::string>& paths)
+{
+	if (!LUA->IsType(-1, Type::Table) || LUA->ObjLen() != numMaterials) return false;
+
+	paths.resize(numMaterials);
+	for (size_t materialId = 0; materialId < numMaterials; materialId++) {
+		LUA->PushNumber(materialId + 1);
+		LUA->GetTable(-2);
+		if (!LUA->IsType(-1, Type::String)) {
+			LUA->Pop();
+			return false;
+		}
+		paths[materialId] = LUA->GetString();
+		LUA->Pop();
+	}
+	return true;
+}
+
+// Reads one value per bodygroup from a list, in the same order as GetBodygroup's indices
+static bool ReadPackedBodygroups(ILuaBase* LUA, size_t numBodygroups, std::vector<int>& values)
+{
+	if (!LUA->IsType(-1, Type::Table) || LUA->ObjLen() != numBodygroups) return false;
+
+	values.resize(numBodygroups);
+	for (size_t bodygroupIdx = 0; bodygroupIdx < numBodygroups; bodygroupIdx++) {
+		LUA->PushNumber(bodygroupIdx + 1);
+		LUA->GetTable(-2);
+		if (!LUA->IsType(-1, Type::Number)) {
+			LUA->Pop();
+			return false;
+		}
+		values[bodygroupIdx] = LUA->GetNumber();
+		LUA->Pop();
+	}
+	return true;
+}
+
+void AccelStruct::PopulateAccel(ILuaBase* LUA, const World* pWorld, int boneMatricesIdx)
+{
+	auto buildStart = std::chrono::steady_clock::now();
+	AccelBuildStats stats{};
+
+	// Everything is gathered from Lua into these before the accel is locked, as throwing an error wont destruct the lock
+	// On error the last build is left as it was
+	std::vector<Triangle> triangles;
+	std::vector<Entity> entities;
+	std::unordered_map<std::string, size_t> materialIds;
+	std::vector<Material> materials;
+
+	if (pWorld != nullptr) {
+		triangles = pWorld->triangles;
+		entities = pWorld->entities;
+		materials = pWorld->materials;
 	} else if (
 		ResourceCache::GetTexture(MISSING_TEXTURE) == nullptr ||
 		ResourceCache::GetModel(MISSING_MODEL) == nullptr
@@ -562,10 +772,25 @@ void AccelStruct::PopulateAccel(ILuaBase* LUA, const World* pWorld)
 
 	LUA->PushSpecial(SPECIAL_GLOB);
 	LUA->Insert(1);
+	if (boneMatricesIdx > 0) boneMatricesIdx++; // Shifted up by _G
+
+	// Every transition into Lua is counted, as they make up most of the time spent gathering entity state
+	auto callLua = [&](int numArgs, int numResults) {
+		LUA->Call(numArgs, numResults);
+		stats.numLuaCalls++;
+	};
 
 	// Iterate over entities
 	size_t numEntities = LUA->ObjLen();
-	mEntities.reserve(mEntities.size() + numEntities);
+	entities.reserve(entities.size() + numEntities);
+
+	// Reused between entities to avoid reallocating
+	std::vector<glm::mat4> palette;
+	std::vector<SkinnedVertex> skinned;
+
+	// Only entities in this build list are kept in the cache afterwards
+	std::unordered_map<uint32_t, EntityCacheEntry> entityCache;
+	entityCache.reserve(numEntities);
 	for (size_t entIndex = 1; entIndex <= numEntities; entIndex++) {
 		Entity entData{};
 
@@ -577,7 +802,7 @@ void AccelStruct::PopulateAccel(ILuaBase* LUA, const World* pWorld)
 		// Make sure entity is valid
 		LUA->GetField(-1, "IsValid");
 		LUA->Push(-2);
-		LUA->Call(1, 1);
+		callLua(1, 1);
 		if (!LUA->GetBool()) LUA->ThrowError("Attempted to build accel from an invalid entity");
 		LUA->Pop(); // Pop the bool
 
@@ -593,7 +818,7 @@ void AccelStruct::PopulateAccel(ILuaBase* LUA, const World* pWorld)
 		{
 			LUA->GetField(-1, "EntIndex");
 			LUA->Push(-2);
-			LUA->Call(1, 1);
+			callLua(1, 1);
 			double entId = LUA->GetNumber(); // Get as a double so after we check it's positive a static cast to unsigned int wont underflow rather than using int
 			LUA->Pop();
 
@@ -604,7 +829,7 @@ void AccelStruct::PopulateAccel(ILuaBase* LUA, const World* pWorld)
 		// Get entity colour
 		LUA->GetField(-1, "GetColor");
 		LUA->Push(-2);
-		LUA->Call(1, 1);
+		callLua(1, 1);
 
 		LUA->GetField(-1, "r");
 		entData.colour[0] = LUA->GetNumber() / 255.f;
@@ -625,154 +850,329 @@ void AccelStruct::PopulateAccel(ILuaBase* LUA, const World* pWorld)
 		// Cache model
 		LUA->GetField(-1, "GetModel");
 		LUA->Push(-2);
-		LUA->Call(1, 1);
+		callLua(1, 1);
 
-		const Model* pModel = LUA->IsType(-1, Type::String) ?
+		const ResourceCache::ModelRef modelRef = LUA->IsType(-1, Type::String) ?
 			ResourceCache::GetModel(LUA->GetString(), MISSING_MODEL) :
 			ResourceCache::GetModel(MISSING_MODEL);
+		const Model* pModel = modelRef.get();
 		LUA->Pop();
 
-		// Cache bone transforms
-		// Make sure the bone transforms are updated and the bones themselves are valid
-		LUA->GetField(-1, "SetupBones");
-		LUA->Push(-2);
-		LUA->Call(1, 0);
+		// Read whatever state was packed for the entity, each property packed skips the calls to query it
+		// An entity's packed state is either its bone matrices alone, or a table of any of bones, material, subMaterials, and bodygroups
+		std::vector<glm::mat4> bones;
+		std::string materialOverride = "";
+		std::vector<std::string> materialPaths;
+		std::vector<int> bodygroupValues;
+		bool packedBones = false, packedMaterial = false, packedSubMaterials = false, packedBodygroups = false;
+		if (boneMatricesIdx > 0) {
+			LUA->Push(-1);
+			LUA->GetTable(boneMatricesIdx);
+
+			// Packed bones are never empty, so a table with no array part holds named properties instead
+			const bool namedState = LUA->IsType(-1, Type::Table) && LUA->ObjLen() == 0;
+			if (namedState) LUA->GetField(-1, "bones");
+
+			if (!LUA->IsType(-1, Type::Nil)) {
+				if (!ReadPackedBones(LUA, bones)) LUA->ThrowError("Packed bone matrices must be a table or string of 12 floats per bone");
+				if (bones.size() != static_cast<size_t>(pModel->GetNumBones())) LUA->ThrowError("Packed bone matrices don't match model");
+				packedBones = true;
+			}
 
-		// Get number of bones and make sure the value is valid
-		LUA->GetField(-1, "GetBoneCount");
-		LUA->Push(-2);
-		LUA->Call(1, 1);
-		int numBones = LUA->GetNumber();
-		LUA->Pop();
+			if (namedState) {
+				LUA->Pop(); // Pop the bones
 
-		if (numBones < 1) LUA->ThrowError("Entity has invalid bones");
-		if (numBones != pModel->GetNumBones()) LUA->ThrowError("Entity bones don't match model");
+				LUA->GetField(-1, "material");
+				if (LUA->IsType(-1, Type::String)) {
+					materialOverride = LUA->GetString();
+					packedMaterial = true;
+				} else if (!LUA->IsType(-1, Type::Nil)) {
+					LUA->ThrowError("Packed material must be a string");
+				}
+				LUA->Pop();
 
-		// For each bone, cache the transform
-		auto bones = std::vector<glm::mat4>(numBones);
-		auto binds = std::vector<glm::mat4>(numBones);
-		for (int boneIndex = 0; boneIndex < numBones; boneIndex++) {
-			LUA->GetField(-1, "GetBoneMatrix");
-			LUA->Push(-2);
-			LUA->PushNumber(boneIndex);
-			LUA->Call(2, 1);
+				LUA->GetField(-1, "subMaterials");
+				if (!LUA->IsType(-1, Type::Nil)) {
+					if (!ReadPackedSubMaterials(LUA, pModel->GetNumMaterials(), materialPaths)) {
+						LUA->ThrowError("Packed submaterials must be a list of one string per model material");
+					}
+					packedSubMaterials = true;
+				}
+				LUA->Pop();
 
-			glm::mat4 transform = glm::identity<glm::mat4>();
-			if (LUA->IsType(-1, Type::Matrix)) {
-				const VMatrix* pMat = LUA->GetUserType<VMatrix>(-1, Type::Matrix);
-				transform = pMat->To4x4();
+				LUA->GetField(-1, "bodygroups");
+				if (!LUA->IsType(-1, Type::Nil)) {
+					if (!ReadPackedBodygroups(LUA, pModel->GetNumBodyGroups(), bodygroupValues)) {
+						LUA->ThrowError("Packed bodygroups must be a list of one number per model bodygroup");
+					}
+					packedBodygroups = true;
+				}
+				LUA->Pop();
 			}
 			LUA->Pop();
-
-			bones[boneIndex] = transform;
-			binds[boneIndex] = pModel->GetBindMatrix(boneIndex);
 		}
 
-		// Get materials
-		entData.materials.reserve(pModel->GetNumMaterials());
-		for (int materialId = 0; materialId < pModel->GetNumMaterials(); materialId++) {
-			std::string materialPath = "";
-			LUA->GetField(-1, "GetMaterial");
+		if (!packedBones) {
+			// Make sure the bone transforms are updated and the bones themselves are valid
+			LUA->GetField(-1, "SetupBones");
+			LUA->Push(-2);
+			callLua(1, 0);
+
+			// Get number of bones and make sure the value is valid
+			LUA->GetField(-1, "GetBoneCount");
 			LUA->Push(-2);
-			LUA->Call(1, 1);
-			if (LUA->IsType(-1, Type::String)) materialPath = LUA->GetString();
+			callLua(1, 1);
+			int numBones = LUA->GetNumber();
 			LUA->Pop();
 
-			if (materialPath.empty()) {
-				LUA->GetField(-1, "GetSubMaterial");
+			if (numBones < 1) LUA->ThrowError("Entity has invalid bones");
+			if (numBones != pModel->GetNumBones()) LUA->ThrowError("Entity bones don't match model");
+
+			// For each bone, cache the transform
+			bones.resize(numBones);
+			for (int boneIndex = 0; boneIndex < numBones; boneIndex++) {
+				LUA->GetField(-1, "GetBoneMatrix");
 				LUA->Push(-2);
-				LUA->PushNumber(materialId);
-				LUA->Call(2, 1);
-				if (LUA->IsType(-1, Type::String)) materialPath = LUA->GetString();
-				LUA->Pop();
+				LUA->PushNumber(boneIndex);
+				callLua(2, 1);
 
-				if (materialPath.empty()) {
-					materialPath = pModel->GetMaterial(materialId);
+				glm::mat4 transform = glm::identity<glm::mat4>();
+				if (LUA->IsType(-1, Type::Matrix)) {
+					const VMatrix* pMat = LUA->GetUserType<VMatrix>(-1, Type::Matrix);
+					transform = pMat->To4x4();
 				}
+				LUA->Pop();
+
+				bones[boneIndex] = transform;
 			}
+		}
 
-			if (mMaterialIds.find(materialPath) == mMaterialIds.end()) {
-				LUA->GetField(1, "Material");
-				LUA->PushString(materialPath.c_str());
-				LUA->Call(1, 1);
-				if (!LUA->IsType(-1, Type::Material)) LUA->ThrowError("Invalid material on entity");
+		// Get material paths, the entity wide override takes priority over submaterials
+		if (!packedMaterial) {
+			LUA->GetField(-1, "GetMaterial");
+			LUA->Push(-2);
+			callLua(1, 1);
+			if (LUA->IsType(-1, Type::String)) materialOverride = LUA->GetString();
+			LUA->Pop();
+		}
+
+		if (!materialOverride.empty()) {
+			materialPaths.assign(pModel->GetNumMaterials(), materialOverride);
+		} else {
+			if (!packedSubMaterials) {
+				materialPaths.assign(pModel->GetNumMaterials(), "");
+				for (int materialId = 0; materialId < pModel->GetNumMaterials(); materialId++) {
+					LUA->GetField(-1, "GetSubMaterial");
+					LUA->Push(-2);
+					LUA->PushNumber(materialId);
+					callLua(2, 1);
+					if (LUA->IsType(-1, Type::String)) materialPaths[materialId] = LUA->GetString();
+					LUA->Pop();
+				}
+			}
 
-				// Grab the source material
-				IMaterial* sourceMaterial = LUA->GetUserType<IMaterial>(-1, Type::Material);
+			for (int materialId = 0; materialId < pModel->GetNumMaterials(); materialId++) {
+				if (materialPaths[materialId].empty()) {
+					materialPaths[materialId] = pModel->GetMaterial(materialId);
+				}
+			}
+		}
 
-				// Read props
-				Material mat = ReadEntityMaterial(sourceMaterial, materialPath);
+		// Get bodygroup values
+		if (!packedBodygroups) {
+			bodygroupValues.resize(pModel->GetNumBodyGroups());
+			for (size_t bodygroupIdx = 0; bodygroupIdx < pModel->GetNumBodyGroups(); bodygroupIdx++) {
+				LUA->GetField(-1, "GetBodygroup");
+				LUA->Push(-2);
+				LUA->PushNumber(bodygroupIdx);
+				callLua(2, 1);
 
-				// Pop the material
+				bodygroupValues[bodygroupIdx] = LUA->GetNumber();
 				LUA->Pop();
-
-				mMaterialIds.emplace(materialPath, mMaterials.size());
-				mMaterials.push_back(mat);
 			}
-
-			entData.materials.push_back(mMaterialIds[materialPath]);
 		}
 
-		for (size_t bodygroupIdx = 0; bodygroupIdx < pModel->GetNumBodyGroups(); bodygroupIdx++) {
-			// Get bodygroup value
-			LUA->GetField(-1, "GetBodygroup");
-			LUA->Push(-2);
-			LUA->PushNumber(bodygroupIdx);
-			LUA->Call(2, 1);
+		// Get skin
+		LUA->GetField(-1, "GetSkin");
+		LUA->Push(-2);
+		callLua(1, 1);
 
-			int bodygroupVal = LUA->GetNumber();
-			LUA->Pop();
+		int skin = LUA->GetNumber();
+		LUA->Pop();
 
-			// Get skin
-			LUA->GetField(-1, "GetSkin");
-			LUA->Push(-2);
-			LUA->Call(1, 1);
+		// Save the entity's pointer for hit verification later
+		entData.rawEntity = LUA->GetUserType<CBaseEntity>(-1, Type::Entity);
+		LUA->Pop(); // Pop entity
 
-			int skin = LUA->GetNumber();
-			LUA->Pop();
+		// Pick a LoD for each bodygroup from the distance of the root bone to the reference point
+		std::vector<int> bodygroupLoDs(bodygroupValues.size(), 0);
+		{
+			const float metric = mLoDSettings.hasReference ?
+				glm::distance(glm::vec3(bones[0][3]), mLoDSettings.reference) * mLoDSettings.scale :
+				0.f;
+
+			for (size_t bodygroupIdx = 0; bodygroupIdx < bodygroupValues.size(); bodygroupIdx++) {
+				const BodyGroup* pBodygroup = pModel->GetBodyGroup(bodygroupIdx);
+				const int value = bodygroupValues[bodygroupIdx];
+				if (pBodygroup == nullptr || value < 0 || value >= pBodygroup->GetNumMeshes()) continue;
+
+				int lod = mLoDSettings.bias;
+				if (mLoDSettings.hasReference) lod += pBodygroup->SelectLoD(value, metric);
+				bodygroupLoDs[bodygroupIdx] = glm::clamp(lod, 0, pBodygroup->GetNumLoDs(value) - 1);
+			}
+		}
 
-			const Mesh* pMesh = pModel->GetMesh(bodygroupIdx, bodygroupVal);
+		// Reuse the last rebuild's geometry and materials if nothing that affects them has changed
+		uint64_t stateHash = HashBytes(&pModel, sizeof(pModel));
+		stateHash = HashBytes(bones.data(), bones.size() * sizeof(glm::mat4), stateHash);
+		stateHash = HashBytes(bodygroupValues.data(), bodygroupValues.size() * sizeof(int), stateHash);
+		stateHash = HashBytes(bodygroupLoDs.data(), bodygroupLoDs.size() * sizeof(int), stateHash);
+		stateHash = HashBytes(&skin, sizeof(skin), stateHash);
+		for (const std::string& materialPath : materialPaths) {
+			stateHash = HashBytes(materialPath.c_str(), materialPath.size() + 1, stateHash);
+		}
 
-			size_t triStart = mTriangles.size();
-			mTriangles.insert(
-				mTriangles.end(),
-				pMesh->GetTriangles(),
-				pMesh->GetTriangles() + pMesh->GetNumTriangles()
-			);
+		EntityCacheEntry cacheEntry{};
+		bool reuse = false;
+		{
+			auto cacheIt = mEntityCache.find(entData.id);
+			if (cacheIt != mEntityCache.end()) {
+				const EntityCacheEntry& cached = cacheIt->second;
+				if (cached.rawEntity == entData.rawEntity && cached.pModel.get() == pModel && cached.stateHash == stateHash) {
+					cacheEntry = std::move(cacheIt->second);
+					reuse = true;
+				}
+
+				// Remove the entry either way, so an error part way through can't leave a moved from entry behind
+				mEntityCache.erase(cacheIt);
+			}
+		}
 
-			for (int triIdx = triStart; triIdx < pMesh->GetNumTriangles() + triStart; triIdx++) {
-				Triangle& tri = mTriangles[triIdx];
+		// Get materials
+		entData.materials.reserve(materialPaths.size());
+		if (!reuse) cacheEntry.materials.reserve(materialPaths.size());
+		for (size_t materialId = 0; materialId < materialPaths.size(); materialId++) {
+			const std::string& materialPath = materialPaths[materialId];
+
+			if (materialIds.find(materialPath) == materialIds.end()) {
+				Material mat{};
+				if (reuse) {
+					mat = cacheEntry.materials[materialId];
+				} else {
+					LUA->GetField(1, "Material");
+					LUA->PushString(materialPath.c_str());
+					callLua(1, 1);
+					if (!LUA->IsType(-1, Type::Material)) LUA->ThrowError("Invalid material on entity");
+
+					// Grab the source material
+					IMaterial* sourceMaterial = LUA->GetUserType<IMaterial>(-1, Type::Material);
+
+					// Read props
+					mat = ReadEntityMaterial(sourceMaterial, materialPath);
+					LoadMaterialTextures(mat);
+
+					// Pop the material
+					LUA->Pop();
+				}
+
+				materialIds.emplace(materialPath, materials.size());
+				materials.push_back(mat);
+			}
 
-				tri.entIdx = mEntities.size();
-				tri.material = entData.materials[pModel->GetMaterialIdx(skin, tri.material)];
+			const size_t accelMaterialId = materialIds[materialPath];
+			if (!reuse) cacheEntry.materials.push_back(materials[accelMaterialId]);
+			entData.materials.push_back(accelMaterialId);
+		}
 
-				SkinTriangle(tri, bones, binds);
+		// Triangles are cached with the entity's own material indices, and remapped to the accel's below
+		const size_t entityTriStart = triangles.size();
+		if (reuse) {
+			triangles.insert(triangles.end(), cacheEntry.triangles.begin(), cacheEntry.triangles.end());
+			stats.numReusedEntities++;
+		} else {
+			BuildSkinningPalette(bones, pModel, palette);
+
+			for (size_t bodygroupIdx = 0; bodygroupIdx < pModel->GetNumBodyGroups(); bodygroupIdx++) {
+				const Mesh* pMesh = pModel->GetMesh(bodygroupIdx, bodygroupValues[bodygroupIdx], bodygroupLoDs[bodygroupIdx]);
+				if (pMesh == nullptr) continue;
+
+				size_t triStart = triangles.size();
+				triangles.resize(triStart + pMesh->GetNumTriangles());
+
+				auto skinStart = std::chrono::steady_clock::now();
+				skinned.resize(pMesh->GetNumVertices());
+				SkinVertices(pMesh->GetVertices(), pMesh->GetNumVertices(), palette.data(), palette.size(), skinned.data());
+				AssembleSkinnedTriangles(pMesh, skinned.data(), triangles.data() + triStart);
+				stats.skinningTime += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - skinStart).count();
+				stats.numSkinnedVertices += pMesh->GetNumVertices();
+
+				for (size_t triIdx = triStart; triIdx < triangles.size(); triIdx++) {
+					Triangle& tri = triangles[triIdx];
+					tri.material = pModel->GetMaterialIdx(skin, tri.material);
+				}
 			}
+
+			cacheEntry.triangles.assign(triangles.begin() + entityTriStart, triangles.end());
+			cacheEntry.rawEntity = entData.rawEntity;
+			cacheEntry.pModel = modelRef;
+			cacheEntry.stateHash = stateHash;
 		}
 
-		// Save the entity's pointer for hit verification later
-		entData.rawEntity = LUA->GetUserType<CBaseEntity>(-1, Type::Entity);
-		LUA->Pop(); // Pop entity
+		for (size_t triIdx = entityTriStart; triIdx < triangles.size(); triIdx++) {
+			Triangle& tri = triangles[triIdx];
+
+			tri.entIdx = entities.size();
+			tri.material = entData.materials[tri.material];
+		}
 
-		mEntities.push_back(entData);
+		entityCache.insert_or_assign(entData.id, std::move(cacheEntry));
+		entities.push_back(entData);
 	}
 
 	LUA->Pop(); // Pop entity table
 
-	// Build BVH
-	mAccel = BVH();
-	bvh::LocallyOrderedClusteringBuilder<BVH, uint32_t> builder(mAccel);
-	auto [bboxes, centers] = bvh::compute_bounding_boxes_and_centers(mTriangles.data(), mTriangles.size());
-	auto global_bbox = bvh::compute_bounding_boxes_union(bboxes.get(), mTriangles.size());
-	builder.build(global_bbox, bboxes.get(), centers.get(), mTriangles.size());
+	mEntityCache = std::move(entityCache);
+
+	// Nothing below can throw into Lua, so the lock is always released
+	// Render sessions stop taking traversal locks while this is set, so they can't hold the rebuild off
+	mRebuildPending = true;
+	{
+		std::unique_lock<std::shared_mutex> buildLock(mBuildMutex);
 
-	bvh::LeafCollapser collapser(mAccel);
-	collapser.collapse();
+		// Delete accel
+		mBuildCount++;
+		if (mAccelBuilt) {
+			mAccelBuilt = false;
+			delete mpIntersector;
+			delete mpTraverser;
+		}
 
-	mpIntersector = new Intersector(mAccel, mTriangles.data());
-	mpTraverser = new Traverser(mAccel);
+		mpWorld = pWorld;
+		mTriangles = std::move(triangles);
+		mEntities = std::move(entities);
+		mMaterialIds = std::move(materialIds);
 
-	mAccelBuilt = true;
+		// Results from the last build boxed for Lua keep the old material table alive
+		mpMaterials = std::make_shared<std::vector<Material>>(std::move(materials));
+
+		// Build BVH
+		auto bvhStart = std::chrono::steady_clock::now();
+		BuildBVH(mAccel, mTriangles.data(), mTriangles.size());
+
+		mpIntersector = new Intersector(mAccel, mTriangles.data());
+		mpTraverser = new Traverser(mAccel);
+
+		auto buildEnd = std::chrono::steady_clock::now();
+		stats.bvhTime = std::chrono::duration<double, std::milli>(buildEnd - bvhStart).count();
+		stats.totalTime = std::chrono::duration<double, std::milli>(buildEnd - buildStart).count();
+		stats.numEntities = mEntities.size();
+		stats.numTriangles = mTriangles.size();
+		stats.numInstances = mpWorld != nullptr ? mpWorld->instances.size() : 0;
+		mBuildStats = stats;
+
+		mAccelBuilt = true;
+	}
+	mRebuildPending = false;
 }
 
 int AccelStruct::Traverse(ILuaBase* LUA)
@@ -807,6 +1207,28 @@ int AccelStruct::Traverse(ILuaBase* LUA)
 
 	LUA->Pop(LUA->Top()); // Clear the stack of any items
 
+	std::optional<TraceResult> result = Trace(
+		glm::vec3(origin.x, origin.y, origin.z),
+		glm::vec3(direction.x, direction.y, direction.z),
+		tMin, tMax,
+		coneWidth, coneAngle
+	);
+
+	if (result) {
+		LUA->PushUserType_Value(BoxResult(*result), TraceResult::id);
+		return 1;
+	}
+
+	return 0;
+}
+
+std::optional<HitRecord> AccelStruct::FindHit(
+	const glm::vec3& origin, const glm::vec3& direction,
+	float tMin, float tMax
+) const
+{
+	if (!mAccelBuilt) return std::nullopt;
+
 	Ray ray(
 		Vector3(origin.x, origin.y, origin.z),
 		Vector3(direction.x, direction.y, direction.z),
@@ -816,28 +1238,170 @@ int AccelStruct::Traverse(ILuaBase* LUA)
 
 	// Perform BVH traversal for mesh hit
 	auto hit = mpTraverser->traverse(ray, *mpIntersector);
-	if (hit) {
-		auto intersection = hit->intersection;
-		const Triangle& tri = mTriangles[hit->primitive_index];
-		const Entity& ent = mEntities[tri.entIdx];
-		const Material& mat = mMaterials[tri.material];
-
-		TraceResult* pRes = new TraceResult(
-			glm::normalize(glm::vec3(direction.x, direction.y, direction.z)), hit->distance(),
-			coneWidth, coneAngle,
-			tri,
-			glm::vec2(hit->intersection.u, hit->intersection.v),
-			ent, mat
-		);
 
-		LUA->PushUserType_Value(pRes, TraceResult::id);
-		return 1;
+	// Then the static prop instances, only as far as the closest mesh hit
+	if (mpWorld != nullptr) {
+		if (hit) ray.tmax = hit->distance();
+
+		auto instanceHit = mpWorld->TraverseInstances(ray);
+		if (instanceHit) {
+			return HitRecord{
+				instanceHit->distance(),
+				glm::vec2(instanceHit->intersection.u, instanceHit->intersection.v),
+				static_cast<uint32_t>(instanceHit->intersection.primitive),
+				static_cast<uint32_t>(instanceHit->primitive_index)
+			};
+		}
 	}
 
-	return 0;
+	if (!hit) return std::nullopt;
+
+	return HitRecord{
+		hit->distance(),
+		glm::vec2(hit->intersection.u, hit->intersection.v),
+		static_cast<uint32_t>(hit->primitive_index)
+	};
+}
+
+const Triangle& AccelStruct::GetHitTriangle(const HitRecord& hit, Triangle& storage) const
+{
+	if (hit.instance == HitRecord::NO_INSTANCE) return mTriangles[hit.triangle];
+
+	storage = mpWorld->instances[hit.instance].GetWorldTriangle(hit.triangle);
+	return storage;
+}
+
+TraceResult AccelStruct::MakeResult(const HitRecord& hit, const glm::vec3& direction, float coneWidth, float coneAngle) const
+{
+	Triangle storage;
+	const Triangle& tri = GetHitTriangle(hit, storage);
+
+	return TraceResult(
+		glm::normalize(direction), hit.distance,
+		coneWidth, coneAngle,
+		tri,
+		hit.uv,
+		mEntities[tri.entIdx], (*mpMaterials)[tri.material]
+	);
+}
+
+TraceResult* AccelStruct::BoxResult(const TraceResult& result) const
+{
+	TraceResult* pRes = new TraceResult(result);
+	pRes->RetainMaterials(mpMaterials);
+	return pRes;
+}
+
+std::optional<TraceResult> AccelStruct::Trace(
+	const glm::vec3& origin, const glm::vec3& direction,
+	float tMin, float tMax,
+	float coneWidth, float coneAngle
+) const
+{
+	std::optional<HitRecord> hit = FindHit(origin, direction, tMin, tMax);
+	if (!hit) return std::nullopt;
+
+	return std::make_optional<TraceResult>(MakeResult(*hit, direction, coneWidth, coneAngle));
 }
 
+static bool ValidGBufferTarget(IRenderTarget* pRt, RTFormat format, const Camera& camera)
+{
+	return pRt == nullptr || (
+		pRt->IsValid() && pRt->GetFormat() == format &&
+		pRt->GetWidth() == camera.width && pRt->GetHeight() == camera.height
+	);
+}
+
+template<typename T>
+static T* GBufferData(IRenderTarget* pRt)
+{
+	return pRt != nullptr ? reinterpret_cast<T*>(pRt->GetRawData()) : nullptr;
+}
+
+bool AccelStruct::RenderGBuffer(const Camera& camera, uint32_t seed, const GBufferTargets& targets) const
+{
+	if (
+		!ValidGBufferTarget(targets.pDepth, RTFormat::RF, camera) ||
+		!ValidGBufferTarget(targets.pPosition, RTFormat::RGBFFF, camera) ||
+		!ValidGBufferTarget(targets.pNormal, RTFormat::RGBFFF, camera) ||
+		!ValidGBufferTarget(targets.pGeometricNormal, RTFormat::RGBFFF, camera) ||
+		!ValidGBufferTarget(targets.pAlbedo, RTFormat::RGBFFF, camera) ||
+		!ValidGBufferTarget(targets.pRoughness, RTFormat::RF, camera) ||
+		!ValidGBufferTarget(targets.pMetalness, RTFormat::RF, camera) ||
+		!ValidGBufferTarget(targets.pEntity, RTFormat::RF, camera) ||
+		!ValidGBufferTarget(targets.pMaterial, RTFormat::RF, camera)
+	) return false;
+
+	auto traversalLock = LockForTraversal();
+	if (!mAccelBuilt) return false;
+
+	float* pDepth = GBufferData<float>(targets.pDepth);
+	glm::vec3* pPosition = GBufferData<glm::vec3>(targets.pPosition);
+	glm::vec3* pNormal = GBufferData<glm::vec3>(targets.pNormal);
+	glm::vec3* pGeometricNormal = GBufferData<glm::vec3>(targets.pGeometricNormal);
+	glm::vec3* pAlbedo = GBufferData<glm::vec3>(targets.pAlbedo);
+	float* pRoughness = GBufferData<float>(targets.pRoughness);
+	float* pMetalness = GBufferData<float>(targets.pMetalness);
+	float* pEntity = GBufferData<float>(targets.pEntity);
+	float* pMaterial = GBufferData<float>(targets.pMaterial);
+
+	#pragma omp parallel for schedule(dynamic, 1)
+	for (int32_t y = 0; y < camera.height; y++) {
+		for (int32_t x = 0; x < camera.width; x++) {
+			const size_t idx = static_cast<size_t>(y) * camera.width + x;
+
+			glm::vec3 origin, direction;
+			GeneratePixelRay(camera, seed, x, y, origin, direction);
+
+			std::optional<TraceResult> hit = Trace(origin, direction, 0.f, FLT_MAX, 0.f, camera.spreadAngle);
+			if (!hit || hit->hitSky) {
+				if (pDepth) pDepth[idx] = 0.f;
+				if (pPosition) pPosition[idx] = glm::vec3(0.f);
+				if (pNormal) pNormal[idx] = glm::vec3(0.f);
+				if (pGeometricNormal) pGeometricNormal[idx] = glm::vec3(0.f);
+				if (pAlbedo) pAlbedo[idx] = glm::vec3(0.f);
+				if (pRoughness) pRoughness[idx] = 0.f;
+				if (pMetalness) pMetalness[idx] = 0.f;
+				if (pEntity) pEntity[idx] = -1.f;
+				if (pMaterial) pMaterial[idx] = -1.f;
+				continue;
+			}
+
+			if (pDepth) pDepth[idx] = hit->distance;
+			if (pPosition) pPosition[idx] = hit->GetPos();
+			if (pNormal) pNormal[idx] = hit->GetNormal();
+			if (pGeometricNormal) pGeometricNormal[idx] = hit->geometricNormal;
+			if (pAlbedo) pAlbedo[idx] = hit->GetAlbedo();
+			if (pRoughness) pRoughness[idx] = hit->GetRoughness();
+			if (pMetalness) pMetalness[idx] = hit->GetMetalness();
+			if (pEntity) pEntity[idx] = hit->entIdx;
+			if (pMaterial) pMaterial[idx] = hit->submatIdx;
+		}
+	}
+
+	return true;
+}
+
+std::shared_lock<std::shared_mutex> AccelStruct::LockForTraversal() const
+{
+	return std::shared_lock<std::shared_mutex>(mBuildMutex);
+}
+
+bool AccelStruct::IsBuilt() const { return mAccelBuilt; }
+uint64_t AccelStruct::GetBuildCount() const { return mBuildCount; }
+bool AccelStruct::IsRebuildPending() const { return mRebuildPending; }
+
+void AccelStruct::SetLoDSettings(const AccelLoDSettings& settings) { mLoDSettings = settings; }
+const AccelLoDSettings& AccelStruct::GetLoDSettings() const { return mLoDSettings; }
+
+const AccelBuildStats& AccelStruct::GetBuildStats() const { return mBuildStats; }
+
 const Material& AccelStruct::GetMaterial(const size_t i) const
 {
-	return mMaterials[i];
+	return (*mpMaterials)[i];
+}
+
+const Entity& AccelStruct::GetEntity(const size_t i) const
+{
+	return mEntities[i];
 }
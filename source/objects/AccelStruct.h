@@ -1,8 +1,15 @@
 #pragma once
 
 #include <vector>
+#include <memory>
 #include <unordered_map>
 #include <string>
+#include <optional>
+#include <shared_mutex>
+#include <atomic>
+#include <future>
+#include <chrono>
+#include <cfloat>
 
 #include "GarrysMod/Lua/Interface.h"
 
@@ -19,16 +26,27 @@
 #include "Material.h"
 #include "Primitives.h"
 #include "Model.h"
+#include "Instance.h"
+#include "Camera.h"
+#include "ResourceCache.h"
 
-#include "bvh/sweep_sah_builder.hpp"
-#include "bvh/single_ray_traverser.hpp"
-#include "bvh/primitive_intersectors.hpp"
+class TraceResult;
 
-using BVH = bvh::Bvh<float>;
-using Ray = bvh::Ray<float>;
-
-using Intersector = bvh::ClosestPrimitiveIntersector<BVH, Triangle>;
-using Traverser = bvh::SingleRayTraverser<BVH>;
+/// <summary>
+/// Render targets to write G-buffer channels to, null channels are skipped
+/// </summary>
+struct GBufferTargets
+{
+	VisTrace::IRenderTarget* pDepth = nullptr;           // RF, hit distance
+	VisTrace::IRenderTarget* pPosition = nullptr;        // RGBFFF
+	VisTrace::IRenderTarget* pNormal = nullptr;          // RGBFFF, shading normal
+	VisTrace::IRenderTarget* pGeometricNormal = nullptr; // RGBFFF
+	VisTrace::IRenderTarget* pAlbedo = nullptr;          // RGBFFF
+	VisTrace::IRenderTarget* pRoughness = nullptr;       // RF
+	VisTrace::IRenderTarget* pMetalness = nullptr;       // RF
+	VisTrace::IRenderTarget* pEntity = nullptr;          // RF, entity index
+	VisTrace::IRenderTarget* pMaterial = nullptr;        // RF, submaterial index
+};
 
 struct Entity
 {
@@ -39,12 +57,94 @@ struct Entity
 	glm::vec4 colour;
 };
 
+/// <summary>
+/// Timings and counts from the last PopulateAccel, times are in milliseconds
+/// </summary>
+struct AccelBuildStats
+{
+	size_t numEntities = 0;
+	size_t numTriangles = 0;
+	size_t numInstances = 0; // Static props, whose triangles aren't included in numTriangles
+	size_t numSkinnedVertices = 0;
+	size_t numReusedEntities = 0; // Entities whose geometry was reused from the last build
+	size_t numLuaCalls = 0; // Calls into Lua while gathering entity state and materials
+
+	double skinningTime = 0.0; // Skinning and triangle assembly, excluding gathering entity state from Lua
+	double bvhTime = 0.0;
+	double totalTime = 0.0;
+};
+
+/// <summary>
+/// Controls which VTX LoD entity geometry is built from
+/// </summary>
+struct AccelLoDSettings
+{
+	// Without a reference point every entity uses LoD 0 plus the bias
+	bool hasReference = false;
+	glm::vec3 reference = glm::vec3(0.f);
+
+	// Distance is multiplied by this before being compared against the model's LoD switch points
+	float scale = 0.1f;
+
+	// Added to the selected LoD, before clamping to the LoDs the model has
+	int bias = 0;
+};
+
+/// <summary>
+/// Geometry and materials of an entity from the last build, reused if the entity's state hasn't changed
+/// </summary>
+struct EntityCacheEntry
+{
+	CBaseEntity* rawEntity = nullptr;
+	ResourceCache::ModelRef pModel; // Keeps the model alive, so its address can't be reused by another one
+	uint64_t stateHash = 0;
+
+	std::vector<Material> materials; // Per model material, with overrides applied
+	std::vector<Triangle> triangles; // Skinned, with materials indexing into the above
+};
+
+/// <summary>
+/// Timings and counts from loading the world, times are in milliseconds
+/// </summary>
+struct WorldLoadStats
+{
+	size_t numTriangles = 0;
+	size_t numStaticProps = 0;
+	size_t numUniqueProps = 0;
+	size_t bytesSkipped = 0; // Lump data that was never read from the BSP
+	size_t numTextures = 0; // Unique texture paths prefetched for world and prop materials
+
+	double readTime = 0.0; // Reading and parsing the BSP
+	double materialTime = 0.0; // Resolving world materials through Lua
+	double textureTime = 0.0; // Prefetching every material's textures in parallel
+	double triangleTime = 0.0; // Background
+	double propModelTime = 0.0; // Background, parsing prop models and building their BLASes
+	double propMaterialTime = 0.0; // Resolving prop materials through Lua and placing instances
+	double instanceTime = 0.0; // Building the top level BVH
+	double totalTime = 0.0; // Wall time from starting the load to the world being ready
+};
+
 class World
 {
 private:
-	BSPMap* pMap;
+	BSPMap* pMap = nullptr;
+
+	// Set once Finalise has completed, after which the world is never modified again
+	bool mReady = false;
+
+	std::future<void> mBackgroundLoad;
+	std::chrono::steady_clock::time_point mLoadStart;
+
+	// Static props and their models, only kept until Finalise
+	std::vector<BSPStaticProp> mProps;
+	std::vector<ResourceCache::ModelRef> mPropModels;
+
+	// Builds triangles, and parses prop models and their BLASes, without touching Lua
+	void LoadBackground(const std::unordered_map<int16_t, size_t>& textureMaterials);
 
 public:
+	WorldLoadStats loadStats;
+
 	std::vector<Triangle> triangles;
 
 	std::vector<Entity> entities;
@@ -52,10 +152,49 @@ public:
 	std::unordered_map<std::string, size_t> materialIds;
 	std::vector<Material> materials;
 
+	// Static props, instancing one BLAS per unique model
+	std::unordered_map<const Model*, std::unique_ptr<BLAS>> modelBLAS;
+	std::vector<Instance> instances;
+	BVH instanceAccel;
+	std::unique_ptr<InstanceIntersector> pInstanceIntersector;
+	std::unique_ptr<Traverser> pInstanceTraverser;
+
+	/// <summary>
+	/// Reads the map and resolves world materials through Lua, then continues loading on a background thread
+	/// The world can't be used by an accel until Finalise returns true
+	/// </summary>
 	World(GarrysMod::Lua::ILuaBase* LUA, const std::string& mapName);
 	~World();
 
 	bool IsValid() const;
+	bool IsReady() const;
+
+	/// <summary>
+	/// Finishes loading on the main thread once the background load is done, resolving prop materials through Lua
+	/// </summary>
+	/// <param name="timeout">Milliseconds to wait for the background load, negative to wait indefinitely</param>
+	/// <returns>Whether the world is ready</returns>
+	bool Finalise(GarrysMod::Lua::ILuaBase* LUA, double timeout = 0.0);
+
+	/// <summary>
+	/// Traverses the static prop instances
+	/// </summary>
+	/// <returns>Closest instance hit, or nullopt if there are no instances or none were hit</returns>
+	std::optional<InstanceIntersector::Result> TraverseInstances(const Ray& ray) const;
+};
+
+/// <summary>
+/// Closest hit of a ray, which can be turned back into a TraceResult until the accel is rebuilt
+/// </summary>
+struct HitRecord
+{
+	static constexpr uint32_t NO_INSTANCE = UINT32_MAX;
+
+	float distance;
+	glm::vec2 uv;
+
+	uint32_t triangle; // Index into the accel's triangles, or the instance's BLAS if instance is set
+	uint32_t instance = NO_INSTANCE;
 };
 
 class AccelStruct
@@ -64,6 +203,7 @@ private:
 	const World* mpWorld;
 
 	bool mAccelBuilt;
+	uint64_t mBuildCount = 0; // Incremented whenever the accel is torn down, invalidating hit records
 	BVH mAccel;
 	Intersector* mpIntersector;
 	Traverser* mpTraverser;
@@ -73,14 +213,102 @@ private:
 	std::vector<Entity> mEntities;
 
 	std::unordered_map<std::string, size_t> mMaterialIds;
-	std::vector<Material> mMaterials;
+	std::shared_ptr<std::vector<Material>> mpMaterials; // Shared with every TraceResult from the accel boxed for Lua
+
+	AccelBuildStats mBuildStats;
+	AccelLoDSettings mLoDSettings;
+
+	// Keyed by entity index
+	std::unordered_map<uint32_t, EntityCacheEntry> mEntityCache;
+
+	// Held exclusively while rebuilding, and shared by any threads traversing outside of Lua
+	mutable std::shared_mutex mBuildMutex;
+
+	// Set while a rebuild is waiting for or holding the build lock
+	std::atomic<bool> mRebuildPending{ false };
 
 public:
 	AccelStruct();
 	~AccelStruct();
 
-	void PopulateAccel(GarrysMod::Lua::ILuaBase* LUA, const World* pWorld = nullptr);
+	/// <summary>
+	/// Rebuilds the accel from the table of entities at the top of the stack
+	/// </summary>
+	/// <param name="pWorld">World to include, or nullptr</param>
+	/// <param name="boneMatricesIdx">Absolute stack index of a table of packed entity state keyed by entity, or 0 to query all state from Lua</param>
+	void PopulateAccel(GarrysMod::Lua::ILuaBase* LUA, const World* pWorld = nullptr, int boneMatricesIdx = 0);
 	int Traverse(GarrysMod::Lua::ILuaBase* LUA);
 
+	/// <summary>
+	/// Traces a ray against the acceleration structure without going through Lua
+	/// Safe to call from multiple threads at once, as long as they hold the lock from LockForTraversal
+	/// </summary>
+	/// <param name="origin">Ray origin</param>
+	/// <param name="direction">Ray direction</param>
+	/// <param name="tMin">Minimum distance along the ray</param>
+	/// <param name="tMax">Maximum distance along the ray</param>
+	/// <param name="coneWidth">Starting width of the ray cone (negative to only sample mip 0)</param>
+	/// <param name="coneAngle">Spread angle of the ray cone (negative to only sample mip 0)</param>
+	/// <returns>Hit result, or nullopt if nothing was hit or the accel isn't built</returns>
+	std::optional<TraceResult> Trace(
+		const glm::vec3& origin, const glm::vec3& direction,
+		float tMin = 0.f, float tMax = FLT_MAX,
+		float coneWidth = -1.f, float coneAngle = -1.f
+	) const;
+
+	/// <summary>
+	/// Finds the closest hit of a ray without building a TraceResult, the caller must hold the lock from LockForTraversal
+	/// </summary>
+	/// <returns>Closest hit, or nullopt if nothing was hit or the accel isn't built</returns>
+	std::optional<HitRecord> FindHit(const glm::vec3& origin, const glm::vec3& direction, float tMin = 0.f, float tMax = FLT_MAX) const;
+
+	/// <summary>
+	/// Gets the world space triangle a hit is on
+	/// </summary>
+	/// <param name="storage">Written to and returned for instance hits, which have to be transformed into world space</param>
+	const Triangle& GetHitTriangle(const HitRecord& hit, Triangle& storage) const;
+
+	/// <summary>
+	/// Builds the TraceResult of a hit from FindHit, which must be from the current build
+	/// </summary>
+	TraceResult MakeResult(const HitRecord& hit, const glm::vec3& direction, float coneWidth = -1.f, float coneAngle = -1.f) const;
+
+	/// <summary>
+	/// Copies a result from the current build onto the heap to be pushed to Lua, keeping the build's material table alive with it
+	/// </summary>
+	TraceResult* BoxResult(const TraceResult& result) const;
+
+	/// <summary>
+	/// Traces a primary ray per pixel and writes the requested G-buffer channels, in parallel
+	/// Shading uses the same lazy evaluation as TraceResult, so unrequested channels cost nothing
+	/// Pixels that miss or hit the sky are 0, with -1 entity and material indices
+	/// </summary>
+	/// <param name="camera">Camera to generate rays with, must match the size of the targets</param>
+	/// <param name="seed">Seed for thin lens samples</param>
+	/// <param name="targets">Channels to write</param>
+	/// <returns>False if the accel isn't built or a target has the wrong size or format</returns>
+	bool RenderGBuffer(const Camera& camera, uint32_t seed, const GBufferTargets& targets) const;
+
+	/// <summary>
+	/// Locks the accel against rebuilds for the lifetime of the returned lock
+	/// </summary>
+	std::shared_lock<std::shared_mutex> LockForTraversal() const;
+
+	bool IsBuilt() const;
+	uint64_t GetBuildCount() const;
+
+	/// <summary>
+	/// Checks if the main thread is rebuilding the accel, background threads should back off rather than take the traversal lock
+	/// </summary>
+	bool IsRebuildPending() const;
+	const AccelBuildStats& GetBuildStats() const;
+
+	/// <summary>
+	/// Sets how entity LoDs are selected, takes effect on the next rebuild
+	/// </summary>
+	void SetLoDSettings(const AccelLoDSettings& settings);
+	const AccelLoDSettings& GetLoDSettings() const;
+
 	const Material& GetMaterial(const size_t i) const;
+	const Entity& GetEntity(const size_t i) const;
 };
@@ -0,0 +1,314 @@
+#include "HitBuffer.h"
+
+#include <algorithm>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace VisTrace;
+
+// Rays per work item, hits vary too much in cost for a static schedule
+#define HIT_BUFFER_CHUNK 64
+
+// Rays shaded at once, bounding the memory of their results and prefetched texels
+#define HIT_BUFFER_SHADE_BATCH 16384
+
+int HitBuffer::id = -1;
+
+template<typename T>
+static void ResizeIfAllocated(std::vector<T>& v, size_t size)
+{
+	if (!v.empty()) v.resize(size);
+}
+
+template<typename T>
+static void Allocate(std::vector<T>& v, size_t size)
+{
+	if (v.size() != size) v.resize(size);
+}
+
+static bool HasAttribute(const HitAttributes attributes, const HitAttributes attribute)
+{
+	return (attributes & attribute) != HitAttributes::None;
+}
+
+void HitBuffer::Resize(size_t size)
+{
+	mSize = size;
+
+	mDistances.resize(size);
+	mTriangles.resize(size);
+	mInstances.resize(size);
+	mBarycentrics.resize(size);
+	mEntities.resize(size);
+	mSubMaterials.resize(size);
+	mHitSky.resize(size);
+
+	mDirections.resize(size);
+	mRawEntities.resize(size);
+
+	mShaded.assign(size, HitAttributes::None);
+	ResizeIfAllocated(mPositions, size);
+	ResizeIfAllocated(mNormals, size);
+	ResizeIfAllocated(mTangents, size);
+	ResizeIfAllocated(mBinormals, size);
+	ResizeIfAllocated(mAlbedos, size);
+	ResizeIfAllocated(mAlphas, size);
+	ResizeIfAllocated(mMetalness, size);
+	ResizeIfAllocated(mRoughness, size);
+}
+
+bool HitBuffer::IsCurrent() const
+{
+	return mpAccel != nullptr && mpAccel->IsBuilt() && mpAccel->GetBuildCount() == mBuildCount;
+}
+
+bool HitBuffer::Trace(
+	const AccelStruct* pAccel,
+	const glm::vec3* pOrigins, const glm::vec3* pDirections, size_t numRays,
+	float tMin, float tMax,
+	float coneWidth, float coneAngle
+)
+{
+	auto traversalLock = pAccel->LockForTraversal();
+	if (!pAccel->IsBuilt()) return false;
+
+	mpAccel = pAccel;
+	mBuildCount = pAccel->GetBuildCount();
+	mConeWidth = coneWidth;
+	mConeAngle = coneAngle;
+
+	Resize(numRays);
+
+	#pragma omp parallel for schedule(dynamic, HIT_BUFFER_CHUNK)
+	for (int32_t i = 0; i < static_cast<int32_t>(numRays); i++) {
+		mDirections[i] = pDirections[i];
+
+		std::optional<HitRecord> hit = pAccel->FindHit(pOrigins[i], pDirections[i], tMin, tMax);
+		if (!hit) {
+			mDistances[i] = 0.f;
+			mTriangles[i] = INVALID_INDEX;
+			mInstances[i] = INVALID_INDEX;
+			mBarycentrics[i] = glm::vec2(0.f);
+			mEntities[i] = INVALID_INDEX;
+			mSubMaterials[i] = INVALID_INDEX;
+			mHitSky[i] = false;
+			mRawEntities[i] = nullptr;
+			continue;
+		}
+
+		Triangle storage;
+		const Triangle& tri = pAccel->GetHitTriangle(*hit, storage);
+		const Entity& ent = pAccel->GetEntity(tri.entIdx);
+
+		mDistances[i] = hit->distance;
+		mTriangles[i] = hit->triangle;
+		mInstances[i] = hit->instance;
+		mBarycentrics[i] = hit->uv;
+		mEntities[i] = ent.id;
+		mSubMaterials[i] = tri.material;
+		mHitSky[i] = (pAccel->GetMaterial(tri.material).surfFlags & BSPEnums::SURF::SKY) != BSPEnums::SURF::NONE;
+		mRawEntities[i] = ent.rawEntity;
+	}
+
+	return true;
+}
+
+const AccelStruct* HitBuffer::GetAccel() const { return mpAccel; }
+
+std::optional<TraceResult> HitBuffer::GetResult(size_t i) const
+{
+	if (i >= mSize || !IsHit(i)) return std::nullopt;
+
+	auto traversalLock = mpAccel->LockForTraversal();
+	if (!IsCurrent()) return std::nullopt;
+
+	const HitRecord hit{ mDistances[i], mBarycentrics[i], mTriangles[i], mInstances[i] };
+	return std::make_optional<TraceResult>(mpAccel->MakeResult(hit, mDirections[i], mConeWidth, mConeAngle));
+}
+
+CBaseEntity* HitBuffer::GetRawEntity(size_t i) const { return mRawEntities[i]; }
+const float* HitBuffer::GetDirections() const { return mDirections.empty() ? nullptr : &mDirections[0].x; }
+
+size_t HitBuffer::GetSize() const { return mSize; }
+
+bool HitBuffer::IsHit(size_t i) const { return mTriangles[i] != INVALID_INDEX; }
+bool HitBuffer::HitSky(size_t i) const { return mHitSky[i] != 0; }
+
+const float* HitBuffer::GetDistances() const { return mDistances.data(); }
+const uint32_t* HitBuffer::GetTriangles() const { return mTriangles.data(); }
+const uint32_t* HitBuffer::GetInstances() const { return mInstances.data(); }
+const float* HitBuffer::GetBarycentrics() const { return mBarycentrics.empty() ? nullptr : &mBarycentrics[0].x; }
+const uint32_t* HitBuffer::GetEntities() const { return mEntities.data(); }
+const uint32_t* HitBuffer::GetSubMaterials() const { return mSubMaterials.data(); }
+
+static HitAttributes GetMissing(const HitAttributes attributes, const HitAttributes shaded)
+{
+	return static_cast<HitAttributes>(static_cast<uint8_t>(attributes) & ~static_cast<uint8_t>(shaded));
+}
+
+bool HitBuffer::Shade(size_t start, size_t count, HitAttributes attributes)
+{
+	if (start > mSize || count > mSize - start || mpAccel == nullptr) return false;
+
+	auto traversalLock = mpAccel->LockForTraversal();
+	if (!IsCurrent()) return false;
+
+	if (HasAttribute(attributes, HitAttributes::Position)) Allocate(mPositions, mSize);
+	if (HasAttribute(attributes, HitAttributes::TBN)) {
+		Allocate(mNormals, mSize);
+		Allocate(mTangents, mSize);
+		Allocate(mBinormals, mSize);
+	}
+	if (HasAttribute(attributes, HitAttributes::Shading)) {
+		Allocate(mAlbedos, mSize);
+		Allocate(mAlphas, mSize);
+		Allocate(mMetalness, mSize);
+		Allocate(mRoughness, mSize);
+	}
+
+	for (size_t offset = 0; offset < count; offset += HIT_BUFFER_SHADE_BATCH) {
+		ShadeBatch(start + offset, std::min<size_t>(HIT_BUFFER_SHADE_BATCH, count - offset), attributes);
+	}
+
+	return true;
+}
+
+void HitBuffer::ShadeBatch(size_t start, size_t count, HitAttributes attributes)
+{
+	if (mResults.size() < count) {
+		mResults.resize(count);
+		mSlots.resize(count);
+		mPixels.resize(count * static_cast<size_t>(TextureSlot::Count));
+	}
+
+	#pragma omp parallel for schedule(dynamic, HIT_BUFFER_CHUNK)
+	for (int32_t offset = 0; offset < static_cast<int32_t>(count); offset++) {
+		const size_t i = start + offset;
+
+		mResults[offset].reset();
+		mSlots[offset] = 0;
+		if (!IsHit(i)) continue;
+
+		const HitAttributes missing = GetMissing(attributes, mShaded[i]);
+		if (missing == HitAttributes::None) continue;
+
+		const HitRecord hit{ mDistances[i], mBarycentrics[i], mTriangles[i], mInstances[i] };
+		mResults[offset].emplace(mpAccel->MakeResult(hit, mDirections[i], mConeWidth, mConeAngle));
+		mSlots[offset] = mResults[offset]->GetTextureSlots(
+			HasAttribute(missing, HitAttributes::TBN),
+			HasAttribute(missing, HitAttributes::Shading)
+		);
+	}
+
+	PrefetchTextures(start, count);
+
+	#pragma omp parallel for schedule(dynamic, HIT_BUFFER_CHUNK)
+	for (int32_t offset = 0; offset < static_cast<int32_t>(count); offset++) {
+		std::optional<TraceResult>& result = mResults[offset];
+		if (!result) continue;
+
+		const size_t i = start + offset;
+		const HitAttributes missing = GetMissing(attributes, mShaded[i]);
+
+		// Each attribute goes through the result's lazy getters, so only what's missing is evaluated
+		result->SetPrefetchedPixels(&mPixels[offset * static_cast<size_t>(TextureSlot::Count)]);
+
+		if (HasAttribute(missing, HitAttributes::Position)) mPositions[i] = result->GetPos();
+		if (HasAttribute(missing, HitAttributes::TBN)) {
+			mNormals[i] = result->GetNormal();
+			mTangents[i] = result->GetTangent();
+			mBinormals[i] = result->GetBinormal();
+		}
+		if (HasAttribute(missing, HitAttributes::Shading)) {
+			mAlbedos[i] = result->GetAlbedo();
+			mAlphas[i] = result->GetAlpha();
+			mMetalness[i] = result->GetMetalness();
+			mRoughness[i] = result->GetRoughness();
+		}
+
+		mShaded[i] = mShaded[i] | missing;
+	}
+}
+
+// Samples every texture the batch's results need through SampleBatch, a call per texture of each material hit
+// rather than a virtual Sample per texture of each hit, and in ray order within a material so neighbouring rays share texels
+void HitBuffer::PrefetchTextures(size_t start, size_t count)
+{
+	constexpr size_t numSlots = static_cast<size_t>(TextureSlot::Count);
+
+	mOrder.clear();
+	for (uint32_t offset = 0; offset < count; offset++) {
+		if (mSlots[offset] != 0) mOrder.push_back(offset);
+	}
+	if (mOrder.empty()) return;
+
+	std::sort(mOrder.begin(), mOrder.end(), [this, start](const uint32_t a, const uint32_t b) {
+		const uint32_t materialA = mSubMaterials[start + a], materialB = mSubMaterials[start + b];
+		return materialA != materialB ? materialA < materialB : a < b;
+	});
+
+	mGroups.clear();
+	for (size_t j = 0; j < mOrder.size(); j++) {
+		if (j == 0 || mSubMaterials[start + mOrder[j]] != mSubMaterials[start + mOrder[j - 1]]) {
+			mGroups.push_back(static_cast<uint32_t>(j));
+		}
+	}
+	mGroups.push_back(static_cast<uint32_t>(mOrder.size()));
+
+	const size_t planeSize = mOrder.size();
+	if (mSampled.size() < planeSize * numSlots) {
+		mTapU.resize(planeSize * numSlots);
+		mTapV.resize(planeSize * numSlots);
+		mTapLod.resize(planeSize * numSlots);
+		mSampled.resize(planeSize * numSlots);
+	}
+
+	#pragma omp parallel for schedule(dynamic, 1)
+	for (int32_t group = 0; group < static_cast<int32_t>(mGroups.size() - 1); group++) {
+		const size_t first = mGroups[group], last = mGroups[group + 1];
+		const Material& material = mpAccel->GetMaterial(mSubMaterials[start + mOrder[first]]);
+
+		for (size_t slotIdx = 0; slotIdx < numSlots; slotIdx++) {
+			const TextureSlot slot = static_cast<TextureSlot>(slotIdx);
+			const uint8_t bit = TextureSlotBit(slot);
+
+			// Each group and slot gathers into its own part of the slot's plane, so groups don't share any scratch
+			const size_t plane = slotIdx * planeSize + first;
+			size_t numTaps = 0;
+			for (size_t j = first; j < last; j++) {
+				const uint32_t offset = mOrder[j];
+				if ((mSlots[offset] & bit) == 0) continue;
+
+				mResults[offset]->GetTextureTap(slot, mTapU[plane + numTaps], mTapV[plane + numTaps], mTapLod[plane + numTaps]);
+				numTaps++;
+			}
+			if (numTaps == 0) continue;
+
+			material.GetTexture(slot)->SampleBatch(
+				&mTapU[plane], &mTapV[plane], &mTapLod[plane],
+				&mSampled[plane], numTaps
+			);
+
+			numTaps = 0;
+			for (size_t j = first; j < last; j++) {
+				const uint32_t offset = mOrder[j];
+				if ((mSlots[offset] & bit) == 0) continue;
+
+				mPixels[offset * numSlots + slotIdx] = mSampled[plane + numTaps++];
+			}
+		}
+	}
+}
+
+HitAttributes HitBuffer::GetShaded(size_t i) const { return mShaded[i]; }
+
+const float* HitBuffer::GetPositions() const { return mPositions.empty() ? nullptr : &mPositions[0].x; }
+const float* HitBuffer::GetNormals() const { return mNormals.empty() ? nullptr : &mNormals[0].x; }
+const float* HitBuffer::GetTangents() const { return mTangents.empty() ? nullptr : &mTangents[0].x; }
+const float* HitBuffer::GetBinormals() const { return mBinormals.empty() ? nullptr : &mBinormals[0].x; }
+const float* HitBuffer::GetAlbedos() const { return mAlbedos.empty() ? nullptr : &mAlbedos[0].x; }
+const float* HitBuffer::GetAlphas() const { return mAlphas.empty() ? nullptr : mAlphas.data(); }
+const float* HitBuffer::GetMetalness() const { return mMetalness.empty() ? nullptr : mMetalness.data(); }
+const float* HitBuffer::GetRoughness() const { return mRoughness.empty() ? nullptr : mRoughness.data(); }
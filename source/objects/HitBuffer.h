@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <optional>
+
+#include "glm/glm.hpp"
+
+#include "vistrace/IHitBuffer.h"
+
+#include "AccelStruct.h"
+#include "TraceResult.h"
+
+/// <summary>
+/// Hits of a batch of rays against an accel, with shading attributes computed on request
+/// </summary>
+class HitBuffer : public VisTrace::IHitBuffer
+{
+private:
+	const AccelStruct* mpAccel = nullptr;
+	uint64_t mBuildCount = 0;
+
+	float mConeWidth = -1.f;
+	float mConeAngle = -1.f;
+
+	size_t mSize = 0;
+
+	std::vector<float> mDistances;
+	std::vector<uint32_t> mTriangles;
+	std::vector<uint32_t> mInstances;
+	std::vector<glm::vec2> mBarycentrics;
+	std::vector<uint32_t> mEntities;
+	std::vector<uint32_t> mSubMaterials;
+	std::vector<uint8_t> mHitSky;
+
+	// Needed to rebuild each hit's TraceResult, and to check its entity from Lua
+	std::vector<glm::vec3> mDirections;
+	std::vector<CBaseEntity*> mRawEntities;
+
+	// Allocated the first time an attribute is requested
+	std::vector<VisTrace::HitAttributes> mShaded;
+	std::vector<glm::vec3> mPositions;
+	std::vector<glm::vec3> mNormals;
+	std::vector<glm::vec3> mTangents;
+	std::vector<glm::vec3> mBinormals;
+	std::vector<glm::vec3> mAlbedos;
+	std::vector<float> mAlphas;
+	std::vector<float> mMetalness;
+	std::vector<float> mRoughness;
+
+	// Kept between calls to Shade, so shading a range doesn't allocate once they've grown
+	std::vector<std::optional<TraceResult>> mResults;
+	std::vector<uint8_t> mSlots; // TextureSlotBit of each slot a result samples
+	std::vector<VisTrace::Pixel> mPixels; // TextureSlot::Count per result
+	std::vector<uint32_t> mOrder; // Results that sample any texture, sorted by material
+	std::vector<uint32_t> mGroups; // Start of each material's results in mOrder, and the end of the last
+	std::vector<float> mTapU, mTapV, mTapLod; // A plane of mOrder's size per slot
+	std::vector<VisTrace::Pixel> mSampled;
+
+	void Resize(size_t size);
+	void ShadeBatch(size_t start, size_t count, VisTrace::HitAttributes attributes);
+	void PrefetchTextures(size_t start, size_t count);
+	bool IsCurrent() const;
+
+public:
+	static int id;
+
+	// Registry reference to the accel the rays were traced against, so it can't be collected while the buffer is alive
+	int accelRef = -1;
+
+	/// <summary>
+	/// Traces a batch of rays in parallel, replacing the buffer's contents
+	/// </summary>
+	/// <param name="coneWidth">Starting width of every ray's cone (negative to only sample mip 0)</param>
+	/// <param name="coneAngle">Spread angle of every ray's cone (negative to only sample mip 0)</param>
+	/// <returns>False if the accel isn't built</returns>
+	bool Trace(
+		const AccelStruct* pAccel,
+		const glm::vec3* pOrigins, const glm::vec3* pDirections, size_t numRays,
+		float tMin = 0.f, float tMax = FLT_MAX,
+		float coneWidth = -1.f, float coneAngle = -1.f
+	);
+
+	const AccelStruct* GetAccel() const;
+
+	/// <summary>
+	/// Builds the full TraceResult of a ray
+	/// </summary>
+	/// <returns>Result, or nullopt if the ray missed or the accel has been rebuilt since it was traced</returns>
+	std::optional<TraceResult> GetResult(size_t i) const;
+
+	CBaseEntity* GetRawEntity(size_t i) const;
+
+	// Direction of each ray, 3 floats per ray
+	const float* GetDirections() const;
+
+	size_t GetSize() const;
+
+	bool IsHit(size_t i) const;
+	bool HitSky(size_t i) const;
+
+	const float* GetDistances() const;
+	const uint32_t* GetTriangles() const;
+	const uint32_t* GetInstances() const;
+	const float* GetBarycentrics() const;
+	const uint32_t* GetEntities() const;
+	const uint32_t* GetSubMaterials() const;
+
+	bool Shade(size_t start, size_t count, VisTrace::HitAttributes attributes = VisTrace::HitAttributes::All);
+	VisTrace::HitAttributes GetShaded(size_t i) const;
+
+	const float* GetPositions() const;
+	const float* GetNormals() const;
+	const float* GetTangents() const;
+	const float* GetBinormals() const;
+	const float* GetAlbedos() const;
+	const float* GetAlphas() const;
+	const float* GetMetalness() const;
+	const float* GetRoughness() const;
+};
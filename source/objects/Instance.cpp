@@ -0,0 +1,138 @@
+#include "Instance.h"
+
+#include "Skinning.h"
+
+#include "bvh/locally_ordered_clustering_builder.hpp"
+#include "bvh/leaf_collapser.hpp"
+
+template <typename Primitive>
+static bvh::BoundingBox<float> BuildBVHImpl(BVH& accel, const Primitive* pPrimitives, size_t numPrimitives)
+{
+	accel = BVH();
+	bvh::LocallyOrderedClusteringBuilder<BVH, uint32_t> builder(accel);
+	auto [bboxes, centers] = bvh::compute_bounding_boxes_and_centers(pPrimitives, numPrimitives);
+	auto global_bbox = bvh::compute_bounding_boxes_union(bboxes.get(), numPrimitives);
+	builder.build(global_bbox, bboxes.get(), centers.get(), numPrimitives);
+
+	bvh::LeafCollapser collapser(accel);
+	collapser.collapse();
+
+	return global_bbox;
+}
+
+bvh::BoundingBox<float> BuildBVH(BVH& accel, const Triangle* pPrimitives, size_t numPrimitives)
+{
+	return BuildBVHImpl(accel, pPrimitives, numPrimitives);
+}
+
+bvh::BoundingBox<float> BuildBVH(BVH& accel, const Instance* pPrimitives, size_t numPrimitives)
+{
+	return BuildBVHImpl(accel, pPrimitives, numPrimitives);
+}
+
+BLAS::BLAS(const Model* pModel)
+{
+	// Bind pose of the root bone, instances apply their own transform on top
+	const glm::mat4 palette = pModel->GetBindMatrix(0);
+
+	std::vector<SkinnedVertex> skinned;
+	for (int32_t bodygroupIdx = 0; bodygroupIdx < pModel->GetNumBodyGroups(); bodygroupIdx++) {
+		const Mesh* pMesh = pModel->GetMesh(bodygroupIdx, 0);
+		if (pMesh == nullptr) continue;
+
+		const size_t triStart = mTriangles.size();
+		mTriangles.resize(triStart + pMesh->GetNumTriangles());
+
+		skinned.resize(pMesh->GetNumVertices());
+		SkinVertices(pMesh->GetVertices(), pMesh->GetNumVertices(), &palette, 1, skinned.data());
+		AssembleSkinnedTriangles(pMesh, skinned.data(), mTriangles.data() + triStart);
+	}
+
+	if (mTriangles.empty()) return;
+
+	for (const Triangle& tri : mTriangles) {
+		if (tri.material >= mNumSubmaterials) mNumSubmaterials = tri.material + 1;
+	}
+
+	mBounds = BuildBVH(mAccel, mTriangles.data(), mTriangles.size());
+	mpIntersector = std::make_unique<Intersector>(mAccel, mTriangles.data());
+	mpTraverser = std::make_unique<Traverser>(mAccel);
+}
+
+bool BLAS::IsValid() const { return mpTraverser != nullptr; }
+
+const Triangle& BLAS::GetTriangle(size_t i) const { return mTriangles[i]; }
+size_t BLAS::GetNumTriangles() const { return mTriangles.size(); }
+
+const bvh::BoundingBox<float>& BLAS::GetBounds() const { return mBounds; }
+size_t BLAS::GetNumSubmaterials() const { return mNumSubmaterials; }
+
+std::optional<Intersector::Result> BLAS::Traverse(const Ray& ray) const
+{
+	return mpTraverser->traverse(ray, *mpIntersector);
+}
+
+Instance::Instance(const BLAS* pBLAS, const glm::mat4& transform, std::vector<size_t>&& materials, uint16_t entIdx) :
+	pBLAS(pBLAS), transform(transform), invTransform(glm::inverse(transform)), materials(std::move(materials)), entIdx(entIdx)
+{
+	// Transform each corner of the object space bounds to get conservative world bounds
+	const bvh::BoundingBox<float>& local = pBLAS->GetBounds();
+	bounds = bvh::BoundingBox<float>::empty();
+	for (int corner = 0; corner < 8; corner++) {
+		const glm::vec4 p = transform * glm::vec4(
+			(corner & 1) ? local.max[0] : local.min[0],
+			(corner & 2) ? local.max[1] : local.min[1],
+			(corner & 4) ? local.max[2] : local.min[2],
+			1.f
+		);
+		bounds.extend(bvh::Vector3<float>(p.x, p.y, p.z));
+	}
+}
+
+std::optional<Instance::Intersection> Instance::intersect(const Ray& ray) const
+{
+	// The direction isn't renormalised, so distances along the ray are the same in both spaces
+	const glm::vec4 origin = invTransform * glm::vec4(ray.origin[0], ray.origin[1], ray.origin[2], 1.f);
+	const glm::vec4 direction = invTransform * glm::vec4(ray.direction[0], ray.direction[1], ray.direction[2], 0.f);
+
+	Ray localRay(
+		Vector3(origin.x, origin.y, origin.z),
+		Vector3(direction.x, direction.y, direction.z),
+		ray.pAccel,
+		ray.tmin, ray.tmax
+	);
+	localRay.pMaterialRemap = materials.data();
+
+	auto hit = pBLAS->Traverse(localRay);
+	if (!hit) return std::nullopt;
+
+	return std::make_optional(Intersection{
+		hit->intersection.t, hit->intersection.u, hit->intersection.v,
+		hit->primitive_index
+	});
+}
+
+Triangle Instance::GetWorldTriangle(size_t primitive) const
+{
+	Triangle tri = pBLAS->GetTriangle(primitive);
+
+	const Vector3 localPoints[3] = { tri.p0, tri.p1(), tri.p2() };
+	Vector3 points[3];
+	for (int i = 0; i < 3; i++) {
+		const glm::vec4 p = transform * glm::vec4(localPoints[i][0], localPoints[i][1], localPoints[i][2], 1.f);
+		points[i] = Vector3(p.x, p.y, p.z);
+
+		tri.normals[i] = glm::vec3(transform * glm::vec4(tri.normals[i], 0.f));
+		tri.tangents[i] = glm::vec3(transform * glm::vec4(tri.tangents[i], 0.f));
+	}
+
+	tri.p0 = points[0];
+	tri.e1 = points[0] - points[1];
+	tri.e2 = points[2] - points[0];
+	tri.ComputeNormalAndLoD();
+
+	tri.material = materials[tri.material];
+	tri.entIdx = entIdx;
+
+	return tri;
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <memory>
+#include <optional>
+
+#include "glm/glm.hpp"
+
+#include "Primitives.h"
+#include "Model.h"
+
+#include "bvh/single_ray_traverser.hpp"
+#include "bvh/primitive_intersectors.hpp"
+
+using BVH = bvh::Bvh<float>;
+using Ray = bvh::Ray<float>;
+
+using Intersector = bvh::ClosestPrimitiveIntersector<BVH, Triangle>;
+using Traverser = bvh::SingleRayTraverser<BVH>;
+
+/// <summary>
+/// Object space geometry and BVH of a model, shared between every instance of it
+/// </summary>
+class BLAS
+{
+private:
+	std::vector<Triangle> mTriangles;
+	BVH mAccel;
+	std::unique_ptr<Intersector> mpIntersector;
+	std::unique_ptr<Traverser> mpTraverser;
+
+	bvh::BoundingBox<float> mBounds;
+	size_t mNumSubmaterials = 0;
+
+public:
+	/// <summary>
+	/// Builds a BLAS from all of a model's bodygroups at their default value, in bind pose
+	/// Triangle materials are left as the model's submaterial indices, to be remapped per instance
+	/// </summary>
+	BLAS(const Model* pModel);
+
+	BLAS(const BLAS&) = delete;
+	BLAS& operator=(const BLAS&) = delete;
+
+	bool IsValid() const;
+
+	const Triangle& GetTriangle(size_t i) const;
+	size_t GetNumTriangles() const;
+
+	const bvh::BoundingBox<float>& GetBounds() const;
+
+	/// <summary>
+	/// Gets one more than the highest submaterial index used by a triangle
+	/// </summary>
+	size_t GetNumSubmaterials() const;
+
+	std::optional<Intersector::Result> Traverse(const Ray& ray) const;
+};
+
+/// <summary>
+/// Placement of a BLAS in the world, used as the primitive of the top level BVH
+/// </summary>
+struct Instance
+{
+	struct Intersection
+	{
+		float t, u, v;
+		size_t primitive;
+		float distance() const { return t; }
+	};
+
+	using ScalarType = float;
+	using IntersectionType = Intersection;
+
+	const BLAS* pBLAS;
+
+	glm::mat4 transform;
+	glm::mat4 invTransform;
+
+	// Maps the model's submaterial indices to the accel's materials, with the instance's skin applied
+	std::vector<size_t> materials;
+
+	uint16_t entIdx;
+
+	bvh::BoundingBox<float> bounds;
+
+	Instance(const BLAS* pBLAS, const glm::mat4& transform, std::vector<size_t>&& materials, uint16_t entIdx);
+
+	bvh::BoundingBox<float> bounding_box() const { return bounds; }
+	bvh::Vector3<float> center() const { return bounds.center(); }
+
+	std::optional<Intersection> intersect(const Ray& ray) const;
+
+	/// <summary>
+	/// Gets a triangle of the instance in world space, with its material and entity set
+	/// </summary>
+	Triangle GetWorldTriangle(size_t primitive) const;
+};
+
+using InstanceIntersector = bvh::ClosestPrimitiveIntersector<BVH, Instance>;
+
+/// <summary>
+/// Builds a BVH over primitives, which must outlive it
+/// </summary>
+/// <returns>Bounds of all primitives</returns>
+bvh::BoundingBox<float> BuildBVH(BVH& accel, const Triangle* pPrimitives, size_t numPrimitives);
+bvh::BoundingBox<float> BuildBVH(BVH& accel, const Instance* pPrimitives, size_t numPrimitives);
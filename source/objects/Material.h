@@ -8,6 +8,7 @@
 #include "glm/ext/matrix_transform.hpp"
 
 #include <string>
+#include <memory>
 
 enum class DetailBlendMode : uint8_t
 {
@@ -71,6 +72,66 @@ inline MaterialFlags operator&(const MaterialFlags a, const MaterialFlags b)
 	return static_cast<MaterialFlags>(static_cast<const uint32_t>(a) & static_cast<const uint32_t>(b));
 }
 
+/// <summary>
+/// Optional textures a material uses, selecting which specialisation of the shading functions it's shaded with
+/// TBN and shading features are each contiguous so they can index their dispatch tables
+/// </summary>
+enum class MaterialFeatures : uint8_t
+{
+	None = 0,
+
+	NormalMap    = 0b000001,
+	NormalMap2   = 0b000010, // Only with NormalMap
+
+	BaseTexture2 = 0b000100,
+	Detail       = 0b001000,
+	MRAO         = 0b010000,
+	MRAO2        = 0b100000, // Only with MRAO
+
+	TBN     = 0b000011,
+	Shading = 0b111100
+};
+
+constexpr bool HasFeature(const MaterialFeatures features, const MaterialFeatures feature)
+{
+	return (static_cast<uint8_t>(features) & static_cast<uint8_t>(feature)) != 0;
+}
+
+inline MaterialFeatures operator|(const MaterialFeatures a, const MaterialFeatures b)
+{
+	return static_cast<MaterialFeatures>(static_cast<uint8_t>(a) | static_cast<uint8_t>(b));
+}
+inline MaterialFeatures& operator|=(MaterialFeatures& a, const MaterialFeatures b)
+{
+	a = a | b;
+	return a;
+}
+
+/// <summary>
+/// Textures of a material that shading samples, used to sample a texture for many hits at once
+/// </summary>
+enum class TextureSlot : uint8_t
+{
+	Blend,
+	NormalMap,
+	NormalMap2,
+	BaseTexture,
+	BaseTexture2,
+	Detail,
+	MRAO,
+	MRAO2,
+
+	Count
+};
+
+constexpr uint8_t TextureSlotBit(const TextureSlot slot)
+{
+	return static_cast<uint8_t>(1 << static_cast<uint8_t>(slot));
+}
+
+/// <summary>
+/// Textures are held by reference so the resource cache can't evict them while the material is alive
+/// </summary>
 struct Material
 {
 	std::string path = "";
@@ -78,34 +139,34 @@ struct Material
 	glm::vec4 colour = glm::vec4(1.f);
 
 	std::string baseTexPath = "";
-	const VisTrace::IVTFTexture* baseTexture = nullptr;
+	std::shared_ptr<const VisTrace::IVTFTexture> baseTexture = nullptr;
 	glm::mat2x4 baseTexMat = glm::identity<glm::mat2x4>();
 
 	std::string normalMapPath = "";
-	const VisTrace::IVTFTexture* normalMap = nullptr;
+	std::shared_ptr<const VisTrace::IVTFTexture> normalMap = nullptr;
 	glm::mat2x4 normalMapMat = glm::identity<glm::mat2x4>();
 
-	const VisTrace::IVTFTexture* mrao = nullptr;
+	std::shared_ptr<const VisTrace::IVTFTexture> mrao = nullptr;
 	//glm::mat2x4 mraoMat     = glm::identity<glm::mat2x4>(); MRAO texture lookups are driven by the base texture
 
 	std::string baseTexPath2 = "";
-	const VisTrace::IVTFTexture* baseTexture2 = nullptr;
+	std::shared_ptr<const VisTrace::IVTFTexture> baseTexture2 = nullptr;
 	glm::mat2x4 baseTexMat2 = glm::identity<glm::mat2x4>();
 
 	std::string normalMapPath2 = "";
-	const VisTrace::IVTFTexture* normalMap2 = nullptr;
+	std::shared_ptr<const VisTrace::IVTFTexture> normalMap2 = nullptr;
 	glm::mat2x4 normalMapMat2 = glm::identity<glm::mat2x4>();
 
-	const VisTrace::IVTFTexture* mrao2 = nullptr;
+	std::shared_ptr<const VisTrace::IVTFTexture> mrao2 = nullptr;
 	//glm::mat2x4 mraoMat2    = glm::identity<glm::mat2x4>(); MRAO texture lookups are driven by the base texture
 
 	std::string blendTexPath = "";
-	const VisTrace::IVTFTexture* blendTexture = nullptr;
+	std::shared_ptr<const VisTrace::IVTFTexture> blendTexture = nullptr;
 	glm::mat2x4 blendTexMat = glm::identity<glm::mat2x4>();
 	bool maskedBlending = false;
 
 	std::string detailPath = "";
-	const VisTrace::IVTFTexture* detail = nullptr;
+	std::shared_ptr<const VisTrace::IVTFTexture> detail = nullptr;
 
 	glm::mat2x4     detailMat = glm::identity<glm::mat2x4>();
 	float           detailScale = 4.f;
@@ -122,4 +183,38 @@ struct Material
 	float alphatestreference = 0.5f;
 
 	bool water = false;
+
+	// Must be updated with UpdateFeatures whenever textures are changed
+	MaterialFeatures features = MaterialFeatures::None;
+
+	void UpdateFeatures()
+	{
+		features = MaterialFeatures::None;
+		if (normalMap != nullptr) {
+			features |= MaterialFeatures::NormalMap;
+			if (normalMap2 != nullptr) features |= MaterialFeatures::NormalMap2;
+		}
+
+		if (baseTexture2 != nullptr) features |= MaterialFeatures::BaseTexture2;
+		if (detail != nullptr) features |= MaterialFeatures::Detail;
+		if (mrao != nullptr) {
+			features |= MaterialFeatures::MRAO;
+			if (mrao2 != nullptr) features |= MaterialFeatures::MRAO2;
+		}
+	}
+
+	const VisTrace::IVTFTexture* GetTexture(const TextureSlot slot) const
+	{
+		switch (slot) {
+		case TextureSlot::Blend: return blendTexture.get();
+		case TextureSlot::NormalMap: return normalMap.get();
+		case TextureSlot::NormalMap2: return normalMap2.get();
+		case TextureSlot::BaseTexture: return baseTexture.get();
+		case TextureSlot::BaseTexture2: return baseTexture2.get();
+		case TextureSlot::Detail: return detail.get();
+		case TextureSlot::MRAO: return mrao.get();
+		case TextureSlot::MRAO2: return mrao2.get();
+		default: return nullptr;
+		}
+	}
 };
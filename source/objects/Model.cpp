@@ -2,22 +2,24 @@
 
 #include "MDLParser.h"
 #include "GMFS.h"
+#include "ResourceCache.h"
 
 #include <new>
 #include <string>
+#include <unordered_map>
 
 #include "glm/gtx/compatibility.hpp"
 
 Mesh::Mesh(
 	const BodyGroup* pBodygroup,
-	const MDLStructs::Model* pModel, const VTXStructs::Model* pVTXModel
+	const MDLStructs::Model* pModel, const VTXStructs::Model* pVTXModel,
+	const int lod
 ) : mpBodygroup(pBodygroup)
 {
-	const VTXStructs::ModelLoD* modelLod = pVTXModel->GetModelLoD(0);
+	const VTXStructs::ModelLoD* modelLod = pVTXModel->GetModelLoD(lod);
 
 	// Loop over all strips once to precompute the number of tris (this means we can use a single allocation)
 	for (int mshIdx = 0; mshIdx < pModel->meshesCount; mshIdx++) {
-		const MDLStructs::Mesh* mesh = pModel->GetMesh(mshIdx);
 		const VTXStructs::Mesh* vtxMesh = modelLod->GetMesh(mshIdx);
 
 		for (int grpIdx = 0; grpIdx < vtxMesh->numStripGroups; grpIdx++) {
@@ -35,14 +37,12 @@ Mesh::Mesh(
 		}
 	}
 
-	mpTris = static_cast<Triangle*>(malloc(mNumTris * sizeof(Triangle)));
-	if (mpTris == nullptr) {
-		mpTris = nullptr;
-		mNumTris = 0;
-		return;
-	}
+	// Maps VVD vertex indices to their index in mVertices
+	std::unordered_map<int, uint32_t> vertexMap;
 
-	size_t triIndex = 0;
+	std::vector<uint32_t> indices;
+	indices.reserve(static_cast<size_t>(mNumTris) * 3);
+	mMaterials.reserve(mNumTris);
 
 	for (int mshIdx = 0; mshIdx < pModel->meshesCount; mshIdx++) {
 		const MDLStructs::Mesh* mesh = pModel->GetMesh(mshIdx);
@@ -55,67 +55,42 @@ Mesh::Mesh(
 				const VTXStructs::Strip* strip = stripGroup->GetStrip(strIdx);
 
 				if ((strip->flags & VTXEnums::StripFlags::IS_TRILIST) != VTXEnums::StripFlags::NONE) {
-					for (int i = strip->indexOffset; i < strip->numIndices + strip->indexOffset; i += 3) {
-						uint16_t i1 = *stripGroup->GetIndex(i);
-						uint16_t i2 = *stripGroup->GetIndex(i + 1);
-						uint16_t i3 = *stripGroup->GetIndex(i + 2);
-
-						const VTXStructs::Vertex* vtxVerts[3] = {
-							stripGroup->GetVertex(i1),
-							stripGroup->GetVertex(i2),
-							stripGroup->GetVertex(i3)
-						};
-
-						const VVDStructs::Vertex* verts[3];
-						const MDLStructs::Vector4D* tangents[3];
-						for (int j = 0; j < 3; j++) {
-							verts[j] = GetModel()->GetVertexData(mesh->GetVertexIndex(vtxVerts[j]));
-							tangents[j] = GetModel()->GetTangent(mesh->GetTangentIndex(vtxVerts[j]));
-						}
-
-						const glm::vec2 uvs[3] = {
-							glm::vec2(verts[0]->texCoord.x, verts[0]->texCoord.y),
-							glm::vec2(verts[1]->texCoord.x, verts[1]->texCoord.y),
-							glm::vec2(verts[2]->texCoord.x, verts[2]->texCoord.y)
-						};
-
-						Triangle tri(
-							Vector3(verts[0]->pos.x, verts[0]->pos.y, verts[0]->pos.z),
-							Vector3(verts[1]->pos.x, verts[1]->pos.y, verts[1]->pos.z),
-							Vector3(verts[2]->pos.x, verts[2]->pos.y, verts[2]->pos.z),
-							mesh->material,
-							uvs,
-							false
-						);
-
-						tri.alphas[0] = tri.alphas[1] = tri.alphas[2] = 0.f;
-
+					for (int i = strip->indexOffset; i + 2 < strip->numIndices + strip->indexOffset; i += 3) {
 						for (int j = 0; j < 3; j++) {
-							tri.normals[j] = glm::normalize(glm::vec3(verts[j]->normal.x, verts[j]->normal.y, verts[j]->normal.z));
-							if (!glm::all(glm::isfinite(tri.tangents[j]))) {
-								tri.normals[j] = glm::vec3(tri.nNorm[0], tri.nNorm[1], tri.nNorm[2]);
-							}
-
-							tri.tangents[j] = glm::normalize(glm::vec3(tangents[j]->x, tangents[j]->y, tangents[j]->z));
-							if (!glm::all(glm::isfinite(tri.tangents[j]))) {
-								tri.tangents[j] = glm::normalize(glm::vec3(tri.e1[0], tri.e1[1], tri.e1[2]));
-							}
-
-							if (vtxVerts[j]->numBones > 0) {
-								tri.numBones[j] = vtxVerts[j]->numBones;
-
-								for (int boneIdx = 0; boneIdx < 3; boneIdx++) {
-									tri.weights[j][boneIdx] = verts[j]->boneWeights.weight[boneIdx];
-									tri.boneIds[j][boneIdx] = verts[j]->boneWeights.bone[boneIdx];
+							const VTXStructs::Vertex* vtxVert = stripGroup->GetVertex(*stripGroup->GetIndex(i + j));
+							const int vertIdx = mesh->GetVertexIndex(vtxVert);
+
+							auto [it, inserted] = vertexMap.try_emplace(vertIdx, static_cast<uint32_t>(mVertices.size()));
+							if (inserted) {
+								const VVDStructs::Vertex* vert = GetModel()->GetVertexData(vertIdx);
+								const MDLStructs::Vector4D* tangent = GetModel()->GetTangent(mesh->GetTangentIndex(vtxVert));
+
+								// Degenerate normals and tangents are replaced per triangle once assembled
+								SkinVertex vertex{};
+								vertex.pos = glm::vec3(vert->pos.x, vert->pos.y, vert->pos.z);
+								vertex.normal = glm::normalize(glm::vec3(vert->normal.x, vert->normal.y, vert->normal.z));
+								vertex.tangent = glm::normalize(glm::vec3(tangent->x, tangent->y, tangent->z));
+								vertex.uv = glm::vec2(vert->texCoord.x, vert->texCoord.y);
+
+								if (vtxVert->numBones > 0) {
+									vertex.numBones = vtxVert->numBones;
+
+									for (int boneIdx = 0; boneIdx < 3; boneIdx++) {
+										vertex.weights[boneIdx] = vert->boneWeights.weight[boneIdx];
+										vertex.boneIds[boneIdx] = vert->boneWeights.bone[boneIdx];
+									}
+								} else {
+									vertex.numBones = 1;
+									vertex.weights[0] = 1.f;
+									vertex.boneIds[0] = 0;
 								}
-							} else {
-								tri.numBones[j] = 1;
-								tri.weights[j][0] = 1.f;
-								tri.boneIds[j][0] = 0;
+
+								mVertices.push_back(vertex);
 							}
+							indices.push_back(it->second);
 						}
 
-						mpTris[triIndex++] = tri;
+						mMaterials.push_back(mesh->material);
 					}
 				} else if ((strip->flags & VTXEnums::StripFlags::IS_TRISTRIP) != VTXEnums::StripFlags::NONE) {
 					// nyi
@@ -124,12 +99,16 @@ Mesh::Mesh(
 		}
 	}
 
-	mIsValid = true;
-}
+	mVertices.shrink_to_fit();
 
-Mesh::~Mesh()
-{
-	if (mpTris != nullptr) free(mpTris);
+	// Most meshes fit in 16 bit indices, halving the size of the index buffer
+	if (mVertices.size() <= UINT16_MAX + 1) {
+		mIndices16.assign(indices.begin(), indices.end());
+	} else {
+		mIndices32 = std::move(indices);
+	}
+
+	mIsValid = true;
 }
 
 bool Mesh::IsValid() const { return mIsValid; }
@@ -138,7 +117,21 @@ const BodyGroup* Mesh::GetBodyGroup() const { return mpBodygroup; }
 const Model* Mesh::GetModel() const { return mpBodygroup->GetModel(); }
 
 int32_t Mesh::GetNumTriangles() const { return mNumTris; }
-const Triangle* Mesh::GetTriangles() const { return mpTris; }
+int16_t Mesh::GetTriangleMaterial(const int32_t tri) const { return mMaterials[tri]; }
+
+size_t Mesh::GetNumVertices() const { return mVertices.size(); }
+const SkinVertex* Mesh::GetVertices() const { return mVertices.data(); }
+uint32_t Mesh::GetIndex(const size_t i) const
+{
+	return mIndices32.empty() ? mIndices16[i] : mIndices32[i];
+}
+
+size_t Mesh::GetMemorySize() const
+{
+	return mVertices.size() * sizeof(SkinVertex) +
+		mIndices16.size() * sizeof(uint16_t) + mIndices32.size() * sizeof(uint32_t) +
+		mMaterials.size() * sizeof(int16_t);
+}
 
 BodyGroup::BodyGroup(
 	const Model* pModel,
@@ -146,39 +139,61 @@ BodyGroup::BodyGroup(
 ) : mpModel(pModel)
 {
 	mNumMeshes = pBodypart->modelsCount;
-	mpMeshes = new (std::nothrow) Mesh*[mNumMeshes];
-	if (mpMeshes == nullptr) return;
+	mMeshes.resize(mNumMeshes);
 
 	for (int i = 0; i < mNumMeshes; i++) {
-		const MDLStructs::Model* model = pBodypart->GetModel(i);
-		const VTXStructs::Model* vtxModel = pVTXBodypart->GetModel(i);
+		MeshLoDs& meshLoDs = mMeshes[i];
+		meshLoDs.pModel = pBodypart->GetModel(i);
+		meshLoDs.pVTXModel = pVTXBodypart->GetModel(i);
+
+		const int numLoDs = meshLoDs.pVTXModel->numLoDs > 0 ? meshLoDs.pVTXModel->numLoDs : 1;
+		meshLoDs.lods.resize(numLoDs);
+		meshLoDs.switchPoints.resize(numLoDs, 0.f);
+		for (int lod = 1; lod < numLoDs; lod++) {
+			meshLoDs.switchPoints[lod] = meshLoDs.pVTXModel->GetModelLoD(lod)->switchPoint;
+		}
 
-		mpMeshes[i] = new (std::nothrow) Mesh(this, model, vtxModel);
-		if (mpMeshes[i] == nullptr || !mpMeshes[i]->IsValid()) return;
+		meshLoDs.lods[0] = std::unique_ptr<Mesh>(new (std::nothrow) Mesh(this, meshLoDs.pModel, meshLoDs.pVTXModel, 0));
+		if (meshLoDs.lods[0] == nullptr || !meshLoDs.lods[0]->IsValid()) return;
 	}
 
 	mIsValid = true;
 }
 
-BodyGroup::~BodyGroup()
+bool BodyGroup::IsValid() const { return mIsValid; }
+
+const Model* BodyGroup::GetModel() const { return mpModel; }
+
+int32_t BodyGroup::GetNumMeshes() const { return mNumMeshes; }
+const Mesh* BodyGroup::GetMesh(const int bodygroupValue, const int lod) const
 {
-	if (mpMeshes != nullptr) {
-		for (int i = 0; i < mNumMeshes; i++) {
-			if (mpMeshes[i] != nullptr) delete mpMeshes[i];
-		}
+	MeshLoDs& meshLoDs = mMeshes[bodygroupValue];
+	if (lod <= 0 || static_cast<size_t>(lod) >= meshLoDs.lods.size()) return meshLoDs.lods[0].get();
 
-		delete[] mpMeshes;
+	std::lock_guard<std::mutex> lock(mLoDMutex);
+	if (meshLoDs.lods[lod] == nullptr) {
+		meshLoDs.lods[lod] = std::unique_ptr<Mesh>(new (std::nothrow) Mesh(this, meshLoDs.pModel, meshLoDs.pVTXModel, lod));
 	}
-}
 
-bool BodyGroup::IsValid() const { return mIsValid; }
+	if (meshLoDs.lods[lod] == nullptr || !meshLoDs.lods[lod]->IsValid()) return meshLoDs.lods[0].get();
+	return meshLoDs.lods[lod].get();
+}
 
-const Model* BodyGroup::GetModel() const { return mpModel; }
+int32_t BodyGroup::GetNumLoDs(const int bodygroupValue) const
+{
+	return mMeshes[bodygroupValue].lods.size();
+}
 
-int32_t BodyGroup::GetNumMeshes() const { return mNumMeshes; }
-const Mesh* BodyGroup::GetMesh(const int bodygroupValue) const
+int32_t BodyGroup::SelectLoD(const int bodygroupValue, const float metric) const
 {
-	return mpMeshes[bodygroupValue];
+	const std::vector<float>& switchPoints = mMeshes[bodygroupValue].switchPoints;
+
+	int32_t lod = 0;
+	for (int32_t i = 1; i < static_cast<int32_t>(switchPoints.size()); i++) {
+		if (switchPoints[i] > metric) break;
+		lod = i;
+	}
+	return lod;
 }
 
 Model::Model(const std::string& path)
@@ -190,11 +205,11 @@ Model::Model(const std::string& path)
 	if (!FileSystem::Exists(vvdPath.c_str(), "GAME")) return;
 
 	std::string vtxPath = path + ".sw.vtx";
-	if (!FileSystem::Exists(vtxPath.c_str(), "GAME")) {
+	if (!ResourceCache::FileExists(vtxPath)) {
 		vtxPath = path + ".dx90.vtx";
-		if (!FileSystem::Exists(vtxPath.c_str(), "GAME")) {
+		if (!ResourceCache::FileExists(vtxPath)) {
 			vtxPath = path + ".dx80.vtx";
-			if (!FileSystem::Exists(vtxPath.c_str(), "GAME")) return;
+			if (!ResourceCache::FileExists(vtxPath)) return;
 		}
 	}
 
@@ -275,12 +290,22 @@ Model::Model(const std::string& path)
 			path += matPath.name;
 			path += ".vmt";
 
-			if (FileSystem::Exists(path.c_str(), "GAME")) break;
+			// Models share directories, so most misses here have been probed before
+			if (ResourceCache::FileExists(path)) break;
 		}
 
 		mpMaterialPaths[matIdx] = matPath;
 	}
 
+	// The parser keeps its own copy of each file, on top of the meshes built from them
+	mMemorySize = static_cast<size_t>(mdlSize) + vvdSize + vtxSize + mMDL.GetNumBones() * sizeof(glm::mat4);
+	for (int bdyIdx = 0; bdyIdx < mNumBodygroups; bdyIdx++) {
+		const BodyGroup* pBodygroup = mpBodygroups[bdyIdx];
+		for (int mshIdx = 0; mshIdx < pBodygroup->GetNumMeshes(); mshIdx++) {
+			mMemorySize += pBodygroup->GetMesh(mshIdx, 0)->GetMemorySize();
+		}
+	}
+
 	mIsValid = true;
 }
 
@@ -302,16 +327,23 @@ Model::~Model()
 }
 
 bool Model::IsValid() const { return mIsValid; }
+size_t Model::GetMemorySize() const { return mMemorySize; }
 
 int32_t Model::GetNumBodyGroups() const { return mNumBodygroups; }
-const Mesh* Model::GetMesh(const int bodygroup, const int bodygroupValue) const
+const Mesh* Model::GetMesh(const int bodygroup, const int bodygroupValue, const int lod) const
 {
 	if (bodygroup >= mNumBodygroups) return nullptr;
 	
 	const BodyGroup* pBodygroup = mpBodygroups[bodygroup];
 	if (bodygroupValue >= pBodygroup->GetNumMeshes()) return nullptr;
 
-	return pBodygroup->GetMesh(bodygroupValue);
+	return pBodygroup->GetMesh(bodygroupValue, lod);
+}
+
+const BodyGroup* Model::GetBodyGroup(const int bodygroup) const
+{
+	if (bodygroup < 0 || bodygroup >= mNumBodygroups) return nullptr;
+	return mpBodygroups[bodygroup];
 }
 
 const VVDStructs::Vector4D* Model::GetTangent(const int i) const
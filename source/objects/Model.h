@@ -4,9 +4,27 @@
 #include "Primitives.h"
 
 #include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
 
 #include "glm/glm.hpp"
 
+/// <summary>
+/// Unique vertex of a mesh in bind pose, with the bone weights needed to skin it
+/// </summary>
+struct SkinVertex
+{
+	glm::vec3 pos;
+	glm::vec3 normal;
+	glm::vec3 tangent;
+	glm::vec2 uv;
+
+	uint8_t numBones;
+	float weights[3];
+	int8_t boneIds[3];
+};
+
 class Mesh;
 class BodyGroup;
 class Model;
@@ -17,13 +35,20 @@ private:
 	bool mIsValid = false;
 
 	int32_t mNumTris = 0U;
-	Triangle* mpTris = nullptr;
+
+	// Each VVD vertex the mesh references once, and 3 indices into it per triangle
+	// Only one of the index buffers is used, 16 bit if every vertex can be addressed with it
+	std::vector<SkinVertex> mVertices;
+	std::vector<uint16_t> mIndices16;
+	std::vector<uint32_t> mIndices32;
+
+	// Material of each triangle
+	std::vector<int16_t> mMaterials;
 
 	const BodyGroup* mpBodygroup = nullptr;
 
 public:
-	Mesh(const BodyGroup* pBodygroup, const MDLStructs::Model* pModel, const VTXStructs::Model* pVTXModel);
-	~Mesh();
+	Mesh(const BodyGroup* pBodygroup, const MDLStructs::Model* pModel, const VTXStructs::Model* pVTXModel, const int lod = 0);
 
 	bool IsValid() const;
 
@@ -31,29 +56,57 @@ public:
 	const Model* GetModel() const;
 
 	int32_t GetNumTriangles() const;
-	const Triangle* GetTriangles() const;
+	int16_t GetTriangleMaterial(const int32_t tri) const;
+
+	size_t GetNumVertices() const;
+	const SkinVertex* GetVertices() const;
+	uint32_t GetIndex(const size_t i) const;
+
+	size_t GetMemorySize() const;
 };
 
 class BodyGroup
 {
 private:
+	struct MeshLoDs
+	{
+		const MDLStructs::Model* pModel = nullptr;
+		const VTXStructs::Model* pVTXModel = nullptr;
+
+		// LoD 0 is loaded with the model, the rest the first time they're requested
+		std::vector<std::unique_ptr<Mesh>> lods;
+		std::vector<float> switchPoints;
+	};
+
 	bool mIsValid = false;
 
 	int32_t mNumMeshes = 0U;
-	Mesh** mpMeshes = nullptr;
+	mutable std::vector<MeshLoDs> mMeshes;
+	mutable std::mutex mLoDMutex;
 
 	const Model* mpModel = nullptr;
 
 public:
 	BodyGroup(const Model* pModel, const MDLStructs::BodyPart* pBodypart, const VTXStructs::BodyPart* pVTXBodypart);
-	~BodyGroup();
 
 	bool IsValid() const;
 
 	const Model* GetModel() const;
 
 	int32_t GetNumMeshes() const;
-	const Mesh* GetMesh(const int bodygroupValue) const;
+
+	/// <summary>
+	/// Gets the mesh of a bodygroup value at a LoD, loading the LoD if this is the first time it's been used
+	/// Falls back to LoD 0 if the LoD is out of range or fails to load
+	/// </summary>
+	const Mesh* GetMesh(const int bodygroupValue, const int lod = 0) const;
+
+	int32_t GetNumLoDs(const int bodygroupValue) const;
+
+	/// <summary>
+	/// Picks the lowest detail LoD whose switch point is at or below the metric
+	/// </summary>
+	int32_t SelectLoD(const int bodygroupValue, const float metric) const;
 };
 
 class Model
@@ -75,14 +128,22 @@ private:
 	MaterialPath* mpMaterialPaths = nullptr;
 	glm::mat4* mpBindMatrices = nullptr;
 
+	size_t mMemorySize = 0;
+
 public:
 	Model(const std::string& path);
 	~Model();
 
 	bool IsValid() const;
 
+	/// <summary>
+	/// Gets the number of bytes the model held in memory once loaded (LoDs loaded on demand aren't included), used to budget the resource cache
+	/// </summary>
+	size_t GetMemorySize() const;
+
 	int32_t GetNumBodyGroups() const;
-	const Mesh* GetMesh(const int bodygroup, const int bodygroupValue) const;
+	const Mesh* GetMesh(const int bodygroup, const int bodygroupValue, const int lod = 0) const;
+	const BodyGroup* GetBodyGroup(const int bodygroup) const;
 
 	const MDLStructs::Vector4D* GetTangent(const int i) const;
 	const VVDStructs::Vertex* GetVertexData(const int i) const;
@@ -20,6 +20,9 @@ namespace bvh
 
 		const AccelStruct* pAccel = nullptr;
 
+		// Maps triangle materials to the accel's when traversing an instance
+		const size_t* pMaterialRemap = nullptr;
+
 		Ray() = default;
 		Ray(const Vector3<Scalar>& origin,
 			const Vector3<Scalar>& direction,
@@ -65,10 +68,6 @@ struct TriangleBackfaceCull
 	glm::vec2 uvs[3];
 	float alphas[3];
 
-	uint8_t numBones[3];
-	float weights[3][3];
-	int8_t boneIds[3][3];
-
 	float lod;
 
 	TriangleBackfaceCull() = default;
@@ -167,7 +166,7 @@ struct TriangleBackfaceCull
 
 	std::optional<Intersection> intersect(const bvh::Ray<Scalar>& ray) const
 	{
-		const Material& mat = ray.pAccel->GetMaterial(material);
+		const Material& mat = ray.pAccel->GetMaterial(ray.pMaterialRemap != nullptr ? ray.pMaterialRemap[material] : material);
 		auto negate_when_right_handed = [](Scalar x) { return LeftHandedNormal ? x : -x; };
 
 		auto nDotDir = dot(n, ray.direction);
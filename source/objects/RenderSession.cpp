@@ -0,0 +1,355 @@
+#include "RenderSession.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include <algorithm>
+#include <cfloat>
+
+#include "TraceResult.h"
+#include "Sampler.h"
+#include "BSDF.h"
+#include "Utils.h"
+
+using namespace VisTrace;
+using namespace glm;
+
+int RenderSession::id{ -1 };
+
+static std::mutex sessionsMutex;
+static std::vector<RenderSession*> sessions;
+
+RenderSession::RenderSession(const AccelStruct* pAccel, const RenderSessionSettings& settings) :
+	mpAccel(pAccel), mSettings(settings), mBudget(settings.budget)
+{
+	mCamera = MakeCamera(
+		mSettings.cameraType,
+		mSettings.pos, mSettings.ang, mSettings.fov,
+		mSettings.width, mSettings.height,
+		mSettings.aperture, mSettings.focusDistance
+	);
+
+	mTilesX = (mSettings.width + TILE_SIZE - 1) / TILE_SIZE;
+	mTilesY = (mSettings.height + TILE_SIZE - 1) / TILE_SIZE;
+	mNumTiles = mTilesX * mTilesY;
+
+	mpAccumulation = new RenderTarget(mSettings.width, mSettings.height, RTFormat::RGBFFF);
+	mTileSamples = std::vector<uint32_t>(mNumTiles, 0U);
+	mAccumulatedBuild = pAccel != nullptr ? pAccel->GetBuildCount() : 0;
+
+	std::lock_guard<std::mutex> lock(sessionsMutex);
+	sessions.push_back(this);
+}
+
+RenderSession::~RenderSession()
+{
+	Cancel();
+
+	{
+		std::lock_guard<std::mutex> lock(sessionsMutex);
+		sessions.erase(std::remove(sessions.begin(), sessions.end(), this), sessions.end());
+	}
+
+	delete mpAccumulation;
+}
+
+bool RenderSession::IsValid() const
+{
+	return mpAccel != nullptr && mNumTiles > 0 && mpAccumulation->IsValid();
+}
+
+void RenderSession::Start()
+{
+	{
+		std::lock_guard<std::mutex> lock(mStateMutex);
+		if (mStarted || mCancelled) return;
+		mStarted = true;
+		mBudgetUsed = std::chrono::steady_clock::duration::zero();
+	}
+
+	uint32_t numThreads = mSettings.threads;
+	if (numThreads == 0) numThreads = std::max(std::thread::hardware_concurrency(), 2U) - 1U;
+
+	mWorkers.reserve(numThreads);
+	for (uint32_t i = 0; i < numThreads; i++) {
+		mWorkers.emplace_back(&RenderSession::WorkerMain, this, i);
+	}
+}
+
+void RenderSession::Pause()
+{
+	std::lock_guard<std::mutex> lock(mStateMutex);
+	mPaused = true;
+}
+
+void RenderSession::Resume()
+{
+	{
+		std::lock_guard<std::mutex> lock(mStateMutex);
+		mPaused = false;
+	}
+	mStateCV.notify_all();
+}
+
+void RenderSession::Cancel()
+{
+	{
+		std::lock_guard<std::mutex> lock(mStateMutex);
+		mCancelled = true;
+	}
+	mStateCV.notify_all();
+
+	for (std::thread& worker : mWorkers) {
+		if (worker.joinable()) worker.join();
+	}
+	mWorkers.clear();
+}
+
+bool RenderSession::IsRunning()
+{
+	std::lock_guard<std::mutex> lock(mStateMutex);
+	return mStarted && !mPaused && !mCancelled && !IsComplete();
+}
+
+bool RenderSession::IsPaused()
+{
+	std::lock_guard<std::mutex> lock(mStateMutex);
+	return mPaused;
+}
+
+bool RenderSession::IsCancelled()
+{
+	std::lock_guard<std::mutex> lock(mStateMutex);
+	return mCancelled;
+}
+
+void RenderSession::SetBudget(float budget)
+{
+	{
+		std::lock_guard<std::mutex> lock(mStateMutex);
+		mBudget = std::max(budget, 0.f);
+	}
+	Tick();
+}
+
+float RenderSession::GetBudget()
+{
+	std::lock_guard<std::mutex> lock(mStateMutex);
+	return mBudget;
+}
+
+void RenderSession::Tick()
+{
+	{
+		std::lock_guard<std::mutex> lock(mStateMutex);
+		mBudgetUsed = std::chrono::steady_clock::duration::zero();
+	}
+	mStateCV.notify_all();
+}
+
+void RenderSession::TickAll()
+{
+	std::lock_guard<std::mutex> lock(sessionsMutex);
+	for (RenderSession* pSession : sessions) {
+		pSession->Tick();
+	}
+}
+
+void RenderSession::CancelAll()
+{
+	std::lock_guard<std::mutex> lock(sessionsMutex);
+	for (RenderSession* pSession : sessions) {
+		pSession->Cancel();
+	}
+}
+
+// Must be called with the state mutex held
+bool RenderSession::CanWork() const
+{
+	if (!mStarted || mPaused || mCancelled) return false;
+
+	// Workers sleep through rebuilds and are woken by the next tick, so the main thread never waits on them
+	if (mpAccel->IsRebuildPending()) return false;
+	return mBudget <= 0.f || mBudgetUsed < std::chrono::duration<float, std::milli>(mBudget);
+}
+
+bool RenderSession::IsComplete() const
+{
+	return mSettings.samples > 0 && mNextTicket >= static_cast<uint64_t>(mSettings.samples) * mNumTiles;
+}
+
+float RenderSession::GetProgress() const
+{
+	if (mSettings.samples == 0) return 0.f;
+	return static_cast<float>(
+		static_cast<double>(mCompletedTiles) / (static_cast<double>(mSettings.samples) * mNumTiles)
+	);
+}
+
+uint32_t RenderSession::GetSamples() const
+{
+	return static_cast<uint32_t>(mCompletedTiles / mNumTiles);
+}
+
+void RenderSession::WorkerMain(uint32_t workerIdx)
+{
+	Sampler sampler(mSettings.seed + workerIdx * 7919U);
+	std::vector<vec3> buffer(TILE_SIZE * TILE_SIZE);
+
+	// Tile abandoned for a rebuild, retried before taking a new ticket so the pass isn't left with a hole
+	bool retry = false;
+	uint32_t tile = 0;
+	std::chrono::steady_clock::duration tileTime{ 0 };
+
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(mStateMutex);
+			mBudgetUsed += tileTime;
+			tileTime = std::chrono::steady_clock::duration::zero();
+
+			// Workers outlive the last ticket, as a rebuild restarts the render and needs all of them again
+			mStateCV.wait(lock, [this, retry] { return mCancelled || ((retry || !IsComplete()) && CanWork()); });
+			if (mCancelled) return;
+		}
+
+		if (!retry) {
+			// Tickets are handed out in order, so each pass covers every tile exactly once
+			const uint64_t ticket = mNextTicket.fetch_add(1);
+			if (mSettings.samples > 0 && ticket >= static_cast<uint64_t>(mSettings.samples) * mNumTiles) continue;
+			tile = static_cast<uint32_t>(ticket % mNumTiles);
+		}
+
+		const auto start = std::chrono::steady_clock::now();
+		retry = !RenderTile(tile, &sampler, buffer);
+		tileTime = std::chrono::steady_clock::now() - start;
+	}
+}
+
+bool RenderSession::RenderTile(uint32_t tile, ISampler* pSampler, std::vector<vec3>& buffer)
+{
+	const uint32_t x0 = (tile % mTilesX) * TILE_SIZE, y0 = (tile / mTilesX) * TILE_SIZE;
+	const uint32_t x1 = std::min<uint32_t>(x0 + TILE_SIZE, mSettings.width);
+	const uint32_t y1 = std::min<uint32_t>(y0 + TILE_SIZE, mSettings.height);
+
+	// Shared locks are only taken while no rebuild is waiting, and dropped within a row of one starting
+	// Otherwise workers continually relocking could starve the exclusive lock the main thread needs
+	uint64_t buildCount;
+	{
+		if (mpAccel->IsRebuildPending()) return false;
+		auto traversalLock = mpAccel->LockForTraversal();
+		buildCount = mpAccel->GetBuildCount();
+
+		for (uint32_t y = y0; y < y1; y++) {
+			if (mpAccel->IsRebuildPending()) return false;
+			for (uint32_t x = x0; x < x1; x++) {
+				float jitterX, jitterY;
+				pSampler->GetFloat2D(jitterX, jitterY);
+
+				vec3 radiance = TracePath(x + jitterX, y + jitterY, pSampler);
+				if (!all(isfinite(radiance))) radiance = vec3(0.f);
+
+				buffer[(y - y0) * TILE_SIZE + (x - x0)] = radiance;
+			}
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(mAccumulationMutex);
+
+	// Samples of the old and new scene are never mixed, the first tile traced after a rebuild restarts the render
+	// and any still in flight from before it are dropped
+	if (buildCount < mAccumulatedBuild) return true;
+	if (buildCount > mAccumulatedBuild) ResetAccumulation(buildCount);
+
+	vec3* pData = reinterpret_cast<vec3*>(mpAccumulation->GetRawData());
+	for (uint32_t y = y0; y < y1; y++) {
+		for (uint32_t x = x0; x < x1; x++) {
+			pData[y * mSettings.width + x] += buffer[(y - y0) * TILE_SIZE + (x - x0)];
+		}
+	}
+	mTileSamples[tile]++;
+	mCompletedTiles++;
+	return true;
+}
+
+// Must be called with the accumulation mutex held
+void RenderSession::ResetAccumulation(uint64_t buildCount)
+{
+	vec3* pData = reinterpret_cast<vec3*>(mpAccumulation->GetRawData());
+	std::fill(pData, pData + static_cast<size_t>(mSettings.width) * mSettings.height, vec3(0.f));
+	std::fill(mTileSamples.begin(), mTileSamples.end(), 0U);
+
+	mAccumulatedBuild = buildCount;
+	mCompletedTiles = 0;
+
+	// Restarting the tickets under the state mutex means workers waiting on a finished render can't miss the wake
+	{
+		std::lock_guard<std::mutex> lock(mStateMutex);
+		mNextTicket = 0;
+	}
+	mStateCV.notify_all();
+}
+
+vec3 RenderSession::TracePath(float x, float y, ISampler* pSampler) const
+{
+	vec2 lensSample;
+	pSampler->GetFloat2D(lensSample.x, lensSample.y);
+
+	vec3 origin, direction;
+	GenerateCameraRay(mCamera, x, y, lensSample, origin, direction);
+
+	// Only primary rays track a ray cone, secondary rays sample mip 0
+	float coneWidth = 0.f, coneAngle = mCamera.spreadAngle;
+
+	vec3 throughput(1.f), radiance(0.f);
+	for (uint32_t bounce = 0; bounce <= mSettings.bounces; bounce++) {
+		std::optional<TraceResult> hit = mpAccel->Trace(origin, direction, 0.f, FLT_MAX, coneWidth, coneAngle);
+		if (!hit || hit->hitSky) {
+			radiance += throughput * (mSettings.pHDRI != nullptr ? mSettings.pHDRI->GetPixel(direction) : mSettings.skyColour);
+			break;
+		}
+		if (bounce == mSettings.bounces) break;
+
+		BSDFMaterial material{};
+		material.PrepShadingData(hit->GetAlbedo(), hit->GetMetalness(), hit->GetRoughness());
+
+		BSDFSample sample;
+		if (!SampleBSDF(
+			material, pSampler,
+			hit->GetNormal(), hit->GetTangent(), hit->GetBinormal(),
+			hit->wo,
+			sample
+		)) break;
+
+		throughput *= sample.weight;
+		if (!ValidVector(throughput)) break;
+
+		const vec3& geometricNormal = hit->geometricNormal;
+		origin = OffsetRayOrigin(hit->GetPos(), dot(sample.scattered, geometricNormal) >= 0.f ? geometricNormal : -geometricNormal);
+		direction = sample.scattered;
+		coneWidth = coneAngle = -1.f;
+	}
+
+	return radiance;
+}
+
+bool RenderSession::GetImage(IRenderTarget* pRt) const
+{
+	if (!pRt->IsValid() || pRt->GetWidth() != mSettings.width || pRt->GetHeight() != mSettings.height) return false;
+
+	std::lock_guard<std::mutex> lock(mAccumulationMutex);
+	const vec3* pData = reinterpret_cast<const vec3*>(mpAccumulation->GetRawData());
+
+	#pragma omp parallel for collapse(2)
+	for (int32_t y = 0; y < mSettings.height; y++) {
+		for (int32_t x = 0; x < mSettings.width; x++) {
+			const uint32_t tile = (y / TILE_SIZE) * mTilesX + x / TILE_SIZE;
+			const uint32_t samples = mTileSamples[tile];
+
+			vec3 colour = samples > 0 ? pData[y * mSettings.width + x] / static_cast<float>(samples) : vec3(0.f);
+			pRt->SetPixel(x, y, Pixel{ colour.r, colour.g, colour.b, 1.f });
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+
+#include "glm/glm.hpp"
+
+#include "vistrace/IRenderTarget.h"
+
+#include "AccelStruct.h"
+#include "RenderTarget.h"
+#include "HDRI.h"
+#include "Camera.h"
+
+struct RenderSessionSettings
+{
+	glm::vec3 pos = glm::vec3(0.f);
+	glm::vec3 ang = glm::vec3(0.f);
+	float fov = 90.f;
+
+	CameraType cameraType = CameraType::Pinhole;
+	float aperture = 0.f;
+	float focusDistance = 100.f;
+
+	uint16_t width = 0;
+	uint16_t height = 0;
+
+	uint32_t samples = 0; // Target samples per pixel, 0 renders until cancelled
+	uint32_t bounces = 4;
+	uint32_t threads = 0; // 0 uses all but one hardware thread
+	uint32_t seed = 0;
+
+	float budget = 0.f; // Milliseconds of CPU time per frame summed over all workers, 0 is unlimited
+
+	const HDRI* pHDRI = nullptr;
+	glm::vec3 skyColour = glm::vec3(1.f);
+};
+
+/// <summary>
+/// Progressively path traces an accel on background threads, accumulating samples into a render target
+/// </summary>
+class RenderSession
+{
+private:
+	static constexpr uint16_t TILE_SIZE = 16;
+
+	const AccelStruct* mpAccel;
+	RenderSessionSettings mSettings;
+
+	Camera mCamera;
+
+	uint32_t mTilesX, mTilesY, mNumTiles;
+
+	// Sum of all samples per pixel, and the number of samples that have been added to each tile
+	RenderTarget* mpAccumulation;
+	std::vector<uint32_t> mTileSamples;
+	uint64_t mAccumulatedBuild; // Build of the accel the accumulated samples were traced against
+	mutable std::mutex mAccumulationMutex;
+
+	std::vector<std::thread> mWorkers;
+
+	std::mutex mStateMutex;
+	std::condition_variable mStateCV;
+	bool mStarted = false;
+	bool mPaused = false;
+	bool mCancelled = false;
+	float mBudget;
+	std::chrono::steady_clock::duration mBudgetUsed{ 0 }; // Time spent rendering tiles since the last tick, summed over all workers
+
+	std::atomic<uint64_t> mNextTicket{ 0 };
+	std::atomic<uint64_t> mCompletedTiles{ 0 };
+
+	bool CanWork() const;
+	bool IsComplete() const;
+
+	void WorkerMain(uint32_t workerIdx);
+	bool RenderTile(uint32_t tile, VisTrace::ISampler* pSampler, std::vector<glm::vec3>& buffer);
+	void ResetAccumulation(uint64_t buildCount);
+	glm::vec3 TracePath(float x, float y, VisTrace::ISampler* pSampler) const;
+
+public:
+	static int id;
+
+	// Registry references to the Lua objects this session depends on, so they can't be collected while rendering
+	int accelRef = -1;
+	int hdriRef = -1;
+
+	RenderSession(const AccelStruct* pAccel, const RenderSessionSettings& settings);
+	~RenderSession();
+
+	bool IsValid() const;
+
+	void Start();
+	void Pause();
+	void Resume();
+	void Cancel();
+
+	bool IsRunning();
+	bool IsPaused();
+	bool IsCancelled();
+
+	/// <summary>
+	/// Sets the amount of CPU time the workers may spend rendering each frame, summed over all workers
+	/// Tiles are never interrupted, so a frame can overrun the budget by up to one tile per worker
+	/// </summary>
+	/// <param name="budget">Budget in milliseconds, 0 for unlimited</param>
+	void SetBudget(float budget);
+	float GetBudget();
+
+	/// <summary>
+	/// Grants the workers another frame's budget, called once per frame from the main thread
+	/// </summary>
+	void Tick();
+
+	/// <summary>
+	/// Gets the progress of the render
+	/// </summary>
+	/// <returns>Fraction of target samples completed, or 0 if there is no target</returns>
+	float GetProgress() const;
+
+	/// <summary>
+	/// Gets the number of full passes over the image that have completed
+	/// </summary>
+	uint32_t GetSamples() const;
+
+	/// <summary>
+	/// Writes the current averaged image into a render target of the same size
+	/// </summary>
+	/// <param name="pRt">Render target to write to</param>
+	/// <returns>False if the render target's size doesn't match</returns>
+	bool GetImage(VisTrace::IRenderTarget* pRt) const;
+
+	/// <summary>
+	/// Ticks every live session, call once per frame
+	/// </summary>
+	static void TickAll();
+
+	/// <summary>
+	/// Stops the workers of every live session, used before the resources they depend on are freed
+	/// </summary>
+	static void CancelAll();
+};
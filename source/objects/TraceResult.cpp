@@ -1,5 +1,9 @@
 #include "TraceResult.h"
 #include "Utils.h"
+#include "ObjectPool.h"
+
+#include <array>
+#include <utility>
 
 #include "glm/gtx/compatibility.hpp"
 using namespace glm;
@@ -8,6 +12,27 @@ using namespace VisTrace;
 
 int TraceResult::id = -1;
 
+static ObjectPool<TraceResult> resultPool;
+
+void* TraceResult::operator new(size_t size)
+{
+	// Classes deriving from TraceResult don't fit in the pool's slots
+	if (size != sizeof(TraceResult)) return ::operator new(size);
+	return resultPool.Allocate();
+}
+
+void TraceResult::operator delete(void* p, size_t size)
+{
+	if (size != sizeof(TraceResult)) return ::operator delete(p);
+	resultPool.Free(p);
+}
+
+void TraceResult::GetPoolStats(size_t& numAllocated, size_t& capacity)
+{
+	numAllocated = resultPool.GetNumAllocated();
+	capacity = resultPool.GetCapacity();
+}
+
 vec4 TextureCombine(
 	vec4 baseColour, vec4 detailColour,
 	DetailBlendMode blendMode, float blendFactor
@@ -47,11 +72,11 @@ TraceResult::TraceResult(
 	float coneWidth, float coneAngle,
 	const Triangle& tri,
 	const vec2& uv,
-	const Entity& ent, const Material mat
+	const Entity& ent, const Material& material
 ) :
 	distance(distance),
 	coneWidth(coneWidth), coneAngle(coneAngle), lodOffset(tri.lod), mipOverride(coneWidth < 0.f || coneAngle <= 0.f),
-	material(mat)
+	pMaterial(&material)
 {
 	wo = -direction;
 
@@ -77,14 +102,94 @@ TraceResult::TraceResult(
 	rawEnt = ent.rawEntity;
 	submatIdx = tri.material;
 
-	albedo = ent.colour * material.colour;
-	alpha = ent.colour.a * material.colour.a;
+	albedo = ent.colour * pMaterial->colour;
+	alpha = ent.colour.a * pMaterial->colour.a;
 
-	hitSky = (material.surfFlags & BSPEnums::SURF::SKY) != BSPEnums::SURF::NONE;
+	hitSky = (pMaterial->surfFlags & BSPEnums::SURF::SKY) != BSPEnums::SURF::NONE;
 
 	frontFacing = dot(wo, geometricNormal) >= 0.f;
 }
 
+void TraceResult::RetainMaterials(const std::shared_ptr<const std::vector<Material>>& pMaterials)
+{
+	mpMaterials = pMaterials;
+}
+
+uint8_t TraceResult::GetTextureSlots(bool tbn, bool shading) const
+{
+	const MaterialFeatures features = pMaterial->features;
+
+	uint8_t slots = 0;
+	bool blended = false;
+
+	if (tbn && !tbnSet && HasFeature(features, MaterialFeatures::NormalMap)) {
+		slots |= TextureSlotBit(TextureSlot::NormalMap);
+		if (HasFeature(features, MaterialFeatures::NormalMap2)) {
+			slots |= TextureSlotBit(TextureSlot::NormalMap2);
+			blended = true;
+		}
+	}
+
+	if (shading && !shadingDataSet) {
+		if (pMaterial->baseTexture != nullptr) slots |= TextureSlotBit(TextureSlot::BaseTexture);
+		if (HasFeature(features, MaterialFeatures::BaseTexture2)) slots |= TextureSlotBit(TextureSlot::BaseTexture2);
+		if (HasFeature(features, MaterialFeatures::Detail)) slots |= TextureSlotBit(TextureSlot::Detail);
+		if (HasFeature(features, MaterialFeatures::MRAO)) slots |= TextureSlotBit(TextureSlot::MRAO);
+		if (HasFeature(features, MaterialFeatures::MRAO2)) slots |= TextureSlotBit(TextureSlot::MRAO2);
+
+		blended |= HasFeature(features, MaterialFeatures::BaseTexture2) || HasFeature(features, MaterialFeatures::MRAO2);
+	}
+
+	if (blended && !blendFactorSet && pMaterial->blendTexture != nullptr) slots |= TextureSlotBit(TextureSlot::Blend);
+	return slots;
+}
+
+void TraceResult::GetTextureTap(TextureSlot slot, float& u, float& v, float& lod)
+{
+	CalcFootprint();
+
+	vec2 scaled;
+	switch (slot) {
+	case TextureSlot::Blend:
+		scaled = TransformTexcoord(texUV, pMaterial->blendTexMat, pMaterial->texScale);
+		break;
+	case TextureSlot::NormalMap:
+		scaled = TransformTexcoord(texUV, pMaterial->normalMapMat, pMaterial->texScale);
+		break;
+	case TextureSlot::NormalMap2:
+		scaled = TransformTexcoord(texUV, pMaterial->normalMapMat2, pMaterial->texScale);
+		break;
+	case TextureSlot::Detail:
+		scaled = TransformTexcoord(texUV, pMaterial->detailMat, pMaterial->detailScale);
+		break;
+	case TextureSlot::BaseTexture2: // MRAO texture lookups are driven by the base texture
+	case TextureSlot::MRAO2:
+		scaled = TransformTexcoord(texUV, pMaterial->baseTexMat2, pMaterial->texScale);
+		break;
+	default:
+		scaled = TransformTexcoord(texUV, pMaterial->baseTexMat, pMaterial->texScale);
+		break;
+	}
+
+	u = scaled.x;
+	v = scaled.y;
+	lod = mipOverride ? 0 : TriUVInfoToTexLOD(pMaterial->GetTexture(slot), textureLodInfo);
+}
+
+void TraceResult::SetPrefetchedPixels(const Pixel* pPixels)
+{
+	pPrefetched = pPixels;
+}
+
+Pixel TraceResult::SampleSlot(TextureSlot slot)
+{
+	if (pPrefetched != nullptr) return pPrefetched[static_cast<uint8_t>(slot)];
+
+	float u, v, lod;
+	GetTextureTap(slot, u, v, lod);
+	return pMaterial->GetTexture(slot)->Sample(u, v, lod);
+}
+
 // Ray Tracing Gems
 void TraceResult::CalcFootprint()
 {
@@ -107,17 +212,11 @@ void TraceResult::CalcBlendFactor()
 {
 	if (blendFactorSet) return;
 
-	if (material.maskedBlending) blendFactor = 0.5f;
-	if (material.blendTexture != nullptr) {
-		CalcFootprint();
+	if (pMaterial->maskedBlending) blendFactor = 0.5f;
+	if (pMaterial->blendTexture != nullptr) {
+		Pixel pixelBlend = SampleSlot(TextureSlot::Blend);
 
-		vec2 scaled = TransformTexcoord(texUV, material.blendTexMat, material.texScale);
-		Pixel pixelBlend = material.blendTexture->Sample(
-			scaled.x, scaled.y,
-			mipOverride ? 0 : TriUVInfoToTexLOD(material.blendTexture, textureLodInfo)
-		);
-
-		if (material.maskedBlending) {
+		if (pMaterial->maskedBlending) {
 			blendFactor = pixelBlend.g;
 		} else {
 			float minb = saturate(pixelBlend.g - pixelBlend.r);
@@ -129,127 +228,150 @@ void TraceResult::CalcBlendFactor()
 	blendFactorSet = true;
 }
 
-void TraceResult::CalcTBN()
+struct ShadingPaths
 {
-	if (tbnSet) return;
+	using Path = void (*)(TraceResult& result);
+
+	static vec3 SampleNormal(TraceResult& result, TextureSlot slot)
+	{
+		Pixel pixelNormal = result.SampleSlot(slot);
+		return vec3(pixelNormal.r, pixelNormal.g, pixelNormal.b) * 2.f - 1.f;
+	}
 
-	normal = normalize(uvw[2] * vN[0] + uvw[0] * vN[1] + uvw[1] * vN[2]);
-	tangent = normalize(uvw[2] * vT[0] + uvw[0] * vT[1] + uvw[1] * vT[2]);
-	binormal = normalize(uvw[2] * vB[0] + uvw[0] * vB[1] + uvw[1] * vB[2]);
-
-	if (material.normalMap != nullptr) {
-		CalcFootprint();
-		CalcBlendFactor();
-
-		vec2 scaled = TransformTexcoord(texUV, material.normalMapMat, material.texScale);
-		Pixel pixelNormal = material.normalMap->Sample(
-			scaled.x, scaled.y,
-			mipOverride ? 0 : TriUVInfoToTexLOD(material.normalMap, textureLodInfo)
-		);
-		vec3 mappedNormal = vec3(pixelNormal.r, pixelNormal.g, pixelNormal.b) * 2.f - 1.f;
-
-		if (material.normalMap2 != nullptr) {
-			scaled = TransformTexcoord(texUV, material.normalMapMat2, material.texScale);
-			pixelNormal = material.normalMap2->Sample(
-				scaled.x, scaled.y,
-				mipOverride ? 0 : TriUVInfoToTexLOD(material.normalMap2, textureLodInfo)
-			);
-			vec3 mappedNormal2 = vec3(pixelNormal.r, pixelNormal.g, pixelNormal.b) * 2.f - 1.f;
-
-			mappedNormal = normalize(lerp(mappedNormal, mappedNormal2, blendFactor));
+	template<MaterialFeatures Features>
+	static void CalcTBN(TraceResult& result)
+	{
+		const vec3& uvw = result.uvw;
+
+		vec3 normal = normalize(uvw[2] * result.vN[0] + uvw[0] * result.vN[1] + uvw[1] * result.vN[2]);
+		vec3 tangent = normalize(uvw[2] * result.vT[0] + uvw[0] * result.vT[1] + uvw[1] * result.vT[2]);
+		vec3 binormal = normalize(uvw[2] * result.vB[0] + uvw[0] * result.vB[1] + uvw[1] * result.vB[2]);
+
+		if constexpr (HasFeature(Features, MaterialFeatures::NormalMap)) {
+			vec3 mappedNormal = SampleNormal(result, TextureSlot::NormalMap);
+
+			if constexpr (HasFeature(Features, MaterialFeatures::NormalMap2)) {
+				result.CalcBlendFactor();
+
+				vec3 mappedNormal2 = SampleNormal(result, TextureSlot::NormalMap2);
+				mappedNormal = normalize(lerp(mappedNormal, mappedNormal2, result.blendFactor));
+			}
+
+			vec3 worldspaceMappedNormal = mat3{
+				tangent[0],  tangent[1],  tangent[2],
+				binormal[0], binormal[1], binormal[2],
+				normal[0],   normal[1],   normal[2]
+			} * mappedNormal;
+			worldspaceMappedNormal = normalize(worldspaceMappedNormal);
+
+			if (glm::all(glm::isfinite(worldspaceMappedNormal))) {
+				normal = worldspaceMappedNormal;
+				tangent = normalize(tangent - normal * dot(tangent, normal));
+				binormal = cross(tangent, normal);
+			}
 		}
 
-		vec3 worldspaceMappedNormal = mat3{
-			tangent[0],  tangent[1],  tangent[2],
-			binormal[0], binormal[1], binormal[2],
-			normal[0],   normal[1],   normal[2]
-		} * mappedNormal;
-		worldspaceMappedNormal = normalize(worldspaceMappedNormal);
+		const float kCosThetaThreshold = 0.1f;
+		float cosTheta = abs(dot(result.wo, normal));
+		if (cosTheta <= kCosThetaThreshold) {
+			float t = saturate(cosTheta * (1.f / kCosThetaThreshold));
+			normal = normalize(lerp(result.geometricNormal, normal, t));
 
-		if (glm::all(glm::isfinite(worldspaceMappedNormal))) {
-			normal = worldspaceMappedNormal;
 			tangent = normalize(tangent - normal * dot(tangent, normal));
 			binormal = cross(tangent, normal);
 		}
+
+		result.normal = normal;
+		result.tangent = tangent;
+		result.binormal = binormal;
+		result.tbnSet = true;
 	}
 
-	const float kCosThetaThreshold = 0.1f;
-	float cosTheta = abs(dot(wo, normal));
-	if (cosTheta <= kCosThetaThreshold) {
-		float t = saturate(cosTheta * (1.f / kCosThetaThreshold));
-		normal = normalize(lerp(geometricNormal, normal, t));
+	template<MaterialFeatures Features>
+	static void CalcShadingData(TraceResult& result)
+	{
+		// The blend factor only matters to materials with a second layer
+		constexpr bool layered = HasFeature(Features, MaterialFeatures::BaseTexture2) || HasFeature(Features, MaterialFeatures::MRAO2);
 
-		tangent = normalize(tangent - normal * dot(tangent, normal));
-		binormal = cross(tangent, normal);
-	}
+		if constexpr (layered) result.CalcBlendFactor();
 
-	tbnSet = true;
-}
+		Pixel pixelColour = result.SampleSlot(TextureSlot::BaseTexture);
+		vec4 colour(pixelColour.r, pixelColour.g, pixelColour.b, pixelColour.a);
 
-void TraceResult::CalcShadingData()
-{
-	if (shadingDataSet) return;
-	CalcFootprint();
-	CalcBlendFactor();
+		if constexpr (HasFeature(Features, MaterialFeatures::BaseTexture2)) {
+			pixelColour = result.SampleSlot(TextureSlot::BaseTexture2);
+			vec4 colour2(pixelColour.r, pixelColour.g, pixelColour.b, pixelColour.a);
 
-	// Cache the scaled textures for both here cause we might use them again on the MRAO
-	vec2 scaled = TransformTexcoord(texUV, material.baseTexMat, material.texScale);
-	vec2 scaled2 = TransformTexcoord(texUV, material.baseTexMat2, material.texScale);
+			colour = lerp(colour, colour2, result.blendFactor);
+		}
 
-	Pixel pixelColour = material.baseTexture->Sample(
-		scaled.x, scaled.y,
-		mipOverride ? 0 : TriUVInfoToTexLOD(material.baseTexture, textureLodInfo)
-	);
-	vec4 colour(pixelColour.r, pixelColour.g, pixelColour.b, pixelColour.a);
+		if constexpr (HasFeature(Features, MaterialFeatures::Detail)) {
+			Pixel detailColour = result.SampleSlot(TextureSlot::Detail);
+
+			colour = clamp(TextureCombine(
+				colour, vec4(detailColour.r, detailColour.g, detailColour.b, detailColour.a),
+				result.pMaterial->detailBlendMode, result.pMaterial->detailBlendFactor
+			), 0.f, 1.f);
+		}
 
-	if (material.baseTexture2 != nullptr) {
-		pixelColour = material.baseTexture2->Sample(
-			scaled2.x, scaled2.y,
-			mipOverride ? 0 : TriUVInfoToTexLOD(material.baseTexture2, textureLodInfo)
-		);
-		vec4 colour2(pixelColour.r, pixelColour.g, pixelColour.b, pixelColour.a);
+		result.albedo *= vec3(colour.r, colour.g, colour.b);
+		result.alpha *= colour.a;
 
-		colour = lerp(colour, colour2, blendFactor);
+		if constexpr (HasFeature(Features, MaterialFeatures::MRAO)) {
+			Pixel pixelMRAO = result.SampleSlot(TextureSlot::MRAO);
+			vec2 metalnessRoughness(pixelMRAO.r, pixelMRAO.g);
+
+			if constexpr (HasFeature(Features, MaterialFeatures::MRAO2)) {
+				pixelMRAO = result.SampleSlot(TextureSlot::MRAO2);
+				vec2 metalnessRoughness2(pixelMRAO.r, pixelMRAO.g);
+
+				metalnessRoughness = lerp(metalnessRoughness, metalnessRoughness2, result.blendFactor);
+			}
+
+			result.metalness = metalnessRoughness.r;
+			result.roughness = metalnessRoughness.g;
+		}
+
+		result.shadingDataSet = true;
 	}
 
-	if (material.detail != nullptr) {
-		vec2 detailUVs = TransformTexcoord(texUV, material.detailMat, material.detailScale);
-		Pixel detailColour = material.detail->Sample(
-			detailUVs.x, detailUVs.y,
-			mipOverride ? 0 : TriUVInfoToTexLOD(material.detail, textureLodInfo)
-		);
-
-		colour = clamp(TextureCombine(
-			colour, vec4(detailColour.r, detailColour.g, detailColour.b, detailColour.a),
-			material.detailBlendMode, material.detailBlendFactor
-		), 0.f, 1.f);
+	// Tables of every combination of a stage's features, indexed by the material's features shifted down to the stage's lowest bit
+	template<size_t... Indices>
+	static constexpr std::array<Path, sizeof...(Indices)> MakeTBNPaths(std::index_sequence<Indices...>)
+	{
+		return { &CalcTBN<static_cast<MaterialFeatures>(Indices << TBN_SHIFT)>... };
 	}
 
-	albedo *= vec3(colour.r, colour.g, colour.b);
-	alpha *= colour.a;
+	template<size_t... Indices>
+	static constexpr std::array<Path, sizeof...(Indices)> MakeShadingPaths(std::index_sequence<Indices...>)
+	{
+		return { &CalcShadingData<static_cast<MaterialFeatures>(Indices << SHADING_SHIFT)>... };
+	}
 
-	if (material.mrao != nullptr) {
-		Pixel pixelMRAO = material.mrao->Sample(
-			scaled.x, scaled.y,
-			mipOverride ? 0 : TriUVInfoToTexLOD(material.mrao, textureLodInfo)
-		);
-		vec2 metalnessRoughness(pixelMRAO.r, pixelMRAO.g);
+	static constexpr uint8_t TBN_SHIFT = 0;
+	static constexpr uint8_t SHADING_SHIFT = 2;
+};
 
-		if (material.mrao2 != nullptr) {
-			pixelMRAO = material.mrao2->Sample(
-				scaled2.x, scaled2.y,
-				mipOverride ? 0 : TriUVInfoToTexLOD(material.mrao2, textureLodInfo)
-			);
-			vec2 metalnessRoughness2(pixelMRAO.r, pixelMRAO.g);
+static constexpr std::array<ShadingPaths::Path, 4> TBN_PATHS = ShadingPaths::MakeTBNPaths(std::make_index_sequence<4>());
+static constexpr std::array<ShadingPaths::Path, 16> SHADING_PATHS = ShadingPaths::MakeShadingPaths(std::make_index_sequence<16>());
 
-			metalnessRoughness = lerp(metalnessRoughness, metalnessRoughness2, blendFactor);
-		}
+static_assert(static_cast<uint8_t>(MaterialFeatures::TBN) >> ShadingPaths::TBN_SHIFT == TBN_PATHS.size() - 1, "TBN features don't match the TBN paths");
+static_assert(static_cast<uint8_t>(MaterialFeatures::Shading) >> ShadingPaths::SHADING_SHIFT == SHADING_PATHS.size() - 1, "Shading features don't match the shading paths");
 
-		metalness = metalnessRoughness.r;
-		roughness = metalnessRoughness.g;
-	}
+void TraceResult::CalcTBN()
+{
+	if (tbnSet) return;
 
-	shadingDataSet = true;
+	const uint8_t features = static_cast<uint8_t>(pMaterial->features) & static_cast<uint8_t>(MaterialFeatures::TBN);
+	TBN_PATHS[features >> ShadingPaths::TBN_SHIFT](*this);
+}
+
+void TraceResult::CalcShadingData()
+{
+	if (shadingDataSet) return;
+
+	const uint8_t features = static_cast<uint8_t>(pMaterial->features) & static_cast<uint8_t>(MaterialFeatures::Shading);
+	SHADING_PATHS[features >> ShadingPaths::SHADING_SHIFT](*this);
 }
 
 const vec3& TraceResult::GetPos()
@@ -302,21 +424,23 @@ float TraceResult::GetRoughness()
 float TraceResult::GetBaseMIPLevel()
 {
 	CalcFootprint();
-	return mipOverride ? 0 : TriUVInfoToTexLOD(material.baseTexture, textureLodInfo);
+	return mipOverride ? 0 : TriUVInfoToTexLOD(pMaterial->baseTexture.get(), textureLodInfo);
 }
 
-std::string    TraceResult::GetMaterial()      const { return material.path; }
-MaterialFlags  TraceResult::GetMaterialFlags() const { return material.flags; }
-BSPEnums::SURF TraceResult::GetSurfFlags()     const { return material.surfFlags; }
-bool           TraceResult::HitWater()         const { return material.water; }
+static const std::string EMPTY_PATH = "";
+
+const std::string& TraceResult::GetMaterial()      const { return pMaterial->path; }
+MaterialFlags      TraceResult::GetMaterialFlags() const { return pMaterial->flags; }
+BSPEnums::SURF     TraceResult::GetSurfFlags()     const { return pMaterial->surfFlags; }
+bool               TraceResult::HitWater()         const { return pMaterial->water; }
 
-std::string TraceResult::GetBaseTexture()   const { return material.baseTexture  != nullptr ? material.baseTexPath : ""; }
-std::string TraceResult::GetNormalMap()     const { return material.normalMap    != nullptr ? material.normalMapPath : ""; }
-std::string TraceResult::GetMRAO()          const { return material.mrao         != nullptr ? "vistrace/pbr/" + material.baseTexPath + "_mrao" : ""; }
+const std::string& TraceResult::GetBaseTexture()   const { return pMaterial->baseTexture  != nullptr ? pMaterial->baseTexPath : EMPTY_PATH; }
+const std::string& TraceResult::GetNormalMap()     const { return pMaterial->normalMap    != nullptr ? pMaterial->normalMapPath : EMPTY_PATH; }
+std::string        TraceResult::GetMRAO()          const { return pMaterial->mrao         != nullptr ? "vistrace/pbr/" + pMaterial->baseTexPath + "_mrao" : EMPTY_PATH; }
 
-std::string TraceResult::GetBaseTexture2()  const { return material.baseTexture2 != nullptr ? material.baseTexPath2 : ""; }
-std::string TraceResult::GetNormalMap2()    const { return material.normalMap2   != nullptr ? material.normalMapPath2 : ""; }
-std::string TraceResult::GetMRAO2()         const { return material.mrao2        != nullptr ? "vistrace/pbr/" + material.baseTexPath2 + "_mrao" : ""; }
+const std::string& TraceResult::GetBaseTexture2()  const { return pMaterial->baseTexture2 != nullptr ? pMaterial->baseTexPath2 : EMPTY_PATH; }
+const std::string& TraceResult::GetNormalMap2()    const { return pMaterial->normalMap2   != nullptr ? pMaterial->normalMapPath2 : EMPTY_PATH; }
+std::string        TraceResult::GetMRAO2()         const { return pMaterial->mrao2        != nullptr ? "vistrace/pbr/" + pMaterial->baseTexPath2 + "_mrao" : EMPTY_PATH; }
 
-std::string TraceResult::GetBlendTexture()  const { return material.blendTexture != nullptr ? material.blendTexPath : ""; }
-std::string TraceResult::GetDetailTexture() const { return material.detail       != nullptr ? material.detailPath : ""; }
+const std::string& TraceResult::GetBlendTexture()  const { return pMaterial->blendTexture != nullptr ? pMaterial->blendTexPath : EMPTY_PATH; }
+const std::string& TraceResult::GetDetailTexture() const { return pMaterial->detail       != nullptr ? pMaterial->detailPath : EMPTY_PATH; }
@@ -1,6 +1,9 @@
 #pragma once
 
 #include <cstdint>
+#include <memory>
+#include <vector>
+#include <string>
 #include "glm/glm.hpp"
 
 #include "BSPParser.h"
@@ -10,10 +13,53 @@
 
 #include "Utils.h"
 
+/// <summary>
+/// Attributes of a TraceResult that TraceResult:Fill can write, named after the accessor that reads each one
+/// </summary>
+enum class TraceField : uint32_t
+{
+	None = 0,
+
+	Pos              = 1 << 0,
+	Incident         = 1 << 1,
+	Distance         = 1 << 2,
+	Entity           = 1 << 3,
+	GeometricNormal  = 1 << 4,
+	Normal           = 1 << 5,
+	Tangent          = 1 << 6,
+	Binormal         = 1 << 7,
+	Barycentric      = 1 << 8,
+	TextureUV        = 1 << 9,
+	SubMaterialIndex = 1 << 10,
+	Albedo           = 1 << 11,
+	Alpha            = 1 << 12,
+	Metalness        = 1 << 13,
+	Roughness        = 1 << 14,
+	MaterialFlags    = 1 << 15,
+	SurfaceFlags     = 1 << 16,
+	HitSky           = 1 << 17,
+	HitWater         = 1 << 18,
+	FrontFacing      = 1 << 19,
+	BaseMIPLevel     = 1 << 20,
+
+	TBN      = Normal | Tangent | Binormal,
+	Shading  = Albedo | Alpha | Metalness | Roughness,
+
+	All = (1 << 21) - 1
+};
+
+inline TraceField operator &(const TraceField& lhs, const TraceField& rhs)
+{
+	return static_cast<TraceField>(static_cast<uint32_t>(lhs) & static_cast<uint32_t>(rhs));
+}
+
 class TraceResult
 {
 private:
-	Material material;
+	// Points into the accel's material table, which results boxed for Lua keep alive as they can outlive the build
+	// Transient results are only used under the traversal lock, so they don't touch the table's refcount
+	std::shared_ptr<const std::vector<Material>> mpMaterials;
+	const Material* pMaterial;
 
 	bool blendFactorSet = false;
 	float blendFactor;
@@ -46,11 +92,18 @@ private:
 	float metalness = 0;
 	float roughness = 1;
 
+	// Pixels sampled ahead of time, one per TextureSlot, which are read instead of the material's textures when set
+	const VisTrace::Pixel* pPrefetched = nullptr;
+
 	void CalcFootprint();
 	void CalcBlendFactor();
+	VisTrace::Pixel SampleSlot(TextureSlot slot);
 	void CalcTBN();
 	void CalcShadingData();
 
+	// Specialisations of CalcTBN and CalcShadingData for each combination of material features
+	friend struct ShadingPaths;
+
 public:
 	static int id;
 
@@ -71,14 +124,48 @@ public:
 
 	bool frontFacing;
 
+	/// <summary>
+	/// Results pushed to Lua are allocated from a pool rather than the heap, as a frame of traces can box millions of them
+	/// This only makes each allocation cheaper, Lua still collects every result through its __gc
+	/// </summary>
+	static void* operator new(size_t size);
+	static void operator delete(void* p, size_t size);
+
+	/// <summary>
+	/// Gets the number of pooled results currently alive, and how many the pool has room for before it grows
+	/// </summary>
+	static void GetPoolStats(size_t& numAllocated, size_t& capacity);
+
 	TraceResult(
 		const glm::vec3& direction, float distance,
 		float coneWidth, float coneAngle,
 		const Triangle& tri,
 		const glm::vec2& uv,
-		const Entity& ent, const Material mat
+		const Entity& ent, const Material& material
 	);
 
+	/// <summary>
+	/// Keeps the material table the result's material is from alive, for results that outlive the traversal lock
+	/// </summary>
+	void RetainMaterials(const std::shared_ptr<const std::vector<Material>>& pMaterials);
+
+	/// <summary>
+	/// Gets the texture slots computing the TBN and/or shading attributes would sample, as a TextureSlotBit per slot
+	/// Attributes that are already computed, and textures the material doesn't have, are left out
+	/// </summary>
+	uint8_t GetTextureSlots(bool tbn, bool shading) const;
+
+	/// <summary>
+	/// Gets the coordinates and MIP level a texture slot would be sampled at, so it can be sampled along with other results
+	/// </summary>
+	void GetTextureTap(TextureSlot slot, float& u, float& v, float& lod);
+
+	/// <summary>
+	/// Reads the texture slots from GetTextureSlots from already sampled pixels, indexed by TextureSlot, rather than sampling them
+	/// The pixels must be kept alive until the attributes are computed
+	/// </summary>
+	void SetPrefetchedPixels(const VisTrace::Pixel* pPixels);
+
 	const glm::vec3& GetPos();
 
 	const glm::vec3& GetNormal();
@@ -93,19 +180,19 @@ public:
 
 	float GetBaseMIPLevel();
 
-	std::string GetMaterial() const;
+	const std::string& GetMaterial() const;
 	MaterialFlags GetMaterialFlags() const;
 	BSPEnums::SURF GetSurfFlags() const;
 	bool HitWater() const;
 
-	std::string GetBaseTexture() const;
-	std::string GetNormalMap() const;
+	const std::string& GetBaseTexture() const;
+	const std::string& GetNormalMap() const;
 	std::string GetMRAO() const;
 
-	std::string GetBaseTexture2() const;
-	std::string GetNormalMap2() const;
+	const std::string& GetBaseTexture2() const;
+	const std::string& GetNormalMap2() const;
 	std::string GetMRAO2() const;
 
-	std::string GetBlendTexture() const;
-	std::string GetDetailTexture() const;
+	const std::string& GetBlendTexture() const;
+	const std::string& GetDetailTexture() const;
 };
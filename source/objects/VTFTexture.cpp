@@ -1,8 +1,25 @@
 #include "VTFTexture.h"
 #include "GMFS.h"
+#include "ResourceCache.h"
+
+#include <cmath>
+#include <cstring>
+
+#include "glm/gtc/packing.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TEXTURE_SSE
+#include <emmintrin.h>
+#endif
 
 using namespace VisTrace;
 
+// Width and height of a decoded tile in texels
+#define TILE_SIZE 4
+
+// Decoded MIPs with at most this many texels (64x64) are never evicted
+#define RESIDENT_MIP_TEXELS 4096
+
 int VTFTextureWrapper::id{ -1 };
 
 VTFTextureWrapper::VTFTextureWrapper(const std::string& path)
@@ -18,8 +35,18 @@ VTFTextureWrapper::VTFTextureWrapper(const std::string& path)
 	FileSystem::Read(data, filesize, file);
 	FileSystem::Close(file);
 
-	mpTex = new VTFTexture{ data, filesize };
+	Load(data, filesize);
 	free(data);
+}
+
+VTFTextureWrapper::VTFTextureWrapper(uint8_t* pData, uint32_t size)
+{
+	Load(pData, size);
+}
+
+void VTFTextureWrapper::Load(uint8_t* pData, uint32_t size)
+{
+	mpTex = new VTFTexture{ pData, size };
 
 	if (!mpTex->IsValid()) {
 		delete mpTex;
@@ -27,11 +54,17 @@ VTFTextureWrapper::VTFTextureWrapper(const std::string& path)
 		return;
 	}
 
+	// The parser keeps its own copy of the file's data
+	mMemorySize = size;
 	mValid = true;
 }
 
 VTFTextureWrapper::~VTFTextureWrapper()
 {
+	for (size_t mipLevel = 0; mipLevel < mNumDecodedMIPs; mipLevel++) {
+		if (mpDecoded[mipLevel].pTexels != nullptr) ResourceCache::ReleaseDecode(mpDecoded[mipLevel].size);
+	}
+
 	if (mValid) delete mpTex;
 	mValid = false;
 	mpTex = nullptr;
@@ -42,6 +75,187 @@ bool VTFTextureWrapper::IsValid() const
 	return mValid && mpTex != nullptr && mpTex->IsValid();
 }
 
+size_t VTFTextureWrapper::GetTexelSize() const { return mHDR ? 8 : 4; }
+
+bool VTFTextureWrapper::EnableDecoding()
+{
+	if (!IsValid() || mpTex->GetDepth() > 1 || mpTex->GetFaces() > 1 || mpTex->GetFrames() > 1) return false;
+	if (mpTex->GetMIPLevels() > MAX_DECODED_MIPS) return false;
+	if (IsDecodingEnabled()) return true;
+
+	// Formats with more than 8 bits per channel are decoded as half floats so HDR values survive
+	const ImageFormatInfo format = mpTex->GetFormat();
+	mHDR = !format.isCompressed && format.bitsPerPixel > 32;
+
+	mNumDecodedMIPs = mpTex->GetMIPLevels();
+	mpDecoded = std::make_unique<DecodedMIP[]>(mNumDecodedMIPs);
+	for (size_t mipLevel = 0; mipLevel < mNumDecodedMIPs; mipLevel++) {
+		DecodedMIP& mip = mpDecoded[mipLevel];
+		mip.width = mpTex->GetWidth(static_cast<uint8_t>(mipLevel));
+		mip.height = mpTex->GetHeight(static_cast<uint8_t>(mipLevel));
+		mip.tilesX = (mip.width + TILE_SIZE - 1) / TILE_SIZE;
+
+		const size_t tilesY = (mip.height + TILE_SIZE - 1) / TILE_SIZE;
+		mip.size = static_cast<size_t>(mip.tilesX) * tilesY * TILE_SIZE * TILE_SIZE * GetTexelSize();
+	}
+
+	return true;
+}
+
+bool VTFTextureWrapper::IsDecodingEnabled() const { return mpDecoded != nullptr; }
+
+std::shared_ptr<const std::vector<uint8_t>> VTFTextureWrapper::GetDecodedMIP(size_t mipLevel) const
+{
+	DecodedMIP& mip = mpDecoded[mipLevel];
+
+	// Only written when the frame changes, so threads sampling the same MIP don't keep stealing its cache line
+	const uint32_t frame = ResourceCache::GetFrame();
+	if (mip.lastUse.load(std::memory_order_relaxed) != frame) mip.lastUse.store(frame, std::memory_order_relaxed);
+
+	std::shared_ptr<const std::vector<uint8_t>> pTexels = std::atomic_load(&mip.pTexels);
+	if (pTexels != nullptr) return pTexels;
+
+	// No lock is held while decoding, so eviction on the game thread never waits on it
+	if (mip.decoding.exchange(true, std::memory_order_acquire)) return nullptr;
+
+	// Another thread may have finished decoding between the load and the claim
+	pTexels = std::atomic_load(&mip.pTexels);
+	if (pTexels != nullptr || !ResourceCache::ReserveDecode(mip.size)) {
+		mip.decoding.store(false, std::memory_order_release);
+		return pTexels;
+	}
+
+	const size_t texelSize = GetTexelSize();
+	auto pDecoded = std::make_shared<std::vector<uint8_t>>(mip.size);
+	for (uint16_t y = 0; y < mip.height; y++) {
+		for (uint16_t x = 0; x < mip.width; x++) {
+			const VTFPixel p = mpTex->GetPixel(x, y, 0, static_cast<uint8_t>(mipLevel), 0, 0);
+			const glm::vec4 colour(p.r, p.g, p.b, p.a);
+
+			const size_t tile = static_cast<size_t>(y / TILE_SIZE) * mip.tilesX + x / TILE_SIZE;
+			const size_t texel = tile * TILE_SIZE * TILE_SIZE + (y % TILE_SIZE) * TILE_SIZE + x % TILE_SIZE;
+			if (mHDR) {
+				const glm::uint64 packed = glm::packHalf4x16(colour);
+				memcpy(pDecoded->data() + texel * texelSize, &packed, sizeof(packed));
+			} else {
+				const glm::uint32 packed = glm::packUnorm4x8(colour);
+				memcpy(pDecoded->data() + texel * texelSize, &packed, sizeof(packed));
+			}
+		}
+	}
+
+	pTexels = std::move(pDecoded);
+	std::atomic_store(&mip.pTexels, pTexels);
+	mip.decoding.store(false, std::memory_order_release);
+	return pTexels;
+}
+
+size_t VTFTextureWrapper::EvictMIPs(uint32_t frame) const
+{
+	if (!IsDecodingEnabled()) return 0;
+
+	size_t numEvicted = 0;
+	for (size_t mipLevel = 0; mipLevel < mNumDecodedMIPs; mipLevel++) {
+		DecodedMIP& mip = mpDecoded[mipLevel];
+
+		// Small MIPs cost next to nothing to keep, and are what distant surfaces sample
+		if (static_cast<uint32_t>(mip.width) * mip.height <= RESIDENT_MIP_TEXELS) break;
+		if (mip.lastUse.load(std::memory_order_relaxed) >= frame) continue;
+		if (std::atomic_load(&mip.pTexels) == nullptr) continue;
+
+		// Swapped out without locking, and only the thread that gets the texels back releases their budget
+		// Threads still sampling the MIP hold their own reference, so it's freed once they're done
+		if (std::atomic_exchange(&mip.pTexels, std::shared_ptr<const std::vector<uint8_t>>()) == nullptr) continue;
+		ResourceCache::ReleaseDecode(mip.size);
+		numEvicted++;
+	}
+	return numEvicted;
+}
+
+static inline size_t TexelIndex(const uint16_t tilesX, const int32_t x, const int32_t y)
+{
+	const size_t tile = static_cast<size_t>(y / TILE_SIZE) * tilesX + x / TILE_SIZE;
+	return tile * TILE_SIZE * TILE_SIZE + (y % TILE_SIZE) * TILE_SIZE + x % TILE_SIZE;
+}
+
+#ifdef TEXTURE_SSE
+static inline __m128 FetchSSE(const uint8_t* pTexels, const size_t texel, const bool hdr)
+{
+	if (hdr) {
+		glm::uint64 packed;
+		memcpy(&packed, pTexels + texel * 8, sizeof(packed));
+		const glm::vec4 colour = glm::unpackHalf4x16(packed);
+		return _mm_loadu_ps(&colour[0]);
+	}
+
+	// Widen the 4 bytes to 4 ints, then convert and normalise all channels at once
+	int32_t packed;
+	memcpy(&packed, pTexels + texel * 4, sizeof(packed));
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i wide = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero), zero);
+	return _mm_mul_ps(_mm_cvtepi32_ps(wide), _mm_set1_ps(1.f / 255.f));
+}
+
+static inline __m128 LerpSSE(const __m128 a, const __m128 b, const float t)
+{
+	return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), _mm_set1_ps(t)));
+}
+#endif
+
+glm::vec4 VTFTextureWrapper::FetchDecoded(const uint8_t* pTexels, const size_t texel) const
+{
+	if (mHDR) {
+		glm::uint64 packed;
+		memcpy(&packed, pTexels + texel * 8, sizeof(packed));
+		return glm::unpackHalf4x16(packed);
+	}
+
+	glm::uint32 packed;
+	memcpy(&packed, pTexels + texel * 4, sizeof(packed));
+	return glm::unpackUnorm4x8(packed);
+}
+
+glm::vec4 VTFTextureWrapper::SampleDecoded(const DecodedMIP& mip, const uint8_t* pTexels, float u, float v) const
+{
+	// Bilinear filtering between texel centres, wrapping at the edges
+	const float x = (u - floorf(u)) * mip.width - 0.5f;
+	const float y = (v - floorf(v)) * mip.height - 0.5f;
+	const float x0f = floorf(x), y0f = floorf(y);
+	const float fx = x - x0f, fy = y - y0f;
+
+	int32_t x0 = static_cast<int32_t>(x0f), y0 = static_cast<int32_t>(y0f);
+	if (x0 < 0) x0 += mip.width;
+	if (y0 < 0) y0 += mip.height;
+	if (x0 >= mip.width) x0 -= mip.width;
+	if (y0 >= mip.height) y0 -= mip.height;
+	const int32_t x1 = x0 + 1 < mip.width ? x0 + 1 : 0;
+	const int32_t y1 = y0 + 1 < mip.height ? y0 + 1 : 0;
+
+#ifdef TEXTURE_SSE
+	const __m128 top = LerpSSE(FetchSSE(pTexels, TexelIndex(mip.tilesX, x0, y0), mHDR), FetchSSE(pTexels, TexelIndex(mip.tilesX, x1, y0), mHDR), fx);
+	const __m128 bottom = LerpSSE(FetchSSE(pTexels, TexelIndex(mip.tilesX, x0, y1), mHDR), FetchSSE(pTexels, TexelIndex(mip.tilesX, x1, y1), mHDR), fx);
+
+	glm::vec4 colour;
+	_mm_storeu_ps(&colour[0], LerpSSE(top, bottom, fy));
+	return colour;
+#else
+	return glm::mix(
+		glm::mix(FetchDecoded(pTexels, TexelIndex(mip.tilesX, x0, y0)), FetchDecoded(pTexels, TexelIndex(mip.tilesX, x1, y0)), fx),
+		glm::mix(FetchDecoded(pTexels, TexelIndex(mip.tilesX, x0, y1)), FetchDecoded(pTexels, TexelIndex(mip.tilesX, x1, y1)), fx),
+		fy
+	);
+#endif
+}
+
+float VTFTextureWrapper::ClampMIP(float mipLevel) const
+{
+	const float maxMip = static_cast<float>(mNumDecodedMIPs - 1);
+	mipLevel = mipLevel < 0.f ? 0.f : (mipLevel > maxMip ? maxMip : mipLevel);
+	return std::isfinite(mipLevel) ? mipLevel : 0.f;
+}
+
+size_t VTFTextureWrapper::GetMemorySize() const { return mMemorySize; }
+
 VTFTextureFormatInfo VTFTextureWrapper::GetFormat() const
 {
 	ImageFormatInfo pFormat = mpTex->GetFormat();
@@ -67,6 +281,64 @@ Pixel VTFTextureWrapper::GetPixel(uint16_t x, uint16_t y, uint16_t z, uint8_t mi
 }
 Pixel VTFTextureWrapper::Sample(float u, float v, uint16_t z, float mipLevel, uint16_t frame, uint8_t face) const
 {
+	if (IsDecodingEnabled() && z == 0 && frame == 0 && face == 0) {
+		// Trilinear filtering between the two nearest MIP levels
+		mipLevel = ClampMIP(mipLevel);
+		const size_t mipA = static_cast<size_t>(mipLevel);
+		const float t = mipLevel - mipA;
+		const bool blend = t > 0.f && mipA + 1 < mNumDecodedMIPs;
+
+		// Falls through to the VTF data if either MIP didn't fit in the decode budget
+		const auto pTexelsA = GetDecodedMIP(mipA);
+		const auto pTexelsB = blend ? GetDecodedMIP(mipA + 1) : nullptr;
+		if (pTexelsA != nullptr && (!blend || pTexelsB != nullptr)) {
+			glm::vec4 colour = SampleDecoded(mpDecoded[mipA], pTexelsA->data(), u, v);
+			if (blend) colour = glm::mix(colour, SampleDecoded(mpDecoded[mipA + 1], pTexelsB->data(), u, v), t);
+			return Pixel{ colour.r, colour.g, colour.b, colour.a };
+		}
+	}
+
 	VTFPixel p = mpTex->Sample(u, v, z, mipLevel, frame, face);
 	return Pixel{ p.r, p.g, p.b, p.a };
 }
+
+void VTFTextureWrapper::SampleBatch(const float* u, const float* v, const float* lod, Pixel* out, size_t n) const
+{
+	if (!IsDecodingEnabled()) {
+		for (size_t i = 0; i < n; i++) {
+			VTFPixel p = mpTex->Sample(u[i], v[i], 0, lod[i], 0, 0);
+			out[i] = Pixel{ p.r, p.g, p.b, p.a };
+		}
+		return;
+	}
+
+	// Each MIP is looked up (and decoded if needed) once per batch, rather than once per sample
+	std::shared_ptr<const std::vector<uint8_t>> mips[MAX_DECODED_MIPS];
+	uint32_t fetched = 0;
+	auto getMIP = [&](const size_t mipLevel) -> const uint8_t* {
+		if ((fetched & (1U << mipLevel)) == 0) {
+			mips[mipLevel] = GetDecodedMIP(mipLevel);
+			fetched |= 1U << mipLevel;
+		}
+		return mips[mipLevel] != nullptr ? mips[mipLevel]->data() : nullptr;
+	};
+
+	for (size_t i = 0; i < n; i++) {
+		const float mipLevel = ClampMIP(lod[i]);
+		const size_t mipA = static_cast<size_t>(mipLevel);
+		const float t = mipLevel - mipA;
+		const bool blend = t > 0.f && mipA + 1 < mNumDecodedMIPs;
+
+		const uint8_t* pTexelsA = getMIP(mipA);
+		const uint8_t* pTexelsB = blend ? getMIP(mipA + 1) : nullptr;
+		if (pTexelsA == nullptr || (blend && pTexelsB == nullptr)) {
+			VTFPixel p = mpTex->Sample(u[i], v[i], 0, mipLevel, 0, 0);
+			out[i] = Pixel{ p.r, p.g, p.b, p.a };
+			continue;
+		}
+
+		glm::vec4 colour = SampleDecoded(mpDecoded[mipA], pTexelsA, u[i], v[i]);
+		if (blend) colour = glm::mix(colour, SampleDecoded(mpDecoded[mipA + 1], pTexelsB, u[i], v[i]), t);
+		out[i] = Pixel{ colour.r, colour.g, colour.b, colour.a };
+	}
+}
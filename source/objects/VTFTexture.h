@@ -4,21 +4,91 @@
 #include "vistrace/IVTFTexture.h"
 
 #include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+
+#include "glm/glm.hpp"
 
 class VTFTextureWrapper : public VisTrace::IVTFTexture
 {
 private:
+	/// <summary>
+	/// One MIP level of the first frame, decoded into 4x4 tiles of RGBA8 (or RGBA16F for HDR formats) the first time it's sampled
+	/// A tile of RGBA8 is one cache line, so most bilinear taps only touch one or two lines
+	/// </summary>
+	struct DecodedMIP
+	{
+		uint16_t width = 0;
+		uint16_t height = 0;
+		uint16_t tilesX = 0;
+		size_t size = 0;
+
+		// Only accessed through std::atomic_load/atomic_store/atomic_exchange, as it can be evicted while other threads sample
+		std::shared_ptr<const std::vector<uint8_t>> pTexels;
+		std::atomic<uint32_t> lastUse{ 0 };
+
+		// Claimed by the one thread decoding the MIP, others sample the VTF data meanwhile rather than wait
+		std::atomic<bool> decoding{ false };
+	};
+
 	bool mValid = false;
 	const VTFTexture* mpTex = nullptr;
+	size_t mMemorySize = 0;
+
+	// Dimensions are 16 bit, so a valid texture never has more MIPs than this
+	static constexpr size_t MAX_DECODED_MIPS = 16;
+
+	bool mHDR = false; // Decoded as RGBA16F instead of RGBA8
+	size_t mNumDecodedMIPs = 0;
+	std::unique_ptr<DecodedMIP[]> mpDecoded;
+
+	size_t GetTexelSize() const;
+	std::shared_ptr<const std::vector<uint8_t>> GetDecodedMIP(size_t mipLevel) const;
+	glm::vec4 FetchDecoded(const uint8_t* pTexels, size_t texel) const;
+	glm::vec4 SampleDecoded(const DecodedMIP& mip, const uint8_t* pTexels, float u, float v) const;
+	float ClampMIP(float mipLevel) const;
+
+	void Load(uint8_t* pData, uint32_t size);
 
 public:
 	static int id;
 
 	VTFTextureWrapper(const std::string& path);
+
+	/// <summary>
+	/// Loads a texture from the contents of a VTF file, for textures that don't come from the game's file system
+	/// </summary>
+	VTFTextureWrapper(uint8_t* pData, uint32_t size);
 	~VTFTextureWrapper();
 
+	VTFTextureWrapper(const VTFTextureWrapper&) = delete;
+	VTFTextureWrapper& operator=(const VTFTextureWrapper&) = delete;
+
 	bool IsValid() const;
 
+	/// <summary>
+	/// Gets the number of bytes the texture holds in memory, used to budget the resource cache
+	/// </summary>
+	size_t GetMemorySize() const;
+
+	/// <summary>
+	/// Lets Sample decode MIP levels of the first frame as they're requested, so it no longer decompresses texels on every tap
+	/// Decoded MIPs count against ResourceCache's decode budget, and are sampled from the VTF data as before when they don't fit
+	/// Must be called before the texture is shared between threads
+	/// </summary>
+	/// <returns>False if the texture can't be decoded (volumetric, cubemap, or animated)</returns>
+	bool EnableDecoding();
+
+	bool IsDecodingEnabled() const;
+
+	/// <summary>
+	/// Frees decoded MIPs larger than the resident size that haven't been sampled since a frame
+	/// </summary>
+	/// <param name="frame">Frame to compare against ResourceCache::GetFrame at the time of sampling</param>
+	/// <returns>Number of MIPs evicted</returns>
+	size_t EvictMIPs(uint32_t frame) const;
+
 	VisTrace::VTFTextureFormatInfo GetFormat() const;
 	uint32_t GetVersionMajor() const;
 	uint32_t GetVersionMinor() const;
@@ -36,4 +106,10 @@ public:
 
 	VisTrace::Pixel GetPixel(uint16_t x, uint16_t y, uint16_t z, uint8_t mipLevel, uint16_t frame, uint8_t face) const;
 	VisTrace::Pixel Sample(float u, float v, uint16_t z, float mipLevel, uint16_t frame, uint8_t face) const;
+
+	/// <summary>
+	/// Always samples frame 0, face 0, and slice 0, as the batch has no way to pick others and that is the only image decoding covers
+	/// Textures that haven't enabled decoding (including all animated, cubemap, and volumetric ones) are sampled from the VTF data instead
+	/// </summary>
+	void SampleBatch(const float* u, const float* v, const float* lod, VisTrace::Pixel* out, size_t n) const;
 };
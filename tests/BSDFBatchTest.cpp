@@ -0,0 +1,286 @@
+// Checks EvalBSDFBatch and EvalPDFBatch against EvalBSDF and EvalPDF point by point
+// Materials, shading frames, and directions are random (with fixed seeds), and cover:
+// - points hit from behind, mixed with points hit from the front in the same group of 4
+// - roughness either side of kMinGGXAlpha, where groups fall back to the scalar path
+// - batch sizes that aren't a multiple of 4, and batches large enough to be split across threads
+// - materials the SSE path doesn't handle (specular transmission, anisotropic rotation)
+//
+// Usage: vistrace_test_bsdf_batch [seed = 1234]
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "BSDF.h"
+
+using namespace glm;
+using namespace VisTrace;
+
+// The SSE path mirrors the scalar one operation for operation, so any difference beyond rounding is a bug
+constexpr float kRelativeTolerance = 1e-3f;
+constexpr float kAbsoluteTolerance = 1e-5f;
+
+// Failures printed per check before only counting them
+constexpr size_t kMaxPrintedFailures = 8;
+
+enum class RoughnessRange
+{
+	Any,
+	NearMinAlpha // Linear roughness squared lands on, just above, and (for some points) just below kMinGGXAlpha
+};
+
+struct Points
+{
+	std::vector<float> normals, tangents, binormals, incident, scattered;
+	std::vector<float> albedos, metalness, roughness;
+
+	BSDFBatch View(bool withShading) const
+	{
+		BSDFBatch batch;
+		batch.size = metalness.size();
+		batch.pNormals = normals.data();
+		batch.pTangents = tangents.data();
+		batch.pBinormals = binormals.data();
+		batch.pIncident = incident.data();
+		batch.pScattered = scattered.data();
+		if (withShading) {
+			batch.pAlbedos = albedos.data();
+			batch.pMetalness = metalness.data();
+			batch.pRoughness = roughness.data();
+		}
+		return batch;
+	}
+};
+
+static vec3 RandomUnit(std::mt19937& rng)
+{
+	std::normal_distribution<float> normal(0.f, 1.f);
+	vec3 v;
+	do {
+		v = vec3(normal(rng), normal(rng), normal(rng));
+	} while (dot(v, v) < 1e-6f);
+	return normalize(v);
+}
+
+static void Store(std::vector<float>& array, size_t i, const vec3& v)
+{
+	array[i * 3] = v.x;
+	array[i * 3 + 1] = v.y;
+	array[i * 3 + 2] = v.z;
+}
+
+static vec3 Load(const std::vector<float>& array, size_t i)
+{
+	return vec3(array[i * 3], array[i * 3 + 1], array[i * 3 + 2]);
+}
+
+static float RandomRoughness(std::mt19937& rng, RoughnessRange range)
+{
+	std::uniform_real_distribution<float> unit(0.f, 1.f);
+	if (range == RoughnessRange::Any) return unit(rng);
+
+	// sqrt(kMinGGXAlpha) squared may round either side of it, so nudge by a few ulps as well as a relative step
+	const float threshold = std::sqrt(kMinGGXAlpha);
+	const float candidates[] = {
+		threshold,
+		std::nextafter(threshold, 1.f),
+		std::nextafter(std::nextafter(threshold, 1.f), 1.f),
+		threshold * 1.001f,
+		threshold * 1.01f
+	};
+
+	// Only an occasional point below the threshold, so most groups stay on the SSE path
+	if (unit(rng) < 0.125f) return unit(rng) < 0.5f ? std::nextafter(threshold, 0.f) : threshold * 0.99f;
+	return candidates[std::uniform_int_distribution<int>(0, 4)(rng)];
+}
+
+static Points MakePoints(size_t n, std::mt19937& rng, RoughnessRange range)
+{
+	std::uniform_real_distribution<float> unit(0.f, 1.f);
+
+	Points points;
+	points.normals.resize(n * 3);
+	points.tangents.resize(n * 3);
+	points.binormals.resize(n * 3);
+	points.incident.resize(n * 3);
+	points.scattered.resize(n * 3);
+	points.albedos.resize(n * 3);
+	points.metalness.resize(n);
+	points.roughness.resize(n);
+
+	for (size_t i = 0; i < n; i++) {
+		const vec3 normal = RandomUnit(rng);
+		vec3 tangent = cross(normal, RandomUnit(rng));
+		while (dot(tangent, tangent) < 1e-6f) tangent = cross(normal, RandomUnit(rng));
+		tangent = normalize(tangent);
+
+		Store(points.normals, i, normal);
+		Store(points.tangents, i, tangent);
+		Store(points.binormals, i, cross(normal, tangent));
+
+		// Roughly a third of the points are hit from behind, and scattered directions land on either side
+		vec3 incident = RandomUnit(rng);
+		const bool behind = unit(rng) < 0.33f;
+		if ((dot(incident, normal) < 0.f) != behind) incident = -incident;
+		Store(points.incident, i, incident);
+		Store(points.scattered, i, RandomUnit(rng));
+
+		// Albedos above 1 check the clamp in PrepShadingData is mirrored
+		Store(points.albedos, i, vec3(unit(rng), unit(rng), unit(rng)) * 1.2f);
+		points.metalness[i] = unit(rng) < 0.25f ? std::round(unit(rng)) : unit(rng);
+		points.roughness[i] = RandomRoughness(rng, range);
+	}
+
+	return points;
+}
+
+static BSDFMaterial RandomMaterial(std::mt19937& rng, RoughnessRange range, bool scalarOnly)
+{
+	std::uniform_real_distribution<float> unit(0.f, 1.f);
+
+	BSDFMaterial material;
+	material.dielectricInput = vec3(unit(rng), unit(rng), unit(rng));
+	material.conductorInput = vec3(unit(rng), unit(rng), unit(rng));
+	material.edgetint = vec3(unit(rng), unit(rng), unit(rng));
+	material.falloff = unit(rng);
+	material.ior = 1.1f + unit(rng) * 1.4f;
+	material.outsideIoR = unit(rng) < 0.75f ? 1.f : 1.f + unit(rng) * 0.5f;
+	material.anisotropy = unit(rng) < 0.5f ? 0.f : unit(rng) * 1.8f - 0.9f;
+
+	// Values used when a batch has no shading arrays, or when overridden
+	material.metallicOverridden = unit(rng) < 0.2f;
+	material.metallic = unit(rng);
+	material.roughnessOverridden = unit(rng) < 0.2f;
+	material.linearRoughness = RandomRoughness(rng, range);
+	material.roughness = material.linearRoughness * material.linearRoughness;
+	material.dielectric = material.dielectricInput;
+	material.conductor = material.conductorInput;
+
+	const LobeType lobeSets[] = {
+		LobeType::All,
+		LobeType::Diffuse,
+		LobeType::Specular,
+		LobeType::Conductive,
+		LobeType::Dielectric,
+		LobeType::Reflection,
+		LobeType::NonDelta
+	};
+	material.activeLobes = lobeSets[std::uniform_int_distribution<int>(0, 6)(rng)];
+
+	if (scalarOnly) {
+		if (unit(rng) < 0.5f) material.specularTransmission = 0.25f + unit(rng) * 0.75f;
+		else material.anisotropicRotation = unit(rng) * 6.28f;
+		material.thin = unit(rng) < 0.5f;
+	}
+
+	return material;
+}
+
+static bool Matches(float expected, float actual)
+{
+	if (std::isnan(expected) || std::isnan(actual)) return std::isnan(expected) && std::isnan(actual);
+	if (std::isinf(expected) || std::isinf(actual)) return expected == actual;
+
+	const float scale = std::max(std::fabs(expected), std::fabs(actual));
+	return std::fabs(expected - actual) <= kAbsoluteTolerance + kRelativeTolerance * scale;
+}
+
+static size_t Check(const char* name, const BSDFMaterial& material, const Points& points, bool withShading)
+{
+	const BSDFBatch batch = points.View(withShading);
+
+	std::vector<float> bsdf(batch.size * 3), pdf(batch.size);
+	EvalBSDFBatch(material, batch, bsdf.data());
+	EvalPDFBatch(material, batch, pdf.data());
+
+	size_t failures = 0;
+	for (size_t i = 0; i < batch.size; i++) {
+		// Same per point preparation as the batch's scalar fallback
+		BSDFMaterial point = material;
+		if (withShading) point.PrepShadingData(Load(points.albedos, i), points.metalness[i], points.roughness[i]);
+
+		const vec3 normal = Load(points.normals, i), tangent = Load(points.tangents, i), binormal = Load(points.binormals, i);
+		const vec3 incident = Load(points.incident, i), scattered = Load(points.scattered, i);
+
+		const vec3 expectedBSDF = EvalBSDF(point, normal, tangent, binormal, incident, scattered);
+		const float expectedPDF = EvalPDF(point, normal, tangent, binormal, incident, scattered);
+		const vec3 actualBSDF = Load(bsdf, i);
+
+		const bool ok =
+			Matches(expectedBSDF.x, actualBSDF.x) && Matches(expectedBSDF.y, actualBSDF.y) &&
+			Matches(expectedBSDF.z, actualBSDF.z) && Matches(expectedPDF, pdf[i]);
+		if (ok) continue;
+
+		if (failures < kMaxPrintedFailures) {
+			printf(
+				"  %s, point %zu of %zu (%s, roughness %g): expected (%g, %g, %g) pdf %g, got (%g, %g, %g) pdf %g\n",
+				name, i, batch.size, dot(incident, normal) >= 0.f ? "front" : "behind", point.roughness,
+				expectedBSDF.x, expectedBSDF.y, expectedBSDF.z, expectedPDF,
+				actualBSDF.x, actualBSDF.y, actualBSDF.z, pdf[i]
+			);
+		}
+		failures++;
+	}
+
+	return failures;
+}
+
+int main(int argc, char** argv)
+{
+	const unsigned int seed = argc > 1 ? static_cast<unsigned int>(std::atoi(argv[1])) : 1234;
+	std::mt19937 rng(seed);
+
+	// Smaller than a group, ragged tails, and either side of PARALLEL_BSDF_THRESHOLD
+	const size_t sizes[] = { 1, 3, 4, 7, 61, 1023, 1029 };
+
+	struct Case
+	{
+		const char* name;
+		RoughnessRange range;
+		bool scalarOnly;
+	};
+	const Case cases[] = {
+		{ "any roughness", RoughnessRange::Any, false },
+		{ "near min alpha", RoughnessRange::NearMinAlpha, false },
+		{ "scalar only material", RoughnessRange::Any, true }
+	};
+
+	// Several materials per case, as the lobe weights and Fresnel terms are per material
+	constexpr int kMaterialsPerCase = 8;
+
+	size_t checks = 0, failedChecks = 0, totalFailures = 0;
+	for (const Case& testCase : cases) {
+		for (const size_t size : sizes) {
+			for (int m = 0; m < kMaterialsPerCase; m++) {
+				const BSDFMaterial material = RandomMaterial(rng, testCase.range, testCase.scalarOnly);
+				const Points points = MakePoints(size, rng, testCase.range);
+
+				for (const bool withShading : { false, true }) {
+					const size_t failures = Check(testCase.name, material, points, withShading);
+					checks++;
+					if (failures == 0) continue;
+
+					printf(
+						"%s: %zu of %zu points differ (%s shading arrays, material %d)\n",
+						testCase.name, failures, size, withShading ? "with" : "without", m
+					);
+					failedChecks++;
+					totalFailures += failures;
+				}
+			}
+		}
+	}
+
+	if (failedChecks != 0) {
+		printf("FAILED: %zu of %zu checks, %zu points (seed %u)\n", failedChecks, checks, totalFailures, seed);
+		return 1;
+	}
+
+	printf("Passed %zu checks (seed %u)\n", checks, seed);
+	return 0;
+}